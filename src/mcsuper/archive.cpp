@@ -0,0 +1,554 @@
+#include "archive.hpp"
+
+#include <mutex>
+#include <deque>
+#include <algorithm>
+#include <stdexcept>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		constexpr char magic[4] = { 'M', 'C', 'S', 'A' };
+		constexpr utils::tuchar format_version = 1;
+		constexpr size_t header_size = 8;
+		constexpr size_t footer_size = 4 * 8 + 4;
+
+		// Block flags in the index
+		constexpr utils::tuchar block_uses_dict = 1 << 0;
+
+		// ZDICT wants around a hundred times the dictionary size in samples, more only slows training down
+		constexpr size_t dict_sample_ratio = 100;
+		constexpr size_t dict_min_samples = 16;
+
+
+		void put(std::string &out, utils::tulong v, int bytes)
+		{
+			for (int i = 0; i < bytes; i++) out.push_back(static_cast<char>(v >> (8 * i)));
+		}
+
+
+		/**
+		 * @brief Bounds-checked little-endian reader over the index
+		 */
+		struct cursor
+		{
+			const utils::tuchar *p;
+			const utils::tuchar *end;
+
+			utils::tulong get(int bytes)
+			{
+				if (end - p < bytes) throw std::runtime_error("corrupt archive index");
+				utils::tulong v = 0;
+				for (int i = 0; i < bytes; i++) v |= static_cast<utils::tulong>(p[i]) << (8 * i);
+				p += bytes;
+				return v;
+			}
+
+			std::string get_string(size_t len)
+			{
+				if (static_cast<size_t>(end - p) < len) throw std::runtime_error("corrupt archive index");
+				std::string s(reinterpret_cast<const char *>(p), len);
+				p += len;
+				return s;
+			}
+		};
+
+
+		utils::unique_fd open_read(const fs::path &path)
+		{
+			utils::unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME));
+			if (!fd && errno == EPERM) fd.reset(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+			if (!fd) utils::throw_errno("open " + path.string());
+			return fd;
+		}
+
+
+		void read_exact(int fd, utils::tuchar *buf, size_t len, utils::tulong offset, const fs::path &path)
+		{
+			while (len > 0)
+			{
+				ssize_t n = pread(fd, buf, len, offset);
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0) utils::throw_errno("read " + path.string());
+				if (n == 0) throw std::runtime_error(path.string() + " shrank while being archived");
+				buf += n;
+				len -= n;
+				offset += n;
+			}
+		}
+
+
+		void write_all(int fd, const void *data, size_t len, const fs::path &path)
+		{
+			const char *p = static_cast<const char *>(data);
+			while (len > 0)
+			{
+				ssize_t n = ::write(fd, p, len);
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0) utils::throw_errno("write " + path.string());
+				p += n;
+				len -= n;
+			}
+		}
+
+
+		void pwrite_all(int fd, const utils::tuchar *data, size_t len, utils::tulong offset, const fs::path &path)
+		{
+			while (len > 0)
+			{
+				ssize_t n = pwrite(fd, data, len, offset);
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0) utils::throw_errno("write " + path.string());
+				data += n;
+				len -= n;
+				offset += n;
+			}
+		}
+
+
+		/**
+		 * @brief A block of some file waiting to be compressed
+		 */
+		struct planned_block
+		{
+			size_t entry;
+			utils::tulong offset;
+			size_t length;
+			bool small;
+		};
+
+
+		/**
+		 * @brief A block back from a worker, or the reason it isn't
+		 */
+		struct compressed_block
+		{
+			size_t index;
+			std::vector<utils::tuchar> data;
+			std::exception_ptr error;
+		};
+
+
+		/**
+		 * @brief Refuse archive paths that would land outside the extraction directory
+		 */
+		bool safe_path(const std::string &path)
+		{
+			fs::path p(path);
+			if (p.empty() || p.is_absolute()) return false;
+			for (const fs::path &part : p)
+			{
+				if (part == "..") return false;
+			}
+			return true;
+		}
+	}
+
+
+	archive_stats create_archive(const fs::path &source, const fs::path &archive, const archive_params &params)
+	{
+		auto started = std::chrono::steady_clock::now();
+
+		if (!codec_available(params.kind)) throw std::runtime_error(std::string("codec not built in: ") + codec_name(params.kind));
+		int level = params.level != 0 ? params.level : default_level(params.kind);
+		thread_pool &pool = params.pool ? *params.pool : thread_pool::shared();
+
+		archive_stats stats;
+		stats.threads = pool.size();
+
+		// Everything to store, sorted so archives of the same tree list files identically
+		std::vector<std::pair<archive_entry, fs::path>> found;
+		for (const fs::directory_entry &de : fs::recursive_directory_iterator(source))
+		{
+			struct stat st;
+			if (lstat(de.path().c_str(), &st) < 0) utils::throw_errno("lstat " + de.path().string());
+			if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) continue;
+
+			archive_entry entry;
+			entry.path = fs::relative(de.path(), source).generic_string();
+			entry.directory = S_ISDIR(st.st_mode);
+			entry.mode = st.st_mode & 07777;
+			entry.size = entry.directory ? 0 : st.st_size;
+			entry.mtime_ns = static_cast<utils::tslong>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+			found.emplace_back(std::move(entry), de.path());
+		}
+		std::sort(found.begin(), found.end(), [](const auto &a, const auto &b) { return a.first.path < b.first.path; });
+
+		std::vector<archive_entry> entries;
+		std::vector<fs::path> paths;
+		std::vector<planned_block> plan;
+		utils::tulong small_bytes = 0;
+
+		for (auto &[entry, path] : found)
+		{
+			entry.first_block = static_cast<utils::tuint>(plan.size());
+			bool small = entry.size <= params.small_file;
+			if (small && entry.size > 0) small_bytes += entry.size;
+
+			for (utils::tulong at = 0; at < entry.size; at += params.block_size)
+			{
+				plan.push_back({ entries.size(), at, static_cast<size_t>(std::min<utils::tulong>(params.block_size, entry.size - at)), small });
+			}
+			entry.block_count = static_cast<utils::tuint>(plan.size() - entry.first_block);
+
+			if (!entry.directory) stats.files++;
+			stats.bytes_in += entry.size;
+			entries.push_back(std::move(entry));
+			paths.push_back(std::move(path));
+		}
+
+		// Small files (playerdata, stats, advancements, data/*.dat) are too short to compress well on their own but
+		// are all alike, a dictionary trained on a spread of them gives each one the context it lacks
+		compression_dictionary dict;
+		if (params.dict_size > 0 && small_bytes > 0)
+		{
+			utils::tulong budget = params.dict_size * dict_sample_ratio;
+			utils::tulong stride = small_bytes / budget + 1;
+
+			std::vector<std::string> samples;
+			utils::tulong seen = 0;
+			for (const planned_block &b : plan)
+			{
+				if (!b.small) continue;
+				if (seen++ % stride != 0) continue;
+
+				std::string content(b.length, '\0');
+				utils::unique_fd fd = open_read(paths[b.entry]);
+				read_exact(fd.get(), reinterpret_cast<utils::tuchar *>(content.data()), content.size(), 0, paths[b.entry]);
+				samples.push_back(std::move(content));
+			}
+
+			if (samples.size() >= dict_min_samples)
+			{
+				std::vector<std::string_view> views(samples.begin(), samples.end());
+				dict = compression_dictionary::train(params.kind, views, params.dict_size, level);
+			}
+		}
+		stats.dict_bytes = dict.bytes().size();
+
+		fs::path tmp = archive;
+		tmp += ".tmp";
+		utils::unique_fd out(open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+		if (!out) utils::throw_errno("open " + tmp.string());
+
+		const char header[header_size] = { magic[0], magic[1], magic[2], magic[3], static_cast<char>(format_version), static_cast<char>(params.kind), 0, 0 };
+		write_all(out.get(), header, sizeof(header), tmp);
+		utils::tulong offset = header_size;
+
+		struct written
+		{
+			utils::tulong offset = 0;
+			utils::tuint stored = 0;
+		};
+		std::vector<written> table(plan.size());
+
+		// Workers hand blocks back through this queue, the writer keeps at most two per worker in flight
+		std::mutex lock;
+		std::condition_variable ready;
+		std::deque<compressed_block> done;
+		size_t in_flight = 0;
+		size_t limit = pool.size() * 2;
+		std::exception_ptr error;
+
+		auto drain = [&]()
+		{
+			std::deque<compressed_block> batch;
+			{
+				std::unique_lock guard(lock);
+				ready.wait(guard, [&]() { return !done.empty(); });
+				batch.swap(done);
+			}
+
+			for (compressed_block &cb : batch)
+			{
+				in_flight--;
+				if (cb.error && !error) error = cb.error;
+				if (error) continue;
+
+				try
+				{
+					write_all(out.get(), cb.data.data(), cb.data.size(), tmp);
+				}
+				catch (...)
+				{
+					error = std::current_exception();
+					continue;
+				}
+				table[cb.index] = { offset, static_cast<utils::tuint>(cb.data.size()) };
+				offset += cb.data.size();
+				stats.bytes_out += cb.data.size();
+			}
+		};
+
+		compress_params small_params{ params.kind, level, false, dict.empty() ? nullptr : &dict };
+		compress_params large_params{ params.kind, level, params.long_distance, nullptr };
+
+		for (size_t i = 0; i < plan.size() && !error; i++)
+		{
+			while (in_flight >= limit) drain();
+			if (error) break;
+
+			in_flight++;
+			pool.submit([&, i]()
+			{
+				const planned_block &b = plan[i];
+				compressed_block cb{ i, {}, nullptr };
+				try
+				{
+					std::vector<utils::tuchar> raw(b.length);
+					utils::unique_fd fd = open_read(paths[b.entry]);
+					read_exact(fd.get(), raw.data(), raw.size(), b.offset, paths[b.entry]);
+					cb.data = compress(raw.data(), raw.size(), b.small ? small_params : large_params);
+				}
+				catch (...)
+				{
+					cb.error = std::current_exception();
+				}
+
+				{
+					std::lock_guard guard(lock);
+					done.push_back(std::move(cb));
+				}
+				ready.notify_one();
+			});
+		}
+
+		// Every task refers to locals here, so they all have to come back before an error may unwind
+		while (in_flight > 0) drain();
+		if (error)
+		{
+			out.reset();
+			fs::remove(tmp);
+			std::rethrow_exception(error);
+		}
+
+		utils::tulong dict_offset = offset;
+		write_all(out.get(), dict.bytes().data(), dict.bytes().size(), tmp);
+		offset += dict.bytes().size();
+
+		std::string index;
+		put(index, plan.size(), 4);
+		for (size_t i = 0; i < plan.size(); i++)
+		{
+			bool uses_dict = plan[i].small && !dict.empty();
+			put(index, table[i].offset, 8);
+			put(index, table[i].stored, 4);
+			put(index, plan[i].length, 4);
+			put(index, uses_dict ? block_uses_dict : 0, 1);
+			if (uses_dict) stats.dict_files++;
+		}
+
+		put(index, entries.size(), 4);
+		for (const archive_entry &e : entries)
+		{
+			put(index, e.path.size(), 4);
+			index += e.path;
+			put(index, e.directory ? 1 : 0, 1);
+			put(index, e.mode, 4);
+			put(index, e.size, 8);
+			put(index, static_cast<utils::tulong>(e.mtime_ns), 8);
+			put(index, e.first_block, 4);
+			put(index, e.block_count, 4);
+		}
+
+		std::string footer;
+		put(footer, dict_offset, 8);
+		put(footer, dict.bytes().size(), 8);
+		put(footer, offset, 8);
+		put(footer, index.size(), 8);
+		footer.append(magic, sizeof(magic));
+
+		write_all(out.get(), index.data(), index.size(), tmp);
+		write_all(out.get(), footer.data(), footer.size(), tmp);
+		if (fsync(out.get()) < 0) utils::throw_errno("fsync " + tmp.string());
+		out.reset();
+		fs::rename(tmp, archive);
+
+		stats.blocks = plan.size();
+		stats.bytes_out += header_size + dict.bytes().size() + index.size() + footer.size();
+		stats.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+		return stats;
+	}
+
+
+	archive_reader::archive_reader(const fs::path &archive)
+	{
+		utils::unique_fd fd = open_read(archive);
+		struct stat st;
+		if (fstat(fd.get(), &st) < 0) utils::throw_errno("fstat " + archive.string());
+		m_size = st.st_size;
+		if (m_size < header_size + footer_size) throw std::runtime_error("not an mcsuper archive: " + archive.string());
+
+		void *map = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+		if (map == MAP_FAILED) utils::throw_errno("mmap " + archive.string());
+		m_map = static_cast<const utils::tuchar *>(map);
+
+		const utils::tuchar *footer = m_map + m_size - footer_size;
+		if (!std::equal(magic, magic + 4, m_map) || !std::equal(magic, magic + 4, footer + footer_size - 4))
+		{
+			throw std::runtime_error("not an mcsuper archive: " + archive.string());
+		}
+		if (m_map[4] != format_version) throw std::runtime_error("unsupported archive version in " + archive.string());
+
+		m_kind = static_cast<codec>(m_map[5]);
+		if (!codec_available(m_kind)) throw std::runtime_error(archive.string() + " needs " + codec_name(m_kind) + ", which isn't built in");
+
+		cursor f{ footer, footer + footer_size - 4 };
+		utils::tulong dict_offset = f.get(8);
+		utils::tulong dict_len = f.get(8);
+		utils::tulong index_offset = f.get(8);
+		utils::tulong index_len = f.get(8);
+
+		utils::tulong body_end = m_size - footer_size;
+		// Compared without adding, crafted offsets would wrap a sum back into range
+		if (dict_len > body_end || dict_offset > body_end - dict_len || index_len > body_end || index_offset > body_end - index_len)
+		{
+			throw std::runtime_error("corrupt archive footer");
+		}
+
+		if (dict_len > 0)
+		{
+			m_dict = compression_dictionary(m_kind, std::vector<utils::tuchar>(m_map + dict_offset, m_map + dict_offset + dict_len), default_level(m_kind));
+		}
+
+		cursor c{ m_map + index_offset, m_map + index_offset + index_len };
+		utils::tulong blocks = c.get(4);
+		for (utils::tulong i = 0; i < blocks; i++)
+		{
+			block b;
+			b.offset = c.get(8);
+			b.stored = static_cast<utils::tuint>(c.get(4));
+			b.raw = static_cast<utils::tuint>(c.get(4));
+			b.uses_dict = c.get(1) & block_uses_dict;
+			if (b.stored > body_end || b.offset > body_end - b.stored) throw std::runtime_error("corrupt archive block table");
+			m_blocks.push_back(b);
+		}
+
+		utils::tulong files = c.get(4);
+		for (utils::tulong i = 0; i < files; i++)
+		{
+			archive_entry e;
+			e.path = c.get_string(c.get(4));
+			e.directory = c.get(1) != 0;
+			e.mode = static_cast<utils::tuint>(c.get(4));
+			e.size = c.get(8);
+			e.mtime_ns = static_cast<utils::tslong>(c.get(8));
+			e.first_block = static_cast<utils::tuint>(c.get(4));
+			e.block_count = static_cast<utils::tuint>(c.get(4));
+			if (utils::tulong(e.first_block) + e.block_count > m_blocks.size()) throw std::runtime_error("corrupt archive file list");
+
+			// Blocks are written at their offset in the file, more than its size would write past what extract() truncated it to
+			utils::tulong raw = 0;
+			for (utils::tuint b = 0; b < e.block_count; b++) raw += m_blocks[e.first_block + b].raw;
+			if (raw > e.size) throw std::runtime_error("corrupt archive: blocks of " + e.path + " overrun its size");
+			m_entries.push_back(std::move(e));
+		}
+	}
+
+
+	archive_reader::~archive_reader()
+	{
+		if (m_map != nullptr) munmap(const_cast<utils::tuchar *>(m_map), m_size);
+	}
+
+
+	void archive_reader::decompress_block(const block &b, utils::tuchar *dst) const
+	{
+		decompress(m_kind, m_map + b.offset, b.stored, dst, b.raw, b.uses_dict ? &m_dict : nullptr);
+	}
+
+
+	std::vector<utils::tuchar> archive_reader::read(const archive_entry &entry) const
+	{
+		std::vector<utils::tuchar> out(entry.size);
+		size_t at = 0;
+		for (utils::tuint i = 0; i < entry.block_count; i++)
+		{
+			const block &b = m_blocks[entry.first_block + i];
+			if (at + b.raw > out.size()) throw std::runtime_error("corrupt archive: blocks overrun " + entry.path);
+			decompress_block(b, out.data() + at);
+			at += b.raw;
+		}
+		return out;
+	}
+
+
+	utils::tulong archive_reader::extract(const fs::path &target, std::string_view prefix, thread_pool *pool) const
+	{
+		thread_pool &workers = pool ? *pool : thread_pool::shared();
+
+		// Every file is created at its full size up front, then each block opens its file for just as long as its write
+		// takes, so a world of many thousands of files never holds more descriptors than there are workers.
+		// workers.wait() rethrows the first failure of a block
+		std::vector<const archive_entry *> files;
+		std::vector<const archive_entry *> dirs;
+
+		for (const archive_entry &e : m_entries)
+		{
+			if (!e.path.starts_with(prefix)) continue;
+			if (!safe_path(e.path)) throw std::runtime_error("refusing to extract " + e.path);
+
+			fs::path path = target / e.path;
+			if (e.directory)
+			{
+				fs::create_directories(path);
+				dirs.push_back(&e);
+				continue;
+			}
+
+			fs::create_directories(path.parent_path());
+			utils::unique_fd fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+			if (!fd) utils::throw_errno("open " + path.string());
+			if (ftruncate(fd.get(), e.size) < 0) utils::throw_errno("ftruncate " + path.string());
+			files.push_back(&e);
+		}
+
+		for (const archive_entry *e : files)
+		{
+			utils::tulong at = 0;
+			for (utils::tuint i = 0; i < e->block_count; i++)
+			{
+				const block &b = m_blocks[e->first_block + i];
+				workers.submit([this, e, &b, at, &target]()
+				{
+					std::vector<utils::tuchar> raw(b.raw);
+					decompress_block(b, raw.data());
+
+					fs::path path = target / e->path;
+					utils::unique_fd fd(open(path.c_str(), O_WRONLY | O_CLOEXEC));
+					if (!fd) utils::throw_errno("open " + path.string());
+					pwrite_all(fd.get(), raw.data(), raw.size(), at, path);
+				});
+				at += b.raw;
+			}
+		}
+		workers.wait();
+
+		auto restore_attrs = [&target](const archive_entry &e)
+		{
+			fs::path path = target / e.path;
+			chmod(path.c_str(), e.mode);
+			timespec times[2];
+			times[0].tv_sec = times[1].tv_sec = e.mtime_ns / 1'000'000'000;
+			times[0].tv_nsec = times[1].tv_nsec = e.mtime_ns % 1'000'000'000;
+			utimensat(AT_FDCWD, path.c_str(), times, 0);
+		};
+
+		for (const archive_entry *e : files) restore_attrs(*e);
+
+		// Directories last, writing their files would have bumped their mtimes again
+		for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) restore_attrs(**it);
+		return files.size() + dirs.size();
+	}
+
+} // End namespace mcsuper
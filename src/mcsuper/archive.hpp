@@ -0,0 +1,138 @@
+#pragma once
+#ifndef H_736419_SRC_ARCHIVE
+#define H_736419_SRC_ARCHIVE 1
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <string_view>
+
+#include "utils.hpp"
+#include "compress.hpp"
+#include "thread_pool.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief How to build an archive
+	 */
+	struct archive_params
+	{
+		codec kind = best_codec();
+		// 0 for the codec's default_level
+		int level = 0;
+		// Big files are cut into independently compressed blocks of this size, the unit of parallelism and of seeking
+		size_t block_size = 16 << 20;
+		// Files up to this size get one block each, compressed against the shared dictionary
+		size_t small_file = 64 << 10;
+		size_t dict_size = 112 << 10;
+		bool long_distance = true;
+		// Workers to compress on, null for thread_pool::shared()
+		thread_pool *pool = nullptr;
+	};
+
+
+	/**
+	 * @brief What building an archive did
+	 */
+	struct archive_stats
+	{
+		utils::tulong files = 0;
+		utils::tulong blocks = 0;
+		utils::tulong bytes_in = 0;
+		utils::tulong bytes_out = 0;
+		// Small files compressed against the dictionary, and the dictionary's size (0 if none was trained)
+		utils::tulong dict_files = 0;
+		utils::tulong dict_bytes = 0;
+		size_t threads = 0;
+		std::chrono::milliseconds elapsed{ 0 };
+	};
+
+
+	/**
+	 * @brief One file or directory in an archive
+	 */
+	struct archive_entry
+	{
+		std::string path;
+		bool directory = false;
+		utils::tuint mode = 0;
+		utils::tulong size = 0;
+		utils::tslong mtime_ns = 0;
+		// Range of the archive's block table holding this file's content, in order
+		utils::tuint first_block = 0;
+		utils::tuint block_count = 0;
+	};
+
+
+	/**
+	 * @brief Compress a directory tree into a seekable archive
+	 *
+	 * Blocks are compressed in parallel and written in whatever order they finish, with at most a couple per
+	 * worker in memory at once. Every block is an independent frame and the index at the end records where
+	 * each one landed, so a reader can pull a single file (or a single block of a big one) without touching
+	 * the rest.
+	 *
+	 * Layout:
+	 *   "MCSA" version codec 0 0     8 byte header
+	 *   frames                       one per block, in completion order
+	 *   dictionary                   raw bytes, may be empty
+	 *   index                        block table, then the file list
+	 *   footer                       dictionary and index offsets and lengths, then "MCSA"
+	 * All integers are little-endian
+	 */
+	archive_stats create_archive(const std::filesystem::path &source, const std::filesystem::path &archive, const archive_params &params = {});
+
+
+	/**
+	 * @brief Random access to an archive made by create_archive
+	 */
+	class archive_reader
+	{
+		public:
+			explicit archive_reader(const std::filesystem::path &archive);
+			~archive_reader();
+
+			archive_reader(const archive_reader &) = delete;
+			archive_reader &operator=(const archive_reader &) = delete;
+
+			codec kind() const noexcept { return m_kind; }
+			const std::vector<archive_entry> &entries() const noexcept { return m_entries; }
+
+			/**
+			 * @brief Decompress one file's content
+			 */
+			std::vector<utils::tuchar> read(const archive_entry &entry) const;
+
+			/**
+			 * @brief Recreate entries under target, decompressing blocks in parallel
+			 *
+			 * @param prefix Only entries whose path starts with this, empty for everything
+			 * @return utils::tulong Entries extracted
+			 */
+			utils::tulong extract(const std::filesystem::path &target, std::string_view prefix = {}, thread_pool *pool = nullptr) const;
+
+		private:
+			struct block
+			{
+				utils::tulong offset;
+				utils::tuint stored;
+				utils::tuint raw;
+				bool uses_dict;
+			};
+
+			void decompress_block(const block &b, utils::tuchar *dst) const;
+
+			const utils::tuchar *m_map = nullptr;
+			size_t m_size = 0;
+			codec m_kind = codec::zlib;
+			compression_dictionary m_dict;
+			std::vector<block> m_blocks;
+			std::vector<archive_entry> m_entries;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_736419_SRC_ARCHIVE
@@ -0,0 +1,553 @@
+#include "backup.hpp"
+
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		constexpr std::string_view manifest_magic = "mcsuper-snapshot 1";
+
+
+		utils::tslong mtime_ns_of(const struct stat &st)
+		{
+			return static_cast<utils::tslong>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+		}
+
+
+		/**
+		 * @brief Open for reading without updating atime where we're allowed to
+		 */
+		utils::unique_fd open_read(const fs::path &path)
+		{
+			utils::unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME));
+			if (!fd && errno == EPERM) fd.reset(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+			if (!fd) utils::throw_errno("open " + path.string());
+			return fd;
+		}
+
+
+		void write_all(int fd, const utils::tuchar *data, size_t len, const fs::path &path)
+		{
+			while (len > 0)
+			{
+				ssize_t n = ::write(fd, data, len);
+				if (n < 0)
+				{
+					if (errno == EINTR) continue;
+					utils::throw_errno("write " + path.string());
+				}
+				data += n;
+				len -= n;
+			}
+		}
+
+
+		utils::tuint be32(const utils::tuchar *p)
+		{
+			return static_cast<utils::tuint>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+		}
+
+
+		/**
+		 * @brief Read-only mapping of a whole file, pages are only faulted in when touched
+		 */
+		struct mapped_file
+		{
+			utils::tuchar *data = nullptr;
+			size_t size = 0;
+			struct stat st{};
+
+			mapped_file(const fs::path &path, int advice)
+			{
+				utils::unique_fd fd = open_read(path);
+				if (fstat(fd.get(), &st) < 0) utils::throw_errno("fstat " + path.string());
+				size = st.st_size;
+				if (size == 0) return;
+
+				void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+				if (map == MAP_FAILED) utils::throw_errno("mmap " + path.string());
+				data = static_cast<utils::tuchar *>(map);
+				madvise(map, size, advice);
+			}
+
+			~mapped_file()
+			{
+				if (data != nullptr) munmap(data, size);
+			}
+
+			mapped_file(const mapped_file &) = delete;
+			mapped_file &operator=(const mapped_file &) = delete;
+		};
+
+
+		std::string snapshot_name_now()
+		{
+			std::time_t now = std::time(nullptr);
+			std::tm tm{};
+			gmtime_r(&now, &tm);
+
+			char buf[32];
+			std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H-%M-%SZ", &tm);
+			return buf;
+		}
+	}
+
+
+	snapshot_manifest snapshot_manifest::load(const fs::path &path)
+	{
+		std::ifstream in(path);
+		if (!in) throw std::runtime_error("can't open snapshot " + path.string());
+
+		std::string line;
+		if (!std::getline(in, line) || line != manifest_magic) throw std::runtime_error("not a snapshot manifest: " + path.string());
+
+		snapshot_manifest manifest;
+		while (std::getline(in, line))
+		{
+			if (line.empty()) continue;
+			std::istringstream fields(line);
+			char kind;
+			fields >> kind;
+
+			if (kind == 'K')
+			{
+				if (manifest.files.empty() || !manifest.files.back().region) throw std::runtime_error("region chunk outside a region file in " + path.string());
+
+				std::string hex;
+				region_chunk rc{};
+				fields >> rc.index >> rc.timestamp >> rc.sector >> hex >> rc.payload.length;
+				if (!from_hex(hex, rc.payload.hash) || rc.index >= 1024) throw std::runtime_error("bad region chunk in " + path.string());
+				manifest.files.back().region_chunks.push_back(rc);
+				continue;
+			}
+
+			if (kind == 'C')
+			{
+				if (manifest.files.empty()) throw std::runtime_error("chunk before any file in " + path.string());
+
+				std::string hex;
+				chunk_ref ref{};
+				fields >> hex >> ref.length;
+				if (!from_hex(hex, ref.hash)) throw std::runtime_error("bad chunk digest in " + path.string());
+				manifest.files.back().chunks.push_back(ref);
+				continue;
+			}
+
+			file_entry entry;
+			if (kind == 'D')
+			{
+				entry.directory = true;
+				fields >> std::oct >> entry.mode >> std::dec;
+			}
+			else if (kind == 'F' || kind == 'R')
+			{
+				entry.region = kind == 'R';
+				fields >> std::oct >> entry.mode >> std::dec >> entry.size >> entry.mtime_ns;
+			}
+			else
+			{
+				throw std::runtime_error("unknown manifest record '" + std::string(1, kind) + "' in " + path.string());
+			}
+
+			// The path is the rest of the line after one separating space, it may itself contain spaces
+			fields.get();
+			std::getline(fields, entry.path);
+			manifest.files.push_back(std::move(entry));
+		}
+
+		return manifest;
+	}
+
+
+	void snapshot_manifest::save(const fs::path &path) const
+	{
+		fs::path tmp = path;
+		tmp += ".tmp";
+
+		std::ostringstream out;
+		out << manifest_magic << '\n';
+
+		for (const file_entry &f : files)
+		{
+			if (f.directory)
+			{
+				out << "D " << std::oct << f.mode << std::dec << ' ' << f.path << '\n';
+				continue;
+			}
+
+			out << (f.region ? "R " : "F ") << std::oct << f.mode << std::dec << ' ' << f.size << ' ' << f.mtime_ns << ' ' << f.path << '\n';
+			for (const chunk_ref &c : f.chunks) out << "C " << to_hex(c.hash) << ' ' << c.length << '\n';
+			for (const region_chunk &k : f.region_chunks)
+			{
+				out << "K " << k.index << ' ' << k.timestamp << ' ' << k.sector << ' ' << to_hex(k.payload.hash) << ' ' << k.payload.length << '\n';
+			}
+		}
+
+		// Synced before the rename and the directory after it, so a crash can't leave the latest snapshot truncated
+		std::string text = std::move(out).str();
+		utils::unique_fd fd(open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+		if (!fd) utils::throw_errno("open " + tmp.string());
+		write_all(fd.get(), reinterpret_cast<const utils::tuchar *>(text.data()), text.size(), tmp);
+		if (fsync(fd.get()) < 0) utils::throw_errno("fsync " + tmp.string());
+		fd.reset();
+
+		fs::rename(tmp, path);
+
+		fs::path dir = path.parent_path().empty() ? fs::path(".") : path.parent_path();
+		utils::unique_fd dir_fd(open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+		if (!dir_fd || fsync(dir_fd.get()) < 0) utils::throw_errno("fsync " + dir.string());
+	}
+
+
+	chunk_store::chunk_store(const fs::path &dir) : m_dir(dir)
+	{
+		fs::create_directories(m_dir);
+
+		for (const fs::directory_entry &sub : fs::directory_iterator(m_dir))
+		{
+			if (!sub.is_directory()) continue;
+
+			for (const fs::directory_entry &chunk : fs::directory_iterator(sub.path()))
+			{
+				// put() only renames a chunk into place once it's synced, so the name alone says it's complete,
+				// what a crash leaves is a stray .tmp
+				std::string name = chunk.path().filename().native();
+				digest d;
+				if (from_hex(name, d)) m_known.insert(d);
+				else if (name.ends_with(".tmp")) fs::remove(chunk.path());
+			}
+		}
+	}
+
+
+	fs::path chunk_store::path_of(const digest &d) const
+	{
+		std::string hex = to_hex(d);
+		return m_dir / hex.substr(0, 2) / hex;
+	}
+
+
+	bool chunk_store::put(const digest &d, const utils::tuchar *data, size_t len)
+	{
+		if (contains(d)) return false;
+
+		fs::path path = path_of(d);
+		fs::create_directories(path.parent_path());
+
+		// Write beside the final name, sync, then rename, a crash leaves a stray .tmp rather than a truncated chunk
+		fs::path tmp = path;
+		tmp += ".tmp";
+
+		utils::unique_fd fd(open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+		if (!fd) utils::throw_errno("open " + tmp.string());
+		write_all(fd.get(), data, len, tmp);
+		if (fdatasync(fd.get()) < 0) utils::throw_errno("fdatasync " + tmp.string());
+		fd.reset();
+
+		fs::rename(tmp, path);
+		m_known.insert(d);
+		return true;
+	}
+
+
+	std::vector<utils::tuchar> chunk_store::get(const digest &d) const
+	{
+		fs::path path = path_of(d);
+		utils::unique_fd fd = open_read(path);
+
+		struct stat st;
+		if (fstat(fd.get(), &st) < 0) utils::throw_errno("fstat " + path.string());
+
+		std::vector<utils::tuchar> data(st.st_size);
+		size_t got = 0;
+		while (got < data.size())
+		{
+			ssize_t n = ::read(fd.get(), data.data() + got, data.size() - got);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) throw std::runtime_error("short read of chunk " + path.string());
+			got += n;
+		}
+
+		return data;
+	}
+
+
+	backup_engine::backup_engine(const fs::path &repo, bool region_aware, chunker_params params)
+		: m_repo(repo), m_region_aware(region_aware), m_store(repo / "chunks"), m_chunker(params)
+	{
+		fs::create_directories(m_repo / "snapshots");
+	}
+
+
+	std::vector<std::string> backup_engine::snapshots() const
+	{
+		std::vector<std::string> names;
+		for (const fs::directory_entry &e : fs::directory_iterator(m_repo / "snapshots"))
+		{
+			std::string name = e.path().filename().string();
+			if (e.is_regular_file() && !name.ends_with(".tmp")) names.push_back(std::move(name));
+		}
+
+		std::sort(names.begin(), names.end());
+		return names;
+	}
+
+
+	void backup_engine::store(const utils::tuchar *data, size_t len, std::vector<chunk_ref> &refs, backup_stats &stats)
+	{
+		digest d = blake3::hash(data, len);
+
+		if (m_store.put(d, data, len))
+		{
+			stats.chunks_new++;
+			stats.bytes_new += len;
+		}
+		stats.chunks_total++;
+		refs.push_back({ d, static_cast<utils::tuint>(len) });
+	}
+
+
+	void backup_engine::chunk_file(const fs::path &path, file_entry &entry, backup_stats &stats)
+	{
+		mapped_file file(path, MADV_SEQUENTIAL);
+		entry.size = file.size;
+		entry.mtime_ns = mtime_ns_of(file.st);
+
+		const utils::tuchar *p = file.data;
+		size_t left = file.size;
+
+		while (left > 0)
+		{
+			size_t n = m_chunker.next(p, left);
+			store(p, n, entry.chunks, stats);
+			p += n;
+			left -= n;
+		}
+
+		stats.bytes_scanned += file.size;
+	}
+
+
+	bool backup_engine::chunk_region(const fs::path &path, file_entry &entry, const file_entry *previous, backup_stats &stats)
+	{
+		constexpr size_t sector = 4096;
+
+		mapped_file file(path, MADV_RANDOM);
+		if (file.size < 2 * sector) return false;
+
+		entry.region = true;
+		entry.size = file.size;
+		entry.mtime_ns = mtime_ns_of(file.st);
+
+		// What the last snapshot knew about each chunk slot
+		const region_chunk *known[1024] = {};
+		if (previous != nullptr && previous->region)
+		{
+			for (const region_chunk &rc : previous->region_chunks) known[rc.index] = &rc;
+		}
+
+		// Header: 1024 big-endian (3 byte sector offset, 1 byte sector count), then 1024 big-endian timestamps
+		const utils::tuchar *locations = file.data;
+		const utils::tuchar *timestamps = file.data + sector;
+
+		for (utils::tushort i = 0; i < 1024; i++)
+		{
+			utils::tuint loc = be32(locations + 4 * i);
+			if (loc == 0) continue;
+
+			utils::tuint offset = loc >> 8;
+			utils::tuint count = loc & 0xFF;
+			if (offset < 2 || count == 0 || (static_cast<size_t>(offset) + count) * sector > file.size) return false;
+
+			region_chunk rc{};
+			rc.index = i;
+			rc.timestamp = be32(timestamps + 4 * i);
+			rc.sector = offset;
+			stats.region_chunks++;
+
+			// Minecraft bumps the timestamp whenever it writes a chunk, an unchanged one can reuse the old digest unread
+			const region_chunk *old = known[i];
+			if (old != nullptr && old->timestamp == rc.timestamp && old->payload.length <= count * sector && m_store.contains(old->payload.hash))
+			{
+				rc.payload = old->payload;
+				stats.region_chunks_unchanged++;
+				stats.chunks_total++;
+				entry.region_chunks.push_back(rc);
+				continue;
+			}
+
+			// Payload is a 4 byte length (counting the compression byte) followed by that many bytes
+			const utils::tuchar *payload = file.data + static_cast<size_t>(offset) * sector;
+			size_t len = 4 + static_cast<size_t>(be32(payload));
+			if (len <= 4 || len > count * sector) return false;
+
+			std::vector<chunk_ref> ref;
+			store(payload, len, ref, stats);
+			rc.payload = ref.front();
+			stats.bytes_scanned += len;
+			entry.region_chunks.push_back(rc);
+		}
+
+		store(file.data, 2 * sector, entry.chunks, stats);
+		stats.bytes_scanned += 2 * sector;
+		return true;
+	}
+
+
+	backup_stats backup_engine::snapshot(const fs::path &source)
+	{
+		auto started = std::chrono::steady_clock::now();
+		backup_stats stats;
+
+		// Files unchanged in size and mtime since the last snapshot reuse its chunk list without being read
+		snapshot_manifest previous;
+		std::unordered_map<std::string_view, const file_entry *> previous_files;
+		std::vector<std::string> existing = snapshots();
+		if (!existing.empty())
+		{
+			previous = snapshot_manifest::load(m_repo / "snapshots" / existing.back());
+			for (const file_entry &f : previous.files) previous_files.emplace(f.path, &f);
+		}
+
+		snapshot_manifest manifest;
+		for (const fs::directory_entry &e : fs::recursive_directory_iterator(source))
+		{
+			std::string rel = e.path().lexically_relative(source).string();
+			if (rel.find('\n') != std::string::npos) continue;
+
+			struct stat st;
+			if (lstat(e.path().c_str(), &st) < 0) continue;
+
+			file_entry entry;
+			entry.path = rel;
+			entry.mode = st.st_mode & 07777;
+
+			if (S_ISDIR(st.st_mode))
+			{
+				entry.directory = true;
+				manifest.files.push_back(std::move(entry));
+				continue;
+			}
+			if (!S_ISREG(st.st_mode)) continue;
+
+			stats.files++;
+
+			auto found = previous_files.find(rel);
+			const file_entry *prev = found == previous_files.end() || found->second->directory ? nullptr : found->second;
+
+			auto stored = [this](const file_entry &f)
+			{
+				return std::all_of(f.chunks.begin(), f.chunks.end(), [this](const chunk_ref &c) { return m_store.contains(c.hash); })
+					&& std::all_of(f.region_chunks.begin(), f.region_chunks.end(), [this](const region_chunk &k) { return m_store.contains(k.payload.hash); });
+			};
+
+			bool region = m_region_aware && e.path().extension() == ".mca";
+
+			if (prev != nullptr && prev->region == region && prev->size == static_cast<utils::tulong>(st.st_size) && prev->mtime_ns == mtime_ns_of(st) && stored(*prev))
+			{
+				entry = *prev;
+				entry.mode = st.st_mode & 07777;
+				stats.files_unchanged++;
+				stats.chunks_total += entry.chunks.size() + entry.region_chunks.size();
+			}
+			else if (!region || !chunk_region(e.path(), entry, prev, stats))
+			{
+				// Not a region file, or one too damaged to parse, chunk it like anything else
+				entry.region = false;
+				entry.chunks.clear();
+				entry.region_chunks.clear();
+				chunk_file(e.path(), entry, stats);
+			}
+
+			manifest.files.push_back(std::move(entry));
+		}
+
+		std::sort(manifest.files.begin(), manifest.files.end(), [](const file_entry &a, const file_entry &b) { return a.path < b.path; });
+
+		// Chunk contents are synced as they're written, this makes their renames durable before a manifest points at them
+		utils::unique_fd repo_fd(open(m_repo.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+		if (!repo_fd) utils::throw_errno("open " + m_repo.string());
+		if (syncfs(repo_fd.get()) < 0) utils::throw_errno("syncfs " + m_repo.string());
+
+		std::string name = snapshot_name_now();
+		fs::path target = m_repo / "snapshots" / name;
+		for (int n = 1; fs::exists(target); n++) target = m_repo / "snapshots" / (name + "-" + std::to_string(n));
+
+		manifest.save(target);
+		stats.snapshot = target.filename().string();
+		stats.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+		return stats;
+	}
+
+
+	void backup_engine::restore(std::string_view name, const fs::path &target)
+	{
+		std::vector<std::string> existing = snapshots();
+		if (existing.empty()) throw std::runtime_error("repository has no snapshots");
+
+		std::string chosen = name.empty() ? existing.back() : std::string(name);
+		snapshot_manifest manifest = snapshot_manifest::load(m_repo / "snapshots" / chosen);
+
+		fs::create_directories(target);
+		for (const file_entry &f : manifest.files)
+		{
+			fs::path out = target / f.path;
+
+			if (f.directory)
+			{
+				fs::create_directories(out);
+				chmod(out.c_str(), f.mode);
+				continue;
+			}
+
+			fs::create_directories(out.parent_path());
+			utils::unique_fd fd(open(out.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+			if (!fd) utils::throw_errno("open " + out.string());
+
+			auto fetch = [this](const chunk_ref &c)
+			{
+				std::vector<utils::tuchar> data = m_store.get(c.hash);
+				if (data.size() != c.length) throw std::runtime_error("chunk " + to_hex(c.hash) + " has the wrong length");
+				return data;
+			};
+
+			for (const chunk_ref &c : f.chunks)
+			{
+				std::vector<utils::tuchar> data = fetch(c);
+				write_all(fd.get(), data.data(), data.size(), out);
+			}
+
+			// Region payloads go back to their sectors, the gaps between them read back as zeros
+			for (const region_chunk &k : f.region_chunks)
+			{
+				std::vector<utils::tuchar> data = fetch(k.payload);
+				if (pwrite(fd.get(), data.data(), data.size(), static_cast<off_t>(k.sector) * 4096) != static_cast<ssize_t>(data.size()))
+				{
+					utils::throw_errno("pwrite " + out.string());
+				}
+			}
+			if (f.region && ftruncate(fd.get(), f.size) < 0) utils::throw_errno("ftruncate " + out.string());
+
+			fchmod(fd.get(), f.mode);
+			timespec times[2];
+			times[0].tv_nsec = UTIME_OMIT;
+			times[1].tv_sec = f.mtime_ns / 1'000'000'000;
+			times[1].tv_nsec = f.mtime_ns % 1'000'000'000;
+			futimens(fd.get(), times);
+		}
+	}
+
+} // End namespace mcsuper
@@ -0,0 +1,189 @@
+#pragma once
+#ifndef H_864120_SRC_BACKUP
+#define H_864120_SRC_BACKUP 1
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <string_view>
+#include <unordered_set>
+
+#include "utils.hpp"
+#include "blake3.hpp"
+#include "chunker.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief A chunk of file content as stored in the repository
+	 */
+	struct chunk_ref
+	{
+		digest hash;
+		utils::tuint length;
+	};
+
+
+	/**
+	 * @brief One compressed chunk payload inside an Anvil region file
+	 */
+	struct region_chunk
+	{
+		// x + z * 32 within the region
+		utils::tushort index;
+		// Last save time from the region header
+		utils::tuint timestamp;
+		// 4 KiB sector the payload starts at
+		utils::tuint sector;
+		// Length-prefixed payload as it sits on disk
+		chunk_ref payload;
+	};
+
+
+	/**
+	 * @brief One file or directory in a snapshot, paths are relative to the snapshotted directory
+	 */
+	struct file_entry
+	{
+		std::string path;
+		bool directory = false;
+		utils::tuint mode = 0;
+		utils::tulong size = 0;
+		utils::tslong mtime_ns = 0;
+		// File content, or for a region file just its 8 KiB header
+		std::vector<chunk_ref> chunks;
+
+		// Set for .mca files stored chunk by chunk instead of through the content-defined chunker
+		bool region = false;
+		std::vector<region_chunk> region_chunks;
+	};
+
+
+	/**
+	 * @brief The list of files making up one snapshot, stored as a small text file
+	 */
+	struct snapshot_manifest
+	{
+		std::vector<file_entry> files;
+
+		static snapshot_manifest load(const std::filesystem::path &path);
+
+		/**
+		 * @brief Write atomically (temp file + rename) so a crash never leaves half a manifest
+		 */
+		void save(const std::filesystem::path &path) const;
+	};
+
+
+	/**
+	 * @brief Content-addressed chunk directory, chunks/<first two hex>/<full hex>
+	 *
+	 * Keeps every known digest in memory so dedup checks never touch the disk
+	 */
+	class chunk_store
+	{
+		public:
+			explicit chunk_store(const std::filesystem::path &dir);
+
+			bool contains(const digest &d) const { return m_known.contains(d); }
+
+			/**
+			 * @brief Store a chunk unless it's already present
+			 *
+			 * @return bool True if it was new and got written
+			 */
+			bool put(const digest &d, const utils::tuchar *data, size_t len);
+
+			/**
+			 * @brief Read a chunk back
+			 */
+			std::vector<utils::tuchar> get(const digest &d) const;
+
+			size_t size() const noexcept { return m_known.size(); }
+
+		private:
+			std::filesystem::path path_of(const digest &d) const;
+
+			std::filesystem::path m_dir;
+			std::unordered_set<digest, digest_hash> m_known;
+	};
+
+
+	/**
+	 * @brief What a snapshot did
+	 */
+	struct backup_stats
+	{
+		std::string snapshot;
+		utils::tulong files = 0;
+		// Files whose size and mtime matched the previous snapshot, reused without reading
+		utils::tulong files_unchanged = 0;
+		utils::tulong bytes_scanned = 0;
+		utils::tulong bytes_new = 0;
+		utils::tulong chunks_total = 0;
+		utils::tulong chunks_new = 0;
+		// Minecraft chunks seen in region files, and how many were skipped because their timestamp hadn't moved
+		utils::tulong region_chunks = 0;
+		utils::tulong region_chunks_unchanged = 0;
+		std::chrono::milliseconds elapsed{ 0 };
+	};
+
+
+	/**
+	 * @brief Incremental, deduplicating backups of a directory tree into a local repository
+	 *
+	 * Files are split by a content-defined chunker and chunks are stored once by BLAKE3 digest, so a snapshot
+	 * of a mostly unchanged world only writes the chunks that actually changed plus a manifest.
+	 *
+	 * In region-aware mode .mca files aren't cut by the chunker, since their 4 KiB sectors shift around as
+	 * Minecraft chunks grow. Instead the Anvil header is parsed and every compressed chunk payload is its own
+	 * dedup unit, and payloads whose header timestamp matches the previous snapshot are reused without being
+	 * read, so the cost of a snapshot follows the Minecraft chunks modified rather than the region files touched.
+	 *
+	 * Repository layout:
+	 *   chunks/    content-addressed chunk files
+	 *   snapshots/ one manifest per snapshot, named by UTC time so they sort chronologically
+	 */
+	class backup_engine
+	{
+		public:
+			/**
+			 * @param repo Repository directory, created if needed
+			 * @param region_aware Store .mca files chunk by chunk
+			 * @param params Content-defined chunking limits for everything else
+			 */
+			explicit backup_engine(const std::filesystem::path &repo, bool region_aware = true, chunker_params params = {});
+
+			/**
+			 * @brief Snapshot a directory tree
+			 */
+			backup_stats snapshot(const std::filesystem::path &source);
+
+			/**
+			 * @brief Recreate a snapshot's files under target
+			 *
+			 * @param name Snapshot name, empty for the latest
+			 */
+			void restore(std::string_view name, const std::filesystem::path &target);
+
+			/**
+			 * @brief Snapshot names, oldest first
+			 */
+			std::vector<std::string> snapshots() const;
+
+		private:
+			void chunk_file(const std::filesystem::path &path, file_entry &entry, backup_stats &stats);
+			bool chunk_region(const std::filesystem::path &path, file_entry &entry, const file_entry *previous, backup_stats &stats);
+			void store(const utils::tuchar *data, size_t len, std::vector<chunk_ref> &refs, backup_stats &stats);
+
+			std::filesystem::path m_repo;
+			bool m_region_aware;
+			chunk_store m_store;
+			chunker m_chunker;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_864120_SRC_BACKUP
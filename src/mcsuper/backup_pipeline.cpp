@@ -0,0 +1,347 @@
+#include "backup_pipeline.hpp"
+
+#include <iostream>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <linux/fs.h>
+
+#include "server_properties.hpp"
+
+using std::cout, std::cerr, std::endl;
+
+namespace fs = std::filesystem;
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		/**
+		 * @brief Plain read/write copy for when the kernel can't copy between these two files itself
+		 */
+		void copy_by_hand(int in, int out)
+		{
+			char buf[1 << 16];
+			for (;;)
+			{
+				ssize_t n = ::read(in, buf, sizeof(buf));
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0) utils::throw_errno("read");
+				if (n == 0) return;
+
+				for (ssize_t done = 0; done < n;)
+				{
+					ssize_t w = ::write(out, buf + done, n - done);
+					if (w < 0 && errno == EINTR) continue;
+					if (w < 0) utils::throw_errno("write");
+					done += w;
+				}
+			}
+		}
+
+
+		/**
+		 * @brief Clone or copy one file, keeping its mode and times
+		 *
+		 * @return bool True if it was reflinked
+		 */
+		bool freeze_file(const fs::path &source, const fs::path &target)
+		{
+			utils::unique_fd in(open(source.c_str(), O_RDONLY | O_CLOEXEC));
+			if (!in) utils::throw_errno("open " + source.string());
+
+			struct stat st;
+			if (fstat(in.get(), &st) < 0) utils::throw_errno("fstat " + source.string());
+
+			utils::unique_fd out(open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777));
+			if (!out) utils::throw_errno("open " + target.string());
+
+			bool reflinked = ioctl(out.get(), FICLONE, in.get()) == 0;
+			if (!reflinked)
+			{
+				// Still cheap on filesystems that offload copies (NFS, CIFS), a real copy anywhere else
+				bool first = true;
+				for (;;)
+				{
+					ssize_t n = copy_file_range(in.get(), nullptr, out.get(), nullptr, 1 << 30, 0);
+					if (n < 0 && errno == EINTR) continue;
+					if (n < 0 && first && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL))
+					{
+						copy_by_hand(in.get(), out.get());
+						break;
+					}
+					if (n < 0) utils::throw_errno("copy_file_range " + source.string());
+					if (n == 0) break;
+					first = false;
+				}
+			}
+
+			fchmod(out.get(), st.st_mode & 07777);
+			timespec times[2] = { st.st_atim, st.st_mtim };
+			futimens(out.get(), times);
+			return reflinked;
+		}
+
+
+		/**
+		 * @brief The world folders of a server, the overworld plus the split-off dimensions Bukkit-based servers use
+		 */
+		std::vector<fs::path> world_dirs(const fs::path &workdir)
+		{
+			server_properties props = server_properties::load(workdir / "server.properties");
+			std::string level = props.get_or("level-name", "world");
+
+			std::vector<fs::path> dirs;
+			for (const char *suffix : { "", "_nether", "_the_end" })
+			{
+				fs::path dir = workdir / (level + suffix);
+				if (fs::is_directory(dir)) dirs.push_back(dir);
+			}
+			return dirs;
+		}
+	}
+
+
+	void freeze_tree(const fs::path &source, const fs::path &target, freeze_stats &stats)
+	{
+		fs::create_directories(target);
+
+		for (auto it = fs::recursive_directory_iterator(source); it != fs::recursive_directory_iterator(); ++it)
+		{
+			const fs::directory_entry &entry = *it;
+			fs::path to = target / fs::relative(entry.path(), source);
+
+			if (entry.is_directory() && !entry.is_symlink())
+			{
+				fs::create_directories(to);
+				continue;
+			}
+
+			// session.lock is held by the running server and means nothing in a copy
+			if (!entry.is_regular_file() || entry.is_symlink() || entry.path().filename() == "session.lock") continue;
+
+			if (freeze_file(entry.path(), to)) stats.reflinked++;
+			stats.files++;
+			stats.bytes += entry.file_size();
+		}
+	}
+
+
+	backup_pipeline::backup_pipeline(event_loop &loop, backup_pipeline_config config, command_sink send)
+		: m_loop(loop), m_config(std::move(config)), m_send(std::move(send))
+	{
+		// Inside the server directory so reflinks stay on the world's filesystem
+		m_staging = m_config.workdir / ".mcsuper-freeze";
+	}
+
+
+	backup_pipeline::~backup_pipeline()
+	{
+		cancel_timeout();
+		if (m_worker.joinable()) m_worker.join();
+	}
+
+
+	bool backup_pipeline::start()
+	{
+		if (busy()) return false;
+
+		cout << "[mcsuper] Backup: pausing saves" << endl;
+		m_phase = phase::disabling;
+		m_cancel = false;
+		m_save_off = std::chrono::steady_clock::now();
+		m_send("save-off");
+
+		m_timeout = m_loop.add_timer(m_config.save_timeout, std::chrono::nanoseconds::zero(), [this]()
+		{
+			m_timeout.reset();
+			on_timeout();
+		});
+		return true;
+	}
+
+
+	void backup_pipeline::on_event(const events::console_event &event)
+	{
+		std::visit(utils::overloaded{
+			[this](const events::saving_disabled &)
+			{
+				if (m_phase != phase::disabling) return;
+				m_phase = phase::flushing;
+				m_send("save-all flush");
+			},
+			[this](const events::game_saved &)
+			{
+				if (m_phase != phase::flushing) return;
+				cancel_timeout();
+				freeze();
+			},
+			[this](const events::server_stopping &)
+			{
+				// The server's last save lands on disk whatever save-off said, so anything copied from here on is torn
+				if (m_phase == phase::disabling || m_phase == phase::flushing) abandon("the server is stopping");
+				else if (m_phase == phase::freezing) m_cancel = true;
+			},
+			[](const auto &) {}
+		}, event);
+	}
+
+
+	void backup_pipeline::freeze()
+	{
+		m_phase = phase::freezing;
+
+		std::vector<fs::path> worlds;
+		try
+		{
+			worlds = world_dirs(m_config.workdir);
+			if (worlds.empty()) throw std::runtime_error("no world folder in " + m_config.workdir.string());
+			fs::remove_all(m_staging);
+		}
+		catch (const std::exception &)
+		{
+			on_frozen(std::current_exception(), {});
+			return;
+		}
+
+		m_worker = std::thread([this, worlds = std::move(worlds)]()
+		{
+			freeze_stats frozen;
+			try
+			{
+				for (const fs::path &world : worlds) freeze_tree(world, m_staging / world.filename(), frozen);
+			}
+			catch (const std::exception &)
+			{
+				std::error_code ec;
+				fs::remove_all(m_staging, ec);
+				m_loop.post([this, error = std::current_exception()]() { on_frozen(error, {}); });
+				return;
+			}
+			m_loop.post([this, frozen]() { on_frozen(nullptr, frozen); });
+
+			// Saving is back on by now, stay out of the server's way while chunking and hashing
+			setpriority(PRIO_PROCESS, gettid(), 10);
+
+			std::exception_ptr error;
+			std::optional<backup_stats> stats;
+			if (!m_cancel)
+			{
+				try
+				{
+					backup_engine engine(m_config.repo, m_config.region_aware);
+					stats = engine.snapshot(m_staging);
+				}
+				catch (const std::exception &)
+				{
+					error = std::current_exception();
+				}
+			}
+
+			std::error_code ec;
+			fs::remove_all(m_staging, ec);
+			m_loop.post([this, error, stats]() { on_archived(error, stats); });
+		});
+	}
+
+
+	void backup_pipeline::on_frozen(std::exception_ptr error, freeze_stats stats)
+	{
+		if (m_cancel)
+		{
+			cerr << "[mcsuper] Backup abandoned, the server stopped while the world was being copied" << endl;
+			m_metrics.failed.add();
+			// A failed copy means the worker is already gone, otherwise on_archived finishes up
+			if (error) finish();
+			return;
+		}
+
+		m_send("save-on");
+		auto window = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_save_off);
+
+		if (error)
+		{
+			try
+			{
+				std::rethrow_exception(error);
+			}
+			catch (const std::exception &e)
+			{
+				cerr << "[mcsuper] Backup failed while copying the world: " << e.what() << endl;
+			}
+			m_metrics.failed.add();
+			finish();
+			return;
+		}
+
+		m_phase = phase::archiving;
+		m_metrics.paused_ms.add(window.count());
+		cout << "[mcsuper] Backup: saves resumed after " << window.count() << "ms, froze " << stats.files << " files ("
+		     << stats.bytes / (1024 * 1024) << " MiB, " << stats.reflinked << " reflinked)" << endl;
+	}
+
+
+	void backup_pipeline::on_archived(std::exception_ptr error, std::optional<backup_stats> stats)
+	{
+		finish();
+
+		if (error)
+		{
+			try
+			{
+				std::rethrow_exception(error);
+			}
+			catch (const std::exception &e)
+			{
+				cerr << "[mcsuper] Backup failed: " << e.what() << endl;
+			}
+			m_metrics.failed.add();
+			return;
+		}
+		if (!stats) return;
+
+		auto took = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_save_off);
+		m_metrics.completed.add();
+		m_metrics.duration_ms.add(took.count());
+		m_metrics.last_duration_ms.set(took.count());
+		cout << "[mcsuper] Backup " << stats->snapshot << " done: " << stats->chunks_new << "/" << stats->chunks_total << " chunks new ("
+		     << stats->bytes_new / (1024 * 1024) << " MiB) in " << stats->elapsed.count() << "ms" << endl;
+	}
+
+
+	void backup_pipeline::on_timeout()
+	{
+		if (m_phase == phase::disabling) abandon("the server never confirmed save-off");
+		else if (m_phase == phase::flushing) abandon("save-all flush didn't finish in time");
+	}
+
+
+	void backup_pipeline::abandon(std::string_view why)
+	{
+		cancel_timeout();
+		m_send("save-on");
+		m_phase = phase::idle;
+		m_metrics.failed.add();
+		cerr << "[mcsuper] Backup abandoned, " << why << endl;
+	}
+
+
+	void backup_pipeline::cancel_timeout()
+	{
+		if (m_timeout) m_loop.cancel_timer(*m_timeout);
+		m_timeout.reset();
+	}
+
+
+	void backup_pipeline::finish()
+	{
+		if (m_worker.joinable()) m_worker.join();
+		m_phase = phase::idle;
+	}
+
+} // End namespace mcsuper
@@ -0,0 +1,160 @@
+#pragma once
+#ifndef H_427936_SRC_BACKUP_PIPELINE
+#define H_427936_SRC_BACKUP_PIPELINE 1
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <optional>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <string_view>
+
+#include "utils.hpp"
+#include "event_loop.hpp"
+#include "console_events.hpp"
+#include "backup.hpp"
+#include "metrics.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Where a live backup reads from and writes to
+	 */
+	struct backup_pipeline_config
+	{
+		// Backup repository, see backup_engine
+		std::filesystem::path repo;
+		// The server's directory, world folders are found through its server.properties
+		std::filesystem::path workdir;
+		// How long the server gets to confirm save-off and finish save-all flush
+		std::chrono::seconds save_timeout{ 120 };
+		bool region_aware = true;
+	};
+
+
+	/**
+	 * @brief What freezing the world cost
+	 */
+	struct freeze_stats
+	{
+		utils::tulong files = 0;
+		utils::tulong bytes = 0;
+		// Files shared with the live world through a reflink rather than copied
+		utils::tulong reflinked = 0;
+	};
+
+
+	/**
+	 * @brief Copy a directory tree so the copy can't change when the original does
+	 *
+	 * Each file is cloned with FICLONE where the filesystem can (btrfs, XFS, bcachefs), which only shares
+	 * extents and takes milliseconds however big the world is, and falls back to copy_file_range otherwise.
+	 * Hard links are no substitute, Minecraft rewrites region file sectors in place so a linked "copy" would
+	 * keep changing under the backup. mtimes and modes are carried over so incremental backups still
+	 * recognise unchanged files
+	 */
+	void freeze_tree(const std::filesystem::path &source, const std::filesystem::path &target, freeze_stats &stats);
+
+
+	/**
+	 * @brief Running totals of a pipeline's backups
+	 */
+	struct backup_metrics
+	{
+		padded_counter completed;
+		// Abandoned or failed, whatever the phase
+		padded_counter failed;
+		// From save-off until the repository is written, added up and for the latest backup
+		padded_counter duration_ms;
+		padded_counter last_duration_ms;
+		// The part of it saving was paused for
+		padded_counter paused_ms;
+	};
+
+
+	/**
+	 * @brief Backs up a running server with saving paused for as short a time as possible
+	 *
+	 * save-off, then save-all flush, then once the console confirms "Saved the game" the world folders are
+	 * frozen into a staging directory next to them and save-on goes out straight away. Chunking, hashing and
+	 * writing the repository happen afterwards on a low-priority thread, from the frozen copy, while the
+	 * server carries on saving normally.
+	 *
+	 * The supervisor feeds it console events and it talks back through the command sink, everything but
+	 * the worker thread runs on the event loop
+	 */
+	class backup_pipeline
+	{
+		public:
+			typedef std::function<void(std::string_view command)> command_sink;
+
+			backup_pipeline(event_loop &loop, backup_pipeline_config config, command_sink send);
+
+			/**
+			 * @brief Waits for a running archive phase, it's writing the repository
+			 */
+			~backup_pipeline();
+
+			backup_pipeline(const backup_pipeline &) = delete;
+			backup_pipeline &operator=(const backup_pipeline &) = delete;
+
+			/**
+			 * @brief Begin a backup
+			 *
+			 * @return bool False if one is already in progress
+			 */
+			bool start();
+
+			/**
+			 * @brief Feed a console event, the pipeline advances on the save confirmations
+			 */
+			void on_event(const events::console_event &event);
+
+			bool busy() const noexcept { return m_phase != phase::idle; }
+
+			const backup_metrics &metrics() const noexcept { return m_metrics; }
+
+		private:
+			enum class phase
+			{
+				idle,
+				// save-off sent, waiting for the confirmation
+				disabling,
+				// save-all flush sent, waiting for "Saved the game"
+				flushing,
+				// Worker is copying the world, saving is still off
+				freezing,
+				// Saving is back on, worker is writing the repository
+				archiving
+			};
+
+			void freeze();
+			void on_frozen(std::exception_ptr error, freeze_stats stats);
+			void on_archived(std::exception_ptr error, std::optional<backup_stats> stats);
+			void on_timeout();
+			void abandon(std::string_view why);
+			void cancel_timeout();
+			void finish();
+
+			event_loop &m_loop;
+			backup_pipeline_config m_config;
+			command_sink m_send;
+
+			phase m_phase = phase::idle;
+			std::optional<event_loop::timer_id> m_timeout;
+			std::chrono::steady_clock::time_point m_save_off;
+			std::filesystem::path m_staging;
+
+			std::thread m_worker;
+			// Set when the server stops mid-freeze, its final save makes the copy torn
+			std::atomic<bool> m_cancel{ false };
+
+			backup_metrics m_metrics;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_427936_SRC_BACKUP_PIPELINE
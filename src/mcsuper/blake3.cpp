@@ -0,0 +1,269 @@
+#include "blake3.hpp"
+
+#include <algorithm>
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		constexpr utils::tuint iv[8] = {
+			0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+		};
+
+		constexpr size_t msg_permutation[16] = { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 };
+
+		constexpr utils::tuint chunk_start = 1 << 0;
+		constexpr utils::tuint chunk_end   = 1 << 1;
+		constexpr utils::tuint parent      = 1 << 2;
+		constexpr utils::tuint root        = 1 << 3;
+
+		constexpr size_t chunk_len = 1024;
+
+
+		inline utils::tuint rotr(utils::tuint x, int n)
+		{
+			return (x >> n) | (x << (32 - n));
+		}
+
+
+		inline void g(utils::tuint *s, int a, int b, int c, int d, utils::tuint mx, utils::tuint my)
+		{
+			s[a] = s[a] + s[b] + mx;
+			s[d] = rotr(s[d] ^ s[a], 16);
+			s[c] = s[c] + s[d];
+			s[b] = rotr(s[b] ^ s[c], 12);
+			s[a] = s[a] + s[b] + my;
+			s[d] = rotr(s[d] ^ s[a], 8);
+			s[c] = s[c] + s[d];
+			s[b] = rotr(s[b] ^ s[c], 7);
+		}
+
+
+		void compress(const utils::tuint cv[8], const utils::tuint block[16], utils::tulong counter, utils::tuint block_len, utils::tuint flags, utils::tuint out[16])
+		{
+			utils::tuint s[16] = {
+				cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+				iv[0], iv[1], iv[2], iv[3],
+				static_cast<utils::tuint>(counter), static_cast<utils::tuint>(counter >> 32), block_len, flags
+			};
+
+			utils::tuint m[16];
+			std::copy(block, block + 16, m);
+
+			for (int r = 0; r < 7; r++)
+			{
+				g(s, 0, 4, 8, 12, m[0], m[1]);
+				g(s, 1, 5, 9, 13, m[2], m[3]);
+				g(s, 2, 6, 10, 14, m[4], m[5]);
+				g(s, 3, 7, 11, 15, m[6], m[7]);
+				g(s, 0, 5, 10, 15, m[8], m[9]);
+				g(s, 1, 6, 11, 12, m[10], m[11]);
+				g(s, 2, 7, 8, 13, m[12], m[13]);
+				g(s, 3, 4, 9, 14, m[14], m[15]);
+
+				if (r == 6) break;
+				utils::tuint permuted[16];
+				for (int i = 0; i < 16; i++) permuted[i] = m[msg_permutation[i]];
+				std::copy(permuted, permuted + 16, m);
+			}
+
+			for (int i = 0; i < 8; i++)
+			{
+				out[i] = s[i] ^ s[i + 8];
+				out[i + 8] = s[i + 8] ^ cv[i];
+			}
+		}
+
+
+		void load_words(const utils::tuchar *bytes, utils::tuint words[16])
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				const utils::tuchar *p = bytes + 4 * i;
+				words[i] = p[0] | p[1] << 8 | p[2] << 16 | static_cast<utils::tuint>(p[3]) << 24;
+			}
+		}
+
+
+		void parent_cv(const utils::tuint left[8], const utils::tuint right[8], utils::tuint flags, utils::tuint out[8])
+		{
+			utils::tuint block[16];
+			std::copy(left, left + 8, block);
+			std::copy(right, right + 8, block + 8);
+
+			utils::tuint full[16];
+			compress(iv, block, 0, 64, flags | parent, full);
+			std::copy(full, full + 8, out);
+		}
+	}
+
+
+	std::string to_hex(const digest &d)
+	{
+		static constexpr char digits[] = "0123456789abcdef";
+		std::string out(d.size() * 2, '0');
+		for (size_t i = 0; i < d.size(); i++)
+		{
+			out[2 * i] = digits[d[i] >> 4];
+			out[2 * i + 1] = digits[d[i] & 0xF];
+		}
+		return out;
+	}
+
+
+	bool from_hex(std::string_view hex, digest &out)
+	{
+		if (hex.size() != out.size() * 2) return false;
+
+		auto nibble = [](char c) -> int
+		{
+			if (c >= '0' && c <= '9') return c - '0';
+			if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+			if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+			return -1;
+		};
+
+		for (size_t i = 0; i < out.size(); i++)
+		{
+			int hi = nibble(hex[2 * i]);
+			int lo = nibble(hex[2 * i + 1]);
+			if (hi < 0 || lo < 0) return false;
+			out[i] = static_cast<utils::tuchar>(hi << 4 | lo);
+		}
+		return true;
+	}
+
+
+	void blake3::chunk_state::reset(utils::tulong chunk_counter) noexcept
+	{
+		std::copy(iv, iv + 8, cv);
+		counter = chunk_counter;
+		std::fill(block, block + 64, 0);
+		block_len = 0;
+		blocks_compressed = 0;
+	}
+
+
+	void blake3::chunk_state::update(const utils::tuchar *in, size_t len) noexcept
+	{
+		while (len > 0)
+		{
+			// Only compress a full block once more input arrives, the last block of a chunk needs CHUNK_END
+			if (block_len == 64)
+			{
+				utils::tuint words[16], out[16];
+				load_words(block, words);
+				compress(cv, words, counter, 64, blocks_compressed == 0 ? chunk_start : 0, out);
+				std::copy(out, out + 8, cv);
+				blocks_compressed++;
+				std::fill(block, block + 64, 0);
+				block_len = 0;
+			}
+
+			size_t take = std::min<size_t>(64 - block_len, len);
+			std::copy(in, in + take, block + block_len);
+			block_len += take;
+			in += take;
+			len -= take;
+		}
+	}
+
+
+	blake3::blake3() noexcept
+	{
+		m_chunk.reset(0);
+	}
+
+
+	void blake3::push_chunk(const utils::tuint cv[8], utils::tulong total_chunks) noexcept
+	{
+		// Each trailing zero bit of the chunk count is a completed subtree to merge with
+		utils::tuint merged[8];
+		std::copy(cv, cv + 8, merged);
+
+		while ((total_chunks & 1) == 0)
+		{
+			m_stack_len--;
+			parent_cv(m_stack[m_stack_len], merged, 0, merged);
+			total_chunks >>= 1;
+		}
+
+		std::copy(merged, merged + 8, m_stack[m_stack_len]);
+		m_stack_len++;
+	}
+
+
+	void blake3::update(const void *data, size_t len) noexcept
+	{
+		const utils::tuchar *in = static_cast<const utils::tuchar *>(data);
+
+		while (len > 0)
+		{
+			if (m_chunk.len() == chunk_len)
+			{
+				utils::tuint words[16], out[16];
+				load_words(m_chunk.block, words);
+				compress(m_chunk.cv, words, m_chunk.counter, m_chunk.block_len, (m_chunk.blocks_compressed == 0 ? chunk_start : 0) | chunk_end, out);
+
+				utils::tulong total = m_chunk.counter + 1;
+				push_chunk(out, total);
+				m_chunk.reset(total);
+			}
+
+			size_t take = std::min(chunk_len - m_chunk.len(), len);
+			m_chunk.update(in, take);
+			in += take;
+			len -= take;
+		}
+	}
+
+
+	digest blake3::finalize() const noexcept
+	{
+		// The root is the last chunk if there's only one, otherwise the topmost parent, either gets ROOT
+		utils::tuint cv[8];
+		utils::tuint block[16];
+		utils::tulong counter = m_chunk.counter;
+		utils::tuint block_len = m_chunk.block_len;
+		utils::tuint flags = (m_chunk.blocks_compressed == 0 ? chunk_start : 0) | chunk_end;
+
+		std::copy(m_chunk.cv, m_chunk.cv + 8, cv);
+		load_words(m_chunk.block, block);
+
+		for (size_t i = m_stack_len; i-- > 0;)
+		{
+			utils::tuint out[16];
+			compress(cv, block, counter, block_len, flags, out);
+
+			std::copy(m_stack[i], m_stack[i] + 8, block);
+			std::copy(out, out + 8, block + 8);
+			std::copy(iv, iv + 8, cv);
+			counter = 0;
+			block_len = 64;
+			flags = parent;
+		}
+
+		utils::tuint out[16];
+		compress(cv, block, 0, block_len, flags | root, out);
+
+		digest d;
+		for (int i = 0; i < 8; i++)
+		{
+			d[4 * i]     = static_cast<utils::tuchar>(out[i]);
+			d[4 * i + 1] = static_cast<utils::tuchar>(out[i] >> 8);
+			d[4 * i + 2] = static_cast<utils::tuchar>(out[i] >> 16);
+			d[4 * i + 3] = static_cast<utils::tuchar>(out[i] >> 24);
+		}
+		return d;
+	}
+
+
+	digest blake3::hash(const void *data, size_t len) noexcept
+	{
+		blake3 h;
+		h.update(data, len);
+		return h.finalize();
+	}
+
+} // End namespace mcsuper
@@ -0,0 +1,87 @@
+#pragma once
+#ifndef H_702658_SRC_BLAKE3
+#define H_702658_SRC_BLAKE3 1
+
+#include <array>
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief 256-bit BLAKE3 digest
+	 */
+	typedef std::array<utils::tuchar, 32> digest;
+
+	/**
+	 * @brief Lower-case hex of a digest
+	 */
+	std::string to_hex(const digest &d);
+
+	/**
+	 * @brief Parse 64 hex characters
+	 *
+	 * @return bool False if hex isn't a well-formed digest
+	 */
+	bool from_hex(std::string_view hex, digest &out);
+
+	/**
+	 * @brief For unordered containers keyed by digest, the digest is already uniformly distributed
+	 */
+	struct digest_hash
+	{
+		size_t operator()(const digest &d) const noexcept
+		{
+			size_t h;
+			std::memcpy(&h, d.data(), sizeof(h));
+			return h;
+		}
+	};
+
+
+	/**
+	 * @brief Incremental BLAKE3 hasher, portable implementation following the reference
+	 */
+	class blake3
+	{
+		public:
+			blake3() noexcept;
+
+			void update(const void *data, size_t len) noexcept;
+			digest finalize() const noexcept;
+
+			/**
+			 * @brief Hash a buffer in one go
+			 */
+			static digest hash(const void *data, size_t len) noexcept;
+
+		private:
+			struct chunk_state
+			{
+				utils::tuint cv[8];
+				utils::tulong counter;
+				utils::tuchar block[64];
+				utils::tuchar block_len;
+				utils::tuchar blocks_compressed;
+
+				void reset(utils::tulong chunk_counter) noexcept;
+				size_t len() const noexcept { return 64 * blocks_compressed + block_len; }
+				void update(const utils::tuchar *in, size_t len) noexcept;
+			};
+
+			void push_chunk(const utils::tuint cv[8], utils::tulong total_chunks) noexcept;
+
+			chunk_state m_chunk;
+			// Chaining values of completed subtrees, one per set bit of the chunk count, 54 covers 2^64 bytes
+			utils::tuint m_stack[54][8];
+			utils::tuchar m_stack_len = 0;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_702658_SRC_BLAKE3
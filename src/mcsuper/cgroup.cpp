@@ -0,0 +1,364 @@
+#include "cgroup.hpp"
+
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+namespace fs = std::filesystem;
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		/**
+		 * @brief Where the cgroup v2 hierarchy is mounted, /sys/fs/cgroup or /sys/fs/cgroup/unified on hybrid setups
+		 */
+		fs::path cgroup2_mount()
+		{
+			std::ifstream in("/proc/self/mountinfo");
+			std::string line;
+			while (std::getline(in, line))
+			{
+				// The filesystem type follows the " - " separator, the mount point is the fifth field
+				size_t sep = line.find(" - ");
+				if (sep == std::string::npos || line.compare(sep + 3, 8, "cgroup2 ") != 0) continue;
+
+				std::istringstream fields(line.substr(0, sep));
+				std::string field;
+				for (int i = 0; i < 5 && fields >> field; i++) {}
+				return field;
+			}
+			return {};
+		}
+
+
+		/**
+		 * @brief Our own cgroup v2, relative to the mount
+		 */
+		fs::path own_cgroup()
+		{
+			std::ifstream in("/proc/self/cgroup");
+			std::string line;
+			while (std::getline(in, line))
+			{
+				if (line.starts_with("0::")) return fs::path(line.substr(3)).relative_path();
+			}
+			throw std::runtime_error("not in a cgroup v2 hierarchy");
+		}
+
+
+		std::string read_text(const fs::path &path)
+		{
+			std::ifstream in(path);
+			std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			while (!text.empty() && std::isspace(static_cast<utils::tuchar>(text.back()))) text.pop_back();
+			return text;
+		}
+
+
+		/**
+		 * @brief Write a whole control value in one write, as cgroupfs expects
+		 *
+		 * @return bool False with errno set if the kernel refused it
+		 */
+		bool write_control(const fs::path &path, std::string_view value)
+		{
+			utils::unique_fd fd(open(path.c_str(), O_WRONLY | O_CLOEXEC));
+			if (!fd) return false;
+			return ::write(fd.get(), value.data(), value.size()) == static_cast<ssize_t>(value.size());
+		}
+
+
+		void set_control(const fs::path &path, std::string_view value)
+		{
+			if (!write_control(path, value)) utils::throw_errno("write " + path.string() + " \"" + std::string(value) + "\"");
+		}
+
+
+		bool has_word(std::string_view list, std::string_view word)
+		{
+			while (!list.empty())
+			{
+				size_t sp = list.find(' ');
+				if (list.substr(0, sp) == word) return true;
+				if (sp == std::string_view::npos) break;
+				list.remove_prefix(sp + 1);
+			}
+			return false;
+		}
+
+
+		/**
+		 * @brief Turn on controllers for the children of parent, moving ourselves out of it if we're in the way
+		 */
+		void delegate_controllers(const fs::path &parent, bool is_root)
+		{
+			std::string available = read_text(parent / "cgroup.controllers");
+			for (const char *controller : { "cpu", "memory", "io" })
+			{
+				if (!has_word(available, controller) || has_word(read_text(parent / "cgroup.subtree_control"), controller)) continue;
+
+				std::string enable = std::string("+") + controller;
+				if (write_control(parent / "cgroup.subtree_control", enable)) continue;
+
+				// "No internal processes": a cgroup with members can't hand controllers to its children
+				if (errno != EBUSY || is_root) utils::throw_errno("enable " + std::string(controller) + " in " + parent.string());
+
+				fs::path leaf = parent / "supervisor";
+				if (mkdir(leaf.c_str(), 0755) < 0 && errno != EEXIST) utils::throw_errno("mkdir " + leaf.string());
+				set_control(leaf / "cgroup.procs", std::to_string(getpid()));
+				set_control(parent / "cgroup.subtree_control", enable);
+			}
+		}
+
+
+		/**
+		 * @brief "major:minor" of the whole disk a path lives on, io.max refuses partitions
+		 */
+		std::string block_device(const fs::path &path)
+		{
+			struct stat st;
+			if (stat(path.c_str(), &st) < 0) utils::throw_errno("stat " + path.string());
+			if (major(st.st_dev) == 0) throw std::runtime_error(path.string() + " isn't on a block device, io.max can't limit it");
+
+			std::string dev = std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+			fs::path sys = fs::path("/sys/dev/block") / dev;
+
+			std::error_code ec;
+			if (fs::exists(sys / "partition", ec))
+			{
+				fs::path disk = fs::canonical(sys, ec).parent_path();
+				if (!ec) dev = read_text(disk / "dev");
+			}
+			return dev;
+		}
+
+
+		/**
+		 * @brief "wbps=50M riops=2000" with sizes expanded, as io.max takes them
+		 */
+		std::string io_limits(std::string_view spec)
+		{
+			std::string out;
+			std::istringstream in{ std::string(spec) };
+			std::string token;
+			while (in >> token)
+			{
+				size_t eq = token.find('=');
+				std::string key = token.substr(0, eq);
+				std::string value = eq == std::string::npos ? "" : token.substr(eq + 1);
+				if (key != "rbps" && key != "wbps" && key != "riops" && key != "wiops") throw std::invalid_argument("unknown io.max key \"" + key + "\"");
+
+				if (value != "max")
+				{
+					std::optional<utils::tulong> n = parse_size(value);
+					if (!n || *n == 0) throw std::invalid_argument("bad io.max value \"" + token + "\"");
+					value = std::to_string(*n);
+				}
+				out.append(" ").append(key).append("=").append(value);
+			}
+			if (out.empty()) throw std::invalid_argument("empty io.max limits");
+			return out;
+		}
+	}
+
+
+	const char *pressure_name(pressure_kind kind) noexcept
+	{
+		switch (kind)
+		{
+			case pressure_kind::cpu: return "cpu";
+			case pressure_kind::memory: return "memory";
+			case pressure_kind::io: return "io";
+			default: return "?";
+		}
+	}
+
+
+	utils::tulong read_counter(const fs::path &path, std::string_view key)
+	{
+		std::ifstream in(path);
+		std::string line;
+		while (std::getline(in, line))
+		{
+			if (line.size() > key.size() && line.starts_with(key) && line[key.size()] == ' ') return std::stoull(line.substr(key.size() + 1));
+		}
+		return 0;
+	}
+
+
+	std::optional<utils::tulong> parse_size(std::string_view text) noexcept
+	{
+		utils::tulong value = 0;
+		size_t i = 0;
+		for (; i < text.size() && std::isdigit(static_cast<utils::tuchar>(text[i])); i++) value = value * 10 + (text[i] - '0');
+		if (i == 0) return std::nullopt;
+
+		std::string_view unit = text.substr(i);
+		if (unit.ends_with('B') || unit.ends_with('b')) unit.remove_suffix(1);
+		if (unit.ends_with('i')) unit.remove_suffix(1);
+		if (unit.size() > 1) return std::nullopt;
+
+		int shift = 0;
+		switch (unit.empty() ? 0 : std::toupper(static_cast<utils::tuchar>(unit[0])))
+		{
+			case 0: break;
+			case 'K': shift = 10; break;
+			case 'M': shift = 20; break;
+			case 'G': shift = 30; break;
+			case 'T': shift = 40; break;
+			default: return std::nullopt;
+		}
+		return value << shift;
+	}
+
+
+	server_cgroup::server_cgroup(const std::string &name, const fs::path &workdir, const cgroup_limits &limits)
+	{
+		fs::path mount = cgroup2_mount();
+		if (mount.empty()) throw std::runtime_error("no cgroup v2 hierarchy mounted");
+
+		fs::path own = own_cgroup();
+		fs::path parent = mount / own;
+		delegate_controllers(parent, own.empty());
+
+		std::string enabled = read_text(parent / "cgroup.subtree_control");
+		auto require = [&](const char *controller, bool wanted)
+		{
+			if (wanted && !has_word(enabled, controller)) throw std::runtime_error(std::string("the ") + controller + " controller isn't available in " + parent.string());
+		};
+		require("memory", limits.memory_high > 0 || limits.memory_max > 0);
+		require("cpu", limits.cpu_weight > 0);
+		require("io", !limits.io_max.empty());
+		std::string io = limits.io_max.empty() ? "" : block_device(workdir) + io_limits(limits.io_max);
+
+		m_path = parent / name;
+		if (mkdir(m_path.c_str(), 0755) < 0 && errno != EEXIST) utils::throw_errno("mkdir " + m_path.string());
+
+		try
+		{
+			m_dir.reset(open(m_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+			if (!m_dir) utils::throw_errno("open " + m_path.string());
+
+			// Written even when unset, a cgroup left over from an earlier run may still carry old limits
+			if (has_word(enabled, "memory"))
+			{
+				set_control(m_path / "memory.high", limits.memory_high > 0 ? std::to_string(limits.memory_high) : "max");
+				set_control(m_path / "memory.max", limits.memory_max > 0 ? std::to_string(limits.memory_max) : "max");
+			}
+			if (has_word(enabled, "cpu")) set_control(m_path / "cpu.weight", std::to_string(limits.cpu_weight > 0 ? limits.cpu_weight : 100));
+			if (!io.empty()) set_control(m_path / "io.max", io);
+		}
+		catch (...)
+		{
+			rmdir(m_path.c_str());
+			throw;
+		}
+	}
+
+
+	server_cgroup::~server_cgroup()
+	{
+		m_dir.reset();
+		rmdir(m_path.c_str());
+	}
+
+
+	std::optional<pressure_stats> server_cgroup::pressure(pressure_kind kind) const
+	{
+		std::ifstream in(m_path / (std::string(pressure_name(kind)) + ".pressure"));
+		if (!in) return std::nullopt;
+
+		// "some avg10=0.12 avg60=0.05 avg300=0.01 total=123456", then the same for "full"
+		pressure_stats stats;
+		std::string line;
+		while (std::getline(in, line))
+		{
+			std::istringstream fields(line);
+			std::string which, field;
+			fields >> which;
+			bool some = which == "some";
+
+			while (fields >> field)
+			{
+				if (field.starts_with("avg10=")) (some ? stats.some_avg10 : stats.full_avg10) = std::stod(field.substr(6));
+				else if (field.starts_with("total=")) (some ? stats.some_us : stats.full_us) = std::stoull(field.substr(6));
+			}
+		}
+		return stats;
+	}
+
+
+	utils::tulong server_cgroup::memory_current() const
+	{
+		std::string text = read_text(m_path / "memory.current");
+		return text.empty() ? 0 : std::stoull(text);
+	}
+
+
+	utils::tulong server_cgroup::memory_events(std::string_view key) const
+	{
+		return read_counter(m_path / "memory.events", key);
+	}
+
+
+	pressure_watch::pressure_watch(event_loop &loop, const fs::path &cgroup, std::chrono::milliseconds stall, handler on_pressure) : m_loop(loop), m_handler(std::move(on_pressure))
+	{
+		using std::chrono::microseconds;
+		stall = std::clamp(stall, std::chrono::milliseconds(1), std::chrono::duration_cast<std::chrono::milliseconds>(window));
+		std::string trigger = "some " + std::to_string(microseconds(stall).count()) + " " + std::to_string(microseconds(window).count());
+
+		for (size_t i = 0; i < m_triggers.size(); i++)
+		{
+			auto kind = static_cast<pressure_kind>(i);
+			fs::path file = cgroup / (std::string(pressure_name(kind)) + ".pressure");
+
+			// A trigger lives as long as the descriptor it was written to
+			utils::unique_fd fd(open(file.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC));
+			if (!fd || ::write(fd.get(), trigger.c_str(), trigger.size() + 1) < 0) continue;
+
+			m_loop.add(fd.get(), EPOLLPRI, [this, kind](utils::tuint events) { on_trigger(kind, events); });
+			m_triggers[i] = std::move(fd);
+		}
+	}
+
+
+	pressure_watch::~pressure_watch()
+	{
+		for (utils::unique_fd &fd : m_triggers)
+		{
+			if (fd) m_loop.remove(fd.get());
+		}
+	}
+
+
+	size_t pressure_watch::armed() const noexcept
+	{
+		return std::count_if(m_triggers.begin(), m_triggers.end(), [](const utils::unique_fd &fd) { return bool(fd); });
+	}
+
+
+	void pressure_watch::on_trigger(pressure_kind kind, utils::tuint events)
+	{
+		utils::unique_fd &fd = m_triggers[static_cast<size_t>(kind)];
+
+		// The cgroup went away under the trigger
+		if (events & EPOLLERR)
+		{
+			m_loop.remove(fd.get());
+			fd.reset();
+			return;
+		}
+
+		m_events[static_cast<size_t>(kind)]++;
+		m_handler(kind);
+	}
+
+} // End namespace mcsuper
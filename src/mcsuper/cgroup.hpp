@@ -0,0 +1,163 @@
+#pragma once
+#ifndef H_731946_SRC_CGROUP
+#define H_731946_SRC_CGROUP 1
+
+#include <array>
+#include <chrono>
+#include <string>
+#include <optional>
+#include <filesystem>
+#include <functional>
+#include <string_view>
+
+#include "utils.hpp"
+#include "event_loop.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief The resource envelope of a server's cgroup
+	 */
+	struct cgroup_limits
+	{
+		// memory.high, above it the server is throttled and reclaimed from, 0 leaves it unlimited
+		utils::tulong memory_high = 0;
+		// memory.max, where the OOM killer steps in, 0 leaves it unlimited
+		utils::tulong memory_max = 0;
+		// cpu.weight against the cgroup's siblings, 1 to 10000, 0 keeps the kernel's 100
+		utils::tuint cpu_weight = 0;
+		// io.max limits such as "wbps=50M riops=2000" for the disk holding the workdir, empty for none
+		std::string io_max;
+		// Stall per two second window that counts as pressure, for every resource
+		std::chrono::milliseconds pressure_stall{ 200 };
+	};
+
+
+	enum class pressure_kind
+	{
+		cpu,
+		memory,
+		io,
+		count
+	};
+
+	const char *pressure_name(pressure_kind kind) noexcept;
+
+
+	/**
+	 * @brief One <resource>.pressure file, the share of the last 10s some or all tasks were stalled and
+	 * the total stall time
+	 */
+	struct pressure_stats
+	{
+		double some_avg10 = 0;
+		double full_avg10 = 0;
+		utils::tulong some_us = 0;
+		utils::tulong full_us = 0;
+	};
+
+
+	/**
+	 * @brief A size such as 512M or 6G, binary units, nothing if it doesn't parse
+	 */
+	std::optional<utils::tulong> parse_size(std::string_view text) noexcept;
+
+
+	/**
+	 * @brief Value of a "key value" line in a flat keyed file such as memory.events or /proc/vmstat, 0 if missing
+	 */
+	utils::tulong read_counter(const std::filesystem::path &path, std::string_view key);
+
+
+	/**
+	 * @brief A cgroup v2 the server runs in, under the supervisor's own
+	 *
+	 * Created next to the supervisor in its cgroup, with the cpu, memory and io controllers enabled for it.
+	 * A non-root cgroup can't hold processes and delegate controllers at once, so if the supervisor's own
+	 * has that problem the supervisor first moves itself into a "supervisor" leaf beside the server's.
+	 * Under systemd that needs Delegate=yes on the unit
+	 */
+	class server_cgroup
+	{
+		public:
+			/**
+			 * @brief Create (or take over) the cgroup and write the limits, throws without a writable cgroup v2
+			 *
+			 * @param workdir Where io_max finds its disk
+			 */
+			server_cgroup(const std::string &name, const std::filesystem::path &workdir, const cgroup_limits &limits);
+
+			/**
+			 * @brief Removes the cgroup, which only works once nothing runs in it
+			 */
+			~server_cgroup();
+
+			server_cgroup(const server_cgroup &) = delete;
+			server_cgroup &operator=(const server_cgroup &) = delete;
+
+			/**
+			 * @brief Directory descriptor for clone3(CLONE_INTO_CGROUP)
+			 */
+			int fd() const noexcept { return m_dir.get(); }
+			const std::filesystem::path &path() const noexcept { return m_path; }
+
+			std::optional<pressure_stats> pressure(pressure_kind kind) const;
+
+			/**
+			 * @brief memory.current, 0 without the memory controller
+			 */
+			utils::tulong memory_current() const;
+
+			/**
+			 * @brief A counter from memory.events: high, max or oom_kill
+			 */
+			utils::tulong memory_events(std::string_view key) const;
+
+		private:
+			std::filesystem::path m_path;
+			utils::unique_fd m_dir;
+	};
+
+
+	/**
+	 * @brief PSI triggers on a cgroup's cpu, memory and io pressure, delivered through the event loop
+	 *
+	 * The kernel checks the stall against the threshold itself and wakes the trigger's descriptor with
+	 * EPOLLPRI, at most once per window, so nothing here reads the pressure files until one fires
+	 */
+	class pressure_watch
+	{
+		public:
+			typedef std::function<void(pressure_kind kind)> handler;
+
+			static constexpr std::chrono::milliseconds window{ 2000 };
+
+			/**
+			 * @param stall Stall within a window that fires the trigger, clamped to the window
+			 */
+			pressure_watch(event_loop &loop, const std::filesystem::path &cgroup, std::chrono::milliseconds stall, handler on_pressure);
+			~pressure_watch();
+
+			pressure_watch(const pressure_watch &) = delete;
+			pressure_watch &operator=(const pressure_watch &) = delete;
+
+			/**
+			 * @brief How many resources have a trigger, PSI may be compiled out or disabled with psi=0
+			 */
+			size_t armed() const noexcept;
+
+			utils::tulong events(pressure_kind kind) const noexcept { return m_events[static_cast<size_t>(kind)]; }
+
+		private:
+			void on_trigger(pressure_kind kind, utils::tuint events);
+
+			event_loop &m_loop;
+			handler m_handler;
+			std::array<utils::unique_fd, static_cast<size_t>(pressure_kind::count)> m_triggers;
+			std::array<utils::tulong, static_cast<size_t>(pressure_kind::count)> m_events{};
+	};
+
+} // End namespace mcsuper
+
+#endif // H_731946_SRC_CGROUP
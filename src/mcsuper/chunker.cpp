@@ -0,0 +1,79 @@
+#include "chunker.hpp"
+
+#include <array>
+#include <algorithm>
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		/**
+		 * @brief 256 pseudo-random 64-bit values for the gear hash, fixed forever so chunk boundaries stay stable
+		 */
+		constexpr std::array<utils::tulong, 256> make_gear()
+		{
+			std::array<utils::tulong, 256> table{};
+			utils::tulong state = 0x6d637375706572ULL; // "mcsuper"
+
+			for (auto &v : table)
+			{
+				// splitmix64
+				state += 0x9E3779B97F4A7C15ULL;
+				utils::tulong z = state;
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+				v = z ^ (z >> 31);
+			}
+			return table;
+		}
+
+		constexpr std::array<utils::tulong, 256> gear = make_gear();
+
+
+		/**
+		 * @brief A mask of the top `bits` bits, the gear hash's high bits depend on the most recent 64 bytes
+		 */
+		utils::tulong top_bits(int bits)
+		{
+			bits = std::clamp(bits, 1, 63);
+			return ~utils::tulong(0) << (64 - bits);
+		}
+	}
+
+
+	chunker::chunker(chunker_params params) : m_params(params)
+	{
+		int avg_bits = 63 - __builtin_clzll(std::max<size_t>(m_params.avg_size, 2));
+		m_mask_small = top_bits(avg_bits + 2);
+		m_mask_large = top_bits(avg_bits - 2);
+	}
+
+
+	size_t chunker::next(const utils::tuchar *data, size_t len) const noexcept
+	{
+		if (len <= m_params.min_size) return len;
+
+		size_t end = std::min(len, m_params.max_size);
+		size_t normal = std::min(end, m_params.avg_size);
+		utils::tulong hash = 0;
+
+		// Bytes before min_size can never be a cut point, so they're skipped entirely
+		size_t i = m_params.min_size;
+
+		for (; i < normal; i++)
+		{
+			hash = (hash << 1) + gear[data[i]];
+			if ((hash & m_mask_small) == 0) return i + 1;
+		}
+
+		for (; i < end; i++)
+		{
+			hash = (hash << 1) + gear[data[i]];
+			if ((hash & m_mask_large) == 0) return i + 1;
+		}
+
+		return end;
+	}
+
+} // End namespace mcsuper
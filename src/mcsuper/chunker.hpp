@@ -0,0 +1,54 @@
+#pragma once
+#ifndef H_318845_SRC_CHUNKER
+#define H_318845_SRC_CHUNKER 1
+
+#include <cstddef>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Size limits for content-defined chunking
+	 */
+	struct chunker_params
+	{
+		size_t min_size = 16 * 1024;
+		size_t avg_size = 64 * 1024;
+		size_t max_size = 256 * 1024;
+	};
+
+
+	/**
+	 * @brief FastCDC content-defined chunker
+	 *
+	 * Cut points come from a gear rolling hash, so an insertion only moves the boundaries near it and
+	 * the rest of a file still chunks (and dedups) identically. Uses normalised chunking: a stricter mask
+	 * before the average size and a looser one after, which tightens the size distribution around avg_size
+	 */
+	class chunker
+	{
+		public:
+			explicit chunker(chunker_params params = {});
+
+			/**
+			 * @brief Length of the next chunk at the start of data
+			 *
+			 * @param data Remaining bytes of the input
+			 * @param len How many remain, the whole tail is one chunk when it's at most min_size
+			 * @return size_t Bytes in the chunk, always > 0 unless len is 0
+			 */
+			size_t next(const utils::tuchar *data, size_t len) const noexcept;
+
+			const chunker_params &params() const noexcept { return m_params; }
+
+		private:
+			chunker_params m_params;
+			utils::tulong m_mask_small;
+			utils::tulong m_mask_large;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_318845_SRC_CHUNKER
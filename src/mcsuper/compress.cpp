@@ -0,0 +1,429 @@
+#include "compress.hpp"
+
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#ifdef MCSUPER_HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		// zlib can only look this far back, a bigger preset dictionary is wasted
+		constexpr size_t zlib_dict_max = 32 * 1024;
+
+		// Largest zstd window a block may ask for, also the default decoder limit so no frame needs special flags
+		constexpr int zstd_window_log_max = 27;
+
+
+		std::vector<utils::tuchar> zlib_compress(const utils::tuchar *data, size_t len, const compress_params &params)
+		{
+			z_stream zs{};
+			if (deflateInit(&zs, params.level) != Z_OK) throw std::runtime_error("deflateInit failed");
+			std::unique_ptr<z_stream, int (*)(z_stream *)> guard(&zs, deflateEnd);
+
+			if (params.dict && !params.dict->empty())
+			{
+				const auto &dict = params.dict->bytes();
+				deflateSetDictionary(&zs, dict.data(), static_cast<uInt>(dict.size()));
+			}
+
+			std::vector<utils::tuchar> out(deflateBound(&zs, len));
+			zs.next_in = const_cast<utils::tuchar *>(data);
+			zs.avail_in = static_cast<uInt>(len);
+			zs.next_out = out.data();
+			zs.avail_out = static_cast<uInt>(out.size());
+
+			if (deflate(&zs, Z_FINISH) != Z_STREAM_END) throw std::runtime_error("deflate failed");
+			out.resize(zs.total_out);
+			return out;
+		}
+
+
+		void zlib_decompress(const utils::tuchar *src, size_t len, utils::tuchar *dst, size_t raw_len, const compression_dictionary *dict)
+		{
+			z_stream zs{};
+			if (inflateInit(&zs) != Z_OK) throw std::runtime_error("inflateInit failed");
+			std::unique_ptr<z_stream, int (*)(z_stream *)> guard(&zs, inflateEnd);
+
+			zs.next_in = const_cast<utils::tuchar *>(src);
+			zs.avail_in = static_cast<uInt>(len);
+			zs.next_out = dst;
+			zs.avail_out = static_cast<uInt>(raw_len);
+
+			int rc = inflate(&zs, Z_FINISH);
+			if (rc == Z_NEED_DICT && dict && !dict->empty())
+			{
+				inflateSetDictionary(&zs, dict->bytes().data(), static_cast<uInt>(dict->bytes().size()));
+				rc = inflate(&zs, Z_FINISH);
+			}
+			if (rc != Z_STREAM_END || zs.total_out != raw_len) throw std::runtime_error("corrupt zlib block");
+		}
+
+
+#ifdef MCSUPER_HAVE_ZSTD
+		/**
+		 * @brief Contexts are expensive to create and every worker compresses many blocks, so each thread keeps one
+		 */
+		ZSTD_CCtx *thread_cctx()
+		{
+			thread_local std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx *)> cctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+			return cctx.get();
+		}
+
+		ZSTD_DCtx *thread_dctx()
+		{
+			thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx *)> dctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+			return dctx.get();
+		}
+
+
+		void zstd_check(size_t rc, const char *what)
+		{
+			if (ZSTD_isError(rc)) throw std::runtime_error(std::string(what) + ": " + ZSTD_getErrorName(rc));
+		}
+
+
+		std::vector<utils::tuchar> zstd_compress(const utils::tuchar *data, size_t len, const compress_params &params)
+		{
+			ZSTD_CCtx *cctx = thread_cctx();
+			zstd_check(ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters), "ZSTD_CCtx_reset");
+			zstd_check(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, params.level), "ZSTD_c_compressionLevel");
+
+			if (params.long_distance)
+			{
+				// A window covering the whole block, LDM can't see further than that anyway
+				int window = std::clamp(64 - __builtin_clzll(std::max<size_t>(len, 2) - 1), 10, zstd_window_log_max);
+				zstd_check(ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, 1), "ZSTD_c_enableLongDistanceMatching");
+				zstd_check(ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, window), "ZSTD_c_windowLog");
+			}
+
+			if (params.dict && params.dict->compress_handle())
+			{
+				zstd_check(ZSTD_CCtx_refCDict(cctx, static_cast<ZSTD_CDict *>(params.dict->compress_handle())), "ZSTD_CCtx_refCDict");
+			}
+
+			std::vector<utils::tuchar> out(ZSTD_compressBound(len));
+			size_t n = ZSTD_compress2(cctx, out.data(), out.size(), data, len);
+			zstd_check(n, "ZSTD_compress2");
+			out.resize(n);
+			return out;
+		}
+
+
+		void zstd_decompress(const utils::tuchar *src, size_t len, utils::tuchar *dst, size_t raw_len, const compression_dictionary *dict)
+		{
+			ZSTD_DCtx *dctx = thread_dctx();
+			zstd_check(ZSTD_DCtx_reset(dctx, ZSTD_reset_session_and_parameters), "ZSTD_DCtx_reset");
+			if (dict && dict->decompress_handle())
+			{
+				zstd_check(ZSTD_DCtx_refDDict(dctx, static_cast<ZSTD_DDict *>(dict->decompress_handle())), "ZSTD_DCtx_refDDict");
+			}
+
+			size_t n = ZSTD_decompressDCtx(dctx, dst, raw_len, src, len);
+			zstd_check(n, "ZSTD_decompressDCtx");
+			if (n != raw_len) throw std::runtime_error("corrupt zstd block");
+		}
+#endif
+	}
+
+
+	const char *codec_name(codec kind) noexcept
+	{
+		switch (kind)
+		{
+			case codec::zlib: return "zlib";
+			case codec::zstd: return "zstd";
+		}
+		return "unknown";
+	}
+
+
+	bool codec_available(codec kind) noexcept
+	{
+#ifdef MCSUPER_HAVE_ZSTD
+		if (kind == codec::zstd) return true;
+#endif
+		return kind == codec::zlib;
+	}
+
+
+	codec best_codec() noexcept
+	{
+		return codec_available(codec::zstd) ? codec::zstd : codec::zlib;
+	}
+
+
+	int default_level(codec kind) noexcept
+	{
+		// Both land around the same ratio on region data, zstd just gets there several times faster
+		return kind == codec::zstd ? 7 : 6;
+	}
+
+
+	compression_dictionary compression_dictionary::train(codec kind, const std::vector<std::string_view> &samples, size_t capacity, int level)
+	{
+		std::vector<utils::tuchar> bytes;
+
+		if (kind == codec::zlib)
+		{
+			// Later bytes are cheaper to reference, so the samples go in back to front and the first one ends up last
+			capacity = std::min(capacity, zlib_dict_max);
+			size_t per_sample = samples.empty() ? 0 : std::max<size_t>(capacity / samples.size(), 64);
+			for (auto it = samples.rbegin(); it != samples.rend() && bytes.size() < capacity; ++it)
+			{
+				size_t take = std::min({ it->size(), per_sample, capacity - bytes.size() });
+				bytes.insert(bytes.end(), it->data(), it->data() + take);
+			}
+		}
+#ifdef MCSUPER_HAVE_ZSTD
+		else if (kind == codec::zstd)
+		{
+			std::string joined;
+			std::vector<size_t> sizes;
+			for (std::string_view s : samples)
+			{
+				joined.append(s);
+				sizes.push_back(s.size());
+			}
+
+			bytes.resize(capacity);
+			size_t n = ZDICT_trainFromBuffer(bytes.data(), bytes.size(), joined.data(), sizes.data(), static_cast<unsigned>(sizes.size()));
+
+			// Too few or too uniform samples, compressing without a dictionary is the right answer then
+			if (ZDICT_isError(n)) n = 0;
+			bytes.resize(n);
+		}
+#endif
+
+		if (bytes.empty()) return {};
+		return compression_dictionary(kind, std::move(bytes), level);
+	}
+
+
+	compression_dictionary::compression_dictionary(codec kind, std::vector<utils::tuchar> bytes, int level) : m_kind(kind), m_bytes(std::move(bytes))
+	{
+#ifdef MCSUPER_HAVE_ZSTD
+		if (m_kind == codec::zstd && !m_bytes.empty())
+		{
+			m_cdict = ZSTD_createCDict(m_bytes.data(), m_bytes.size(), level);
+			m_ddict = ZSTD_createDDict(m_bytes.data(), m_bytes.size());
+			if (!m_cdict || !m_ddict)
+			{
+				release();
+				throw std::runtime_error("invalid zstd dictionary");
+			}
+		}
+#else
+		(void) level;
+#endif
+	}
+
+
+	compression_dictionary::~compression_dictionary()
+	{
+		release();
+	}
+
+
+	compression_dictionary::compression_dictionary(compression_dictionary &&other) noexcept
+		: m_kind(other.m_kind), m_bytes(std::move(other.m_bytes)), m_cdict(std::exchange(other.m_cdict, nullptr)), m_ddict(std::exchange(other.m_ddict, nullptr))
+	{
+	}
+
+
+	compression_dictionary &compression_dictionary::operator=(compression_dictionary &&other) noexcept
+	{
+		if (this != &other)
+		{
+			release();
+			m_kind = other.m_kind;
+			m_bytes = std::move(other.m_bytes);
+			m_cdict = std::exchange(other.m_cdict, nullptr);
+			m_ddict = std::exchange(other.m_ddict, nullptr);
+		}
+		return *this;
+	}
+
+
+	void compression_dictionary::release() noexcept
+	{
+#ifdef MCSUPER_HAVE_ZSTD
+		ZSTD_freeCDict(static_cast<ZSTD_CDict *>(m_cdict));
+		ZSTD_freeDDict(static_cast<ZSTD_DDict *>(m_ddict));
+#endif
+		m_cdict = nullptr;
+		m_ddict = nullptr;
+	}
+
+
+	std::vector<utils::tuchar> compress(const utils::tuchar *data, size_t len, const compress_params &params)
+	{
+#ifdef MCSUPER_HAVE_ZSTD
+		if (params.kind == codec::zstd) return zstd_compress(data, len, params);
+#endif
+		if (params.kind == codec::zlib) return zlib_compress(data, len, params);
+		throw std::runtime_error(std::string("codec not built in: ") + codec_name(params.kind));
+	}
+
+
+	void decompress(codec kind, const utils::tuchar *src, size_t len, utils::tuchar *dst, size_t raw_len, const compression_dictionary *dict)
+	{
+#ifdef MCSUPER_HAVE_ZSTD
+		if (kind == codec::zstd) return zstd_decompress(src, len, dst, raw_len, dict);
+#endif
+		if (kind == codec::zlib) return zlib_decompress(src, len, dst, raw_len, dict);
+		throw std::runtime_error(std::string("codec not built in: ") + codec_name(kind));
+	}
+
+
+	std::vector<utils::tuchar> inflate_stream(const utils::tuchar *src, size_t len, size_t size_hint)
+	{
+		std::vector<utils::tuchar> out;
+		out.reserve(size_hint);
+		inflate_stream(src, len, out);
+		return out;
+	}
+
+
+	void inflate_stream(const utils::tuchar *src, size_t len, std::vector<utils::tuchar> &out)
+	{
+		// One inflater per thread, reset between streams, saves allocating its 40 KiB of state per chunk
+		struct inflater
+		{
+			z_stream zs{};
+
+			inflater()
+			{
+				// 32 + MAX_WBITS detects the zlib or gzip header by itself
+				if (inflateInit2(&zs, 32 + MAX_WBITS) != Z_OK) throw std::runtime_error("inflateInit2 failed");
+			}
+
+			~inflater()
+			{
+				inflateEnd(&zs);
+			}
+		};
+		thread_local inflater state;
+
+		z_stream &zs = state.zs;
+		inflateReset(&zs);
+
+		out.resize(std::max(out.capacity(), len * 4 + 64));
+		zs.next_in = const_cast<utils::tuchar *>(src);
+		zs.avail_in = static_cast<uInt>(len);
+
+		for (;;)
+		{
+			zs.next_out = out.data() + zs.total_out;
+			zs.avail_out = static_cast<uInt>(out.size() - zs.total_out);
+
+			int rc = inflate(&zs, Z_NO_FLUSH);
+			if (rc == Z_STREAM_END) break;
+			if (rc == Z_BUF_ERROR && zs.avail_in == 0) throw std::runtime_error("truncated zlib stream");
+			if (rc != Z_OK && rc != Z_BUF_ERROR) throw std::runtime_error("corrupt zlib stream");
+			if (zs.avail_out == 0) out.resize(out.size() * 2);
+		}
+
+		out.resize(zs.total_out);
+	}
+
+
+	void lz4_decompress_block(const utils::tuchar *src, size_t len, utils::tuchar *dst, size_t raw_len)
+	{
+		const utils::tuchar *ip = src;
+		const utils::tuchar *iend = src + len;
+		utils::tuchar *op = dst;
+		utils::tuchar *oend = dst + raw_len;
+
+		auto corrupt = []() { throw std::runtime_error("corrupt lz4 block"); };
+
+		// Lengths of 15 continue in following bytes, each 255 means another byte follows
+		auto extend = [&](size_t length) -> size_t
+		{
+			if (length != 15) return length;
+			utils::tuchar b;
+			do
+			{
+				if (ip >= iend) corrupt();
+				b = *ip++;
+				length += b;
+			} while (b == 255);
+			return length;
+		};
+
+		for (;;)
+		{
+			if (ip >= iend) corrupt();
+			utils::tuchar token = *ip++;
+
+			size_t literals = extend(token >> 4);
+			if (literals > size_t(iend - ip) || literals > size_t(oend - op)) corrupt();
+			std::copy(ip, ip + literals, op);
+			ip += literals;
+			op += literals;
+
+			// The last sequence is literals only
+			if (ip == iend) break;
+
+			if (iend - ip < 2) corrupt();
+			size_t offset = ip[0] | ip[1] << 8;
+			ip += 2;
+			if (offset == 0 || offset > size_t(op - dst)) corrupt();
+
+			size_t match = extend(token & 0xF) + 4;
+			if (match > size_t(oend - op)) corrupt();
+
+			const utils::tuchar *from = op - offset;
+			if (offset >= match) std::copy(from, from + match, op);
+			else for (size_t i = 0; i < match; i++) op[i] = from[i]; // Overlapping, repeats the last offset bytes
+			op += match;
+		}
+
+		if (op != oend) corrupt();
+	}
+
+
+	void lz4_decode_stream(const utils::tuchar *src, size_t len, std::vector<utils::tuchar> &out)
+	{
+		static constexpr utils::tuchar magic[8] = { 'L', 'Z', '4', 'B', 'l', 'o', 'c', 'k' };
+		constexpr size_t header = 8 + 1 + 4 + 4 + 4;
+		constexpr utils::tuchar method_raw = 0x10;
+		constexpr utils::tuchar method_lz4 = 0x20;
+
+		auto le32 = [](const utils::tuchar *p) { return static_cast<utils::tuint>(p[0]) | p[1] << 8 | p[2] << 16 | static_cast<utils::tuint>(p[3]) << 24; };
+
+		out.clear();
+		size_t pos = 0;
+		while (pos < len)
+		{
+			if (len - pos < header || !std::equal(magic, magic + 8, src + pos)) throw std::runtime_error("corrupt LZ4Block stream");
+
+			utils::tuchar method = src[pos + 8] & 0xF0;
+			utils::tuint stored = le32(src + pos + 9);
+			utils::tuint raw = le32(src + pos + 13);
+			// +17 is an xxhash32 of the block, not checked, the chunk's NBT has to parse anyway
+			pos += header;
+
+			// finish() writes an empty block as the end marker
+			if (raw == 0) break;
+			if (stored > len - pos) throw std::runtime_error("truncated LZ4Block stream");
+
+			size_t at = out.size();
+			out.resize(at + raw);
+			if (method == method_raw && stored == raw) std::copy(src + pos, src + pos + raw, out.data() + at);
+			else if (method == method_lz4) lz4_decompress_block(src + pos, stored, out.data() + at, raw);
+			else throw std::runtime_error("unknown LZ4Block method");
+			pos += stored;
+		}
+	}
+
+} // End namespace mcsuper
@@ -0,0 +1,131 @@
+#pragma once
+#ifndef H_193752_SRC_COMPRESS
+#define H_193752_SRC_COMPRESS 1
+
+#include <vector>
+#include <string_view>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Block compression formats, the values are stored in archives so never renumber them
+	 */
+	enum class codec : utils::tuchar
+	{
+		zlib = 1,
+		// Only when built against libzstd (MCSUPER_HAVE_ZSTD)
+		zstd = 2
+	};
+
+	const char *codec_name(codec kind) noexcept;
+
+	bool codec_available(codec kind) noexcept;
+
+	/**
+	 * @brief zstd when it was compiled in, zlib otherwise
+	 */
+	codec best_codec() noexcept;
+
+	/**
+	 * @brief A level that's a sensible speed/ratio trade-off for world data in that codec
+	 */
+	int default_level(codec kind) noexcept;
+
+
+	/**
+	 * @brief A dictionary trained on many small, similar inputs and shared by every block compressed with it
+	 *
+	 * For zstd this is a real ZDICT-trained dictionary, digested once per direction. zlib only has preset
+	 * dictionaries of up to 32 KiB, so its "training" just packs in the start of the samples, which is where
+	 * NBT and JSON files repeat their tag names and keys
+	 */
+	class compression_dictionary
+	{
+		public:
+			/**
+			 * @brief Build a dictionary from samples
+			 *
+			 * @param capacity Largest dictionary wanted, zlib caps it at 32 KiB
+			 * @return compression_dictionary Empty if there wasn't enough to learn from
+			 */
+			static compression_dictionary train(codec kind, const std::vector<std::string_view> &samples, size_t capacity, int level);
+
+			/**
+			 * @brief Use a dictionary as stored, e.g. read back from an archive
+			 */
+			compression_dictionary(codec kind, std::vector<utils::tuchar> bytes, int level);
+
+			compression_dictionary() = default;
+			~compression_dictionary();
+
+			compression_dictionary(compression_dictionary &&other) noexcept;
+			compression_dictionary &operator=(compression_dictionary &&other) noexcept;
+
+			bool empty() const noexcept { return m_bytes.empty(); }
+			const std::vector<utils::tuchar> &bytes() const noexcept { return m_bytes; }
+
+			// Digested zstd dictionaries, null for zlib
+			void *compress_handle() const noexcept { return m_cdict; }
+			void *decompress_handle() const noexcept { return m_ddict; }
+
+		private:
+			void release() noexcept;
+
+			codec m_kind = codec::zlib;
+			std::vector<utils::tuchar> m_bytes;
+			void *m_cdict = nullptr;
+			void *m_ddict = nullptr;
+	};
+
+
+	/**
+	 * @brief How to compress one block
+	 */
+	struct compress_params
+	{
+		codec kind = codec::zlib;
+		int level = 6;
+		// zstd long-distance matching, worth it for big blocks where repeats are megabytes apart
+		bool long_distance = false;
+		const compression_dictionary *dict = nullptr;
+	};
+
+
+	/**
+	 * @brief Compress one block into an independent frame, safe to call from many threads at once
+	 */
+	std::vector<utils::tuchar> compress(const utils::tuchar *data, size_t len, const compress_params &params);
+
+	/**
+	 * @brief Decompress a frame made by compress(), which must come out at exactly raw_len bytes
+	 */
+	void decompress(codec kind, const utils::tuchar *src, size_t len, utils::tuchar *dst, size_t raw_len, const compression_dictionary *dict = nullptr);
+
+	/**
+	 * @brief Inflate a zlib or gzip stream of unknown size, as found in .dat files and region chunks
+	 *
+	 * @param size_hint Expected output size, the buffer grows past it as needed
+	 */
+	std::vector<utils::tuchar> inflate_stream(const utils::tuchar *src, size_t len, size_t size_hint = 0);
+
+	/**
+	 * @brief Same, into a buffer whose capacity is reused, for callers decompressing many streams in a row
+	 */
+	void inflate_stream(const utils::tuchar *src, size_t len, std::vector<utils::tuchar> &out);
+
+	/**
+	 * @brief Decode one raw LZ4 block, which must come out at exactly raw_len bytes
+	 */
+	void lz4_decompress_block(const utils::tuchar *src, size_t len, utils::tuchar *dst, size_t raw_len);
+
+	/**
+	 * @brief Decode lz4-java's "LZ4Block" framing, which is what region-file-compression=lz4 writes
+	 */
+	void lz4_decode_stream(const utils::tuchar *src, size_t len, std::vector<utils::tuchar> &out);
+
+} // End namespace mcsuper
+
+#endif // H_193752_SRC_COMPRESS
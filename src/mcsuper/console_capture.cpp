@@ -0,0 +1,514 @@
+#include "console_capture.hpp"
+
+#include <vector>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+using std::cerr, std::endl;
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		// The writer hands ring space back to the reader at least this often
+		constexpr size_t write_chunk = 1 << 20;
+		constexpr size_t read_chunk = 256 << 10;
+		constexpr std::chrono::minutes report_every{ 1 };
+
+
+		/**
+		 * @brief The largest pipe an unprivileged process may ask for
+		 */
+		int pipe_max_size()
+		{
+			std::ifstream in("/proc/sys/fs/pipe-max-size");
+			int size = 0;
+			in >> size;
+			return size;
+		}
+	}
+
+
+	std::optional<console_overflow> parse_console_overflow(std::string_view text) noexcept
+	{
+		if (text == "spill") return console_overflow::spill;
+		if (text == "drop") return console_overflow::drop;
+		return std::nullopt;
+	}
+
+
+	console_capture::console_capture(event_loop &loop, const std::filesystem::path &log_path, size_t ring_size, const console_buffering &buffering, line_handler on_lines)
+		: m_loop(loop), m_log_path(log_path), m_buffering(buffering), m_on_lines(std::move(on_lines)), m_disk(buffering.buffer), m_parse(ring_size), m_ring(ring_size)
+	{
+		if (log_path.has_parent_path()) std::filesystem::create_directories(log_path.parent_path());
+
+		// Seeking rather than O_APPEND keeps the offset ours, a FIFO for a log shipper can't seek and needn't
+		m_log.reset(open(log_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+		if (!m_log) utils::throw_errno("open " + log_path.string());
+		if (lseek(m_log.get(), 0, SEEK_END) < 0 && errno != ESPIPE) utils::throw_errno("lseek");
+
+		if (m_buffering.rotate)
+		{
+			struct stat st;
+			if (fstat(m_log.get(), &st) < 0) utils::throw_errno("fstat " + log_path.string());
+			if (!S_ISREG(st.st_mode))
+			{
+				cerr << "[mcsuper] " << log_path.string() << " isn't a regular file, it won't be rotated" << endl;
+			}
+			else
+			{
+				// Queues what an earlier run left uncompressed before this run adds to it
+				m_compressor.emplace(log_path, m_buffering.segments);
+				m_segment_start = hour_start(std::chrono::system_clock::from_time_t(st.st_mtime));
+				rotate_if_due();
+			}
+		}
+
+		if (m_buffering.overflow == console_overflow::spill)
+		{
+			std::error_code ec;
+			std::filesystem::path dir = m_buffering.spill_dir.empty() ? std::filesystem::temp_directory_path(ec) : m_buffering.spill_dir;
+			m_spill.reset(open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600));
+			if (!m_spill) cerr << "[mcsuper] Can't make a spill file in " << dir.string() << " (" << std::strerror(errno) << "), console overflow will be dropped" << endl;
+			else m_spill_ring.emplace(m_buffering.buffer);
+		}
+
+		m_reader_stop.reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+		m_wake.reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+		if (!m_reader_stop || !m_wake) utils::throw_errno("eventfd");
+
+		m_loop.add(m_wake.get(), EPOLLIN, [this](utils::tuint) { on_wake(); });
+		if (m_buffering.collapse > 0) m_dedup.emplace(m_buffering.collapse);
+		if (m_dedup || m_compressor)
+		{
+			m_expire_timer = m_loop.add_timer(std::chrono::seconds{ 1 }, std::chrono::seconds{ 1 }, [this]()
+			{
+				m_writer_seq.fetch_add(1, std::memory_order_release);
+				m_writer_seq.notify_one();
+			});
+		}
+		m_writer = std::thread([this]() { write_loop(); });
+		if (m_spill_ring) m_spiller = std::thread([this]() { spill_loop(); });
+	}
+
+
+	console_capture::~console_capture()
+	{
+		stop_reader();
+		if (m_expire_timer) m_loop.cancel_timer(*m_expire_timer);
+
+		// The spill thread empties its ring into the file first, so the writer sees all of it
+		if (m_spiller.joinable())
+		{
+			m_spill_stop.store(true, std::memory_order_release);
+			m_spill_seq.fetch_add(1, std::memory_order_release);
+			m_spill_seq.notify_one();
+			m_spiller.join();
+		}
+
+		m_writer_stop.store(true, std::memory_order_release);
+		m_writer_seq.fetch_add(1, std::memory_order_release);
+		m_writer_seq.notify_one();
+		m_writer.join();
+
+		m_loop.remove(m_wake.get());
+	}
+
+
+	void console_capture::attach(int src)
+	{
+		detach();
+
+		// The pipe is all the slack the server has while the reader is descheduled, the default 64 KiB is one burst of a stack trace
+		int want = static_cast<int>(m_buffering.pipe_size);
+		if (fcntl(src, F_SETPIPE_SZ, want) < 0 && errno == EPERM) fcntl(src, F_SETPIPE_SZ, std::min(want, pipe_max_size()));
+		int size = fcntl(src, F_GETPIPE_SZ);
+		m_pipe_size = size > 0 ? static_cast<size_t>(size) : 0;
+
+		m_reader = std::thread([this, src]() { read_loop(src); });
+	}
+
+
+	void console_capture::detach()
+	{
+		if (!m_reader.joinable()) return;
+		stop_reader();
+
+		// Whatever the reader delivered last is parsed before the caller moves on
+		on_wake();
+	}
+
+
+	void console_capture::stop_reader() noexcept
+	{
+		if (!m_reader.joinable()) return;
+
+		// A full counter (EAGAIN) is already readable, so the reader wakes either way
+		utils::tulong one = 1;
+		if (::write(m_reader_stop.get(), &one, sizeof(one)) < 0 && errno != EAGAIN)
+		{
+			cerr << "[mcsuper] Can't wake the console reader (" << std::strerror(errno) << "), waiting for the server's output to close" << endl;
+		}
+		m_reader.join();
+
+		utils::tulong count;
+		while (::read(m_reader_stop.get(), &count, sizeof(count)) > 0) {}
+	}
+
+
+	void console_capture::read_loop(int src)
+	{
+		std::vector<char> buf(read_chunk);
+		pollfd fds[2] = { { src, POLLIN, 0 }, { m_reader_stop.get(), POLLIN, 0 } };
+		bool stopping = false;
+
+		for (;;)
+		{
+			ssize_t n = ::read(src, buf.data(), buf.size());
+			if (n > 0)
+			{
+				deliver(buf.data(), n);
+				continue;
+			}
+			if (n < 0 && errno == EINTR) continue;
+
+			// EOF, a hard error, or the pipe drained after detach() asked us to stop
+			if (n == 0 || errno != EAGAIN || stopping) break;
+
+			if (poll(fds, 2, -1) < 0 && errno != EINTR) break;
+			if (fds[1].revents & POLLIN) stopping = true;
+		}
+	}
+
+
+	void console_capture::deliver(const char *data, size_t len)
+	{
+		m_counters.captured.add(len);
+
+		// Back to the ring only once the spill thread has queued nothing more and the writer has emptied the spill
+		// file, so the log keeps the server's order
+		if (m_spilling && m_spill_ring->writable() == m_spill_ring->capacity()
+			&& m_spill_read.load(std::memory_order_acquire) == m_spill_end.load(std::memory_order_acquire))
+		{
+			m_spilling = false;
+		}
+
+		if (m_spilling || !m_disk.push(data, len)) overflow(data, len);
+		m_writer_seq.fetch_add(1, std::memory_order_release);
+		m_writer_seq.notify_one();
+
+		if (!m_parse.push(data, len))
+		{
+			m_counters.unparsed.add(len);
+		}
+		else if (!m_wake_pending.exchange(true, std::memory_order_acq_rel))
+		{
+			utils::tulong one = 1;
+			if (::write(m_wake.get(), &one, sizeof(one)) < 0) m_wake_pending.store(false, std::memory_order_relaxed);
+		}
+	}
+
+
+	void console_capture::overflow(const char *data, size_t len)
+	{
+		// The file is written by the spill thread, the reader only queues for it
+		if (m_spill_ring && m_spill_ring->push(data, len))
+		{
+			m_spilling = true;
+			m_counters.spilled.add(len);
+			m_spill_seq.fetch_add(1, std::memory_order_release);
+			m_spill_seq.notify_one();
+			return;
+		}
+
+		m_counters.dropped.add(len);
+		m_counters.dropped_lines.add(std::count(data, data + len, '\n'));
+		m_drop_note.fetch_add(len, std::memory_order_relaxed);
+	}
+
+
+	void console_capture::spill_loop()
+	{
+		for (;;)
+		{
+			utils::tuint seq = m_spill_seq.load(std::memory_order_acquire);
+
+			std::string_view pending = m_spill_ring->peek();
+			if (!pending.empty())
+			{
+				size_t len = std::min(pending.size(), write_chunk);
+				utils::tulong end = m_spill_end.load(std::memory_order_relaxed);
+				size_t done = 0;
+				while (done < len)
+				{
+					ssize_t n = pwrite(m_spill.get(), pending.data() + done, len - done, end + done);
+					if (n < 0 && errno == EINTR) continue;
+					if (n <= 0) break;
+					done += n;
+				}
+
+				if (done == len)
+				{
+					m_spill_end.store(end + len, std::memory_order_release);
+				}
+				else
+				{
+					// Full or failing spill disk, what couldn't be parked is lost, a partial write past the end is overwritten next time
+					m_counters.dropped.add(len);
+					m_counters.dropped_lines.add(std::count(pending.data(), pending.data() + len, '\n'));
+					m_drop_note.fetch_add(len, std::memory_order_relaxed);
+				}
+
+				// The end moves before the ring empties, the reader checks them the other way round
+				m_spill_ring->consume(len);
+				m_writer_seq.fetch_add(1, std::memory_order_release);
+				m_writer_seq.notify_one();
+				continue;
+			}
+
+			if (m_spill_stop.load(std::memory_order_acquire)) break;
+			m_spill_seq.wait(seq, std::memory_order_acquire);
+		}
+	}
+
+
+	void console_capture::write_loop()
+	{
+		std::vector<char> buf(write_chunk);
+
+		for (;;)
+		{
+			utils::tuint seq = m_writer_seq.load(std::memory_order_acquire);
+
+			std::string_view pending = m_disk.peek();
+			if (!pending.empty())
+			{
+				size_t n = std::min(pending.size(), write_chunk);
+				persist(pending.data(), n);
+				m_disk.consume(n);
+				continue;
+			}
+
+			utils::tulong end = m_spill_end.load(std::memory_order_acquire);
+			utils::tulong read = m_spill_read.load(std::memory_order_relaxed);
+			if (read < end)
+			{
+				ssize_t n = pread(m_spill.get(), buf.data(), std::min<utils::tulong>(end - read, buf.size()), read);
+				if (n <= 0)
+				{
+					// Spilled but unreadable, which counts as lost
+					m_counters.dropped.add(end - read);
+					m_drop_note.fetch_add(end - read, std::memory_order_relaxed);
+					m_spill_read.store(end, std::memory_order_release);
+					continue;
+				}
+
+				persist(buf.data(), n);
+				// Give the space back, the offsets keep growing but the file stays as small as the backlog
+				fallocate(m_spill.get(), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, read, n);
+				m_spill_read.store(read + n, std::memory_order_release);
+				continue;
+			}
+
+			if (utils::tulong dropped = m_drop_note.exchange(0, std::memory_order_relaxed))
+			{
+				std::string note = "[mcsuper] " + std::to_string(dropped) + " bytes of console output dropped around here, the log couldn't keep up\n";
+				write_log(note.data(), note.size());
+				continue;
+			}
+
+			if (m_dedup)
+			{
+				m_filtered.clear();
+				m_dedup->expire(m_filtered);
+				if (!m_filtered.empty()) write_log(m_filtered.data(), m_filtered.size());
+			}
+			if (m_compressor && m_carry.empty()) rotate_if_due();
+
+			if (m_writer_stop.load(std::memory_order_acquire)) break;
+			m_writer_seq.wait(seq, std::memory_order_acquire);
+		}
+
+		if (m_dedup || m_compressor)
+		{
+			m_filtered.clear();
+			if (m_dedup) m_dedup->finish(m_filtered);
+			m_filtered.append(m_carry);
+			write_log(m_filtered.data(), m_filtered.size());
+		}
+	}
+
+
+	void console_capture::persist(const char *data, size_t len)
+	{
+		if (!m_dedup && !m_compressor)
+		{
+			write_log(data, len);
+			return;
+		}
+
+		m_carry.append(data, len);
+		size_t end = m_carry.rfind('\n');
+		if (end == std::string::npos)
+		{
+			// A line this long isn't spam worth holding for, write it as it comes
+			if (m_carry.size() >= write_chunk)
+			{
+				write_log(m_carry.data(), m_carry.size());
+				m_carry.clear();
+			}
+			return;
+		}
+
+		// Between two lines, the only place a segment may end
+		if (m_compressor) rotate_if_due();
+
+		std::string_view lines = std::string_view(m_carry).substr(0, end + 1);
+		if (m_dedup)
+		{
+			m_filtered.clear();
+			m_dedup->filter(lines, m_filtered);
+			lines = m_filtered;
+		}
+		write_log(lines.data(), lines.size());
+		m_carry.erase(0, end + 1);
+	}
+
+
+	void console_capture::rotate_if_due()
+	{
+		// Called for every write, only the hour's end or a clock step is worth a localtime
+		auto now = std::chrono::system_clock::now();
+		if (now >= m_segment_start && now - m_segment_start < std::chrono::hours{ 1 }) return;
+
+		auto hour = hour_start(now);
+		if (hour != m_segment_start) rotate(hour);
+	}
+
+
+	void console_capture::rotate(std::chrono::system_clock::time_point next)
+	{
+		struct stat st;
+		if (fstat(m_log.get(), &st) == 0 && st.st_size == 0)
+		{
+			// Nothing was written in the hour, no segment for it
+			m_segment_start = next;
+			return;
+		}
+
+		std::filesystem::path segment = segment_path(m_log_path, m_segment_start);
+		std::error_code ec;
+		std::filesystem::rename(m_log_path, segment, ec);
+		if (ec)
+		{
+			cerr << "[mcsuper] Can't rotate " << m_log_path.string() << ": " << ec.message() << endl;
+			m_segment_start = next;
+			return;
+		}
+
+		utils::unique_fd log(open(m_log_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644));
+		if (!log)
+		{
+			// Keep writing to the old file under its new name, better one long segment than a lost hour
+			cerr << "[mcsuper] Can't start a new " << m_log_path.string() << ": " << std::strerror(errno) << endl;
+			std::filesystem::rename(segment, m_log_path, ec);
+			m_segment_start = next;
+			return;
+		}
+
+		m_log = std::move(log);
+		m_compressor->submit(segment, m_segment_start);
+		m_segment_start = next;
+	}
+
+
+	bool console_capture::write_log(const char *data, size_t len)
+	{
+		size_t done = 0;
+		while (done < len)
+		{
+			ssize_t n = ::write(m_log.get(), data + done, len - done);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0)
+			{
+				// Full disk or a dead FIFO reader, retrying would spin, what's left is lost
+				m_counters.dropped.add(len - done);
+				m_counters.written.add(done);
+				return false;
+			}
+			done += n;
+		}
+		m_counters.written.add(len);
+		return true;
+	}
+
+
+	void console_capture::on_wake()
+	{
+		utils::tulong count;
+		while (::read(m_wake.get(), &count, sizeof(count)) > 0) {}
+		m_wake_pending.store(false, std::memory_order_release);
+
+		for (;;)
+		{
+			std::string_view pending = m_parse.peek();
+			if (pending.empty()) break;
+
+			if (m_ring.writable() == 0) dispatch_lines();
+			size_t n = std::min(pending.size(), m_ring.writable());
+			std::memcpy(m_ring.write_ptr(), pending.data(), n);
+			m_ring.commit(n);
+			m_parse.consume(n);
+			dispatch_lines();
+		}
+
+		utils::tulong spilled = m_counters.spilled.get();
+		utils::tulong dropped = m_counters.dropped.get();
+		auto now = std::chrono::steady_clock::now();
+		if (spilled + dropped > m_reported && (!m_reported_at || now - *m_reported_at >= report_every))
+		{
+			m_reported = spilled + dropped;
+			m_reported_at = now;
+			// Notes and repeat summaries in the log count as written, so this can come out a little short
+			utils::tulong done = m_counters.written.get() + dropped + (m_dedup ? m_dedup->collapsed_bytes() : 0), captured = m_counters.captured.get();
+			utils::tulong behind = captured > done ? captured - done : 0;
+			cerr << "[mcsuper] The console log can't keep up with the server, " << behind / 1024 << " KiB behind, " << spilled / 1024
+			     << " KiB spilled and " << dropped / 1024 << " KiB dropped so far" << endl;
+		}
+	}
+
+
+	void console_capture::dispatch_lines()
+	{
+		std::string_view pending = m_ring.data();
+		if (pending.empty()) return;
+
+		const void *last = memrchr(pending.data(), '\n', pending.size());
+		size_t len;
+
+		if (last != nullptr) len = static_cast<const char *>(last) - pending.data() + 1;
+		else if (m_ring.writable() == 0) len = pending.size(); // One line bigger than the ring, pass it on in pieces
+		else return;
+
+		m_on_lines(pending.substr(0, len));
+		m_ring.consume(len);
+	}
+
+
+	void console_capture::flush()
+	{
+		std::string_view pending = m_ring.data();
+		if (pending.empty()) return;
+
+		m_on_lines(pending);
+		m_ring.consume(pending.size());
+	}
+
+} // End namespace mcsuper
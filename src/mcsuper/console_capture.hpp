@@ -0,0 +1,212 @@
+#pragma once
+#ifndef H_902371_SRC_CONSOLE_CAPTURE
+#define H_902371_SRC_CONSOLE_CAPTURE 1
+
+#include <atomic>
+#include <thread>
+#include <optional>
+#include <functional>
+#include <filesystem>
+#include <string_view>
+
+#include "utils.hpp"
+#include "event_loop.hpp"
+#include "ring_buffer.hpp"
+#include "metrics.hpp"
+#include "console_dedup.hpp"
+#include "log_segments.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief What happens to console output the log file can't take as fast as the server writes it
+	 */
+	enum class console_overflow
+	{
+		// Park it in an unlinked temp file and write it to the log once the disk catches up
+		spill,
+		// Throw it away, counted, with a note in the log where the gap is
+		drop
+	};
+
+	std::optional<console_overflow> parse_console_overflow(std::string_view text) noexcept;
+
+
+	/**
+	 * @brief How much slack the console path has before the server could notice a slow log
+	 */
+	struct console_buffering
+	{
+		// Bytes the log writer may fall behind by before the overflow policy applies
+		size_t buffer = 8 << 20;
+		console_overflow overflow = console_overflow::spill;
+		// Where spilled output waits, empty for the system's temp directory
+		std::filesystem::path spill_dir;
+		// Asked of the server's stdout pipe, the kernel caps unprivileged requests at /proc/sys/fs/pipe-max-size
+		size_t pipe_size = 1 << 20;
+		// Lines of one message written to the log per minute before the rest are collapsed into a count, 0 writes every line
+		size_t collapse = 0;
+		// Close the log every hour into a segment compressed in the background, a FIFO is never rotated
+		bool rotate = false;
+		segment_params segments;
+	};
+
+
+	/**
+	 * @brief Where the console's bytes went, in total
+	 */
+	struct console_counters
+	{
+		padded_counter captured;
+		padded_counter written;
+		padded_counter spilled;
+		padded_counter dropped;
+		padded_counter dropped_lines;
+		// Bytes the parser missed because the event loop fell a whole ring behind, the log still has them
+		padded_counter unparsed;
+	};
+
+
+	/**
+	 * @brief Persists the server's stdout and hands complete lines to a parser, without ever making the
+	 * server wait
+	 *
+	 * A dedicated reader thread drains the server's enlarged pipe as soon as anything lands in it and
+	 * copies each read into two lock-free rings: one for a writer thread that appends to the log file, one
+	 * for the event loop, which an eventfd wakes to split lines and parse them. Nothing on the reader's
+	 * path touches the disk or waits on another thread, so log4j's writes always find room in the pipe
+	 * however slow the log's disk is; when the writer falls a whole buffer behind, the overflow policy
+	 * decides what happens to the excess. Spilling goes through a third ring to a spill thread, which
+	 * takes the dirty-page throttling of the spill file's disk in the reader's place. With collapsing on, the writer passes complete lines through a
+	 * console_dedup on their way to the file; the parser always sees every line. With rotation on, the
+	 * writer renames the log at the top of each hour, between two lines, and a segment_compressor takes it
+	 */
+	class console_capture
+	{
+		public:
+			/**
+			 * @brief Called with each newly captured run of bytes, always ending at a line break
+			 * unless a single line overflowed the ring
+			 */
+			typedef std::function<void(std::string_view lines)> line_handler;
+
+			/**
+			 * @brief Open (appending) the log file, set up the rings and start the writer
+			 *
+			 * @param log_path Where to persist the console
+			 * @param ring_size Bytes of console kept in memory for parsing, also the longest line parsed whole
+			 * @param on_lines Receives complete lines, on the event loop
+			 */
+			console_capture(event_loop &loop, const std::filesystem::path &log_path, size_t ring_size, const console_buffering &buffering, line_handler on_lines);
+
+			/**
+			 * @brief Stops the reader without parsing what it read last, then lets the writer finish everything it was given
+			 */
+			~console_capture();
+
+			console_capture(const console_capture &) = delete;
+			console_capture &operator=(const console_capture &) = delete;
+
+			/**
+			 * @brief Start draining a server's stdout, enlarging its pipe first
+			 *
+			 * @param src Read end of the server's stdout, non-blocking
+			 */
+			void attach(int src);
+
+			/**
+			 * @brief Read whatever the pipe still holds, stop the reader and parse what it read
+			 *
+			 * For when the server has exited, something it started may keep the pipe open forever
+			 */
+			void detach();
+
+			/**
+			 * @brief Hand out a trailing partial line, for when the server has exited
+			 */
+			void flush();
+
+			const console_counters &counters() const noexcept { return m_counters; }
+
+			// What the kernel granted for the current pipe
+			size_t pipe_size() const noexcept { return m_pipe_size; }
+
+			// Nothing unless collapsing is on
+			const console_dedup *dedup() const noexcept { return m_dedup ? &*m_dedup : nullptr; }
+			// Nothing unless rotation is on
+			const segment_compressor *segments() const noexcept { return m_compressor ? &*m_compressor : nullptr; }
+
+		private:
+			// Wake the reader and join it, for the destructor as well so it never throws
+			void stop_reader() noexcept;
+			void read_loop(int src);
+			void deliver(const char *data, size_t len);
+			void overflow(const char *data, size_t len);
+			void spill_loop();
+			void write_loop();
+			// Through the dedup stage if there is one, holding a trailing partial line back for it
+			void persist(const char *data, size_t len);
+			bool write_log(const char *data, size_t len);
+			// Hand the log to the compressor if its hour is over
+			void rotate_if_due();
+			void rotate(std::chrono::system_clock::time_point next);
+			void on_wake();
+			void dispatch_lines();
+
+			event_loop &m_loop;
+			std::filesystem::path m_log_path;
+			utils::unique_fd m_log;
+			console_buffering m_buffering;
+			line_handler m_on_lines;
+
+			// Reader to writer, and reader to event loop
+			spsc_ring m_disk;
+			spsc_ring m_parse;
+			// Only touched on the event loop
+			ring_buffer m_ring;
+
+			std::thread m_reader;
+			utils::unique_fd m_reader_stop;
+			size_t m_pipe_size = 0;
+			// Reader to event loop, set while a wakeup is already on its way
+			utils::unique_fd m_wake;
+			std::atomic<bool> m_wake_pending{ false };
+
+			std::thread m_writer;
+			// Bumped by the reader for each delivery, the writer sleeps on it
+			std::atomic<utils::tuint> m_writer_seq{ 0 };
+			std::atomic<bool> m_writer_stop{ false };
+
+			// Output the reader parks while spilling: queued in m_spill_ring, appended to the file by the spill
+			// thread and read back by the writer, positions are file offsets
+			utils::unique_fd m_spill;
+			std::optional<spsc_ring> m_spill_ring;
+			std::thread m_spiller;
+			std::atomic<utils::tuint> m_spill_seq{ 0 };
+			std::atomic<bool> m_spill_stop{ false };
+			bool m_spilling = false;
+			std::atomic<utils::tulong> m_spill_end{ 0 };
+			std::atomic<utils::tulong> m_spill_read{ 0 };
+			// Dropped bytes the writer hasn't put a note about in the log yet
+			std::atomic<utils::tulong> m_drop_note{ 0 };
+
+			// Writer only, but for the dedup's pattern table
+			std::optional<console_dedup> m_dedup;
+			std::string m_carry;
+			std::string m_filtered;
+			// Compresses the hours the writer closes, and the start of the hour it's writing
+			std::optional<segment_compressor> m_compressor;
+			std::chrono::system_clock::time_point m_segment_start;
+			// Wakes the writer to close the dedup's windows and rotate while the console is quiet
+			std::optional<event_loop::timer_id> m_expire_timer;
+
+			console_counters m_counters;
+			// Overflow last mentioned on the console, at most once a minute
+			utils::tulong m_reported = 0;
+			std::optional<std::chrono::steady_clock::time_point> m_reported_at;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_902371_SRC_CONSOLE_CAPTURE
@@ -0,0 +1,225 @@
+#include "console_dedup.hpp"
+
+#include <cctype>
+#include <cstdio>
+#include <algorithm>
+#include <functional>
+
+#include "console_scan.hpp"
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		// Patterns tracked at once, lines of any more pass through untouched
+		constexpr size_t max_entries = 4096;
+		constexpr std::chrono::seconds expire_every{ 1 };
+
+
+		bool is_word(char c) noexcept
+		{
+			return std::isalnum(static_cast<utils::tuchar>(c)) || c == '_';
+		}
+
+
+		void append_time(std::string &out, utils::tsint time)
+		{
+			char buf[16];
+			int n = std::snprintf(buf, sizeof(buf), "%02d:%02d:%02d", time / 3600, time / 60 % 60, time % 60);
+			out.append(buf, n);
+		}
+	}
+
+
+	void mask_line(std::string_view line, std::string &out)
+	{
+		out.clear();
+		if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+
+		// "[HH:MM:SS" and whatever closes it, Paper puts the level inside
+		if (line.size() >= 10 && line[0] == '[' && line[3] == ':' && line[6] == ':')
+		{
+			size_t close = line.find(']');
+			if (close != std::string_view::npos) line.remove_prefix(close + 1 + (close + 1 < line.size() && line[close + 1] == ' '));
+		}
+
+		size_t i = 0;
+		while (i < line.size())
+		{
+			if (!is_word(line[i]))
+			{
+				out += line[i++];
+				continue;
+			}
+
+			size_t end = i;
+			bool digit = false, hex = true;
+			while (end < line.size() && is_word(line[end]))
+			{
+				digit |= std::isdigit(static_cast<utils::tuchar>(line[end])) != 0;
+				hex &= std::isxdigit(static_cast<utils::tuchar>(line[end])) != 0;
+				end++;
+			}
+
+			if (digit && hex)
+			{
+				// A minus belongs to the number unless it joins two words, as in Worker-Main-3
+				if (!out.empty() && out.back() == '-' && (out.size() == 1 || !is_word(out[out.size() - 2]))) out.pop_back();
+				out += '#';
+			}
+			else
+			{
+				out.append(line.substr(i, end - i));
+			}
+			i = end;
+		}
+	}
+
+
+	console_dedup::console_dedup(size_t burst, std::chrono::seconds window) : m_burst(burst), m_window(window), m_next_expire(clock::now() + expire_every)
+	{
+	}
+
+
+	void console_dedup::filter(std::string_view lines, std::string &out)
+	{
+		auto now = clock::now();
+		std::lock_guard lock(m_lock);
+
+		while (!lines.empty())
+		{
+			size_t len = lines.find('\n');
+			len = len == std::string_view::npos ? lines.size() : len + 1;
+			std::string_view line = lines.substr(0, len);
+			lines.remove_prefix(len);
+
+			mask_line(line.substr(0, line.size() - (line.back() == '\n')), m_masked);
+			size_t key = std::hash<std::string_view>{}(m_masked);
+
+			auto it = m_entries.find(key);
+			if (it == m_entries.end())
+			{
+				if (m_entries.size() >= max_entries)
+				{
+					out.append(line);
+					continue;
+				}
+				it = m_entries.emplace(key, entry{}).first;
+				it->second.stats.pattern = m_masked;
+				it->second.window_start = now;
+			}
+
+			entry &e = it->second;
+			if (now - e.window_start >= m_window) close_window(e, now, out);
+
+			e.stats.lines++;
+			if (++e.in_window <= m_burst)
+			{
+				out.append(line);
+				continue;
+			}
+
+			utils::tsint time = parse_line(line.substr(0, line.size() - (line.back() == '\n'))).time;
+			if (e.held++ == 0) e.held_first = time;
+			e.held_last = time;
+			e.example.assign(line);
+			e.stats.collapsed++;
+			m_collapsed_lines.add();
+			m_collapsed_bytes.add(line.size());
+		}
+	}
+
+
+	void console_dedup::close_window(entry &e, clock::time_point now, std::string &out)
+	{
+		if (e.held > 0)
+		{
+			out.append("[mcsuper] Repeated ").append(std::to_string(e.held)).append(e.held == 1 ? " more time" : " more times");
+			if (e.held_first >= 0 && e.held_last >= 0 && e.held_first != e.held_last)
+			{
+				out.append(" between ");
+				append_time(out, e.held_first);
+				out.append(" and ");
+				append_time(out, e.held_last);
+			}
+			else if (e.held_last >= 0)
+			{
+				out.append(" at ");
+				append_time(out, e.held_last);
+			}
+			out.append(", the last one: ").append(e.example);
+			if (out.back() != '\n') out += '\n';
+		}
+
+		e.stats.last_window = e.in_window;
+		e.in_window = 0;
+		e.held = 0;
+		e.held_first = e.held_last = -1;
+		e.example.clear();
+		e.example.shrink_to_fit();
+		e.window_start = now;
+	}
+
+
+	void console_dedup::expire(std::string &out)
+	{
+		auto now = clock::now();
+		std::lock_guard lock(m_lock);
+		if (now < m_next_expire) return;
+		m_next_expire = now + expire_every;
+
+		for (auto &[key, e] : m_entries)
+		{
+			if (now - e.window_start >= m_window) close_window(e, now, out);
+		}
+		sweep(now);
+	}
+
+
+	void console_dedup::finish(std::string &out)
+	{
+		auto now = clock::now();
+		std::lock_guard lock(m_lock);
+		for (auto &[key, e] : m_entries) close_window(e, now, out);
+	}
+
+
+	void console_dedup::sweep(clock::time_point now)
+	{
+		// A pattern that never needed collapsing is forgotten after a quiet window, one that did stays for the metrics
+		std::erase_if(m_entries, [&](const auto &item)
+		{
+			const entry &e = item.second;
+			return e.stats.collapsed == 0 && e.in_window == 0 && now - e.window_start >= m_window;
+		});
+		if (m_entries.size() < max_entries) return;
+
+		// Still full of spam: keep the busier half
+		std::vector<utils::tulong> counts;
+		for (const auto &[key, e] : m_entries) counts.push_back(e.stats.lines);
+		std::nth_element(counts.begin(), counts.begin() + counts.size() / 2, counts.end());
+		utils::tulong cutoff = counts[counts.size() / 2];
+		std::erase_if(m_entries, [&](const auto &item) { return item.second.held == 0 && item.second.stats.lines <= cutoff; });
+	}
+
+
+	std::vector<console_pattern> console_dedup::top(size_t n) const
+	{
+		std::vector<console_pattern> patterns;
+		{
+			std::lock_guard lock(m_lock);
+			for (const auto &[key, e] : m_entries)
+			{
+				if (e.stats.collapsed == 0) continue;
+				patterns.push_back(e.stats);
+				patterns.back().this_window = e.in_window;
+			}
+		}
+
+		std::sort(patterns.begin(), patterns.end(), [](const console_pattern &a, const console_pattern &b) { return a.lines > b.lines; });
+		if (patterns.size() > n) patterns.resize(n);
+		return patterns;
+	}
+
+} // End namespace mcsuper
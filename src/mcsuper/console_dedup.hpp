@@ -0,0 +1,119 @@
+#pragma once
+#ifndef H_547203_SRC_CONSOLE_DEDUP
+#define H_547203_SRC_CONSOLE_DEDUP 1
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <string_view>
+#include <unordered_map>
+
+#include "utils.hpp"
+#include "metrics.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Mask the parts of a console line that vary between repeats of one message
+	 *
+	 * Every run of digits becomes '#', along with a sign in front of it and words that are all hex digits
+	 * with at least one decimal, so timestamps, coordinates, entity ids and UUIDs don't tell two "moved too
+	 * quickly!" lines apart. A leading timestamp is left out of the result
+	 *
+	 * @param out Receives the pattern, cleared first
+	 */
+	void mask_line(std::string_view line, std::string &out);
+
+
+	/**
+	 * @brief One message the console repeats often enough to have been collapsed
+	 */
+	struct console_pattern
+	{
+		// Masked as by mask_line
+		std::string pattern;
+		// Every line matching it, written or not
+		utils::tulong lines = 0;
+		// Lines replaced by a repeat summary
+		utils::tulong collapsed = 0;
+		// Lines in the window so far, and in the one before
+		utils::tulong this_window = 0;
+		utils::tulong last_window = 0;
+	};
+
+
+	/**
+	 * @brief Collapses repeats of the same console message into one summary line per window
+	 *
+	 * Each line is fingerprinted by its mask_line pattern. The first burst lines of a pattern in a window
+	 * pass through unchanged, later ones are held back and counted, and when the window closes a single
+	 * line takes their place: how many there were, between which of their timestamps, and the last one
+	 * verbatim. Used by the log writer only, the pattern table is locked so a scrape can read it
+	 */
+	class console_dedup
+	{
+		public:
+			/**
+			 * @param burst Lines of one pattern written per window before the rest are collapsed
+			 */
+			console_dedup(size_t burst, std::chrono::seconds window = std::chrono::seconds{ 60 });
+
+			/**
+			 * @brief Append what should reach the log of a run of complete lines to out
+			 */
+			void filter(std::string_view lines, std::string &out);
+
+			/**
+			 * @brief Append the summaries of windows that have closed to out, checks at most once a second
+			 */
+			void expire(std::string &out);
+
+			/**
+			 * @brief Append the summaries of every window still holding lines back, for when the log closes
+			 */
+			void finish(std::string &out);
+
+			/**
+			 * @brief The patterns collapsed so far, most frequent first
+			 */
+			std::vector<console_pattern> top(size_t n) const;
+
+			utils::tulong collapsed_lines() const noexcept { return m_collapsed_lines.get(); }
+			utils::tulong collapsed_bytes() const noexcept { return m_collapsed_bytes.get(); }
+
+		private:
+			typedef std::chrono::steady_clock clock;
+
+			struct entry
+			{
+				console_pattern stats;
+				clock::time_point window_start;
+				utils::tulong in_window = 0;
+				// Held back in the current window, with the timestamps of the first and last of them
+				utils::tulong held = 0;
+				utils::tsint held_first = -1;
+				utils::tsint held_last = -1;
+				std::string example;
+			};
+
+			void close_window(entry &e, clock::time_point now, std::string &out);
+			void sweep(clock::time_point now);
+
+			size_t m_burst;
+			std::chrono::seconds m_window;
+
+			mutable std::mutex m_lock;
+			std::unordered_map<size_t, entry> m_entries;
+			clock::time_point m_next_expire;
+			// Reused for every line
+			std::string m_masked;
+
+			padded_counter m_collapsed_lines;
+			padded_counter m_collapsed_bytes;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_547203_SRC_CONSOLE_DEDUP
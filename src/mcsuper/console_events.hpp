@@ -0,0 +1,336 @@
+#pragma once
+#ifndef H_275148_SRC_CONSOLE_EVENTS
+#define H_275148_SRC_CONSOLE_EVENTS 1
+
+#include <array>
+#include <variant>
+#include <charconv>
+#include <string_view>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+namespace events
+{
+	// "Done (12.345s)! For help, type "help""
+	struct server_started
+	{
+		double seconds;
+	};
+
+	// "Can't keep up! Is the server overloaded? Running 2034ms or 40 ticks behind"
+	struct server_overloaded
+	{
+		utils::tulong ms;
+		utils::tulong ticks;
+	};
+
+	// "<name> joined the game"
+	struct player_joined
+	{
+		std::string_view name;
+	};
+
+	// "<name> left the game"
+	struct player_left
+	{
+		std::string_view name;
+	};
+
+	// "Stopping server"
+	struct server_stopping {};
+
+	// "Saved the game", the reply to save-all
+	struct game_saved {};
+
+	// "Automatic saving is now disabled" or "Saving is already turned off", the replies to save-off
+	struct saving_disabled {};
+
+	// "Automatic saving is now enabled" or "Saving is already turned on", the replies to save-on
+	struct saving_enabled {};
+
+
+	/**
+	 * @brief A recognised console message, monostate when nothing matched
+	 *
+	 * Views point into the line that was matched and are only valid as long as it is
+	 */
+	typedef std::variant<
+		std::monostate,
+		server_started,
+		server_overloaded,
+		player_joined,
+		player_left,
+		server_stopping,
+		game_saved,
+		saving_disabled,
+		saving_enabled
+	> console_event;
+
+
+	namespace detail
+	{
+		// Whether a pattern's literal anchors the start or the end of the message
+		enum class anchor : utils::tuchar
+		{
+			prefix,
+			suffix
+		};
+
+		// Turns a message already known to carry the pattern's literal into an event, false rejects it
+		typedef bool (*parser)(std::string_view message, console_event &out);
+
+		struct pattern
+		{
+			anchor where;
+			std::string_view literal;
+			parser parse;
+		};
+
+
+		/**
+		 * @brief Parse an unsigned integer and step past it
+		 */
+		inline bool take_number(std::string_view &s, utils::tulong &out)
+		{
+			auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+			if (ec != std::errc()) return false;
+			s.remove_prefix(end - s.data());
+			return true;
+		}
+
+		/**
+		 * @brief Step past a literal, false if s doesn't start with it
+		 */
+		inline bool take(std::string_view &s, std::string_view literal)
+		{
+			if (!s.starts_with(literal)) return false;
+			s.remove_prefix(literal.size());
+			return true;
+		}
+
+		/**
+		 * @brief Player names are 1-16 characters of [A-Za-z0-9_], which rules out chat or /say spoofing
+		 */
+		constexpr bool is_player_name(std::string_view name)
+		{
+			if (name.empty() || name.size() > 16) return false;
+			for (char c : name)
+			{
+				bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+				if (!ok) return false;
+			}
+			return true;
+		}
+
+
+		inline bool parse_done(std::string_view msg, console_event &out)
+		{
+			msg.remove_prefix(6);
+			double seconds;
+			auto [end, ec] = std::from_chars(msg.data(), msg.data() + msg.size(), seconds);
+			if (ec != std::errc() || end == msg.data() + msg.size() || *end != 's') return false;
+
+			out = server_started{ seconds };
+			return true;
+		}
+
+		inline bool parse_overloaded(std::string_view msg, console_event &out)
+		{
+			size_t at = msg.find("Running ");
+			if (at == std::string_view::npos) return false;
+			msg.remove_prefix(at + 8);
+
+			server_overloaded ev{};
+			if (!take_number(msg, ev.ms) || !take(msg, "ms or ") || !take_number(msg, ev.ticks) || !take(msg, " ticks behind")) return false;
+
+			out = ev;
+			return true;
+		}
+
+		inline bool parse_joined(std::string_view msg, console_event &out)
+		{
+			std::string_view name = msg.substr(0, msg.size() - std::string_view(" joined the game").size());
+			if (!is_player_name(name)) return false;
+
+			out = player_joined{ name };
+			return true;
+		}
+
+		inline bool parse_left(std::string_view msg, console_event &out)
+		{
+			std::string_view name = msg.substr(0, msg.size() - std::string_view(" left the game").size());
+			if (!is_player_name(name)) return false;
+
+			out = player_left{ name };
+			return true;
+		}
+
+		inline bool parse_stopping(std::string_view msg, console_event &out)
+		{
+			if (msg != "Stopping server") return false;
+			out = server_stopping{};
+			return true;
+		}
+
+		inline bool parse_saved(std::string_view msg, console_event &out)
+		{
+			if (msg != "Saved the game") return false;
+			out = game_saved{};
+			return true;
+		}
+
+		inline bool parse_autosave(std::string_view msg, console_event &out)
+		{
+			// Both replies come in a fresh and an already-done flavour that mean the same thing
+			if (msg == "Automatic saving is now disabled" || msg == "Saving is already turned off") out = saving_disabled{};
+			else if (msg == "Automatic saving is now enabled" || msg == "Saving is already turned on") out = saving_enabled{};
+			else return false;
+			return true;
+		}
+
+
+		// Every message the supervisor reacts to, add new ones here and the tables below rebuild themselves
+		inline constexpr pattern patterns[] = {
+			{ anchor::prefix, "Done (",                    parse_done },
+			{ anchor::prefix, "Can't keep up!",            parse_overloaded },
+			{ anchor::prefix, "Stopping server",           parse_stopping },
+			{ anchor::prefix, "Saved the game",            parse_saved },
+			{ anchor::prefix, "Automatic saving is now ",  parse_autosave },
+			{ anchor::prefix, "Saving is already turned ", parse_autosave },
+			{ anchor::suffix, " joined the game",          parse_joined },
+			{ anchor::suffix, " left the game",            parse_left },
+		};
+
+		inline constexpr size_t slots = 32;
+		inline constexpr utils::tuchar empty_slot = 0xFF;
+		static_assert(std::size(patterns) < empty_slot);
+
+
+		/**
+		 * @brief Where to sample the second key byte and how to scatter the key, found by a compile-time search
+		 */
+		struct hash_params
+		{
+			// Distance of the second sampled byte from the anchored end
+			size_t pos;
+			utils::tuint mult;
+		};
+
+		/**
+		 * @brief The two bytes a string is keyed on, its anchored end byte and the one pos bytes in from it
+		 */
+		constexpr utils::tuint key_of(anchor where, std::string_view s, size_t pos)
+		{
+			if (where == anchor::prefix) return static_cast<utils::tuchar>(s[0]) << 8 | static_cast<utils::tuchar>(s[pos]);
+			return static_cast<utils::tuchar>(s[s.size() - 1]) << 8 | static_cast<utils::tuchar>(s[s.size() - 1 - pos]);
+		}
+
+		constexpr size_t slot_of(utils::tuint key, utils::tuint mult)
+		{
+			return (key * mult >> 16) % slots;
+		}
+
+		/**
+		 * @brief Search for a byte position and multiplier that put every pattern with this anchor in its own slot
+		 *
+		 * @return hash_params The parameters, mult is 0 if none were found
+		 */
+		constexpr hash_params find_hash(anchor where)
+		{
+			size_t shortest = ~size_t(0);
+			for (const pattern &p : patterns)
+			{
+				if (p.where == where && p.literal.size() < shortest) shortest = p.literal.size();
+			}
+
+			for (size_t pos = 1; pos < shortest; pos++)
+			{
+				for (utils::tuint mult = 1; mult < 1u << 12; mult += 2)
+				{
+					bool used[slots] = {};
+					bool ok = true;
+
+					for (const pattern &p : patterns)
+					{
+						if (p.where != where) continue;
+
+						size_t slot = slot_of(key_of(where, p.literal, pos), mult);
+						if (used[slot])
+						{
+							ok = false;
+							break;
+						}
+						used[slot] = true;
+					}
+
+					if (ok) return { pos, mult };
+				}
+			}
+			return { 0, 0 };
+		}
+
+		/**
+		 * @brief Build the slot -> pattern index table for one anchor
+		 */
+		constexpr std::array<utils::tuchar, slots> build_table(anchor where, hash_params hash)
+		{
+			std::array<utils::tuchar, slots> table{};
+			table.fill(empty_slot);
+
+			for (size_t i = 0; i < std::size(patterns); i++)
+			{
+				if (patterns[i].where != where) continue;
+				table[slot_of(key_of(where, patterns[i].literal, hash.pos), hash.mult)] = static_cast<utils::tuchar>(i);
+			}
+			return table;
+		}
+
+
+		inline constexpr hash_params prefix_hash = find_hash(anchor::prefix);
+		inline constexpr hash_params suffix_hash = find_hash(anchor::suffix);
+		static_assert(prefix_hash.mult != 0 && suffix_hash.mult != 0, "console event patterns collide, grow detail::slots");
+
+		inline constexpr auto prefix_table = build_table(anchor::prefix, prefix_hash);
+		inline constexpr auto suffix_table = build_table(anchor::suffix, suffix_hash);
+
+
+		/**
+		 * @brief Try the one pattern a message can hash to for an anchor
+		 */
+		inline bool try_anchor(anchor where, std::string_view msg, console_event &out)
+		{
+			const auto &table = where == anchor::prefix ? prefix_table : suffix_table;
+			hash_params hash = where == anchor::prefix ? prefix_hash : suffix_hash;
+			if (msg.size() <= hash.pos) return false;
+
+			utils::tuchar index = table[slot_of(key_of(where, msg, hash.pos), hash.mult)];
+			if (index == empty_slot) return false;
+
+			const pattern &p = patterns[index];
+			bool hit = where == anchor::prefix ? msg.starts_with(p.literal) : msg.ends_with(p.literal);
+			return hit && p.parse(msg, out);
+		}
+	} // End namespace detail
+
+
+	/**
+	 * @brief Recognise a console message (the part after the log prefix)
+	 *
+	 * Two table lookups from compile-time perfect hashes and at most two literal compares per line,
+	 * no regex and nothing allocated
+	 */
+	inline console_event match(std::string_view message)
+	{
+		console_event out;
+		if (detail::try_anchor(detail::anchor::prefix, message, out)) return out;
+		detail::try_anchor(detail::anchor::suffix, message, out);
+		return out;
+	}
+
+} // End namespace events
+} // End namespace mcsuper
+
+#endif // H_275148_SRC_CONSOLE_EVENTS
@@ -0,0 +1,243 @@
+#include "console_scan.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MCSUPER_X86_SIMD 1
+#endif
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		typedef size_t (*newline_finder)(const char *, size_t, size_t *, size_t);
+
+
+		size_t find_newlines_scalar(const char *buf, size_t len, size_t *offsets, size_t max)
+		{
+			size_t found = 0;
+			const char *p = buf;
+			const char *end = buf + len;
+
+			while (found < max)
+			{
+				const void *nl = memchr(p, '\n', end - p);
+				if (nl == nullptr) break;
+
+				offsets[found++] = static_cast<const char *>(nl) - buf;
+				p = static_cast<const char *>(nl) + 1;
+			}
+
+			return found;
+		}
+
+
+#ifdef MCSUPER_X86_SIMD
+		/**
+		 * @brief Turn a bitmask of '\n' positions in a block into offsets
+		 *
+		 * @return bool False once offsets is full
+		 */
+		inline bool emit_mask(utils::tuint mask, size_t base, size_t *offsets, size_t &found, size_t max)
+		{
+			while (mask != 0)
+			{
+				if (found == max) return false;
+				offsets[found++] = base + __builtin_ctz(mask);
+				mask &= mask - 1;
+			}
+			return true;
+		}
+
+
+		__attribute__((target("sse4.2")))
+		size_t find_newlines_sse42(const char *buf, size_t len, size_t *offsets, size_t max)
+		{
+			const __m128i nl = _mm_set1_epi8('\n');
+			size_t found = 0;
+			size_t i = 0;
+
+			for (; i + 16 <= len; i += 16)
+			{
+				__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + i));
+				utils::tuint mask = static_cast<utils::tuint>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, nl)));
+				if (!emit_mask(mask, i, offsets, found, max)) return found;
+			}
+
+			for (; i < len && found < max; i++)
+			{
+				if (buf[i] == '\n') offsets[found++] = i;
+			}
+			return found;
+		}
+
+
+		__attribute__((target("avx2")))
+		size_t find_newlines_avx2(const char *buf, size_t len, size_t *offsets, size_t max)
+		{
+			const __m256i nl = _mm256_set1_epi8('\n');
+			size_t found = 0;
+			size_t i = 0;
+
+			for (; i + 32 <= len; i += 32)
+			{
+				__m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(buf + i));
+				utils::tuint mask = static_cast<utils::tuint>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, nl)));
+				if (!emit_mask(mask, i, offsets, found, max)) return found;
+			}
+
+			// Less than a full vector left, let the narrower scanner finish and rebase its offsets
+			size_t tail = found < max ? find_newlines_sse42(buf + i, len - i, offsets + found, max - found) : 0;
+			for (size_t j = found; j < found + tail; j++) offsets[j] += i;
+			return found + tail;
+		}
+#endif
+
+
+		struct dispatch
+		{
+			newline_finder fn;
+			std::string_view name;
+		};
+
+
+		// Picked once at startup from CPUID
+		const dispatch g_newlines = []() -> dispatch
+		{
+#ifdef MCSUPER_X86_SIMD
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx2")) return { find_newlines_avx2, "avx2" };
+			if (__builtin_cpu_supports("sse4.2")) return { find_newlines_sse42, "sse4.2" };
+#endif
+			return { find_newlines_scalar, "scalar" };
+		}();
+
+
+		inline bool is_digit(char c) noexcept
+		{
+			return c >= '0' && c <= '9';
+		}
+
+
+		inline int two_digits(const char *p) noexcept
+		{
+			return (p[0] - '0') * 10 + (p[1] - '0');
+		}
+
+
+		log_level parse_level(std::string_view name) noexcept
+		{
+			// Every log4j level name is unique by its first letter
+			if (name.empty()) return log_level::unknown;
+			switch (name[0])
+			{
+				case 'T': return name == "TRACE" ? log_level::trace : log_level::unknown;
+				case 'D': return name == "DEBUG" ? log_level::debug : log_level::unknown;
+				case 'I': return name == "INFO"  ? log_level::info  : log_level::unknown;
+				case 'W': return name == "WARN"  ? log_level::warn  : log_level::unknown;
+				case 'E': return name == "ERROR" ? log_level::error : log_level::unknown;
+				case 'F': return name == "FATAL" ? log_level::fatal : log_level::unknown;
+				default:  return log_level::unknown;
+			}
+		}
+	}
+
+
+	std::string_view level_name(log_level level) noexcept
+	{
+		switch (level)
+		{
+			case log_level::trace: return "TRACE";
+			case log_level::debug: return "DEBUG";
+			case log_level::info:  return "INFO";
+			case log_level::warn:  return "WARN";
+			case log_level::error: return "ERROR";
+			case log_level::fatal: return "FATAL";
+			default:               return "UNKNOWN";
+		}
+	}
+
+
+	log_line parse_line(std::string_view text) noexcept
+	{
+		if (!text.empty() && text.back() == '\r') text.remove_suffix(1);
+
+		log_line line;
+		line.text = text;
+		line.message = text;
+
+		// "[HH:MM:SS" is fixed width, check it in one go
+		const char *p = text.data();
+		if (text.size() < 12 || p[0] != '[' || p[3] != ':' || p[6] != ':'
+			|| !is_digit(p[1]) || !is_digit(p[2]) || !is_digit(p[4]) || !is_digit(p[5]) || !is_digit(p[7]) || !is_digit(p[8]))
+		{
+			return line;
+		}
+
+		utils::tsint time = two_digits(p + 1) * 3600 + two_digits(p + 4) * 60 + two_digits(p + 7);
+		std::string_view rest = text.substr(9);
+		std::string_view thread;
+		log_level level = log_level::unknown;
+
+		if (rest.starts_with("] ["))
+		{
+			// Vanilla/Forge: "] [Thread/LEVEL]" then optionally " [logger]"
+			rest.remove_prefix(3);
+			size_t close = rest.find(']');
+			if (close == std::string_view::npos) return line;
+
+			std::string_view tag = rest.substr(0, close);
+			size_t slash = tag.rfind('/');
+			if (slash == std::string_view::npos) return line;
+
+			thread = tag.substr(0, slash);
+			level = parse_level(tag.substr(slash + 1));
+			rest.remove_prefix(close + 1);
+
+			if (rest.starts_with(" ["))
+			{
+				size_t logger_end = rest.find(']');
+				if (logger_end == std::string_view::npos) return line;
+				rest.remove_prefix(logger_end + 1);
+			}
+		}
+		else if (rest.starts_with(' '))
+		{
+			// Paper: " LEVEL]"
+			size_t close = rest.find(']');
+			if (close == std::string_view::npos) return line;
+
+			level = parse_level(rest.substr(1, close - 1));
+			rest.remove_prefix(close + 1);
+		}
+		else
+		{
+			return line;
+		}
+
+		if (rest.starts_with(": ")) rest.remove_prefix(2);
+		else if (rest.starts_with(':')) rest.remove_prefix(1);
+		else return line;
+
+		line.thread = thread;
+		line.level = level;
+		line.time = time;
+		line.message = rest;
+		return line;
+	}
+
+
+	size_t find_newlines(const char *buf, size_t len, size_t *offsets, size_t max) noexcept
+	{
+		return g_newlines.fn(buf, len, offsets, max);
+	}
+
+
+	std::string_view newline_scanner_name() noexcept
+	{
+		return g_newlines.name;
+	}
+
+} // End namespace mcsuper
@@ -0,0 +1,117 @@
+#pragma once
+#ifndef H_617350_SRC_CONSOLE_SCAN
+#define H_617350_SRC_CONSOLE_SCAN 1
+
+#include <cstddef>
+#include <iterator>
+#include <string_view>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief log4j level of a console line
+	 */
+	enum class log_level : utils::tuchar
+	{
+		unknown = 0,
+		trace,
+		debug,
+		info,
+		warn,
+		error,
+		fatal,
+		count
+	};
+
+	/**
+	 * @brief Upper-case name of a level as log4j prints it
+	 */
+	std::string_view level_name(log_level level) noexcept;
+
+
+	/**
+	 * @brief One console line split into the parts of the server's log prefix
+	 *
+	 * Understands the vanilla "[HH:MM:SS] [Thread/LEVEL]: msg" layout, Forge's extra "[logger]" before the colon
+	 * and Paper's "[HH:MM:SS LEVEL]: msg". Lines without a recognised prefix keep everything in message
+	 */
+	struct log_line
+	{
+		// Whole line without the line break
+		std::string_view text;
+		// Empty when the line has no thread (Paper) or no prefix
+		std::string_view thread;
+		std::string_view message;
+		log_level level = log_level::unknown;
+		// Seconds since midnight, or -1 when there is no timestamp
+		utils::tsint time = -1;
+	};
+
+
+	/**
+	 * @brief Parse the prefix of a single line, text should not contain the line break
+	 */
+	log_line parse_line(std::string_view text) noexcept;
+
+
+	/**
+	 * @brief Find up to max line breaks in buf, using the widest SIMD the CPU supports
+	 *
+	 * @param buf Bytes to search
+	 * @param len Length of buf
+	 * @param offsets Receives the offset of each '\n' in ascending order
+	 * @param max Capacity of offsets
+	 * @return size_t Offsets written, a full array means there may be more past the last one
+	 */
+	size_t find_newlines(const char *buf, size_t len, size_t *offsets, size_t max) noexcept;
+
+	/**
+	 * @brief Name of the implementation find_newlines dispatched to, "avx2", "sse4.2" or "scalar"
+	 */
+	std::string_view newline_scanner_name() noexcept;
+
+
+	/**
+	 * @brief Split a buffer into lines and parse each one
+	 *
+	 * A trailing partial line (no '\n') is passed on as well. Line breaks are batch-located with
+	 * find_newlines so the buffer is only walked once by the vector unit and once per prefix
+	 *
+	 * @param buf Console bytes
+	 * @param fn Called with each log_line
+	 */
+	template <typename Fn>
+	void scan_console(std::string_view buf, Fn &&fn)
+	{
+		size_t offsets[256];
+		size_t start = 0;
+
+		while (start < buf.size())
+		{
+			size_t remaining = buf.size() - start;
+			size_t found = find_newlines(buf.data() + start, remaining, offsets, std::size(offsets));
+
+			size_t line_start = start;
+			for (size_t i = 0; i < found; i++)
+			{
+				size_t end = start + offsets[i];
+				fn(parse_line(buf.substr(line_start, end - line_start)));
+				line_start = end + 1;
+			}
+
+			if (found < std::size(offsets))
+			{
+				if (line_start < buf.size()) fn(parse_line(buf.substr(line_start)));
+				return;
+			}
+
+			start = line_start;
+		}
+	}
+
+} // End namespace mcsuper
+
+#endif // H_617350_SRC_CONSOLE_SCAN
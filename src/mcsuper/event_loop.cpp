@@ -0,0 +1,153 @@
+#include "event_loop.hpp"
+
+#include <array>
+
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+
+namespace mcsuper
+{
+	event_loop::event_loop() : m_epoll(epoll_create1(EPOLL_CLOEXEC))
+	{
+		if (!m_epoll) utils::throw_errno("epoll_create1");
+
+		m_wakeup.reset(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+		if (!m_wakeup) utils::throw_errno("eventfd");
+
+		add(m_wakeup.get(), EPOLLIN, [this](utils::tuint)
+		{
+			uint64_t count;
+			while (::read(m_wakeup.get(), &count, sizeof(count)) == sizeof(count)) {}
+
+			std::vector<std::function<void()>> posted;
+			{
+				std::lock_guard lock(m_posted_lock);
+				posted.swap(m_posted);
+			}
+			for (auto &fn : posted) fn();
+		});
+	}
+
+
+	void event_loop::post(std::function<void()> fn)
+	{
+		{
+			std::lock_guard lock(m_posted_lock);
+			m_posted.push_back(std::move(fn));
+		}
+
+		uint64_t one = 1;
+		while (::write(m_wakeup.get(), &one, sizeof(one)) < 0 && errno == EINTR) {}
+	}
+
+
+	void event_loop::add(int fd, utils::tuint events, handler h)
+	{
+		utils::tulong token = m_next_token++;
+
+		epoll_event ev{};
+		ev.events = events;
+		ev.data.u64 = token;
+		if (epoll_ctl(m_epoll.get(), EPOLL_CTL_ADD, fd, &ev) < 0) utils::throw_errno("epoll_ctl(ADD)");
+
+		m_registrations.emplace(token, registration{ fd, std::make_shared<handler>(std::move(h)) });
+		m_tokens[fd] = token;
+	}
+
+
+	void event_loop::modify(int fd, utils::tuint events)
+	{
+		auto it = m_tokens.find(fd);
+		if (it == m_tokens.end()) return;
+
+		epoll_event ev{};
+		ev.events = events;
+		ev.data.u64 = it->second;
+		if (epoll_ctl(m_epoll.get(), EPOLL_CTL_MOD, fd, &ev) < 0) utils::throw_errno("epoll_ctl(MOD)");
+	}
+
+
+	void event_loop::remove(int fd)
+	{
+		auto it = m_tokens.find(fd);
+		if (it == m_tokens.end()) return;
+
+		epoll_ctl(m_epoll.get(), EPOLL_CTL_DEL, fd, nullptr);
+		m_registrations.erase(it->second);
+		m_tokens.erase(it);
+	}
+
+
+	event_loop::timer_id event_loop::add_timer(std::chrono::nanoseconds delay, std::chrono::nanoseconds interval, std::function<void()> fn)
+	{
+		utils::unique_fd tfd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+		if (!tfd) utils::throw_errno("timerfd_create");
+
+		// A zero it_value would disarm the timer, so round up to the smallest delay
+		if (delay <= std::chrono::nanoseconds::zero()) delay = std::chrono::nanoseconds(1);
+
+		itimerspec spec{};
+		spec.it_value.tv_sec  = delay.count() / 1'000'000'000;
+		spec.it_value.tv_nsec = delay.count() % 1'000'000'000;
+		spec.it_interval.tv_sec  = interval.count() / 1'000'000'000;
+		spec.it_interval.tv_nsec = interval.count() % 1'000'000'000;
+		if (timerfd_settime(tfd.get(), 0, &spec, nullptr) < 0) utils::throw_errno("timerfd_settime");
+
+		int fd = tfd.get();
+		timer_id id = m_next_token;
+		bool repeating = interval > std::chrono::nanoseconds::zero();
+
+		add(fd, EPOLLIN, [this, fd, id, repeating, fn = std::move(fn)](utils::tuint)
+		{
+			uint64_t expirations;
+			if (::read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+
+			// Keep the callable alive even if it cancels its own timer
+			auto call = fn;
+			if (!repeating) cancel_timer(id);
+			call();
+		});
+
+		m_timers.emplace(id, std::move(tfd));
+		return id;
+	}
+
+
+	void event_loop::cancel_timer(timer_id id)
+	{
+		auto it = m_timers.find(id);
+		if (it == m_timers.end()) return;
+
+		remove(it->second.get());
+		m_timers.erase(it);
+	}
+
+
+	void event_loop::run()
+	{
+		std::array<epoll_event, 64> events;
+		m_running = true;
+
+		while (m_running)
+		{
+			int n = epoll_wait(m_epoll.get(), events.data(), events.size(), -1);
+			if (n < 0)
+			{
+				if (errno == EINTR) continue;
+				utils::throw_errno("epoll_wait");
+			}
+
+			for (int i = 0; i < n; i++)
+			{
+				auto it = m_registrations.find(events[i].data.u64);
+				if (it == m_registrations.end()) continue;
+
+				// Hold a reference so the handler can safely remove its own registration
+				std::shared_ptr<handler> fn = it->second.fn;
+				(*fn)(events[i].events);
+			}
+		}
+	}
+
+} // End namespace mcsuper
@@ -0,0 +1,110 @@
+#pragma once
+#ifndef H_731204_SRC_EVENT_LOOP
+#define H_731204_SRC_EVENT_LOOP 1
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+#include <sys/epoll.h>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Single-threaded epoll reactor, everything the supervisor waits on goes through one epoll_wait
+	 *
+	 * Handlers may add or remove registrations (including their own) while being dispatched,
+	 * events for a registration removed mid-batch are dropped rather than delivered to a stale handler
+	 */
+	class event_loop
+	{
+		public:
+			typedef std::function<void(utils::tuint events)> handler;
+			typedef utils::tulong timer_id;
+
+			event_loop();
+
+			event_loop(const event_loop &) = delete;
+			event_loop &operator=(const event_loop &) = delete;
+
+			/**
+			 * @brief Start watching a file descriptor, the caller keeps ownership of it
+			 *
+			 * @param fd Descriptor to watch
+			 * @param events EPOLL* event mask
+			 * @param h Called with the ready events
+			 */
+			void add(int fd, utils::tuint events, handler h);
+
+			/**
+			 * @brief Change the event mask of a watched descriptor
+			 */
+			void modify(int fd, utils::tuint events);
+
+			/**
+			 * @brief Stop watching a descriptor, does nothing if it isn't watched
+			 */
+			void remove(int fd);
+
+			/**
+			 * @brief Arm a timerfd which calls fn after a delay
+			 *
+			 * @param delay Time until the first call
+			 * @param interval Time between later calls, zero for a one-shot timer
+			 * @param fn Called once per expiry
+			 * @return timer_id Handle for cancel_timer
+			 */
+			timer_id add_timer(std::chrono::nanoseconds delay, std::chrono::nanoseconds interval, std::function<void()> fn);
+
+			/**
+			 * @brief Disarm and release a timer, does nothing if it already fired (one-shot) or was cancelled
+			 */
+			void cancel_timer(timer_id id);
+
+			/**
+			 * @brief Run fn on the loop thread during its next wakeup, the one method safe to call from other threads
+			 */
+			void post(std::function<void()> fn);
+
+			/**
+			 * @brief Dispatch events until stop() is called
+			 */
+			void run();
+
+			/**
+			 * @brief Make run() return after the current batch of events
+			 */
+			void stop() noexcept { m_running = false; }
+
+		private:
+			struct registration
+			{
+				int fd;
+				std::shared_ptr<handler> fn;
+			};
+
+			utils::unique_fd m_epoll;
+			bool m_running = false;
+
+			// Registrations are keyed by a token stored in epoll_event::data so a reused fd number can't alias
+			utils::tulong m_next_token = 1;
+			std::unordered_map<utils::tulong, registration> m_registrations;
+			std::unordered_map<int, utils::tulong> m_tokens;
+
+			std::unordered_map<timer_id, utils::unique_fd> m_timers;
+
+			// Work handed over from other threads, the eventfd wakes epoll_wait when it's non-empty
+			utils::unique_fd m_wakeup;
+			std::mutex m_posted_lock;
+			std::vector<std::function<void()>> m_posted;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_731204_SRC_EVENT_LOOP
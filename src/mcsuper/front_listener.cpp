@@ -0,0 +1,337 @@
+#include "front_listener.hpp"
+
+#include <memory>
+#include <cstring>
+#include <iostream>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "net.hpp"
+#include "mc_protocol.hpp"
+
+using std::cerr, std::endl;
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		// Handshake, status and login start are tiny, anything bigger isn't a client
+		constexpr size_t max_frame = 1024;
+		constexpr size_t max_buffered = 4096;
+		constexpr size_t max_connections = 64;
+		// Real clients finish a ping in a few round trips
+		constexpr std::chrono::seconds connection_timeout{ 5 };
+		// Status responses carry a base64 favicon, vanilla caps the string at 32767 characters but mods don't
+		constexpr size_t max_status = 1 << 21;
+	}
+
+
+	front_listener::front_listener(event_loop &loop, const std::string &host, utils::tushort port, status_source status, login_handler on_login, std::string kick_message)
+		: m_loop(loop), m_status(std::move(status)), m_on_login(std::move(on_login)), m_kick_message(std::move(kick_message)), m_alive(std::make_shared<bool>(true))
+	{
+		m_listen = listen_tcp(host, port, 64);
+
+		m_loop.add(m_listen.get(), EPOLLIN, [this](utils::tuint) { on_accept(); });
+		m_sweep = m_loop.add_timer(std::chrono::seconds(1), std::chrono::seconds(1), [this]() { sweep(); });
+	}
+
+
+	front_listener::~front_listener()
+	{
+		m_loop.cancel_timer(*m_sweep);
+		for (auto &[fd, conn] : m_conns) m_loop.remove(fd);
+		m_loop.remove(m_listen.get());
+	}
+
+
+	void front_listener::on_accept()
+	{
+		for (;;)
+		{
+			utils::unique_fd sock(accept4(m_listen.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+			if (!sock)
+			{
+				if (errno == EINTR || errno == ECONNABORTED) continue;
+				return;
+			}
+
+			int one = 1;
+			setsockopt(sock.get(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+			if (m_forward)
+			{
+				m_forward(std::move(sock));
+				continue;
+			}
+
+			// Plenty for pings from a server list, a flood just gets closed
+			if (m_conns.size() >= max_connections) continue;
+
+			int fd = sock.get();
+			connection &conn = m_conns[fd];
+			conn.sock = std::move(sock);
+			conn.accepted = std::chrono::steady_clock::now();
+			m_loop.add(fd, EPOLLIN, [this, fd](utils::tuint events) { on_socket(fd, events); });
+		}
+	}
+
+
+	void front_listener::on_socket(int fd, utils::tuint events)
+	{
+		auto it = m_conns.find(fd);
+		if (it == m_conns.end()) return;
+		connection &conn = it->second;
+
+		if (events & EPOLLIN)
+		{
+			char buf[1024];
+			for (;;)
+			{
+				ssize_t n = ::read(fd, buf, sizeof(buf));
+				if (n > 0)
+				{
+					conn.in.append(buf, n);
+					if (conn.in.size() > max_buffered) return drop(fd);
+					continue;
+				}
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0 && errno == EAGAIN) break;
+				return drop(fd);
+			}
+
+			// Pre-1.7 clients open with 0xFE and a different format altogether
+			if (conn.st == state::handshake && !conn.in.empty() && static_cast<utils::tuchar>(conn.in[0]) == 0xFE) return drop(fd);
+
+			size_t pos = 0;
+			while (conn.st != state::closing)
+			{
+				size_t used;
+				std::string_view payload;
+				protocol::parse_status status = protocol::next_frame(std::string_view(conn.in).substr(pos), used, payload, max_frame);
+				if (status == protocol::parse_status::incomplete) break;
+				if (status == protocol::parse_status::malformed || !on_frame(conn, payload)) return drop(fd);
+				pos += used;
+			}
+			conn.in.erase(0, pos);
+		}
+		else if (events & (EPOLLHUP | EPOLLERR))
+		{
+			return drop(fd);
+		}
+
+		if (!flush(conn)) return drop(fd);
+	}
+
+
+	bool front_listener::on_frame(connection &conn, std::string_view payload)
+	{
+		if (conn.st == state::handshake)
+		{
+			protocol::handshake hs;
+			if (!protocol::parse_handshake(payload, hs)) return false;
+			conn.protocol = hs.protocol;
+			conn.st = hs.next == protocol::next_state::status ? state::status : state::login;
+			return true;
+		}
+
+		protocol::reader in(payload);
+		utils::tsint id;
+		if (!in.varint(id)) return false;
+
+		if (conn.st == state::status && id == 0x00)
+		{
+			std::string body;
+			protocol::put_string(body, m_status(conn.protocol));
+			conn.out += protocol::packet(0x00, body);
+			m_pings++;
+			return true;
+		}
+
+		if (conn.st == state::status && id == 0x01)
+		{
+			// Pong echoes the client's payload, the ping time it shows is then our round trip
+			utils::tslong token;
+			if (!in.i64(token)) return false;
+			conn.out += protocol::packet(0x01, payload.substr(payload.size() - 8));
+			conn.st = state::closing;
+			return true;
+		}
+
+		if (conn.st == state::login && id == 0x00)
+		{
+			std::string_view player;
+			if (!in.string(player, 16 * 4)) return false;
+
+			std::string body;
+			protocol::put_string(body, "{\"text\":" + protocol::json_string(m_kick_message) + "}");
+			conn.out += protocol::packet(0x00, body);
+			conn.st = state::closing;
+
+			// Deferred, the handler is likely to tear this listener down to free the port
+			std::weak_ptr<bool> alive = m_alive;
+			m_loop.post([this, alive, name = std::string(player)]()
+			{
+				if (alive.lock()) m_on_login(name);
+			});
+			return true;
+		}
+
+		return false;
+	}
+
+
+	bool front_listener::flush(connection &conn)
+	{
+		while (conn.out_pos < conn.out.size())
+		{
+			ssize_t n = ::send(conn.sock.get(), conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+			if (n > 0)
+			{
+				conn.out_pos += n;
+				continue;
+			}
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0 && errno == EAGAIN)
+			{
+				m_loop.modify(conn.sock.get(), EPOLLIN | EPOLLOUT);
+				return true;
+			}
+			return false;
+		}
+
+		conn.out.clear();
+		conn.out_pos = 0;
+		if (conn.st == state::closing) return false;
+		m_loop.modify(conn.sock.get(), EPOLLIN);
+		return true;
+	}
+
+
+	void front_listener::drop(int fd)
+	{
+		m_loop.remove(fd);
+		m_conns.erase(fd);
+	}
+
+
+	void front_listener::sweep()
+	{
+		auto now = std::chrono::steady_clock::now();
+		for (auto it = m_conns.begin(); it != m_conns.end();)
+		{
+			if (now - it->second.accepted < connection_timeout)
+			{
+				++it;
+				continue;
+			}
+			m_loop.remove(it->first);
+			it = m_conns.erase(it);
+		}
+	}
+
+
+	status_probe::status_probe(event_loop &loop, const std::string &host, utils::tushort port, result_handler done) : m_loop(loop), m_done(std::move(done))
+	{
+		sockaddr_storage addr{};
+		socklen_t len = 0;
+		std::string target = host.empty() ? "127.0.0.1" : host;
+
+		addrinfo hints{};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo *res = nullptr;
+		if (getaddrinfo(target.c_str(), std::to_string(port).c_str(), &hints, &res) != 0 || res == nullptr) throw std::runtime_error("can't resolve " + target);
+		std::memcpy(&addr, res->ai_addr, res->ai_addrlen);
+		len = res->ai_addrlen;
+		freeaddrinfo(res);
+
+		m_sock.reset(socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+		if (!m_sock) utils::throw_errno("socket");
+		if (::connect(m_sock.get(), reinterpret_cast<sockaddr *>(&addr), len) < 0 && errno != EINPROGRESS) utils::throw_errno("connect " + target);
+
+		// Protocol -1 is what clients send when they only want the status
+		std::string hs;
+		protocol::put_varint(hs, -1);
+		protocol::put_string(hs, target);
+		protocol::put_u16(hs, port);
+		protocol::put_varint(hs, static_cast<utils::tsint>(protocol::next_state::status));
+		m_out = protocol::packet(0x00, hs) + protocol::packet(0x00, {});
+
+		m_loop.add(m_sock.get(), EPOLLIN | EPOLLOUT, [this](utils::tuint events) { on_socket(events); });
+		m_timeout = m_loop.add_timer(std::chrono::seconds(5), std::chrono::nanoseconds::zero(), [this]()
+		{
+			m_timeout.reset();
+			finish(std::nullopt);
+		});
+	}
+
+
+	status_probe::~status_probe()
+	{
+		if (m_timeout) m_loop.cancel_timer(*m_timeout);
+		if (m_sock) m_loop.remove(m_sock.get());
+	}
+
+
+	void status_probe::on_socket(utils::tuint events)
+	{
+		if ((events & EPOLLOUT) && !m_out.empty())
+		{
+			ssize_t n = ::send(m_sock.get(), m_out.data(), m_out.size(), MSG_NOSIGNAL);
+			if (n < 0 && errno != EAGAIN && errno != EINTR) return finish(std::nullopt);
+			if (n > 0) m_out.erase(0, n);
+			if (m_out.empty()) m_loop.modify(m_sock.get(), EPOLLIN);
+		}
+
+		if (events & EPOLLIN)
+		{
+			char buf[16384];
+			bool eof = false;
+			for (;;)
+			{
+				ssize_t n = ::read(m_sock.get(), buf, sizeof(buf));
+				if (n > 0)
+				{
+					m_in.append(buf, n);
+					continue;
+				}
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0 && errno == EAGAIN) break;
+
+				// The server may well close right after answering, the reply is still in m_in
+				eof = true;
+				break;
+			}
+
+			size_t used;
+			std::string_view payload;
+			protocol::parse_status status = protocol::next_frame(m_in, used, payload, max_status);
+			if (status == protocol::parse_status::incomplete && !eof) return;
+
+			protocol::reader in(payload);
+			utils::tsint id;
+			std::string_view json;
+			if (status == protocol::parse_status::malformed || !in.varint(id) || id != 0x00 || !in.string(json, max_status)) return finish(std::nullopt);
+			return finish(std::string(json));
+		}
+
+		if (events & (EPOLLHUP | EPOLLERR)) finish(std::nullopt);
+	}
+
+
+	void status_probe::finish(std::optional<std::string> json)
+	{
+		if (m_timeout) m_loop.cancel_timer(*m_timeout);
+		m_timeout.reset();
+		if (m_sock) m_loop.remove(m_sock.get());
+		m_sock.reset();
+
+		// Last thing, the handler may well destroy this probe
+		if (m_done) std::exchange(m_done, {})(std::move(json));
+	}
+
+} // End namespace mcsuper
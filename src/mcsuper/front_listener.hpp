@@ -0,0 +1,142 @@
+#pragma once
+#ifndef H_829514_SRC_FRONT_LISTENER
+#define H_829514_SRC_FRONT_LISTENER 1
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <optional>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+
+#include "utils.hpp"
+#include "event_loop.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Answers on the game port while the server is down
+	 *
+	 * Speaks just enough of the protocol for the multiplayer screen: the handshake, the status request
+	 * (answered from a cached status JSON) and the ping. A login attempt gets a friendly disconnect and
+	 * fires on_login, which is the supervisor's cue to start the server. Everything runs on the event loop,
+	 * connections that don't finish within a few seconds are dropped
+	 */
+	class front_listener
+	{
+		public:
+			/**
+			 * @brief Status JSON to hand out, given the protocol version the client announced
+			 */
+			typedef std::function<std::string(utils::tsint protocol)> status_source;
+
+			/**
+			 * @brief Called with the player's name when someone tries to join
+			 */
+			typedef std::function<void(std::string_view player)> login_handler;
+
+			/**
+			 * @brief Takes over a freshly accepted client socket
+			 */
+			typedef std::function<void(utils::unique_fd client)> forward_handler;
+
+			/**
+			 * @brief Bind and start listening, throws if the port is taken
+			 *
+			 * @param host Address to bind, empty for every interface
+			 * @param kick_message Shown to the joining player, who has to reconnect once the server is up
+			 */
+			front_listener(event_loop &loop, const std::string &host, utils::tushort port, status_source status, login_handler on_login, std::string kick_message);
+			~front_listener();
+
+			front_listener(const front_listener &) = delete;
+			front_listener &operator=(const front_listener &) = delete;
+
+			/**
+			 * @brief Hand new connections to a handler instead of answering them, empty to answer again
+			 *
+			 * Connections already being answered aren't affected
+			 */
+			void forward(forward_handler to) { m_forward = std::move(to); }
+
+			// Status requests answered so far
+			utils::tulong pings() const noexcept { return m_pings; }
+
+		private:
+			enum class state
+			{
+				handshake,
+				status,
+				login,
+				// Reply queued, close once it's written
+				closing
+			};
+
+			struct connection
+			{
+				utils::unique_fd sock;
+				state st = state::handshake;
+				utils::tsint protocol = 0;
+				std::string in;
+				std::string out;
+				size_t out_pos = 0;
+				std::chrono::steady_clock::time_point accepted;
+			};
+
+			void on_accept();
+			void on_socket(int fd, utils::tuint events);
+			// Returns false once the connection should go
+			bool on_frame(connection &conn, std::string_view payload);
+			bool flush(connection &conn);
+			void drop(int fd);
+			void sweep();
+
+			event_loop &m_loop;
+			utils::unique_fd m_listen;
+			status_source m_status;
+			login_handler m_on_login;
+			std::string m_kick_message;
+			forward_handler m_forward;
+
+			std::unordered_map<int, connection> m_conns;
+			std::optional<event_loop::timer_id> m_sweep;
+			utils::tulong m_pings = 0;
+			// Lets a deferred on_login tell whether the listener is still around
+			std::shared_ptr<bool> m_alive;
+	};
+
+
+	/**
+	 * @brief Fetches the status JSON of a running server once, the same way a client's server list does
+	 */
+	class status_probe
+	{
+		public:
+			/**
+			 * @brief Called once, with nothing if the server didn't answer properly within the timeout
+			 */
+			typedef std::function<void(std::optional<std::string> json)> result_handler;
+
+			status_probe(event_loop &loop, const std::string &host, utils::tushort port, result_handler done);
+			~status_probe();
+
+			status_probe(const status_probe &) = delete;
+			status_probe &operator=(const status_probe &) = delete;
+
+		private:
+			void on_socket(utils::tuint events);
+			void finish(std::optional<std::string> json);
+
+			event_loop &m_loop;
+			utils::unique_fd m_sock;
+			std::string m_out;
+			std::string m_in;
+			std::optional<event_loop::timer_id> m_timeout;
+			result_handler m_done;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_829514_SRC_FRONT_LISTENER
@@ -0,0 +1,180 @@
+#include "io_ring.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		int ring_setup(unsigned entries, io_uring_params *params)
+		{
+			return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+		}
+
+
+		int ring_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags)
+		{
+			return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, nullptr, 0));
+		}
+
+
+		/**
+		 * @brief Ring indices are shared with the kernel, the side that doesn't own one reads it with acquire
+		 */
+		unsigned load_acquire(unsigned *p)
+		{
+			return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire);
+		}
+
+
+		void store_release(unsigned *p, unsigned v)
+		{
+			std::atomic_ref<unsigned>(*p).store(v, std::memory_order_release);
+		}
+
+
+		template <typename T>
+		T *at(void *base, utils::tuint offset)
+		{
+			return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+		}
+	}
+
+
+	io_ring::io_ring(unsigned entries)
+	{
+		io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+		m_fd.reset(ring_setup(entries, &params));
+		if (!m_fd) utils::throw_errno("io_uring_setup");
+
+		// IORING_OP_WRITE came with 5.6, the same release as this feature bit
+		if ((params.features & IORING_FEAT_RW_CUR_POS) == 0)
+		{
+			errno = ENOSYS;
+			utils::throw_errno("io_uring_setup");
+		}
+		m_entries = params.sq_entries;
+
+		m_sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (single) m_sq_map_size = m_cq_map_size = std::max(m_sq_map_size, m_cq_map_size);
+
+		m_sq_map = mmap(nullptr, m_sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd.get(), IORING_OFF_SQ_RING);
+		if (m_sq_map == MAP_FAILED)
+		{
+			m_sq_map = nullptr;
+			utils::throw_errno("mmap io_uring");
+		}
+
+		if (single)
+		{
+			m_cq_map = m_sq_map;
+		}
+		else
+		{
+			m_cq_map = mmap(nullptr, m_cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd.get(), IORING_OFF_CQ_RING);
+			if (m_cq_map == MAP_FAILED)
+			{
+				m_cq_map = nullptr;
+				munmap(m_sq_map, m_sq_map_size);
+				utils::throw_errno("mmap io_uring");
+			}
+		}
+
+		m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		void *sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd.get(), IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+		{
+			if (m_cq_map != m_sq_map) munmap(m_cq_map, m_cq_map_size);
+			munmap(m_sq_map, m_sq_map_size);
+			utils::throw_errno("mmap io_uring");
+		}
+		m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+		m_sq_head = at<unsigned>(m_sq_map, params.sq_off.head);
+		m_sq_tail = at<unsigned>(m_sq_map, params.sq_off.tail);
+		m_sq_mask = at<unsigned>(m_sq_map, params.sq_off.ring_mask);
+		m_sq_array = at<unsigned>(m_sq_map, params.sq_off.array);
+		m_cq_head = at<unsigned>(m_cq_map, params.cq_off.head);
+		m_cq_tail = at<unsigned>(m_cq_map, params.cq_off.tail);
+		m_cq_mask = at<unsigned>(m_cq_map, params.cq_off.ring_mask);
+		m_cqes = at<io_uring_cqe>(m_cq_map, params.cq_off.cqes);
+	}
+
+
+	io_ring::~io_ring()
+	{
+		munmap(m_sqes, m_sqes_size);
+		if (m_cq_map != m_sq_map) munmap(m_cq_map, m_cq_map_size);
+		munmap(m_sq_map, m_sq_map_size);
+	}
+
+
+	bool io_ring::queue_write(int fd, const void *data, size_t len, utils::tulong offset, utils::tulong user_data) noexcept
+	{
+		// Only this thread moves the tail, the kernel moves the head as it consumes entries
+		unsigned tail = *m_sq_tail;
+		if (tail - load_acquire(m_sq_head) >= m_entries) return false;
+
+		unsigned index = tail & *m_sq_mask;
+		io_uring_sqe &sqe = m_sqes[index];
+		std::memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_WRITE;
+		sqe.fd = fd;
+		sqe.addr = reinterpret_cast<utils::tulong>(data);
+		sqe.len = static_cast<utils::tuint>(len);
+		sqe.off = offset;
+		sqe.user_data = user_data;
+
+		m_sq_array[index] = index;
+		store_release(m_sq_tail, tail + 1);
+		m_queued++;
+		return true;
+	}
+
+
+	void io_ring::submit()
+	{
+		while (m_queued > 0)
+		{
+			int n = ring_enter(m_fd.get(), m_queued, 0, 0);
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0) utils::throw_errno("io_uring_enter");
+			m_queued -= n;
+			m_inflight += n;
+		}
+	}
+
+
+	io_ring::completion io_ring::wait()
+	{
+		if (pending() == 0) throw std::logic_error("io_ring::wait with nothing in flight");
+		submit();
+
+		for (;;)
+		{
+			unsigned head = *m_cq_head;
+			if (head != load_acquire(m_cq_tail))
+			{
+				const io_uring_cqe &cqe = m_cqes[head & *m_cq_mask];
+				completion done{ cqe.user_data, cqe.res };
+				store_release(m_cq_head, head + 1);
+				m_inflight--;
+				return done;
+			}
+
+			if (ring_enter(m_fd.get(), 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) utils::throw_errno("io_uring_enter");
+		}
+	}
+
+} // End namespace mcsuper
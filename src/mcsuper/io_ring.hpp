@@ -0,0 +1,91 @@
+#pragma once
+#ifndef H_473829_SRC_IO_RING
+#define H_473829_SRC_IO_RING 1
+
+#include <cstddef>
+
+#include "utils.hpp"
+
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief A minimal io_uring for batched file writes, straight on the syscalls without liburing
+	 *
+	 * Writes are queued into the shared submission ring and handed to the kernel in one io_uring_enter, so
+	 * a writer can keep several buffers in flight and go on filling the next one while they land.
+	 * Single-threaded: one owner queues, submits and reaps
+	 */
+	class io_ring
+	{
+		public:
+			struct completion
+			{
+				utils::tulong user_data;
+				// Bytes written, or a negated errno
+				int result;
+			};
+
+			/**
+			 * @brief Set up a ring, throws std::system_error where io_uring is missing, too old for plain
+			 * writes (before 5.6) or blocked by seccomp or kernel.io_uring_disabled, callers fall back to pwrite
+			 */
+			explicit io_ring(unsigned entries);
+			~io_ring();
+
+			io_ring(const io_ring &) = delete;
+			io_ring &operator=(const io_ring &) = delete;
+
+			/**
+			 * @brief Queue a pwrite-like write without submitting it, the buffer has to stay alive until it completes
+			 *
+			 * @return bool False if the submission ring is full
+			 */
+			bool queue_write(int fd, const void *data, size_t len, utils::tulong offset, utils::tulong user_data) noexcept;
+
+			/**
+			 * @brief Hand everything queued to the kernel in one call
+			 */
+			void submit();
+
+			/**
+			 * @brief Submit what's queued and block for the next completion
+			 */
+			completion wait();
+
+			/**
+			 * @brief Writes queued or submitted that haven't been reaped
+			 */
+			unsigned pending() const noexcept { return m_queued + m_inflight; }
+
+		private:
+			utils::unique_fd m_fd;
+			unsigned m_entries = 0;
+
+			void *m_sq_map = nullptr;
+			size_t m_sq_map_size = 0;
+			void *m_cq_map = nullptr;
+			size_t m_cq_map_size = 0;
+			io_uring_sqe *m_sqes = nullptr;
+			size_t m_sqes_size = 0;
+
+			unsigned *m_sq_head = nullptr;
+			unsigned *m_sq_tail = nullptr;
+			unsigned *m_sq_mask = nullptr;
+			unsigned *m_sq_array = nullptr;
+			unsigned *m_cq_head = nullptr;
+			unsigned *m_cq_tail = nullptr;
+			unsigned *m_cq_mask = nullptr;
+			io_uring_cqe *m_cqes = nullptr;
+
+			unsigned m_queued = 0;
+			unsigned m_inflight = 0;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_473829_SRC_IO_RING
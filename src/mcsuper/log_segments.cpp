@@ -0,0 +1,425 @@
+#include "log_segments.hpp"
+
+#include <ctime>
+#include <cctype>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "console_scan.hpp"
+
+using std::cerr, std::endl;
+namespace fs = std::filesystem;
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		constexpr char magic[4] = { 'M', 'C', 'S', 'L' };
+		constexpr utils::tuchar format_version = 1;
+		constexpr size_t header_size = 8;
+		constexpr size_t footer_size = 2 * 8 + 4;
+		constexpr size_t frame_entry_size = 8 + 4 + 4 + 4 + 8 + 8;
+		// A frame is cut short past this, so a flood of long lines still seeks in reasonable steps
+		constexpr size_t max_frame = 4 << 20;
+
+		const char *compressed_extension = ".mclog";
+		// "YYYY-MM-DD-HH" after the log's stem and a dash
+		constexpr size_t hour_length = 13;
+
+
+		void put(std::string &out, utils::tulong v, int bytes)
+		{
+			for (int i = 0; i < bytes; i++) out.push_back(static_cast<char>(v >> (8 * i)));
+		}
+
+
+		/**
+		 * @brief Bounds-checked little-endian reader over the index
+		 */
+		struct cursor
+		{
+			const utils::tuchar *p;
+			const utils::tuchar *end;
+
+			utils::tulong get(int bytes)
+			{
+				if (end - p < bytes) throw std::runtime_error("corrupt segment index");
+				utils::tulong v = 0;
+				for (int i = 0; i < bytes; i++) v |= static_cast<utils::tulong>(p[i]) << (8 * i);
+				p += bytes;
+				return v;
+			}
+		};
+
+
+		void write_all(int fd, const void *data, size_t len, const fs::path &path)
+		{
+			const char *p = static_cast<const char *>(data);
+			while (len > 0)
+			{
+				ssize_t n = ::write(fd, p, len);
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0) utils::throw_errno("write " + path.string());
+				p += n;
+				len -= n;
+			}
+		}
+
+
+		std::tm local_time(std::chrono::system_clock::time_point t)
+		{
+			std::time_t tt = std::chrono::system_clock::to_time_t(t);
+			std::tm tm{};
+			localtime_r(&tt, &tm);
+			return tm;
+		}
+
+
+		fs::path compressed_path(fs::path segment)
+		{
+			return segment.replace_extension(compressed_extension);
+		}
+
+
+		/**
+		 * @brief The hour in a segment's name, nothing if the file isn't a segment of log
+		 */
+		std::optional<std::chrono::system_clock::time_point> segment_hour(const fs::path &log, const fs::path &file)
+		{
+			std::string stem = log.stem().string() + "-";
+			std::string name = file.filename().string();
+			if (file.extension() != log.extension() || !name.starts_with(stem) || name.size() < stem.size() + hour_length) return std::nullopt;
+
+			std::string_view hour = std::string_view(name).substr(stem.size(), hour_length);
+			for (size_t i = 0; i < hour.size(); i++)
+			{
+				bool dash = i == 4 || i == 7 || i == 10;
+				if (dash ? hour[i] != '-' : !std::isdigit(static_cast<utils::tuchar>(hour[i]))) return std::nullopt;
+			}
+
+			std::tm tm{};
+			tm.tm_year = std::stoi(std::string(hour.substr(0, 4))) - 1900;
+			tm.tm_mon = std::stoi(std::string(hour.substr(5, 2))) - 1;
+			tm.tm_mday = std::stoi(std::string(hour.substr(8, 2)));
+			tm.tm_hour = std::stoi(std::string(hour.substr(11, 2)));
+			tm.tm_isdst = -1;
+			std::time_t t = mktime(&tm);
+			if (t < 0) return std::nullopt;
+			return std::chrono::system_clock::from_time_t(t);
+		}
+	}
+
+
+	std::chrono::system_clock::time_point hour_start(std::chrono::system_clock::time_point t)
+	{
+		std::tm tm = local_time(t);
+		std::time_t tt = std::chrono::system_clock::to_time_t(t);
+		return std::chrono::system_clock::from_time_t(tt - tm.tm_min * 60 - tm.tm_sec);
+	}
+
+
+	fs::path segment_path(const fs::path &log, std::chrono::system_clock::time_point hour)
+	{
+		std::tm tm = local_time(hour);
+		char name[32];
+		std::strftime(name, sizeof(name), "-%Y-%m-%d-%H", &tm);
+
+		std::string base = log.stem().string() + name;
+		fs::path path = log.parent_path() / (base + log.extension().string());
+		for (int n = 2; fs::exists(path) || fs::exists(compressed_path(path)); n++)
+		{
+			path = log.parent_path() / (base + "." + std::to_string(n) + log.extension().string());
+		}
+		return path;
+	}
+
+
+	utils::tulong compress_segment(const fs::path &src, const fs::path &dst, std::chrono::system_clock::time_point start, const segment_params &params)
+	{
+		std::ifstream in(src, std::ios::binary);
+		if (!in) throw std::runtime_error("can't open " + src.string());
+
+		fs::path tmp = dst;
+		tmp += ".tmp";
+		utils::unique_fd out(open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+		if (!out) utils::throw_errno("open " + tmp.string());
+
+		try
+		{
+			const char header[header_size] = { magic[0], magic[1], magic[2], magic[3], static_cast<char>(format_version), static_cast<char>(params.kind), 0, 0 };
+			write_all(out.get(), header, sizeof(header), tmp);
+
+			compress_params cp;
+			cp.kind = params.kind;
+			cp.level = params.level != 0 ? params.level : default_level(params.kind);
+
+			// Lines only say the time of day, the segment's hour says which day, and a line past midnight is on the next
+			utils::tslong hour = std::chrono::system_clock::to_time_t(start);
+			std::tm tm = local_time(start);
+			utils::tslong midnight = hour - tm.tm_hour * 3600 - tm.tm_min * 60 - tm.tm_sec;
+			utils::tslong time = hour;
+
+			std::vector<segment_frame> frames;
+			utils::tulong offset = header_size;
+			segment_frame frame;
+			std::string buf;
+
+			auto flush = [&]()
+			{
+				if (buf.empty()) return;
+				std::vector<utils::tuchar> data = compress(reinterpret_cast<const utils::tuchar *>(buf.data()), buf.size(), cp);
+				write_all(out.get(), data.data(), data.size(), tmp);
+				frame.offset = offset;
+				frame.stored = static_cast<utils::tuint>(data.size());
+				frame.raw = static_cast<utils::tuint>(buf.size());
+				frames.push_back(frame);
+				offset += data.size();
+				frame = {};
+				buf.clear();
+			};
+
+			for (std::string line; std::getline(in, line);)
+			{
+				utils::tsint secs = parse_line(line).time;
+				if (secs >= 0)
+				{
+					time = midnight + secs;
+					if (time < hour - 3600) time += 86400;
+				}
+
+				frame.first = frame.lines == 0 ? time : std::min(frame.first, time);
+				frame.last = frame.lines == 0 ? time : std::max(frame.last, time);
+				frame.lines++;
+				buf += line;
+				if (!in.eof()) buf += '\n';
+
+				if (frame.lines >= params.frame_lines || buf.size() >= max_frame) flush();
+			}
+			if (in.bad()) throw std::runtime_error("can't read " + src.string());
+			flush();
+
+			std::string index;
+			put(index, frames.size(), 4);
+			for (const segment_frame &f : frames)
+			{
+				put(index, f.offset, 8);
+				put(index, f.stored, 4);
+				put(index, f.raw, 4);
+				put(index, f.lines, 4);
+				put(index, static_cast<utils::tulong>(f.first), 8);
+				put(index, static_cast<utils::tulong>(f.last), 8);
+			}
+
+			std::string footer;
+			put(footer, offset, 8);
+			put(footer, index.size(), 8);
+			footer.append(magic, sizeof(magic));
+			write_all(out.get(), index.data(), index.size(), tmp);
+			write_all(out.get(), footer.data(), footer.size(), tmp);
+
+			// The segment is deleted right after, its replacement has to survive a crash
+			if (fdatasync(out.get()) < 0) utils::throw_errno("fdatasync " + tmp.string());
+			fs::rename(tmp, dst);
+			return offset + index.size() + footer.size();
+		}
+		catch (...)
+		{
+			std::error_code ec;
+			fs::remove(tmp, ec);
+			throw;
+		}
+	}
+
+
+	segment_reader::segment_reader(const fs::path &path)
+	{
+		utils::unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+		if (!fd) utils::throw_errno("open " + path.string());
+		struct stat st;
+		if (fstat(fd.get(), &st) < 0) utils::throw_errno("fstat " + path.string());
+		m_size = st.st_size;
+		if (m_size < header_size + footer_size) throw std::runtime_error("not an mcsuper log segment: " + path.string());
+
+		void *map = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+		if (map == MAP_FAILED) utils::throw_errno("mmap " + path.string());
+		m_map = static_cast<const utils::tuchar *>(map);
+
+		const utils::tuchar *footer = m_map + m_size - footer_size;
+		if (!std::equal(magic, magic + 4, m_map) || !std::equal(magic, magic + 4, footer + footer_size - 4))
+		{
+			throw std::runtime_error("not an mcsuper log segment: " + path.string());
+		}
+		if (m_map[4] != format_version) throw std::runtime_error("unsupported log segment version in " + path.string());
+
+		m_kind = static_cast<codec>(m_map[5]);
+		if (!codec_available(m_kind)) throw std::runtime_error(path.string() + " needs " + codec_name(m_kind) + ", which isn't built in");
+
+		cursor f{ footer, footer + footer_size - 4 };
+		utils::tulong index_offset = f.get(8);
+		utils::tulong index_len = f.get(8);
+		utils::tulong body_end = m_size - footer_size;
+		// Compared without adding, crafted offsets would wrap a sum back into range
+		if (index_len > body_end || index_offset > body_end - index_len) throw std::runtime_error("corrupt segment footer");
+
+		cursor c{ m_map + index_offset, m_map + index_offset + index_len };
+		utils::tulong count = c.get(4);
+		if (count > index_len / frame_entry_size) throw std::runtime_error("corrupt segment index");
+		for (utils::tulong i = 0; i < count; i++)
+		{
+			segment_frame frame;
+			frame.offset = c.get(8);
+			frame.stored = static_cast<utils::tuint>(c.get(4));
+			frame.raw = static_cast<utils::tuint>(c.get(4));
+			frame.lines = static_cast<utils::tuint>(c.get(4));
+			frame.first = static_cast<utils::tslong>(c.get(8));
+			frame.last = static_cast<utils::tslong>(c.get(8));
+			if (frame.stored > index_offset || frame.offset > index_offset - frame.stored) throw std::runtime_error("corrupt segment frame table");
+			m_frames.push_back(frame);
+		}
+	}
+
+
+	segment_reader::~segment_reader()
+	{
+		if (m_map != nullptr) munmap(const_cast<utils::tuchar *>(m_map), m_size);
+	}
+
+
+	std::string segment_reader::read(const segment_frame &frame) const
+	{
+		std::string out(frame.raw, '\0');
+		decompress(m_kind, m_map + frame.offset, frame.stored, reinterpret_cast<utils::tuchar *>(out.data()), out.size());
+		return out;
+	}
+
+
+	void segment_reader::lines(utils::tslong from, utils::tslong to, const std::function<void(std::string_view line)> &fn) const
+	{
+		bool inside = false;
+		for (const segment_frame &frame : m_frames)
+		{
+			if (frame.last < from || frame.first > to)
+			{
+				inside = false;
+				continue;
+			}
+
+			// Lines only say the time of day, resolved the way compress_segment did against the frame's first line
+			std::tm tm = local_time(std::chrono::system_clock::from_time_t(frame.first));
+			utils::tslong midnight = frame.first - tm.tm_hour * 3600 - tm.tm_min * 60 - tm.tm_sec;
+
+			std::string text = read(frame);
+			scan_console(text, [&](const log_line &line)
+			{
+				if (line.time >= 0)
+				{
+					utils::tslong time = midnight + line.time;
+					if (time < frame.first - 3600) time += 86400;
+					inside = time >= from && time <= to;
+				}
+				if (inside) fn(line.text);
+			});
+		}
+	}
+
+
+	segment_compressor::segment_compressor(const fs::path &log, const segment_params &params) : m_params(params)
+	{
+		std::vector<job> leftover;
+		std::error_code ec;
+		fs::path dir = log.has_parent_path() ? log.parent_path() : fs::path(".");
+		for (const fs::directory_entry &entry : fs::directory_iterator(dir, ec))
+		{
+			if (!entry.is_regular_file(ec)) continue;
+			std::optional<std::chrono::system_clock::time_point> hour = segment_hour(log, entry.path());
+			if (!hour) continue;
+
+			// Compressed already, only the removal failed or was cut short
+			if (fs::exists(compressed_path(entry.path()), ec))
+			{
+				fs::remove(entry.path(), ec);
+				continue;
+			}
+			leftover.push_back({ entry.path(), *hour });
+		}
+		std::sort(leftover.begin(), leftover.end(), [](const job &a, const job &b) { return a.segment < b.segment; });
+		m_queue.assign(leftover.begin(), leftover.end());
+
+		m_thread = std::thread([this]() { run(); });
+	}
+
+
+	segment_compressor::~segment_compressor()
+	{
+		{
+			std::lock_guard lock(m_lock);
+			m_stop = true;
+		}
+		m_cv.notify_one();
+		m_thread.join();
+	}
+
+
+	void segment_compressor::submit(const fs::path &segment, std::chrono::system_clock::time_point start)
+	{
+		{
+			std::lock_guard lock(m_lock);
+			m_queue.push_back({ segment, start });
+		}
+		m_cv.notify_one();
+	}
+
+
+	void segment_compressor::run()
+	{
+		// Nobody waits for an old hour of log, the server and the supervisor's own work come first
+		setpriority(PRIO_PROCESS, gettid(), 19);
+
+		for (;;)
+		{
+			job next;
+			{
+				std::unique_lock lock(m_lock);
+				m_cv.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+				if (m_stop) return;
+				next = std::move(m_queue.front());
+				m_queue.pop_front();
+			}
+
+			std::error_code ec;
+			utils::tulong raw = fs::file_size(next.segment, ec);
+			if (ec) raw = 0;
+
+			utils::tulong stored;
+			try
+			{
+				stored = compress_segment(next.segment, compressed_path(next.segment), next.start, m_params);
+			}
+			catch (const std::exception &e)
+			{
+				// Left as it is, the next run tries again
+				cerr << "[mcsuper] Can't compress " << next.segment.string() << ": " << e.what() << endl;
+				continue;
+			}
+
+			m_segments.add();
+			m_bytes_in.add(raw);
+			m_bytes_out.add(stored);
+
+			// The compressed copy is complete, a plain segment left behind only costs space until the next run removes it
+			if (!fs::remove(next.segment, ec) && ec)
+			{
+				cerr << "[mcsuper] Compressed " << next.segment.string() << " but can't remove it: " << ec.message() << endl;
+			}
+		}
+	}
+
+} // End namespace mcsuper
@@ -0,0 +1,164 @@
+#pragma once
+#ifndef H_270584_SRC_LOG_SEGMENTS
+#define H_270584_SRC_LOG_SEGMENTS 1
+
+#include <mutex>
+#include <deque>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <optional>
+#include <filesystem>
+#include <functional>
+#include <string_view>
+#include <condition_variable>
+
+#include "utils.hpp"
+#include "compress.hpp"
+#include "metrics.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Start of the local hour t falls in
+	 */
+	std::chrono::system_clock::time_point hour_start(std::chrono::system_clock::time_point t);
+
+	/**
+	 * @brief Where the hour of a console log starting at hour goes once it's closed, e.g. logs/console-2024-05-01-13.log
+	 *
+	 * Names that are taken, by either the segment or its compressed form, get a ".2", ".3"... before the extension
+	 */
+	std::filesystem::path segment_path(const std::filesystem::path &log, std::chrono::system_clock::time_point hour);
+
+
+	/**
+	 * @brief How to compress a closed segment
+	 */
+	struct segment_params
+	{
+		codec kind = best_codec();
+		// 0 for the codec's default_level
+		int level = 0;
+		// Lines per frame, the unit of seeking
+		size_t frame_lines = 4096;
+	};
+
+
+	/**
+	 * @brief One independently compressed run of lines in a compressed segment
+	 */
+	struct segment_frame
+	{
+		utils::tulong offset = 0;
+		utils::tuint stored = 0;
+		utils::tuint raw = 0;
+		utils::tuint lines = 0;
+		// Unix times of the first and last line, from their timestamps
+		utils::tslong first = 0;
+		utils::tslong last = 0;
+	};
+
+
+	/**
+	 * @brief Compress a closed segment into frames of frame_lines lines with a time index
+	 *
+	 * Layout:
+	 *   "MCSL" version codec 0 0     8 byte header
+	 *   frames                       one per frame_lines lines, each an independent frame of the codec
+	 *   index                        frame count, then each frame's offset, stored and raw length, lines, first and last time
+	 *   footer                       index offset and length, then "MCSL"
+	 * All integers are little-endian. Written to a temporary file that replaces dst once complete
+	 *
+	 * @param start Start of the hour the segment holds, lines only carry a time of day
+	 * @return utils::tulong Bytes written
+	 */
+	utils::tulong compress_segment(const std::filesystem::path &src, const std::filesystem::path &dst, std::chrono::system_clock::time_point start, const segment_params &params = {});
+
+
+	/**
+	 * @brief Random access to a segment made by compress_segment
+	 */
+	class segment_reader
+	{
+		public:
+			explicit segment_reader(const std::filesystem::path &path);
+			~segment_reader();
+
+			segment_reader(const segment_reader &) = delete;
+			segment_reader &operator=(const segment_reader &) = delete;
+
+			codec kind() const noexcept { return m_kind; }
+			const std::vector<segment_frame> &frames() const noexcept { return m_frames; }
+
+			/**
+			 * @brief Decompress one frame
+			 */
+			std::string read(const segment_frame &frame) const;
+
+			/**
+			 * @brief Hand out the lines stamped from from to to, decompressing only the frames that overlap
+			 *
+			 * A line without a timestamp goes with the one before it
+			 */
+			void lines(utils::tslong from, utils::tslong to, const std::function<void(std::string_view line)> &fn) const;
+
+		private:
+			const utils::tuchar *m_map = nullptr;
+			size_t m_size = 0;
+			codec m_kind = codec::zlib;
+			std::vector<segment_frame> m_frames;
+	};
+
+
+	/**
+	 * @brief Compresses closed segments of a console log one at a time on a low-priority thread
+	 *
+	 * Segments an earlier run left uncompressed, because it stopped or crashed before getting to them, are
+	 * queued when it starts. A segment is only deleted once its compressed form is complete
+	 */
+	class segment_compressor
+	{
+		public:
+			segment_compressor(const std::filesystem::path &log, const segment_params &params);
+
+			/**
+			 * @brief Finishes the segment in hand, anything still queued waits for the next run
+			 */
+			~segment_compressor();
+
+			segment_compressor(const segment_compressor &) = delete;
+			segment_compressor &operator=(const segment_compressor &) = delete;
+
+			void submit(const std::filesystem::path &segment, std::chrono::system_clock::time_point start);
+
+			utils::tulong segments() const noexcept { return m_segments.get(); }
+			utils::tulong bytes_in() const noexcept { return m_bytes_in.get(); }
+			utils::tulong bytes_out() const noexcept { return m_bytes_out.get(); }
+
+		private:
+			struct job
+			{
+				std::filesystem::path segment;
+				std::chrono::system_clock::time_point start;
+			};
+
+			void run();
+
+			segment_params m_params;
+			std::mutex m_lock;
+			std::condition_variable m_cv;
+			std::deque<job> m_queue;
+			bool m_stop = false;
+			std::thread m_thread;
+
+			padded_counter m_segments;
+			padded_counter m_bytes_in;
+			padded_counter m_bytes_out;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_270584_SRC_LOG_SEGMENTS
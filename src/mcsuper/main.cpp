@@ -1,20 +1,503 @@
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <exception>
+#include <atomic>
+#include <algorithm>
+#include <optional>
+#include <limits>
+#include <cstdio>
+#include <ctime>
+#include <charconv>
 
-using std::cout, std::cin, std::endl;
+using std::cout, std::cin, std::cerr, std::endl;
 
 #include "utils.hpp"
+#include "event_loop.hpp"
+#include "supervisor.hpp"
+#include "backup.hpp"
+#include "archive.hpp"
+#include "nbt.hpp"
+#include "region.hpp"
+#include "region_tools.hpp"
+#include "log_segments.hpp"
+
+
+/**
+ * @brief Print command-line usage
+ *
+ * @param prog Name the program was launched as
+ */
+static void print_usage(const char *prog)
+{
+	cout << "Usage: " << prog << " [options] -- <server command...>\n"
+	     << "       " << prog << " backup [--plain] <world dir> <repo dir>\n"
+	     << "       " << prog << " restore <repo dir> <target dir> [snapshot]\n"
+	     << "       " << prog << " snapshots <repo dir>\n"
+	     << "       " << prog << " archive <world dir> <archive file>\n"
+	     << "       " << prog << " extract <archive file> <target dir> [path prefix]\n"
+	     << "       " << prog << " nbt <.dat file> [path, e.g. Data.LevelName]\n"
+	     << "       " << prog << " regions <world dir>\n"
+	     << "       " << prog << " prune [--dry-run] [--min-inhabited <ticks>] <world dir>\n"
+	     << "       " << prog << " compact [--dry-run] <world dir>\n"
+	     << "       " << prog << " log <.mclog segment> [from HH:MM[:SS] [to HH:MM[:SS]]]\n"
+	     << "\n"
+	     << "Options:\n"
+	     << "  --workdir <dir>        Directory to start the server in (default: current)\n"
+	     << "  --stop-timeout <sec>   Seconds to wait after \"stop\" before killing the server (default: 60)\n"
+	     << "  --console-log <path>   Where to persist the server console (default: logs/console.log in workdir)\n"
+	     << "  --console-buffer <sz>  Console output held while the log's disk lags, e.g. 32M (default: 8M)\n"
+	     << "  --console-overflow <p> spill (to a temp file in $TMPDIR) or drop what doesn't fit (default: spill)\n"
+	     << "  --collapse <n>         Write n lines of one message per minute to the console log, collapse the rest into a count\n"
+	     << "  --rotate-log           Start a new console log every hour and compress the old one in the background\n"
+	     << "  --frame-lines <n>      Lines per independently compressed frame of a rotated log (default: 4096)\n"
+	     << "  --backup-repo <dir>    Enable live backups of the running world into this repository (\"!backup\")\n"
+	     << "  --backup-interval <m>  Also back up every m minutes (default: only on request)\n"
+	     << "  --restart <mode>       never, on-failure (crashes and OOM kills) or always (default: on-failure)\n"
+	     << "  --restart-delay <sec>  Backoff for repeated failures, doubled each time up to 5 minutes (default: 5)\n"
+	     << "  --max-restarts <n>     Give up after n failures in a row, 0 for never (default: 10)\n"
+	     << "  --wake-on-join         Keep the server stopped until a player joins, answering server list pings meanwhile\n"
+	     << "  --idle-stop <min>      Save and stop the server after min minutes with nobody online\n"
+	     << "  --listen [host:]port   Take players on this port and proxy them to server-port once the server is ready\n"
+	     << "  --sample-interval <ms> Sample the server's /proc counters this often, keeping an hour for \"!samples\"\n"
+	     << "  --metrics [host:]port  Serve OpenMetrics for Prometheus at http://host:port/metrics\n"
+	     << "  --cgroup               Run the server in a cgroup v2 of its own and react to its CPU, memory and I/O pressure\n"
+	     << "  --memory-high <size>   Throttle and reclaim the server above this much memory, e.g. 6G (implies --cgroup)\n"
+	     << "  --memory-max <size>    Hard memory limit, the OOM killer's line (implies --cgroup)\n"
+	     << "  --cpu-weight <n>       CPU share against the supervisor's other children, 1-10000, default 100 (implies --cgroup)\n"
+	     << "  --io-max <limits>      Limit the workdir's disk, e.g. \"wbps=50M riops=2000\" (implies --cgroup)\n"
+	     << "  --pressure-stall <ms>  Stall per 2s window that counts as pressure (default: 200)\n"
+	     << "  --server-cpus <list>   CPUs the server runs on, as a cpulist such as 2-7\n"
+	     << "  --main-cpus <list>     Pin the server's \"Server thread\" here and keep every other thread off them\n"
+	     << "  --worker-cpus <list>   Pin the server's chunk workers here, away from its other threads and mcsuper's\n"
+	     << "  --numa-node <n>        Prefer memory from NUMA node n and run the server on its CPUs\n"
+	     << "  --help                 Show this message\n"
+	     << "\n"
+	     << "Example:\n"
+	     << "  " << prog << " --workdir /srv/smp -- java -Xmx6G -jar server.jar nogui" << endl;
+}
+
+
+/**
+ * @brief A whole decimal number within [min, max], nothing for anything else
+ */
+static std::optional<utils::tulong> parse_number(std::string_view text, utils::tulong min = 0, utils::tulong max = std::numeric_limits<utils::tuint>::max())
+{
+	utils::tulong value = 0;
+	auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+	if (text.empty() || ec != std::errc() || end != text.data() + text.size() || value < min || value > max) return std::nullopt;
+	return value;
+}
+
+
+/**
+ * @brief Split "[host:]port" into its parts, brackets around an IPv6 host are dropped
+ *
+ * @return bool False if the port isn't a number from 1 to 65535
+ */
+static bool parse_endpoint(std::string_view endpoint, std::string &host, utils::tushort &port)
+{
+	size_t colon = endpoint.rfind(':');
+	if (colon != std::string_view::npos)
+	{
+		std::string_view h = endpoint.substr(0, colon);
+		if (h.starts_with('[') && h.ends_with(']')) h = h.substr(1, h.size() - 2);
+		host = h;
+		endpoint.remove_prefix(colon + 1);
+	}
+
+	std::optional<utils::tulong> n = parse_number(endpoint, 1, 65535);
+	if (!n) return false;
+	port = static_cast<utils::tushort>(*n);
+	return true;
+}
+
+
+/**
+ * @brief Take an incremental snapshot of a world into a backup repository
+ *
+ * @return int An error code
+ */
+static int run_backup(const char *world, const char *repo, bool region_aware)
+{
+	mcsuper::backup_engine engine(repo, region_aware);
+	mcsuper::backup_stats stats = engine.snapshot(world);
+
+	cout << "Snapshot " << stats.snapshot << ": " << stats.files << " files (" << stats.files_unchanged << " unchanged), "
+	     << stats.bytes_scanned / (1024 * 1024) << " MiB read, " << stats.chunks_new << "/" << stats.chunks_total << " chunks new ("
+	     << stats.bytes_new / (1024 * 1024) << " MiB) in " << stats.elapsed.count() << "ms" << endl;
+	if (stats.region_chunks > 0)
+	{
+		cout << "Region chunks: " << stats.region_chunks << " (" << stats.region_chunks_unchanged << " unchanged since the last snapshot)" << endl;
+	}
+	return 0;
+}
+
+
+/**
+ * @brief Compress a world into a seekable archive and report throughput
+ *
+ * @return int An error code
+ */
+static int run_archive(const char *world, const char *file)
+{
+	mcsuper::archive_params params;
+	mcsuper::archive_stats stats = mcsuper::create_archive(world, file, params);
+
+	double seconds = std::max<double>(stats.elapsed.count(), 1) / 1000.0;
+	double mb_per_s = stats.bytes_in / 1e6 / seconds;
+	cout << "Archived " << stats.files << " files, " << stats.bytes_in / (1024 * 1024) << " MiB -> " << stats.bytes_out / (1024 * 1024)
+	     << " MiB (ratio " << (stats.bytes_out > 0 ? double(stats.bytes_in) / stats.bytes_out : 0.0) << ") with " << mcsuper::codec_name(params.kind)
+	     << " in " << stats.elapsed.count() << "ms" << endl;
+	cout << stats.blocks << " blocks on " << stats.threads << " threads: " << mb_per_s << " MB/s, " << mb_per_s / stats.threads << " MB/s per core" << endl;
+	if (stats.dict_bytes > 0) cout << stats.dict_files << " small files compressed with a " << stats.dict_bytes / 1024 << " KiB dictionary" << endl;
+	return 0;
+}
+
+
+/**
+ * @brief Print the lines of a compressed log segment between two times of day
+ *
+ * @return int An error code
+ */
+static int run_log(int argc, char *argv[])
+{
+	mcsuper::segment_reader reader(argv[2]);
+	if (reader.frames().empty()) return 0;
+
+	// "HH:MM[:SS]" on the day the segment starts, a "to" before "from" is on the day after
+	auto parse = [&](std::string_view text) -> std::optional<utils::tslong>
+	{
+		int h = 0, m = 0, s = 0;
+		if (std::sscanf(std::string(text).c_str(), "%d:%d:%d", &h, &m, &s) < 2 || h < 0 || h > 23 || m < 0 || m > 59 || s < 0 || s > 59) return std::nullopt;
+
+		std::time_t first = reader.frames().front().first;
+		std::tm tm{};
+		localtime_r(&first, &tm);
+		return first - tm.tm_hour * 3600 - tm.tm_min * 60 - tm.tm_sec + h * 3600 + m * 60 + s;
+	};
+
+	utils::tslong from = std::numeric_limits<utils::tslong>::min(), to = std::numeric_limits<utils::tslong>::max();
+	if (argc >= 4)
+	{
+		std::optional<utils::tslong> t = parse(argv[3]);
+		if (!t) throw std::runtime_error(std::string("not a time of day: ") + argv[3]);
+		from = *t;
+	}
+	if (argc == 5)
+	{
+		std::optional<utils::tslong> t = parse(argv[4]);
+		if (!t) throw std::runtime_error(std::string("not a time of day: ") + argv[4]);
+		to = *t < from ? *t + 86400 : *t;
+	}
+
+	reader.lines(from, to, [](std::string_view line) { cout << line << '\n'; });
+	cout.flush();
+	return 0;
+}
+
+
+/**
+ * @brief Decompress and parse every chunk of a world, reporting throughput and damage
+ *
+ * @return int An error code, 1 if anything was corrupt
+ */
+static int run_regions(const char *world)
+{
+	std::vector<std::filesystem::path> regions = mcsuper::find_regions(world);
+	std::atomic<utils::tulong> tags{ 0 }, bad_nbt{ 0 };
+
+	mcsuper::region_scan_stats stats = mcsuper::scan_regions(regions, [&](const mcsuper::region_file &region, size_t index, const std::vector<utils::tuchar> &nbt)
+	{
+		thread_local mcsuper::nbt::document doc;
+		try
+		{
+			doc.parse(nbt.data(), nbt.size());
+			tags += doc.tape().size();
+		}
+		catch (const std::exception &e)
+		{
+			bad_nbt++;
+			cerr << "[mcsuper] " << region.path().string() << ": chunk " << region.chunk_x(index) << "," << region.chunk_z(index) << ": " << e.what() << endl;
+		}
+	});
+
+	double seconds = std::max<double>(stats.elapsed.count(), 1) / 1000.0;
+	cout << stats.chunks << " chunks in " << stats.regions << " regions, " << tags << " tags, in " << stats.elapsed.count() << "ms: "
+	     << static_cast<utils::tulong>(stats.chunks / seconds) << " chunks/s, " << stats.bytes_raw / 1e6 / seconds << " MB/s of NBT ("
+	     << stats.bytes_stored / (1024 * 1024) << " MiB stored, " << stats.bytes_raw / (1024 * 1024) << " MiB raw)" << endl;
+	if (stats.corrupt > 0 || bad_nbt > 0) cout << stats.corrupt << " unreadable chunks or regions, " << bad_nbt << " chunks with bad NBT" << endl;
+	return stats.corrupt > 0 || bad_nbt > 0 ? 1 : 0;
+}
+
+
+/**
+ * @brief Drop chunks nobody spent time in from a stopped world, flags come before the world dir
+ *
+ * @return int An error code
+ */
+static int run_prune(int argc, char *argv[])
+{
+	mcsuper::prune_options options;
+	int i = 2;
+	for (; i < argc - 1; i++)
+	{
+		std::string_view arg = argv[i];
+		if (arg == "--dry-run") options.dry_run = true;
+		else if (arg == "--min-inhabited" && i + 2 < argc && parse_number(argv[i + 1], 0, std::numeric_limits<utils::tulong>::max()))
+		{
+			options.min_inhabited = *parse_number(argv[++i], 0, std::numeric_limits<utils::tulong>::max());
+		}
+		else break;
+	}
+	if (i != argc - 1)
+	{
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	mcsuper::prune_stats stats = mcsuper::prune_world(argv[i], options);
+
+	double seconds = std::max<double>(stats.elapsed.count(), 1) / 1000.0;
+	cout << (options.dry_run ? "Would drop " : "Dropped ") << stats.chunks_dropped << " of " << stats.chunks << " chunks (InhabitedTime under "
+	     << options.min_inhabited << " ticks), " << stats.regions_removed << " files removed entirely, "
+	     << (stats.bytes_before - stats.bytes_after) / 1048576.0 << " MiB reclaimed, in " << stats.elapsed.count() << "ms: "
+	     << static_cast<utils::tulong>(stats.chunks / seconds) << " chunks/s" << endl;
+	if (stats.unreadable > 0) cout << stats.unreadable << " unreadable chunks were kept" << endl;
+	return 0;
+}
+
+
+/**
+ * @brief Defragment the region files of a stopped world and report fragmentation before and after
+ *
+ * @return int An error code
+ */
+static int run_compact(const char *world, bool dry_run)
+{
+	mcsuper::compact_options options;
+	options.dry_run = dry_run;
+	mcsuper::compact_stats stats = mcsuper::compact_world(world, options);
+
+	auto unused = [](const mcsuper::region_layout &layout) { return (layout.sectors - layout.sectors_used) * mcsuper::region_file::sector_size / 1048576.0; };
+	cout << (dry_run ? "Would rewrite " : "Rewrote ") << stats.files_rewritten << " of " << stats.files << " region files (" << stats.chunks
+	     << " chunks" << (stats.batched ? ", io_uring" : "") << ") in " << stats.elapsed.count() << "ms: " << stats.bytes_before / 1048576.0
+	     << " MiB -> " << stats.bytes_after / 1048576.0 << " MiB" << endl;
+	cout << "Before: " << stats.before.holes << " holes, " << unused(stats.before) << " MiB unused, " << stats.before.seeks << " seeks in Z-order" << endl;
+	cout << "After:  " << stats.after.holes << " holes, " << unused(stats.after) << " MiB unused, " << stats.after.seeks << " seeks in Z-order" << endl;
+	return 0;
+}
 
 
 /**
  * @brief Called when the program is launched
- * 
+ *
  * @param argc Count of command-line arguments
  * @param argv Args, zero is the name of the program
  * @return int An error code
  */
 int main(int argc, char *argv[])
 {
-	cout << "Hello, world!! I'm mcsmp-supervisor :)" << endl;
-	
-	return 0;
-}
\ No newline at end of file
+	// Offline tools, run instead of the supervisor
+	std::string_view tool = argc > 1 ? argv[1] : "";
+	try
+	{
+		if (tool == "backup" && argc == 4) return run_backup(argv[2], argv[3], true);
+		if (tool == "backup" && argc == 5 && std::string_view(argv[2]) == "--plain") return run_backup(argv[3], argv[4], false);
+		if (tool == "restore" && (argc == 4 || argc == 5))
+		{
+			mcsuper::backup_engine(argv[2]).restore(argc == 5 ? argv[4] : "", argv[3]);
+			return 0;
+		}
+		if (tool == "archive" && argc == 4) return run_archive(argv[2], argv[3]);
+		if (tool == "extract" && (argc == 4 || argc == 5))
+		{
+			mcsuper::archive_reader reader(argv[2]);
+			utils::tulong entries = reader.extract(argv[3], argc == 5 ? argv[4] : "");
+			cout << "Extracted " << entries << " entries" << endl;
+			return 0;
+		}
+		if (tool == "regions" && argc == 3) return run_regions(argv[2]);
+		if (tool == "log" && argc >= 3 && argc <= 5) return run_log(argc, argv);
+		if (tool == "prune" && argc >= 3) return run_prune(argc, argv);
+		if (tool == "compact" && argc == 3) return run_compact(argv[2], false);
+		if (tool == "compact" && argc == 4 && std::string_view(argv[2]) == "--dry-run") return run_compact(argv[3], true);
+		if (tool == "nbt" && (argc == 3 || argc == 4))
+		{
+			mcsuper::nbt::document doc = mcsuper::nbt::read_file(argv[2]);
+			mcsuper::nbt::value v = argc == 4 ? doc.root().path(argv[3]) : doc.root();
+			if (!v)
+			{
+				cerr << "No " << argv[3] << " in " << argv[2] << endl;
+				return 1;
+			}
+			cout << mcsuper::nbt::to_string(v) << endl;
+			return 0;
+		}
+		if (tool == "snapshots" && argc == 3)
+		{
+			for (const std::string &name : mcsuper::backup_engine(argv[2]).snapshots()) cout << name << endl;
+			return 0;
+		}
+	}
+	catch (const std::exception &e)
+	{
+		cerr << "[mcsuper] " << tool << " failed: " << e.what() << endl;
+		return 1;
+	}
+
+	mcsuper::supervisor_config config;
+	auto limits = [&config]() -> mcsuper::cgroup_limits & { return config.cgroup ? *config.cgroup : config.cgroup.emplace(); };
+
+	int i = 1;
+	for (; i < argc; i++)
+	{
+		std::string_view arg = argv[i];
+
+		if (arg == "--")
+		{
+			i++;
+			break;
+		}
+		else if (arg == "--help" || arg == "-h")
+		{
+			print_usage(argv[0]);
+			return 0;
+		}
+		else if (arg == "--workdir" && i + 1 < argc)
+		{
+			config.server.workdir = argv[++i];
+		}
+		else if (arg == "--stop-timeout" && i + 1 < argc && parse_number(argv[i + 1]))
+		{
+			config.stop_timeout = std::chrono::seconds(*parse_number(argv[++i]));
+		}
+		else if (arg == "--console-log" && i + 1 < argc)
+		{
+			config.console_log = argv[++i];
+		}
+		else if (arg == "--console-buffer" && i + 1 < argc && mcsuper::parse_size(argv[i + 1]))
+		{
+			config.console.buffer = *mcsuper::parse_size(argv[++i]);
+		}
+		else if (arg == "--console-overflow" && i + 1 < argc && mcsuper::parse_console_overflow(argv[i + 1]))
+		{
+			config.console.overflow = *mcsuper::parse_console_overflow(argv[++i]);
+		}
+		else if (arg == "--collapse" && i + 1 < argc && parse_number(argv[i + 1]))
+		{
+			config.console.collapse = *parse_number(argv[++i]);
+		}
+		else if (arg == "--rotate-log")
+		{
+			config.console.rotate = true;
+		}
+		else if (arg == "--frame-lines" && i + 1 < argc && parse_number(argv[i + 1], 1))
+		{
+			config.console.segments.frame_lines = *parse_number(argv[++i], 1);
+		}
+		else if (arg == "--backup-repo" && i + 1 < argc)
+		{
+			config.backup_repo = argv[++i];
+		}
+		else if (arg == "--backup-interval" && i + 1 < argc && parse_number(argv[i + 1]))
+		{
+			config.backup_interval = std::chrono::minutes(*parse_number(argv[++i]));
+		}
+		else if (arg == "--restart" && i + 1 < argc && mcsuper::parse_restart_mode(argv[i + 1]))
+		{
+			config.restart.mode = *mcsuper::parse_restart_mode(argv[++i]);
+		}
+		else if (arg == "--restart-delay" && i + 1 < argc && parse_number(argv[i + 1]))
+		{
+			config.restart.min_delay = std::chrono::seconds(*parse_number(argv[++i]));
+		}
+		else if (arg == "--max-restarts" && i + 1 < argc && parse_number(argv[i + 1]))
+		{
+			config.restart.max_failures = *parse_number(argv[++i]);
+		}
+		else if (arg == "--wake-on-join")
+		{
+			config.wake_on_join = true;
+		}
+		else if (arg == "--idle-stop" && i + 1 < argc && parse_number(argv[i + 1]))
+		{
+			config.idle_stop = std::chrono::minutes(*parse_number(argv[++i]));
+		}
+		else if (arg == "--listen" && i + 1 < argc && parse_endpoint(argv[i + 1], config.listen_host, config.listen_port))
+		{
+			i++;
+		}
+		else if (arg == "--sample-interval" && i + 1 < argc && parse_number(argv[i + 1]))
+		{
+			config.sample_interval = std::chrono::milliseconds(*parse_number(argv[++i]));
+		}
+		else if (arg == "--metrics" && i + 1 < argc && parse_endpoint(argv[i + 1], config.metrics_host, config.metrics_port))
+		{
+			i++;
+		}
+		else if (arg == "--cgroup")
+		{
+			limits();
+		}
+		else if ((arg == "--memory-high" || arg == "--memory-max") && i + 1 < argc && mcsuper::parse_size(argv[i + 1]))
+		{
+			utils::tulong size = *mcsuper::parse_size(argv[++i]);
+			(arg == "--memory-high" ? limits().memory_high : limits().memory_max) = size;
+		}
+		else if (arg == "--cpu-weight" && i + 1 < argc && parse_number(argv[i + 1], 1, 10000))
+		{
+			limits().cpu_weight = *parse_number(argv[++i], 1, 10000);
+		}
+		else if (arg == "--io-max" && i + 1 < argc)
+		{
+			limits().io_max = argv[++i];
+		}
+		else if (arg == "--pressure-stall" && i + 1 < argc && parse_number(argv[i + 1], 1))
+		{
+			limits().pressure_stall = std::chrono::milliseconds(*parse_number(argv[++i], 1));
+		}
+		else if (arg == "--server-cpus" && i + 1 < argc && mcsuper::cpu_mask::parse(argv[i + 1]))
+		{
+			config.placement.server = mcsuper::cpu_mask::parse(argv[++i]);
+		}
+		else if (arg == "--main-cpus" && i + 1 < argc && mcsuper::cpu_mask::parse(argv[i + 1]))
+		{
+			config.placement.main = mcsuper::cpu_mask::parse(argv[++i]);
+		}
+		else if (arg == "--worker-cpus" && i + 1 < argc && mcsuper::cpu_mask::parse(argv[i + 1]))
+		{
+			config.placement.workers = mcsuper::cpu_mask::parse(argv[++i]);
+		}
+		else if (arg == "--numa-node" && i + 1 < argc && parse_number(argv[i + 1], 0, 1023))
+		{
+			config.placement.numa_node = static_cast<int>(*parse_number(argv[++i], 0, 1023));
+		}
+		else
+		{
+			cerr << "Unknown option, or a missing or invalid value for: " << arg << endl;
+			print_usage(argv[0]);
+			return 2;
+		}
+	}
+
+	for (; i < argc; i++) config.server.argv.emplace_back(argv[i]);
+
+	if (config.server.argv.empty())
+	{
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	try
+	{
+		mcsuper::event_loop loop;
+		mcsuper::supervisor super(loop, std::move(config));
+		return super.run();
+	}
+	catch (const std::exception &e)
+	{
+		cerr << "[mcsuper] Fatal: " << e.what() << endl;
+		return 1;
+	}
+}
@@ -0,0 +1,186 @@
+#include "mc_protocol.hpp"
+
+#include <cstdio>
+
+
+namespace mcsuper
+{
+namespace protocol
+{
+	namespace
+	{
+		// A VarInt is at most 5 bytes for 32 bits
+		constexpr size_t varint_max = 5;
+
+
+		/**
+		 * @brief Decode a VarInt at the start of data
+		 *
+		 * @param used Bytes it took, when ok
+		 */
+		parse_status get_varint(std::string_view data, utils::tsint &out, size_t &used) noexcept
+		{
+			utils::tuint value = 0;
+			for (size_t i = 0; i < varint_max; i++)
+			{
+				if (i >= data.size()) return parse_status::incomplete;
+
+				auto byte = static_cast<utils::tuchar>(data[i]);
+				value |= static_cast<utils::tuint>(byte & 0x7F) << (7 * i);
+				if ((byte & 0x80) == 0)
+				{
+					out = static_cast<utils::tsint>(value);
+					used = i + 1;
+					return parse_status::ok;
+				}
+			}
+			return parse_status::malformed;
+		}
+	}
+
+
+	void put_varint(std::string &out, utils::tsint value)
+	{
+		auto u = static_cast<utils::tuint>(value);
+		do
+		{
+			auto byte = static_cast<char>(u & 0x7F);
+			u >>= 7;
+			if (u != 0) byte |= static_cast<char>(0x80);
+			out.push_back(byte);
+		}
+		while (u != 0);
+	}
+
+
+	void put_string(std::string &out, std::string_view value)
+	{
+		put_varint(out, static_cast<utils::tsint>(value.size()));
+		out.append(value);
+	}
+
+
+	void put_u16(std::string &out, utils::tushort value)
+	{
+		out.push_back(static_cast<char>(value >> 8));
+		out.push_back(static_cast<char>(value));
+	}
+
+
+	std::string packet(utils::tsint id, std::string_view body)
+	{
+		std::string inner;
+		put_varint(inner, id);
+		inner.append(body);
+
+		std::string out;
+		put_varint(out, static_cast<utils::tsint>(inner.size()));
+		out.append(inner);
+		return out;
+	}
+
+
+	bool reader::varint(utils::tsint &out) noexcept
+	{
+		size_t used;
+		if (get_varint(m_data.substr(m_pos), out, used) != parse_status::ok) return false;
+		m_pos += used;
+		return true;
+	}
+
+
+	bool reader::string(std::string_view &out, size_t max_len) noexcept
+	{
+		utils::tsint len;
+		if (!varint(len) || len < 0 || static_cast<size_t>(len) > max_len || static_cast<size_t>(len) > remaining()) return false;
+		out = m_data.substr(m_pos, len);
+		m_pos += len;
+		return true;
+	}
+
+
+	bool reader::u16(utils::tushort &out) noexcept
+	{
+		if (remaining() < 2) return false;
+		out = static_cast<utils::tushort>(static_cast<utils::tuchar>(m_data[m_pos]) << 8 | static_cast<utils::tuchar>(m_data[m_pos + 1]));
+		m_pos += 2;
+		return true;
+	}
+
+
+	bool reader::i64(utils::tslong &out) noexcept
+	{
+		if (remaining() < 8) return false;
+		utils::tulong v = 0;
+		for (size_t i = 0; i < 8; i++) v = v << 8 | static_cast<utils::tuchar>(m_data[m_pos + i]);
+		out = static_cast<utils::tslong>(v);
+		m_pos += 8;
+		return true;
+	}
+
+
+	parse_status next_frame(std::string_view buf, size_t &consumed, std::string_view &payload, size_t max_len) noexcept
+	{
+		utils::tsint len;
+		size_t used;
+		parse_status status = get_varint(buf, len, used);
+		if (status != parse_status::ok) return status;
+		if (len <= 0 || static_cast<size_t>(len) > max_len) return parse_status::malformed;
+		if (buf.size() - used < static_cast<size_t>(len)) return parse_status::incomplete;
+
+		payload = buf.substr(used, len);
+		consumed = used + len;
+		return parse_status::ok;
+	}
+
+
+	bool parse_handshake(std::string_view payload, handshake &out) noexcept
+	{
+		reader in(payload);
+		utils::tsint id, next;
+		if (!in.varint(id) || id != 0x00) return false;
+		if (!in.varint(out.protocol) || !in.string(out.address, 255 * 4) || !in.u16(out.port) || !in.varint(next)) return false;
+		if (next < 1 || next > 3) return false;
+		out.next = static_cast<next_state>(next);
+		return true;
+	}
+
+
+	std::string json_string(std::string_view value)
+	{
+		std::string out = "\"";
+		for (char c : value)
+		{
+			switch (c)
+			{
+				case '"': out += "\\\""; break;
+				case '\\': out += "\\\\"; break;
+				case '\n': out += "\\n"; break;
+				case '\r': out += "\\r"; break;
+				case '\t': out += "\\t"; break;
+				default:
+					if (static_cast<utils::tuchar>(c) < 0x20)
+					{
+						char esc[8];
+						std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+						out += esc;
+					}
+					else
+					{
+						out += c;
+					}
+			}
+		}
+		out += '"';
+		return out;
+	}
+
+
+	std::string status_json(std::string_view version, utils::tsint protocol, utils::tslong max_players, utils::tslong online, std::string_view motd)
+	{
+		return "{\"version\":{\"name\":" + json_string(version) + ",\"protocol\":" + std::to_string(protocol) + "},\"players\":{\"max\":"
+		       + std::to_string(max_players) + ",\"online\":" + std::to_string(online) + "},\"description\":{\"text\":" + json_string(motd) + "}}";
+	}
+
+} // End namespace protocol
+} // End namespace mcsuper
@@ -0,0 +1,113 @@
+#pragma once
+#ifndef H_640297_SRC_MC_PROTOCOL
+#define H_640297_SRC_MC_PROTOCOL 1
+
+#include <string>
+#include <string_view>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+namespace protocol
+{
+	/**
+	 * @brief Connection states a handshake can ask for
+	 */
+	enum class next_state : utils::tsint
+	{
+		status = 1,
+		login = 2,
+		// 1.20.5+ servers sending a player over, handled like a login
+		transfer = 3
+	};
+
+
+	/**
+	 * @brief Outcome of pulling a frame or field off a buffer
+	 */
+	enum class parse_status
+	{
+		ok,
+		// Wait for more bytes
+		incomplete,
+		// Not the Minecraft protocol, or garbage, drop the connection
+		malformed
+	};
+
+
+	void put_varint(std::string &out, utils::tsint value);
+	void put_string(std::string &out, std::string_view value);
+	void put_u16(std::string &out, utils::tushort value);
+
+	/**
+	 * @brief Frame a packet: VarInt length, VarInt id, body
+	 */
+	std::string packet(utils::tsint id, std::string_view body);
+
+
+	/**
+	 * @brief Sequential reader over one packet's payload, every getter returns false once the data runs out
+	 */
+	class reader
+	{
+		public:
+			explicit reader(std::string_view data) noexcept : m_data(data) {}
+
+			bool varint(utils::tsint &out) noexcept;
+			bool string(std::string_view &out, size_t max_len) noexcept;
+			bool u16(utils::tushort &out) noexcept;
+			bool i64(utils::tslong &out) noexcept;
+
+			size_t remaining() const noexcept { return m_data.size() - m_pos; }
+
+		private:
+			std::string_view m_data;
+			size_t m_pos = 0;
+	};
+
+
+	/**
+	 * @brief Take the next length-prefixed frame off the front of a buffer
+	 *
+	 * @param consumed Bytes of the frame, prefix included, when ok
+	 * @param payload The frame without its length prefix, viewing buf
+	 * @param max_len Longest frame accepted
+	 */
+	parse_status next_frame(std::string_view buf, size_t &consumed, std::string_view &payload, size_t max_len) noexcept;
+
+
+	/**
+	 * @brief The first packet of every connection
+	 */
+	struct handshake
+	{
+		utils::tsint protocol = 0;
+		std::string_view address;
+		utils::tushort port = 0;
+		next_state next = next_state::status;
+	};
+
+	/**
+	 * @brief Decode a handshake frame (id 0x00)
+	 */
+	bool parse_handshake(std::string_view payload, handshake &out) noexcept;
+
+
+	/**
+	 * @brief Quote a string for JSON, including the quotes
+	 */
+	std::string json_string(std::string_view value);
+
+	/**
+	 * @brief Build a status response, for when there's no real one to hand out
+	 *
+	 * @param protocol Advertised protocol, echoing the client's keeps it from showing the server as outdated
+	 */
+	std::string status_json(std::string_view version, utils::tsint protocol, utils::tslong max_players, utils::tslong online, std::string_view motd);
+
+} // End namespace protocol
+} // End namespace mcsuper
+
+#endif // H_640297_SRC_MC_PROTOCOL
@@ -0,0 +1,270 @@
+#include "metrics.hpp"
+
+#include <cstdio>
+
+#include <sys/socket.h>
+
+#include "net.hpp"
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		// A scraper's GET fits in a fraction of this
+		constexpr size_t max_request = 8192;
+		constexpr size_t max_connections = 16;
+		constexpr std::chrono::seconds connection_timeout{ 10 };
+
+		// Histogram bounds are 2^k - 1 ms, "Can't keep up" starts at 2s and anything past ~17 minutes is +Inf
+		constexpr utils::tulong first_bound = 1023;
+		constexpr utils::tulong last_bound = (1ull << 20) - 1;
+
+		constexpr std::string_view content_type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+
+		/**
+		 * @brief Milliseconds written out exactly as seconds, the base unit OpenMetrics expects
+		 */
+		std::string as_seconds(utils::tulong ms)
+		{
+			char buf[32];
+			std::snprintf(buf, sizeof(buf), "%llu.%03llu", static_cast<unsigned long long>(ms / 1000), static_cast<unsigned long long>(ms % 1000));
+			return buf;
+		}
+
+
+		std::string http_response(std::string_view status, std::string_view type, std::string_view body)
+		{
+			std::string out = "HTTP/1.1 ";
+			out += status;
+			out += "\r\nContent-Type: ";
+			out += type;
+			out += "\r\nContent-Length: ";
+			out += std::to_string(body.size());
+			out += "\r\nConnection: close\r\n\r\n";
+			out += body;
+			return out;
+		}
+	}
+
+
+	void metrics_text::family(std::string_view name, std::string_view type, std::string_view help, std::string_view unit)
+	{
+		m_out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+		if (!unit.empty()) m_out.append("# UNIT ").append(name).append(" ").append(unit).append("\n");
+		m_out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+	}
+
+
+	void metrics_text::sample(std::string_view name, utils::tulong value, std::string_view labels)
+	{
+		name_and_labels(name, labels);
+		m_out.append(std::to_string(value)).append("\n");
+	}
+
+
+	void metrics_text::sample(std::string_view name, double value, std::string_view labels)
+	{
+		name_and_labels(name, labels);
+		char buf[32];
+		std::snprintf(buf, sizeof(buf), "%.6g", value);
+		m_out.append(buf).append("\n");
+	}
+
+
+	std::string metrics_text::label_value(std::string_view text)
+	{
+		std::string out = "\"";
+		for (char c : text)
+		{
+			if (c == '\\' || c == '"') out += '\\';
+			if (c == '\n') out += "\\n";
+			else out += c;
+		}
+		out += '"';
+		return out;
+	}
+
+
+	void metrics_text::histogram(std::string_view name, std::string_view help, const lag_histogram &h)
+	{
+		family(name, "histogram", help, "seconds");
+
+		std::string bucket = std::string(name) + "_bucket";
+		utils::tulong cumulative = 0;
+		for (size_t i = 0; i < lag_histogram::bucket_count; i++)
+		{
+			cumulative += h.bucket(i);
+
+			// Only the last bucket below each power of two, the others would be a few hundred lines of noise
+			utils::tulong upper = lag_histogram::bucket_upper(i);
+			bool boundary = ((upper + 1) & upper) == 0;
+			if (boundary && upper >= first_bound && upper <= last_bound) sample(bucket, cumulative, "le=\"" + as_seconds(upper) + "\"");
+		}
+
+		// Recordings may race the loop above, the bucket total rather than count() keeps the series consistent
+		sample(bucket, cumulative, "le=\"+Inf\"");
+		name_and_labels(std::string(name) + "_sum", {});
+		m_out.append(as_seconds(h.sum())).append("\n");
+		sample(std::string(name) + "_count", cumulative);
+	}
+
+
+	std::string metrics_text::finish()
+	{
+		m_out += "# EOF\n";
+		return std::move(m_out);
+	}
+
+
+	void metrics_text::name_and_labels(std::string_view name, std::string_view labels)
+	{
+		m_out.append(name);
+		if (!labels.empty()) m_out.append("{").append(labels).append("}");
+		m_out += ' ';
+	}
+
+
+	metrics_endpoint::metrics_endpoint(event_loop &loop, const std::string &host, utils::tushort port, render_fn render) : m_loop(loop), m_render(std::move(render))
+	{
+		m_listen = listen_tcp(host, port, 16);
+		m_loop.add(m_listen.get(), EPOLLIN, [this](utils::tuint) { on_accept(); });
+		m_sweep = m_loop.add_timer(std::chrono::seconds(1), std::chrono::seconds(1), [this]() { sweep(); });
+	}
+
+
+	metrics_endpoint::~metrics_endpoint()
+	{
+		m_loop.cancel_timer(*m_sweep);
+		for (auto &[fd, conn] : m_conns) m_loop.remove(fd);
+		m_loop.remove(m_listen.get());
+	}
+
+
+	void metrics_endpoint::on_accept()
+	{
+		for (;;)
+		{
+			utils::unique_fd sock(accept4(m_listen.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+			if (!sock)
+			{
+				if (errno == EINTR || errno == ECONNABORTED) continue;
+				return;
+			}
+			if (m_conns.size() >= max_connections) continue;
+
+			int fd = sock.get();
+			connection &conn = m_conns[fd];
+			conn.sock = std::move(sock);
+			conn.accepted = std::chrono::steady_clock::now();
+			m_loop.add(fd, EPOLLIN, [this, fd](utils::tuint events) { on_socket(fd, events); });
+		}
+	}
+
+
+	void metrics_endpoint::on_socket(int fd, utils::tuint events)
+	{
+		auto it = m_conns.find(fd);
+		if (it == m_conns.end()) return;
+		connection &conn = it->second;
+
+		if ((events & EPOLLIN) && conn.out.empty())
+		{
+			char buf[2048];
+			for (;;)
+			{
+				ssize_t n = ::read(fd, buf, sizeof(buf));
+				if (n > 0)
+				{
+					conn.in.append(buf, n);
+					if (conn.in.size() > max_request) return drop(fd);
+					continue;
+				}
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0 && errno == EAGAIN) break;
+				return drop(fd);
+			}
+
+			// Nothing but a GET is expected, so the head is the whole request
+			size_t end = conn.in.find("\r\n\r\n");
+			if (end == std::string::npos) return;
+			conn.out = respond(std::string_view(conn.in).substr(0, end));
+		}
+		else if (events & (EPOLLHUP | EPOLLERR))
+		{
+			return drop(fd);
+		}
+
+		if (!conn.out.empty() && !flush(conn)) return drop(fd);
+	}
+
+
+	std::string metrics_endpoint::respond(std::string_view head)
+	{
+		std::string_view line = head.substr(0, head.find("\r\n"));
+		size_t sp1 = line.find(' ');
+		size_t sp2 = line.find(' ', sp1 + 1);
+		if (sp1 == std::string_view::npos || sp2 == std::string_view::npos) return http_response("400 Bad Request", "text/plain", "bad request\n");
+
+		std::string_view method = line.substr(0, sp1);
+		std::string_view path = line.substr(sp1 + 1, sp2 - sp1 - 1);
+		path = path.substr(0, path.find('?'));
+
+		if (method != "GET" && method != "HEAD") return http_response("405 Method Not Allowed", "text/plain", "GET only\n");
+		if (path != "/metrics" && path != "/") return http_response("404 Not Found", "text/plain", "see /metrics\n");
+
+		m_scrapes++;
+		std::string response = http_response("200 OK", content_type, m_render());
+		if (method == "HEAD") response.resize(response.find("\r\n\r\n") + 4);
+		return response;
+	}
+
+
+	bool metrics_endpoint::flush(connection &conn)
+	{
+		while (conn.out_pos < conn.out.size())
+		{
+			ssize_t n = ::send(conn.sock.get(), conn.out.data() + conn.out_pos, conn.out.size() - conn.out_pos, MSG_NOSIGNAL);
+			if (n > 0)
+			{
+				conn.out_pos += n;
+				continue;
+			}
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0 && errno == EAGAIN)
+			{
+				m_loop.modify(conn.sock.get(), EPOLLOUT);
+				return true;
+			}
+			return false;
+		}
+
+		// Connection: close, all sent
+		return false;
+	}
+
+
+	void metrics_endpoint::drop(int fd)
+	{
+		m_loop.remove(fd);
+		m_conns.erase(fd);
+	}
+
+
+	void metrics_endpoint::sweep()
+	{
+		auto now = std::chrono::steady_clock::now();
+		for (auto it = m_conns.begin(); it != m_conns.end();)
+		{
+			if (now - it->second.accepted < connection_timeout)
+			{
+				++it;
+				continue;
+			}
+			m_loop.remove(it->first);
+			it = m_conns.erase(it);
+		}
+	}
+
+} // End namespace mcsuper
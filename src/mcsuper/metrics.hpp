@@ -0,0 +1,133 @@
+#pragma once
+#ifndef H_958207_SRC_METRICS
+#define H_958207_SRC_METRICS 1
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <optional>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+
+#include "utils.hpp"
+#include "event_loop.hpp"
+#include "tick_stats.hpp"
+
+
+namespace mcsuper
+{
+	// Fixed rather than std::hardware_destructive_interference_size, which GCC warns may change between builds
+	inline constexpr size_t cache_line = 64;
+
+	/**
+	 * @brief Relaxed atomic counter alone on its cache line
+	 *
+	 * Counters bumped on the console path and read by a scrape never share a line with anything else,
+	 * so the two sides never bounce it between cores
+	 */
+	struct alignas(cache_line) padded_counter
+	{
+		std::atomic<utils::tulong> value{ 0 };
+
+		void add(utils::tulong n = 1) noexcept { value.fetch_add(n, std::memory_order_relaxed); }
+		void set(utils::tulong n) noexcept { value.store(n, std::memory_order_relaxed); }
+		utils::tulong get() const noexcept { return value.load(std::memory_order_relaxed); }
+	};
+
+
+	/**
+	 * @brief Builds an OpenMetrics text exposition
+	 *
+	 * Call family() once per metric family, then sample() for each of its samples, and take the text with
+	 * finish(), which adds the mandatory "# EOF"
+	 */
+	class metrics_text
+	{
+		public:
+			/**
+			 * @param type counter, gauge or histogram
+			 * @param unit Appended to the name by convention already, declared for consumers that care
+			 */
+			void family(std::string_view name, std::string_view type, std::string_view help, std::string_view unit = {});
+
+			/**
+			 * @param labels Already formatted, as in level="warn"
+			 */
+			void sample(std::string_view name, utils::tulong value, std::string_view labels = {});
+			void sample(std::string_view name, double value, std::string_view labels = {});
+
+			/**
+			 * @brief A label value escaped and quoted, for text that comes from outside
+			 */
+			static std::string label_value(std::string_view text);
+
+			/**
+			 * @brief A histogram family in seconds from a lag histogram of milliseconds, its buckets summed up to
+			 * each power of two
+			 */
+			void histogram(std::string_view name, std::string_view help, const lag_histogram &h);
+
+			std::string finish();
+
+		private:
+			void name_and_labels(std::string_view name, std::string_view labels);
+
+			std::string m_out;
+	};
+
+
+	/**
+	 * @brief Serves /metrics over plain HTTP on the event loop
+	 *
+	 * Just enough HTTP/1.1 for a scraper: one GET per connection, answered with Connection: close. Requests
+	 * are read and responses written nonblocking, slow or oversized clients are dropped
+	 */
+	class metrics_endpoint
+	{
+		public:
+			/**
+			 * @brief Renders the exposition, called once per scrape
+			 */
+			typedef std::function<std::string()> render_fn;
+
+			/**
+			 * @brief Bind and start listening, throws if the port is taken
+			 */
+			metrics_endpoint(event_loop &loop, const std::string &host, utils::tushort port, render_fn render);
+			~metrics_endpoint();
+
+			metrics_endpoint(const metrics_endpoint &) = delete;
+			metrics_endpoint &operator=(const metrics_endpoint &) = delete;
+
+			utils::tulong scrapes() const noexcept { return m_scrapes; }
+
+		private:
+			struct connection
+			{
+				utils::unique_fd sock;
+				std::string in;
+				std::string out;
+				size_t out_pos = 0;
+				std::chrono::steady_clock::time_point accepted;
+			};
+
+			void on_accept();
+			void on_socket(int fd, utils::tuint events);
+			// The full response to a request head
+			std::string respond(std::string_view head);
+			bool flush(connection &conn);
+			void drop(int fd);
+			void sweep();
+
+			event_loop &m_loop;
+			utils::unique_fd m_listen;
+			render_fn m_render;
+			std::unordered_map<int, connection> m_conns;
+			std::optional<event_loop::timer_id> m_sweep;
+			utils::tulong m_scrapes = 0;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_958207_SRC_METRICS
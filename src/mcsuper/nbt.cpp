@@ -0,0 +1,529 @@
+#include "nbt.hpp"
+
+#include <bit>
+#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "compress.hpp"
+
+
+namespace mcsuper
+{
+namespace nbt
+{
+	namespace
+	{
+		// The depth limit Minecraft itself enforces
+		constexpr size_t max_depth = 512;
+
+
+		utils::tuint be16(const utils::tuchar *p)
+		{
+			return static_cast<utils::tuint>(p[0]) << 8 | p[1];
+		}
+
+		utils::tuint be32(const utils::tuchar *p)
+		{
+			return static_cast<utils::tuint>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+		}
+
+		utils::tulong be64(const utils::tuchar *p)
+		{
+			return static_cast<utils::tulong>(be32(p)) << 32 | be32(p + 4);
+		}
+
+
+		/**
+		 * @brief Payload size of the fixed-width tags, 0 for everything else
+		 */
+		constexpr size_t fixed_size(tag type)
+		{
+			switch (type)
+			{
+				case tag::byte_tag: return 1;
+				case tag::short_tag: return 2;
+				case tag::int_tag: case tag::float_tag: return 4;
+				case tag::long_tag: case tag::double_tag: return 8;
+				default: return 0;
+			}
+		}
+
+		constexpr size_t array_width(tag type)
+		{
+			switch (type)
+			{
+				case tag::byte_array: return 1;
+				case tag::int_array: return 4;
+				case tag::long_array: return 8;
+				default: return 0;
+			}
+		}
+
+
+		/**
+		 * @brief Sign-extended big-endian integer of 1, 2, 4 or 8 bytes
+		 */
+		utils::tslong read_int(const utils::tuchar *p, size_t width)
+		{
+			switch (width)
+			{
+				case 1: return static_cast<utils::tschar>(p[0]);
+				case 2: return static_cast<utils::tsshort>(be16(p));
+				case 4: return static_cast<utils::tsint>(be32(p));
+				case 8: return static_cast<utils::tslong>(be64(p));
+				default: return 0;
+			}
+		}
+
+
+		/**
+		 * @brief A container still being filled while parsing
+		 */
+		struct frame
+		{
+			utils::tuint index;
+			tag type;
+			tag element;
+			utils::tuint remaining;
+		};
+
+
+		void truncated()
+		{
+			throw std::runtime_error("truncated NBT");
+		}
+	}
+
+
+	const char *tag_name(tag type) noexcept
+	{
+		static constexpr const char *names[] = {
+			"end", "byte", "short", "int", "long", "float", "double", "byte_array", "string", "list", "compound", "int_array", "long_array"
+		};
+		size_t i = static_cast<size_t>(type);
+		return i < std::size(names) ? names[i] : "invalid";
+	}
+
+
+	void document::parse(std::vector<utils::tuchar> data)
+	{
+		m_owned = std::move(data);
+		parse(m_owned.data(), m_owned.size());
+	}
+
+
+	void document::parse(const utils::tuchar *data, size_t len)
+	{
+		if (data != m_owned.data()) m_owned.clear();
+
+		m_data = data;
+		m_size = len;
+		m_tape.clear();
+
+		if (len > no_name) throw std::runtime_error("NBT buffer over 4 GiB");
+		if (len == 0) truncated();
+		if (static_cast<tag>(data[0]) == tag::end) return;
+
+		// Roughly one tag per 12 bytes of typical chunk data, close enough to avoid most regrowth
+		m_tape.reserve(len / 12 + 16);
+
+		std::vector<frame> stack;
+		size_t pos = 0;
+
+		auto need = [&](utils::tulong n)
+		{
+			if (pos > m_size || m_size - pos < n) truncated();
+		};
+
+		// Append a tag whose payload starts at pos and step past it, or open it as a container
+		auto consume = [&](tag type, utils::tuint name)
+		{
+			utils::tuint index = static_cast<utils::tuint>(m_tape.size());
+			m_tape.push_back({ name, static_cast<utils::tuint>(pos), index + 1, type, tag::end, 0 });
+
+			if (size_t width = fixed_size(type))
+			{
+				need(width);
+				pos += width;
+			}
+			else if (size_t width = array_width(type))
+			{
+				need(4);
+				auto count = static_cast<utils::tsint>(be32(m_data + pos));
+				if (count < 0) throw std::runtime_error("negative NBT array length");
+				need(4 + utils::tulong(count) * width);
+				pos += 4 + size_t(count) * width;
+			}
+			else if (type == tag::string)
+			{
+				need(2);
+				utils::tuint n = be16(m_data + pos);
+				need(2 + n);
+				pos += 2 + n;
+			}
+			else if (type == tag::list)
+			{
+				need(5);
+				auto element = static_cast<tag>(m_data[pos]);
+				auto count = static_cast<utils::tsint>(be32(m_data + pos + 1));
+				pos += 5;
+
+				if (count < 0 || static_cast<utils::tuchar>(element) > static_cast<utils::tuchar>(tag::long_array)) throw std::runtime_error("bad NBT list header");
+				if (count > 0 && element == tag::end) throw std::runtime_error("NBT list of end tags");
+				m_tape.back().element = element;
+
+				// Numeric lists are one tape entry, their elements are read straight from the buffer
+				if (size_t width = fixed_size(element))
+				{
+					need(utils::tulong(count) * width);
+					pos += size_t(count) * width;
+				}
+				else if (count > 0)
+				{
+					if (stack.size() >= max_depth) throw std::runtime_error("NBT nested too deep");
+					stack.push_back({ index, tag::list, element, static_cast<utils::tuint>(count) });
+				}
+			}
+			else if (type == tag::compound)
+			{
+				if (stack.size() >= max_depth) throw std::runtime_error("NBT nested too deep");
+				stack.push_back({ index, tag::compound, tag::end, 0 });
+			}
+			else
+			{
+				throw std::runtime_error("bad NBT tag type " + std::to_string(static_cast<int>(type)));
+			}
+		};
+
+		// The root is a named tag like any other, its name is usually empty
+		tag root = static_cast<tag>(m_data[0]);
+		pos = 1;
+		need(2);
+		utils::tuint root_name = static_cast<utils::tuint>(pos);
+		utils::tuint root_len = be16(m_data + pos);
+		need(2 + root_len);
+		pos += 2 + root_len;
+		consume(root, root_name);
+
+		while (!stack.empty())
+		{
+			frame &top = stack.back();
+
+			if (top.type == tag::compound)
+			{
+				need(1);
+				auto type = static_cast<tag>(m_data[pos++]);
+				if (type == tag::end)
+				{
+					m_tape[top.index].next = static_cast<utils::tuint>(m_tape.size());
+					stack.pop_back();
+					continue;
+				}
+
+				need(2);
+				utils::tuint name = static_cast<utils::tuint>(pos);
+				utils::tuint n = be16(m_data + pos);
+				need(2 + n);
+				pos += 2 + n;
+				consume(type, name);
+			}
+			else
+			{
+				if (top.remaining == 0)
+				{
+					m_tape[top.index].next = static_cast<utils::tuint>(m_tape.size());
+					stack.pop_back();
+					continue;
+				}
+
+				// consume() may grow the stack, so nothing of top is used after it
+				top.remaining--;
+				consume(top.element, no_name);
+			}
+		}
+	}
+
+
+	const tape_entry &value::entry() const noexcept
+	{
+		return m_doc->tape()[m_index];
+	}
+
+
+	tag value::type() const noexcept
+	{
+		return m_doc ? entry().type : tag::end;
+	}
+
+
+	tag value::element_type() const noexcept
+	{
+		return m_doc && entry().type == tag::list ? entry().element : tag::end;
+	}
+
+
+	std::string_view value::name() const noexcept
+	{
+		if (!m_doc || entry().name == no_name) return {};
+		const utils::tuchar *p = m_doc->data() + entry().name;
+		return { reinterpret_cast<const char *>(p + 2), be16(p) };
+	}
+
+
+	utils::tslong value::as_long() const noexcept
+	{
+		if (!m_doc) return 0;
+		tag t = entry().type;
+		if (t == tag::float_tag || t == tag::double_tag) return static_cast<utils::tslong>(as_double());
+		return read_int(m_doc->data() + entry().payload, fixed_size(t));
+	}
+
+
+	double value::as_double() const noexcept
+	{
+		if (!m_doc) return 0;
+		const utils::tuchar *p = m_doc->data() + entry().payload;
+		switch (entry().type)
+		{
+			case tag::float_tag: return std::bit_cast<float>(be32(p));
+			case tag::double_tag: return std::bit_cast<double>(be64(p));
+			default: return static_cast<double>(as_long());
+		}
+	}
+
+
+	std::string_view value::as_string() const noexcept
+	{
+		if (!m_doc || entry().type != tag::string) return {};
+		const utils::tuchar *p = m_doc->data() + entry().payload;
+		return { reinterpret_cast<const char *>(p + 2), be16(p) };
+	}
+
+
+	size_t value::size() const noexcept
+	{
+		if (!m_doc) return 0;
+		const utils::tuchar *p = m_doc->data() + entry().payload;
+
+		switch (entry().type)
+		{
+			case tag::list: return be32(p + 1);
+			case tag::byte_array: case tag::int_array: case tag::long_array: return be32(p);
+			case tag::compound: return static_cast<size_t>(std::distance(begin(), end()));
+			default: return 0;
+		}
+	}
+
+
+	value value::operator[](std::string_view key) const noexcept
+	{
+		if (!m_doc || entry().type != tag::compound) return {};
+
+		for (value child : *this)
+		{
+			if (child.name() == key) return child;
+		}
+		return {};
+	}
+
+
+	bool value::has_children() const noexcept
+	{
+		tag t = entry().type;
+		return t == tag::compound || (t == tag::list && fixed_size(entry().element) == 0);
+	}
+
+
+	value value::at(size_t index) const noexcept
+	{
+		if (!m_doc || entry().type != tag::list || !has_children() || index >= size()) return {};
+
+		iterator it = begin();
+		while (index-- > 0) ++it;
+		return *it;
+	}
+
+
+	utils::tslong value::long_at(size_t index) const noexcept
+	{
+		if (!m_doc || index >= size()) return 0;
+		const utils::tuchar *p = m_doc->data() + entry().payload;
+
+		if (entry().type == tag::list)
+		{
+			tag element = entry().element;
+			if (element == tag::float_tag || element == tag::double_tag) return static_cast<utils::tslong>(double_at(index));
+			size_t width = fixed_size(element);
+			return read_int(p + 5 + index * width, width);
+		}
+
+		size_t width = array_width(entry().type);
+		return read_int(p + 4 + index * width, width);
+	}
+
+
+	double value::double_at(size_t index) const noexcept
+	{
+		if (!m_doc || index >= size()) return 0;
+		const utils::tuchar *p = m_doc->data() + entry().payload;
+
+		if (entry().type == tag::list && entry().element == tag::float_tag) return std::bit_cast<float>(be32(p + 5 + index * 4));
+		if (entry().type == tag::list && entry().element == tag::double_tag) return std::bit_cast<double>(be64(p + 5 + index * 8));
+		return static_cast<double>(long_at(index));
+	}
+
+
+	value value::path(std::string_view dotted) const noexcept
+	{
+		value current = *this;
+
+		while (current && !dotted.empty())
+		{
+			size_t dot = dotted.find('.');
+			std::string_view segment = dotted.substr(0, dot);
+			dotted = dot == std::string_view::npos ? std::string_view() : dotted.substr(dot + 1);
+
+			size_t bracket = segment.find('[');
+			std::string_view key = segment.substr(0, bracket);
+			if (!key.empty()) current = current[key];
+
+			// Any number of [n] after the name index into nested lists
+			while (current && bracket != std::string_view::npos)
+			{
+				size_t close = segment.find(']', bracket);
+				if (close == std::string_view::npos) return {};
+
+				size_t index = 0;
+				for (char c : segment.substr(bracket + 1, close - bracket - 1))
+				{
+					if (c < '0' || c > '9') return {};
+					index = index * 10 + (c - '0');
+				}
+				current = current.at(index);
+				bracket = segment.find('[', close);
+			}
+		}
+		return current;
+	}
+
+
+	value::iterator &value::iterator::operator++() noexcept
+	{
+		m_index = m_doc->tape()[m_index].next;
+		return *this;
+	}
+
+
+	value::iterator value::begin() const noexcept
+	{
+		// A leaf's next is its own index + 1, so begin() == end() falls out for free
+		return m_doc ? iterator(m_doc, m_index + 1) : iterator();
+	}
+
+
+	value::iterator value::end() const noexcept
+	{
+		return m_doc ? iterator(m_doc, entry().next) : iterator();
+	}
+
+
+	document read_file(const std::filesystem::path &path)
+	{
+		std::ifstream in(path, std::ios::binary);
+		if (!in) throw std::runtime_error("can't open " + path.string());
+		std::vector<utils::tuchar> raw((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+		// gzip (1f 8b) is what the game writes, zlib (78 ..) turns up from some tools, plain NBT starts with a compound (0a)
+		bool compressed = raw.size() >= 2 && ((raw[0] == 0x1f && raw[1] == 0x8b) || raw[0] == 0x78);
+
+		document doc;
+		if (compressed) doc.parse(inflate_stream(raw.data(), raw.size()));
+		else doc.parse(std::move(raw));
+		return doc;
+	}
+
+
+	std::string to_string(value v, size_t max_items)
+	{
+		std::ostringstream out;
+
+		auto quote = [&](std::string_view s)
+		{
+			out << '"';
+			for (char c : s)
+			{
+				if (c == '"' || c == '\\') out << '\\';
+				out << c;
+			}
+			out << '"';
+		};
+
+		auto items = [&](size_t count, auto &&each)
+		{
+			for (size_t i = 0; i < count && i < max_items; i++)
+			{
+				if (i > 0) out << ", ";
+				each(i);
+			}
+			if (count > max_items) out << ", ... " << count - max_items << " more";
+		};
+
+		switch (v.type())
+		{
+			case tag::end: return "<none>";
+			case tag::byte_tag: out << v.as_long() << 'b'; break;
+			case tag::short_tag: out << v.as_long() << 's'; break;
+			case tag::int_tag: out << v.as_long(); break;
+			case tag::long_tag: out << v.as_long() << 'L'; break;
+			case tag::float_tag: out << v.as_double() << 'f'; break;
+			case tag::double_tag: out << v.as_double() << 'd'; break;
+			case tag::string: quote(v.as_string()); break;
+
+			case tag::byte_array:
+			case tag::int_array:
+			case tag::long_array:
+				out << '[' << (v.type() == tag::byte_array ? 'B' : v.type() == tag::int_array ? 'I' : 'L') << "; ";
+				items(v.size(), [&](size_t i) { out << v.long_at(i); });
+				out << ']';
+				break;
+
+			case tag::list:
+			{
+				out << '[';
+				tag element = v.element_type();
+				if (element == tag::float_tag || element == tag::double_tag) items(v.size(), [&](size_t i) { out << v.double_at(i); });
+				else if (fixed_size(element) > 0) items(v.size(), [&](size_t i) { out << v.long_at(i); });
+				else
+				{
+					value::iterator it = v.begin();
+					items(v.size(), [&](size_t) { out << to_string(*it++, max_items); });
+				}
+				out << ']';
+				break;
+			}
+
+			case tag::compound:
+			{
+				out << '{';
+				size_t i = 0;
+				for (value child : v)
+				{
+					if (i++ == max_items)
+					{
+						out << ", ...";
+						break;
+					}
+					if (i > 1) out << ", ";
+					out << child.name() << ": " << to_string(child, max_items);
+				}
+				out << '}';
+				break;
+			}
+		}
+		return out.str();
+	}
+
+} // End namespace nbt
+} // End namespace mcsuper
@@ -0,0 +1,222 @@
+#pragma once
+#ifndef H_581460_SRC_NBT
+#define H_581460_SRC_NBT 1
+
+#include <string>
+#include <vector>
+#include <iterator>
+#include <filesystem>
+#include <string_view>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+namespace nbt
+{
+	/**
+	 * @brief NBT tag types, numbered as on disk
+	 */
+	enum class tag : utils::tuchar
+	{
+		end = 0,
+		byte_tag = 1,
+		short_tag = 2,
+		int_tag = 3,
+		long_tag = 4,
+		float_tag = 5,
+		double_tag = 6,
+		byte_array = 7,
+		string = 8,
+		list = 9,
+		compound = 10,
+		int_array = 11,
+		long_array = 12
+	};
+
+	const char *tag_name(tag type) noexcept;
+
+
+	/**
+	 * @brief One tag on the tape, 16 bytes, every field is an offset rather than a copy
+	 */
+	struct tape_entry
+	{
+		// Buffer offset of the name's length prefix, no_name for list elements and the unnamed root
+		utils::tuint name;
+		// Buffer offset of the payload
+		utils::tuint payload;
+		// Tape index just past this tag and everything inside it, which is how siblings are reached
+		utils::tuint next;
+		tag type;
+		// Element type of lists
+		tag element;
+		utils::tushort reserved;
+	};
+
+	inline constexpr utils::tuint no_name = ~utils::tuint(0);
+
+
+	class document;
+
+
+	/**
+	 * @brief A tag in a parsed document, a cheap copyable view that's invalid (false) when a lookup missed
+	 *
+	 * Getters return zero or empty on a type mismatch rather than throwing, world data is full of optional
+	 * tags and the callers care whether the value is usable, not why it isn't
+	 */
+	class value
+	{
+		public:
+			value() = default;
+			value(const document *doc, utils::tuint index) noexcept : m_doc(doc), m_index(index) {}
+
+			explicit operator bool() const noexcept { return m_doc != nullptr; }
+
+			tag type() const noexcept;
+			std::string_view name() const noexcept;
+
+			/**
+			 * @brief Element type of a list, end for anything else
+			 */
+			tag element_type() const noexcept;
+
+			/**
+			 * @brief Any integer tag widened to 64 bits
+			 */
+			utils::tslong as_long() const noexcept;
+
+			/**
+			 * @brief Any numeric tag as a double
+			 */
+			double as_double() const noexcept;
+
+			/**
+			 * @brief The raw (modified UTF-8) bytes of a string tag, viewing the parsed buffer
+			 */
+			std::string_view as_string() const noexcept;
+
+			/**
+			 * @brief Child count of a compound, element count of a list or array
+			 */
+			size_t size() const noexcept;
+
+			/**
+			 * @brief A compound's child by name
+			 */
+			value operator[](std::string_view key) const noexcept;
+
+			/**
+			 * @brief A list element, only for lists of strings, lists or compounds, which have tape entries of their own
+			 */
+			value at(size_t index) const noexcept;
+
+			/**
+			 * @brief Element of a numeric list or array, read straight from the buffer
+			 */
+			utils::tslong long_at(size_t index) const noexcept;
+			double double_at(size_t index) const noexcept;
+
+			/**
+			 * @brief Walk a dotted path like "Data.LevelName" or "sections[3].Y", skipping whole subtrees on the way
+			 */
+			value path(std::string_view dotted) const noexcept;
+
+			/**
+			 * @brief Iterates a compound's children or the elements of a list with tape entries
+			 */
+			class iterator
+			{
+				public:
+					using iterator_category = std::forward_iterator_tag;
+					using value_type = value;
+					using difference_type = std::ptrdiff_t;
+					using pointer = void;
+					using reference = value;
+
+					iterator() = default;
+					iterator(const document *doc, utils::tuint index) noexcept : m_doc(doc), m_index(index) {}
+
+					value operator*() const noexcept { return { m_doc, m_index }; }
+					iterator &operator++() noexcept;
+					iterator operator++(int) noexcept { iterator old = *this; ++*this; return old; }
+					bool operator==(const iterator &other) const noexcept { return m_index == other.m_index; }
+
+				private:
+					const document *m_doc = nullptr;
+					utils::tuint m_index = 0;
+			};
+
+			iterator begin() const noexcept;
+			iterator end() const noexcept;
+
+		private:
+			const tape_entry &entry() const noexcept;
+			bool has_children() const noexcept;
+
+			const document *m_doc = nullptr;
+			utils::tuint m_index = 0;
+	};
+
+
+	/**
+	 * @brief A parsed NBT buffer: the bytes plus a flat tape of offsets into them
+	 *
+	 * Parsing is a single pass with an explicit stack that appends one 16-byte tape entry per tag, and numeric
+	 * lists and arrays get just one entry however long they are. Nothing is decoded or copied until it's asked
+	 * for. The tape's storage is kept across parse() calls, so a document reused for every chunk of a region
+	 * stops allocating after the first few
+	 */
+	class document
+	{
+		public:
+			document() = default;
+
+			// A copy's m_data would still point into the original's buffer, a move takes the buffer along with it
+			document(const document &) = delete;
+			document &operator=(const document &) = delete;
+			document(document &&) noexcept = default;
+			document &operator=(document &&) noexcept = default;
+
+			/**
+			 * @brief Parse uncompressed big-endian NBT the caller keeps alive, e.g. an mmap
+			 */
+			void parse(const utils::tuchar *data, size_t len);
+
+			/**
+			 * @brief Parse a buffer the document takes ownership of, e.g. a decompressed chunk
+			 */
+			void parse(std::vector<utils::tuchar> data);
+
+			/**
+			 * @brief The root compound, invalid if the input was just an end tag
+			 */
+			value root() const noexcept { return m_tape.empty() ? value() : value(this, 0); }
+
+			const utils::tuchar *data() const noexcept { return m_data; }
+			const std::vector<tape_entry> &tape() const noexcept { return m_tape; }
+
+		private:
+			const utils::tuchar *m_data = nullptr;
+			size_t m_size = 0;
+			std::vector<utils::tuchar> m_owned;
+			std::vector<tape_entry> m_tape;
+	};
+
+
+	/**
+	 * @brief Read a .dat file (gzip, zlib or plain NBT) into a document
+	 */
+	document read_file(const std::filesystem::path &path);
+
+	/**
+	 * @brief Render a value as SNBT-ish text for people to read, containers are cut off after max_items entries
+	 */
+	std::string to_string(value v, size_t max_items = 16);
+
+} // End namespace nbt
+} // End namespace mcsuper
+
+#endif // H_581460_SRC_NBT
@@ -0,0 +1,80 @@
+#include "net.hpp"
+
+#include <stdexcept>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		/**
+		 * @brief Listening socket on every interface, dual-stack where IPv6 is available
+		 */
+		utils::unique_fd listen_any(utils::tushort port)
+		{
+			int one = 1, zero = 0;
+
+			utils::unique_fd sock(socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+			if (sock)
+			{
+				sockaddr_in6 addr{};
+				addr.sin6_family = AF_INET6;
+				addr.sin6_addr = in6addr_any;
+				addr.sin6_port = htons(port);
+				setsockopt(sock.get(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+				setsockopt(sock.get(), IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+				if (bind(sock.get(), reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) return sock;
+				if (errno == EADDRINUSE) utils::throw_errno("bind port " + std::to_string(port));
+			}
+
+			sock.reset(socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+			if (!sock) utils::throw_errno("socket");
+
+			sockaddr_in addr{};
+			addr.sin_family = AF_INET;
+			addr.sin_addr.s_addr = htonl(INADDR_ANY);
+			addr.sin_port = htons(port);
+			setsockopt(sock.get(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			if (bind(sock.get(), reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) utils::throw_errno("bind port " + std::to_string(port));
+			return sock;
+		}
+
+
+		/**
+		 * @brief Socket bound to the first address host resolves to
+		 */
+		utils::unique_fd bind_host(const std::string &host, utils::tushort port)
+		{
+			addrinfo hints{};
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+
+			addrinfo *res = nullptr;
+			std::string service = std::to_string(port);
+			if (getaddrinfo(host.c_str(), service.c_str(), &hints, &res) != 0 || res == nullptr) throw std::runtime_error("can't resolve " + host);
+
+			utils::unique_fd sock(socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+			int one = 1;
+			int rc = sock ? setsockopt(sock.get(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) : -1;
+			if (rc == 0) rc = bind(sock.get(), res->ai_addr, res->ai_addrlen);
+			freeaddrinfo(res);
+
+			if (rc < 0) utils::throw_errno("bind " + host + ":" + service);
+			return sock;
+		}
+	}
+
+
+	utils::unique_fd listen_tcp(const std::string &host, utils::tushort port, int backlog)
+	{
+		utils::unique_fd sock = host.empty() ? listen_any(port) : bind_host(host, port);
+		if (listen(sock.get(), backlog) < 0) utils::throw_errno("listen");
+		return sock;
+	}
+
+} // End namespace mcsuper
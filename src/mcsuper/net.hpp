@@ -0,0 +1,21 @@
+#pragma once
+#ifndef H_362918_SRC_NET
+#define H_362918_SRC_NET 1
+
+#include <string>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Nonblocking TCP socket bound and listening, throws if the port is taken
+	 *
+	 * @param host Address to bind, empty for every interface (dual-stack where IPv6 is available)
+	 */
+	utils::unique_fd listen_tcp(const std::string &host, utils::tushort port, int backlog);
+
+} // End namespace mcsuper
+
+#endif // H_362918_SRC_NET
@@ -0,0 +1,310 @@
+#include "placement.hpp"
+
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+
+#include <dirent.h>
+
+using std::cout, std::cerr, std::endl;
+namespace fs = std::filesystem;
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		constexpr std::chrono::seconds rescan_interval{ 5 };
+
+
+		std::string read_line(const fs::path &path)
+		{
+			std::ifstream in(path);
+			std::string line;
+			std::getline(in, line);
+			return line;
+		}
+
+
+		/**
+		 * @brief Thread ids under /proc/<pid>/task, or /proc/self/task
+		 */
+		std::vector<pid_t> list_tasks(const std::string &proc)
+		{
+			std::vector<pid_t> tids;
+			DIR *dir = opendir((proc + "/task").c_str());
+			if (dir == nullptr) return tids;
+
+			while (dirent *entry = readdir(dir))
+			{
+				if (std::isdigit(static_cast<utils::tuchar>(entry->d_name[0]))) tids.push_back(static_cast<pid_t>(std::stol(entry->d_name)));
+			}
+			closedir(dir);
+			return tids;
+		}
+
+
+		utils::tulong field_value(const std::string &line, size_t from)
+		{
+			while (from < line.size() && !std::isdigit(static_cast<utils::tuchar>(line[from]))) from++;
+			return from < line.size() ? std::stoull(line.substr(from)) : 0;
+		}
+	}
+
+
+	std::optional<cpu_mask> cpu_mask::parse(std::string_view list)
+	{
+		cpu_mask mask;
+		while (!list.empty())
+		{
+			std::string_view part = list.substr(0, list.find(','));
+			list.remove_prefix(std::min(list.size(), part.size() + 1));
+
+			size_t dash = part.find('-');
+			std::string_view first = part.substr(0, dash);
+			std::string_view last = dash == std::string_view::npos ? first : part.substr(dash + 1);
+
+			auto number = [](std::string_view text) -> int
+			{
+				if (text.empty() || text.size() > 5) return -1;
+				int n = 0;
+				for (char c : text)
+				{
+					if (!std::isdigit(static_cast<utils::tuchar>(c))) return -1;
+					n = n * 10 + (c - '0');
+				}
+				return n;
+			};
+
+			int lo = number(first), hi = number(last);
+			if (lo < 0 || hi < lo || hi >= CPU_SETSIZE) return std::nullopt;
+			for (int cpu = lo; cpu <= hi; cpu++) CPU_SET(cpu, &mask.m_set);
+		}
+		if (mask.empty()) return std::nullopt;
+		return mask;
+	}
+
+
+	cpu_mask cpu_mask::online()
+	{
+		if (std::optional<cpu_mask> mask = parse(read_line("/sys/devices/system/cpu/online"))) return *mask;
+
+		cpu_mask mask;
+		sched_getaffinity(0, sizeof(mask.m_set), &mask.m_set);
+		return mask;
+	}
+
+
+	cpu_mask cpu_mask::node(int node)
+	{
+		std::string list = read_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		return parse(list).value_or(cpu_mask{});
+	}
+
+
+	cpu_mask cpu_mask::operator-(const cpu_mask &other) const noexcept
+	{
+		cpu_mask out = *this;
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		{
+			if (other.contains(cpu)) CPU_CLR(cpu, &out.m_set);
+		}
+		return out;
+	}
+
+
+	cpu_mask cpu_mask::operator&(const cpu_mask &other) const noexcept
+	{
+		cpu_mask out;
+		CPU_AND(&out.m_set, &m_set, &other.m_set);
+		return out;
+	}
+
+
+	cpu_mask cpu_mask::operator|(const cpu_mask &other) const noexcept
+	{
+		cpu_mask out;
+		CPU_OR(&out.m_set, &m_set, &other.m_set);
+		return out;
+	}
+
+
+	std::string cpu_mask::str() const
+	{
+		std::string out;
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		{
+			if (!contains(cpu)) continue;
+
+			int last = cpu;
+			while (contains(last + 1)) last++;
+			if (!out.empty()) out += ',';
+			out += std::to_string(cpu);
+			if (last > cpu) out.append("-").append(std::to_string(last));
+			cpu = last;
+		}
+		return out;
+	}
+
+
+	std::vector<thread_stats> read_threads(pid_t pid)
+	{
+		std::string proc = "/proc/" + std::to_string(pid);
+		std::vector<thread_stats> threads;
+
+		for (pid_t tid : list_tasks(proc))
+		{
+			std::string task = proc + "/task/" + std::to_string(tid);
+			std::ifstream status(task + "/status");
+			if (!status) continue;
+
+			thread_stats t;
+			t.tid = tid;
+			for (std::string line; std::getline(status, line);)
+			{
+				if (line.starts_with("Name:"))
+				{
+					size_t start = line.find_first_not_of(" \t", 5);
+					t.name = start == std::string::npos ? "" : line.substr(start);
+				}
+				else if (line.starts_with("voluntary_ctxt_switches:")) t.voluntary = field_value(line, 24);
+				else if (line.starts_with("nonvoluntary_ctxt_switches:")) t.involuntary = field_value(line, 27);
+				else if (line.starts_with("Cpus_allowed_list:"))
+				{
+					size_t start = line.find_first_not_of(" \t", 18);
+					if (start != std::string::npos) t.allowed = cpu_mask::parse(std::string_view(line).substr(start)).value_or(cpu_mask{});
+				}
+			}
+
+			std::ifstream sched(task + "/sched");
+			for (std::string line; std::getline(sched, line);)
+			{
+				if (!line.starts_with("se.nr_migrations")) continue;
+				t.migrations = field_value(line, line.find(':'));
+				break;
+			}
+
+			// The comm in stat may hold spaces, fields are counted from its closing parenthesis: processor is the 39th
+			std::string stat = read_line(task + "/stat");
+			size_t pos = stat.rfind(')');
+			for (int field = 2; pos != std::string::npos && field < 39; field++) pos = stat.find(' ', pos + 1);
+			if (pos != std::string::npos) t.cpu = static_cast<int>(field_value(stat, pos));
+
+			threads.push_back(std::move(t));
+		}
+		return threads;
+	}
+
+
+	cpu_mask supervisor_cpus(const placement_config &config)
+	{
+		cpu_mask all = cpu_mask::online();
+		cpu_mask rest = all;
+		if (config.main) rest = rest - *config.main;
+		if (config.workers) rest = rest - *config.workers;
+		return rest.empty() ? all : rest;
+	}
+
+
+	void pin_self(const cpu_mask &cpus)
+	{
+		for (pid_t tid : list_tasks("/proc/self"))
+		{
+			if (sched_setaffinity(tid, sizeof(cpu_set_t), &cpus.set()) < 0 && errno != ESRCH) utils::throw_errno("sched_setaffinity");
+		}
+	}
+
+
+	thread_placement::thread_placement(event_loop &loop, pid_t pid, const placement_config &config) : m_loop(loop), m_pid(pid), m_config(config)
+	{
+		scan();
+		m_timer = m_loop.add_timer(rescan_interval, rescan_interval, [this]() { scan(); });
+	}
+
+
+	thread_placement::~thread_placement()
+	{
+		m_loop.cancel_timer(*m_timer);
+	}
+
+
+	void thread_placement::scan()
+	{
+		std::string proc = "/proc/" + std::to_string(m_pid);
+		std::unordered_map<pid_t, std::optional<role>> seen;
+
+		for (pid_t tid : list_tasks(proc))
+		{
+			auto it = m_seen.find(tid);
+			if (it != m_seen.end())
+			{
+				seen.emplace(tid, it->second);
+				continue;
+			}
+
+			std::string name = read_line(proc + "/task/" + std::to_string(tid) + "/comm");
+			role r = name == "Server thread" ? role::main : name.starts_with("Worker-Main-") ? role::worker : role::other;
+
+			std::optional<cpu_mask> cpus = cpus_for(r);
+			if (!cpus)
+			{
+				seen.emplace(tid, std::nullopt);
+				continue;
+			}
+
+			if (sched_setaffinity(tid, sizeof(cpu_set_t), &cpus->set()) < 0)
+			{
+				if (errno != ESRCH && !std::exchange(m_warned, true))
+				{
+					cerr << "[mcsuper] Can't pin " << name << " to CPUs " << cpus->str() << ": " << std::strerror(errno) << endl;
+				}
+				seen.emplace(tid, std::nullopt);
+				continue;
+			}
+			seen.emplace(tid, r);
+			if (r == role::main) cout << "[mcsuper] Pinned the server's main thread to CPUs " << cpus->str() << endl;
+		}
+
+		// Forgetting threads that are gone keeps a recycled tid from inheriting a role
+		m_seen = std::move(seen);
+	}
+
+
+	std::optional<thread_placement::role> thread_placement::role_of(pid_t tid) const
+	{
+		auto it = m_seen.find(tid);
+		return it == m_seen.end() ? std::nullopt : it->second;
+	}
+
+
+	const char *thread_placement::role_name(role r) noexcept
+	{
+		switch (r)
+		{
+			case role::main: return "main";
+			case role::worker: return "worker";
+			default: return "other";
+		}
+	}
+
+
+	std::optional<cpu_mask> thread_placement::cpus_for(role r) const
+	{
+		// Without dedicated CPUs the affinity set before exec already covers every thread
+		if (!m_config.main && !m_config.workers) return std::nullopt;
+
+		cpu_mask base = m_config.server ? *m_config.server : m_config.numa_node >= 0 ? cpu_mask::node(m_config.numa_node) : cpu_mask::online();
+		if (base.empty()) base = cpu_mask::online();
+
+		if (r == role::main && m_config.main) return m_config.main;
+		if (r == role::worker && m_config.workers) return m_config.workers;
+
+		cpu_mask rest = base;
+		if (m_config.main) rest = rest - *m_config.main;
+		if (m_config.workers && r != role::worker) rest = rest - *m_config.workers;
+		return rest.empty() ? base : rest;
+	}
+
+} // End namespace mcsuper
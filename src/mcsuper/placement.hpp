@@ -0,0 +1,159 @@
+#pragma once
+#ifndef H_386120_SRC_PLACEMENT
+#define H_386120_SRC_PLACEMENT 1
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+#include <sched.h>
+#include <sys/types.h>
+
+#include "utils.hpp"
+#include "event_loop.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief A set of CPUs, parsed from and printed as a kernel cpulist such as "0-3,6"
+	 */
+	class cpu_mask
+	{
+		public:
+			/**
+			 * @brief Nothing if the list doesn't parse or names a CPU past CPU_SETSIZE
+			 */
+			static std::optional<cpu_mask> parse(std::string_view list);
+
+			/**
+			 * @brief The CPUs the kernel has online right now
+			 */
+			static cpu_mask online();
+
+			/**
+			 * @brief The CPUs of a NUMA node, empty if there's no such node
+			 */
+			static cpu_mask node(int node);
+
+			bool empty() const noexcept { return count() == 0; }
+			int count() const noexcept { return CPU_COUNT(&m_set); }
+			bool contains(int cpu) const noexcept { return cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &m_set); }
+
+			cpu_mask operator-(const cpu_mask &other) const noexcept;
+			cpu_mask operator&(const cpu_mask &other) const noexcept;
+			cpu_mask operator|(const cpu_mask &other) const noexcept;
+
+			const cpu_set_t &set() const noexcept { return m_set; }
+			std::string str() const;
+
+		private:
+			cpu_set_t m_set{};
+	};
+
+
+	/**
+	 * @brief Where the server and the supervisor may run, every part optional
+	 */
+	struct placement_config
+	{
+		// Every thread of the server, set before exec so the JVM starts there
+		std::optional<cpu_mask> server;
+		// The "Server thread" that runs the ticks, nothing else is let onto these
+		std::optional<cpu_mask> main;
+		// The "Worker-Main-N" chunk workers, kept apart from the server's other threads and the supervisor's
+		std::optional<cpu_mask> workers;
+		// NUMA node the server's memory comes from, -1 leaves it to the kernel
+		int numa_node = -1;
+
+		bool enabled() const noexcept { return server || main || workers || numa_node >= 0; }
+	};
+
+
+	/**
+	 * @brief Counters of one thread, from /proc/<pid>/task/<tid>
+	 */
+	struct thread_stats
+	{
+		pid_t tid = 0;
+		std::string name;
+		utils::tulong voluntary = 0;
+		utils::tulong involuntary = 0;
+		// Moves between CPUs, needs CONFIG_SCHED_DEBUG for /proc/.../sched, 0 without
+		utils::tulong migrations = 0;
+		// CPU it last ran on
+		int cpu = -1;
+		cpu_mask allowed;
+	};
+
+	/**
+	 * @brief Every thread of a process, skipping any that exit while being read
+	 */
+	std::vector<thread_stats> read_threads(pid_t pid);
+
+
+	/**
+	 * @brief The CPUs the supervisor's own threads keep to: all online ones but those dedicated to the
+	 * server's main thread and chunk workers, or all of them if that would leave none
+	 */
+	cpu_mask supervisor_cpus(const placement_config &config);
+
+	/**
+	 * @brief Restrict every thread of the calling process, and the threads it starts later, to cpus
+	 */
+	void pin_self(const cpu_mask &cpus);
+
+
+	/**
+	 * @brief Keeps the server's threads on their CPUs by name
+	 *
+	 * The JVM starts and names its threads long after exec, so the task list is rescanned on a timer and
+	 * threads not seen before are pinned according to their comm: "Server thread" to the main CPUs,
+	 * "Worker-Main-N" to the worker CPUs and the rest (GC, JIT, Netty) to whatever of the server's CPUs
+	 * neither of those claim
+	 */
+	class thread_placement
+	{
+		public:
+			enum class role
+			{
+				main,
+				worker,
+				other
+			};
+
+			thread_placement(event_loop &loop, pid_t pid, const placement_config &config);
+			~thread_placement();
+
+			thread_placement(const thread_placement &) = delete;
+			thread_placement &operator=(const thread_placement &) = delete;
+
+			/**
+			 * @brief Pin threads that appeared since the last scan
+			 */
+			void scan();
+
+			/**
+			 * @brief The role a thread was pinned for, nothing for threads not seen or left alone
+			 */
+			std::optional<role> role_of(pid_t tid) const;
+
+			static const char *role_name(role r) noexcept;
+
+		private:
+			std::optional<cpu_mask> cpus_for(role r) const;
+
+			event_loop &m_loop;
+			pid_t m_pid;
+			placement_config m_config;
+			std::unordered_map<pid_t, std::optional<role>> m_seen;
+			std::optional<event_loop::timer_id> m_timer;
+			// Reported once, a thread that can't be pinned usually means the CPU list is wrong
+			bool m_warned = false;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_386120_SRC_PLACEMENT
@@ -0,0 +1,110 @@
+#include "player_sessions.hpp"
+
+#include <algorithm>
+
+
+namespace mcsuper
+{
+	void player_sessions::start(clock::time_point now)
+	{
+		m_online.clear();
+		m_running = true;
+		set_empty(true, now);
+	}
+
+
+	void player_sessions::stop(clock::time_point now)
+	{
+		set_empty(false, now);
+		m_online.clear();
+		m_running = false;
+	}
+
+
+	void player_sessions::joined(std::string_view name, clock::time_point now)
+	{
+		if (!m_running) return;
+		m_online.try_emplace(std::string(name), now);
+		set_empty(false, now);
+	}
+
+
+	void player_sessions::left(std::string_view name, clock::time_point now)
+	{
+		if (!m_running) return;
+		m_online.erase(std::string(name));
+		if (m_online.empty()) set_empty(true, now);
+	}
+
+
+	void player_sessions::reconcile(const std::vector<std::string> &online, clock::time_point now)
+	{
+		if (!m_running) return;
+
+		std::unordered_map<std::string, clock::time_point> table;
+		for (const std::string &name : online)
+		{
+			auto it = m_online.find(name);
+			table.emplace(name, it != m_online.end() ? it->second : now);
+		}
+		m_online = std::move(table);
+		set_empty(m_online.empty(), now);
+	}
+
+
+	player_sessions::clock::duration player_sessions::idle_for(clock::time_point now) const noexcept
+	{
+		return m_empty_since ? now - *m_empty_since : clock::duration::zero();
+	}
+
+
+	player_sessions::clock::duration player_sessions::idle_total(clock::time_point now) const noexcept
+	{
+		return m_idle_total + idle_for(now);
+	}
+
+
+	std::vector<player_sessions::session> player_sessions::online() const
+	{
+		std::vector<session> out;
+		out.reserve(m_online.size());
+		for (const auto &[name, since] : m_online) out.push_back({ name, since });
+		std::sort(out.begin(), out.end(), [](const session &a, const session &b) { return a.since < b.since; });
+		return out;
+	}
+
+
+	void player_sessions::set_empty(bool empty, clock::time_point now)
+	{
+		if (empty && !m_empty_since) m_empty_since = now;
+		if (!empty && m_empty_since)
+		{
+			m_idle_total += now - *m_empty_since;
+			m_empty_since.reset();
+		}
+	}
+
+
+	std::optional<std::vector<std::string>> parse_player_list(std::string_view reply)
+	{
+		constexpr std::string_view marker = " players online:";
+		size_t at = reply.find(marker);
+		if (!reply.starts_with("There are ") || at == std::string_view::npos) return std::nullopt;
+		reply.remove_prefix(at + marker.size());
+
+		std::vector<std::string> names;
+		while (!reply.empty())
+		{
+			size_t comma = reply.find(',');
+			std::string_view name = reply.substr(0, comma);
+			while (name.starts_with(' ')) name.remove_prefix(1);
+			while (name.ends_with(' ') || name.ends_with('\n')) name.remove_suffix(1);
+			if (!name.empty()) names.emplace_back(name);
+
+			if (comma == std::string_view::npos) break;
+			reply.remove_prefix(comma + 1);
+		}
+		return names;
+	}
+
+} // End namespace mcsuper
@@ -0,0 +1,90 @@
+#pragma once
+#ifndef H_704162_SRC_PLAYER_SESSIONS
+#define H_704162_SRC_PLAYER_SESSIONS 1
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Who is online and since when, kept from the console's join and leave messages
+	 *
+	 * Only meaningful while the server runs: start() opens the table when the server is ready and stop()
+	 * closes it. Idle time is the time spent running with nobody online
+	 */
+	class player_sessions
+	{
+		public:
+			typedef std::chrono::steady_clock clock;
+
+			struct session
+			{
+				std::string name;
+				clock::time_point since;
+			};
+
+			/**
+			 * @brief The server is ready, nobody is online yet
+			 */
+			void start(clock::time_point now);
+
+			/**
+			 * @brief The server went down, everybody is gone
+			 */
+			void stop(clock::time_point now);
+
+			void joined(std::string_view name, clock::time_point now);
+			void left(std::string_view name, clock::time_point now);
+
+			/**
+			 * @brief Replace the table with an authoritative list of who is online, keeping known join times
+			 */
+			void reconcile(const std::vector<std::string> &online, clock::time_point now);
+
+			size_t count() const noexcept { return m_online.size(); }
+			bool running() const noexcept { return m_running; }
+
+			/**
+			 * @brief How long the server has been running with nobody online, zero if someone is
+			 */
+			clock::duration idle_for(clock::time_point now) const noexcept;
+
+			/**
+			 * @brief Idle time over every run so far, the current stretch included
+			 */
+			clock::duration idle_total(clock::time_point now) const noexcept;
+
+			/**
+			 * @brief Everyone online, longest-connected first
+			 */
+			std::vector<session> online() const;
+
+		private:
+			void set_empty(bool empty, clock::time_point now);
+
+			std::unordered_map<std::string, clock::time_point> m_online;
+			bool m_running = false;
+			// Set while the server runs with nobody online
+			std::optional<clock::time_point> m_empty_since;
+			clock::duration m_idle_total{ 0 };
+	};
+
+
+	/**
+	 * @brief Player names from the reply to the "list" command
+	 *
+	 * "There are 2 of a max of 20 players online: Alice, Bob". Nothing if the reply doesn't look like that
+	 */
+	std::optional<std::vector<std::string>> parse_player_list(std::string_view reply);
+
+} // End namespace mcsuper
+
+#endif // H_704162_SRC_PLAYER_SESSIONS
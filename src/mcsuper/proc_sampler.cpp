@@ -0,0 +1,370 @@
+#include "proc_sampler.hpp"
+
+#include <ctime>
+#include <cstdio>
+#include <fstream>
+#include <charconv>
+#include <stdexcept>
+#include <string_view>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		// Rescan the task directory every this many samples
+		constexpr size_t scan_every = 5;
+
+
+		utils::unique_fd open_proc(const std::string &path)
+		{
+			return utils::unique_fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+		}
+
+
+		/**
+		 * @brief Read a whole /proc file from the start through an open descriptor
+		 */
+		std::string_view read_at(int fd, char *buf, size_t size)
+		{
+			if (fd < 0) return {};
+			ssize_t n = pread(fd, buf, size, 0);
+			return n > 0 ? std::string_view(buf, n) : std::string_view();
+		}
+
+
+		utils::tulong to_number(std::string_view s)
+		{
+			while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+			utils::tulong out = 0;
+			std::from_chars(s.data(), s.data() + s.size(), out);
+			return out;
+		}
+
+
+		/**
+		 * @brief Fields of a stat line, 1-based as in proc(5), counted past the command name
+		 */
+		template<size_t N>
+		bool stat_fields(std::string_view stat, const std::array<size_t, N> &wanted, std::array<utils::tulong, N> &out)
+		{
+			size_t close = stat.rfind(')');
+			if (close == std::string_view::npos) return false;
+			stat.remove_prefix(close + 2);
+
+			// The state is field 3
+			size_t field = 3, found = 0;
+			while (!stat.empty() && found < N)
+			{
+				size_t sp = stat.find(' ');
+				std::string_view value = stat.substr(0, sp);
+				for (size_t i = 0; i < N; i++)
+				{
+					if (wanted[i] == field)
+					{
+						out[i] = to_number(value);
+						found++;
+					}
+				}
+				if (sp == std::string_view::npos) break;
+				stat.remove_prefix(sp + 1);
+				field++;
+			}
+			return found == N;
+		}
+
+
+		/**
+		 * @brief Value of a "key: value" line in status or io
+		 */
+		utils::tulong keyed(std::string_view text, std::string_view key)
+		{
+			size_t at = text.find(key);
+			if (at == std::string_view::npos) return 0;
+			text.remove_prefix(at + key.size());
+			return to_number(text.substr(0, text.find('\n')));
+		}
+
+
+		void put_varint(std::vector<utils::tuchar> &out, utils::tulong value)
+		{
+			while (value >= 0x80)
+			{
+				out.push_back(static_cast<utils::tuchar>(value | 0x80));
+				value >>= 7;
+			}
+			out.push_back(static_cast<utils::tuchar>(value));
+		}
+
+
+		utils::tulong get_varint(const std::vector<utils::tuchar> &in, size_t &pos)
+		{
+			utils::tulong value = 0;
+			for (unsigned shift = 0; pos < in.size() && shift < 64; shift += 7)
+			{
+				utils::tuchar byte = in[pos++];
+				value |= static_cast<utils::tulong>(byte & 0x7F) << shift;
+				if ((byte & 0x80) == 0) break;
+			}
+			return value;
+		}
+
+
+		// Counters can go backwards (a thread id, rss), zigzag keeps small negative deltas small
+		utils::tulong zigzag(utils::tulong delta)
+		{
+			auto s = static_cast<utils::tslong>(delta);
+			return static_cast<utils::tulong>((s << 1) ^ (s >> 63));
+		}
+
+
+		utils::tulong unzigzag(utils::tulong z)
+		{
+			return (z >> 1) ^ (~(z & 1) + 1);
+		}
+	}
+
+
+	proc_sampler::proc_sampler(pid_t pid, std::chrono::milliseconds interval, std::chrono::seconds history)
+		: m_pid(pid), m_interval(interval), m_started(std::chrono::steady_clock::now()), m_started_wall(std::chrono::system_clock::now())
+	{
+		auto per_block = m_interval * block_samples;
+		m_max_blocks = static_cast<size_t>((history + per_block - std::chrono::milliseconds(1)) / per_block) + 1;
+
+		std::string base = "/proc/" + std::to_string(pid);
+		m_stat = open_proc(base + "/stat");
+		if (!m_stat) utils::throw_errno("open " + base + "/stat");
+		m_status = open_proc(base + "/status");
+		// io needs ptrace access, which a child of ours normally grants
+		m_io = open_proc(base + "/io");
+		scan_threads();
+
+		m_thread = std::thread([this]() { run(); });
+	}
+
+
+	proc_sampler::~proc_sampler()
+	{
+		{
+			std::lock_guard lock(m_lock);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		m_thread.join();
+	}
+
+
+	void proc_sampler::run()
+	{
+		auto next = std::chrono::steady_clock::now();
+		std::unique_lock lock(m_lock);
+		while (!m_stop)
+		{
+			// Drifting would make the rates lie, step from the schedule rather than from when we woke
+			next += m_interval;
+			lock.unlock();
+			proc_sample sample;
+			bool ok = take(sample);
+			lock.lock();
+			if (ok) store(sample);
+
+			m_wake.wait_until(lock, next, [this]() { return m_stop; });
+		}
+	}
+
+
+	bool proc_sampler::take(proc_sample &out)
+	{
+		char buf[4096];
+		std::string_view stat = read_at(m_stat.get(), buf, sizeof(buf));
+
+		constexpr std::array<size_t, 6> wanted = { 10, 12, 14, 15, 20, 24 };
+		std::array<utils::tulong, 6> fields{};
+		if (!stat_fields(stat, wanted, fields)) return false;
+
+		out.v[proc_sample::time_ms] = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_started).count();
+		out.v[proc_sample::minflt] = fields[0];
+		out.v[proc_sample::majflt] = fields[1];
+		out.v[proc_sample::utime] = fields[2];
+		out.v[proc_sample::stime] = fields[3];
+		out.v[proc_sample::threads] = fields[4];
+		out.v[proc_sample::rss_pages] = fields[5];
+
+		std::string_view status = read_at(m_status.get(), buf, sizeof(buf));
+		out.v[proc_sample::voluntary_ctxt] = keyed(status, "\nvoluntary_ctxt_switches:");
+		out.v[proc_sample::nonvoluntary_ctxt] = keyed(status, "nonvoluntary_ctxt_switches:");
+
+		std::string_view io = read_at(m_io.get(), buf, sizeof(buf));
+		out.v[proc_sample::read_bytes] = keyed(io, "\nread_bytes:");
+		out.v[proc_sample::write_bytes] = keyed(io, "\nwrite_bytes:");
+
+		if (++m_since_scan >= scan_every || fields[4] != m_threads.size())
+		{
+			m_since_scan = 0;
+			scan_threads();
+		}
+
+		constexpr std::array<size_t, 2> thread_wanted = { 14, 15 };
+		for (auto it = m_threads.begin(); it != m_threads.end();)
+		{
+			std::array<utils::tulong, 2> ticks{};
+			if (!stat_fields(read_at(it->second.fd.get(), buf, sizeof(buf)), thread_wanted, ticks))
+			{
+				// Exited, its descriptor now reads nothing
+				it = m_threads.erase(it);
+				continue;
+			}
+
+			utils::tulong total = ticks[0] + ticks[1];
+			utils::tulong used = total - it->second.ticks;
+			it->second.ticks = total;
+			if (used > out.v[proc_sample::top_ticks])
+			{
+				out.v[proc_sample::top_ticks] = used;
+				out.v[proc_sample::top_tid] = static_cast<utils::tulong>(it->first);
+			}
+			++it;
+		}
+		return true;
+	}
+
+
+	void proc_sampler::scan_threads()
+	{
+		std::error_code ec;
+		fs::path tasks = "/proc/" + std::to_string(m_pid) + "/task";
+		for (const auto &entry : fs::directory_iterator(tasks, ec))
+		{
+			pid_t tid = 0;
+			std::string name = entry.path().filename().string();
+			std::from_chars(name.data(), name.data() + name.size(), tid);
+			if (tid <= 0 || m_threads.contains(tid)) continue;
+
+			thread_file file;
+			file.fd = open_proc(entry.path() / "stat");
+			if (!file.fd) continue;
+			file.comm = open_proc(entry.path() / "comm");
+
+			// Baseline now, or a thread's whole past lands on the first sample it shows up in
+			char buf[1024];
+			constexpr std::array<size_t, 2> wanted = { 14, 15 };
+			std::array<utils::tulong, 2> ticks{};
+			if (stat_fields(read_at(file.fd.get(), buf, sizeof(buf)), wanted, ticks)) file.ticks = ticks[0] + ticks[1];
+			m_threads.emplace(tid, std::move(file));
+		}
+
+		// Names are re-read every scan, exec and the JVM both rename threads after they start
+		std::lock_guard lock(m_lock);
+		for (const auto &[tid, file] : m_threads)
+		{
+			char buf[64];
+			std::string_view comm = read_at(file.comm.get(), buf, sizeof(buf));
+			if (comm.ends_with('\n')) comm.remove_suffix(1);
+			if (!comm.empty()) m_names[tid] = comm;
+		}
+	}
+
+
+	void proc_sampler::store(const proc_sample &sample)
+	{
+		if (m_blocks.empty() || m_in_block == block_samples)
+		{
+			m_blocks.emplace_back();
+			m_in_block = 0;
+			m_prev = {};
+			if (m_blocks.size() > m_max_blocks) m_blocks.pop_front();
+		}
+
+		std::vector<utils::tuchar> &block = m_blocks.back();
+		for (size_t i = 0; i < proc_sample::field_count; i++) put_varint(block, zigzag(sample.v[i] - m_prev.v[i]));
+		m_prev = sample;
+		m_in_block++;
+	}
+
+
+	std::vector<proc_sample> proc_sampler::samples() const
+	{
+		std::lock_guard lock(m_lock);
+		std::vector<proc_sample> out;
+		out.reserve(m_blocks.size() * block_samples);
+
+		for (const std::vector<utils::tuchar> &block : m_blocks)
+		{
+			proc_sample prev;
+			for (size_t pos = 0; pos < block.size();)
+			{
+				for (size_t i = 0; i < proc_sample::field_count; i++) prev.v[i] += unzigzag(get_varint(block, pos));
+				out.push_back(prev);
+			}
+		}
+		return out;
+	}
+
+
+	size_t proc_sampler::encoded_bytes() const
+	{
+		std::lock_guard lock(m_lock);
+		size_t total = 0;
+		for (const auto &block : m_blocks) total += block.size();
+		return total;
+	}
+
+
+	size_t proc_sampler::dump(const fs::path &path) const
+	{
+		std::vector<proc_sample> all = samples();
+		std::unordered_map<pid_t, std::string> names;
+		{
+			std::lock_guard lock(m_lock);
+			names = m_names;
+		}
+
+		double hz = static_cast<double>(sysconf(_SC_CLK_TCK));
+		long page = sysconf(_SC_PAGESIZE);
+
+		fs::path tmp = path;
+		tmp += ".tmp";
+		std::ofstream out(tmp, std::ios::trunc);
+		out << "time,cpu_pct,user_pct,sys_pct,minflt_s,majflt_s,threads,rss_mib,ctxsw_voluntary_s,ctxsw_involuntary_s,read_kib_s,write_kib_s,top_thread,top_thread_pct\n";
+
+		for (size_t i = 1; i < all.size(); i++)
+		{
+			const auto &a = all[i - 1].v;
+			const auto &b = all[i].v;
+			double secs = (b[proc_sample::time_ms] - a[proc_sample::time_ms]) / 1000.0;
+			if (secs <= 0) continue;
+			auto rate = [&](size_t f) { return (b[f] - a[f]) / secs; };
+			auto pct = [&](utils::tulong ticks) { return ticks / hz / secs * 100; };
+
+			std::time_t t = std::chrono::system_clock::to_time_t(m_started_wall + std::chrono::milliseconds(b[proc_sample::time_ms]));
+			char stamp[32];
+			std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", std::localtime(&t));
+
+			auto name = names.find(static_cast<pid_t>(b[proc_sample::top_tid]));
+			std::string top = b[proc_sample::top_ticks] == 0 ? "" : name != names.end() ? name->second : std::to_string(b[proc_sample::top_tid]);
+			// Commas would break the row, a JVM names threads freely
+			for (char &c : top) if (c == ',' || c == '"') c = ' ';
+
+			char line[512];
+			std::snprintf(line, sizeof(line), "%s,%.1f,%.1f,%.1f,%.0f,%.0f,%llu,%.1f,%.0f,%.0f,%.0f,%.0f,%s,%.1f\n", stamp,
+			              pct(b[proc_sample::utime] + b[proc_sample::stime] - a[proc_sample::utime] - a[proc_sample::stime]),
+			              pct(b[proc_sample::utime] - a[proc_sample::utime]), pct(b[proc_sample::stime] - a[proc_sample::stime]),
+			              rate(proc_sample::minflt), rate(proc_sample::majflt), static_cast<unsigned long long>(b[proc_sample::threads]),
+			              static_cast<double>(b[proc_sample::rss_pages] * page) / (1024 * 1024), rate(proc_sample::voluntary_ctxt),
+			              rate(proc_sample::nonvoluntary_ctxt), rate(proc_sample::read_bytes) / 1024, rate(proc_sample::write_bytes) / 1024,
+			              top.c_str(), pct(b[proc_sample::top_ticks]));
+			out << line;
+		}
+
+		out.close();
+		if (!out) throw std::runtime_error("can't write " + tmp.string());
+		fs::rename(tmp, path);
+		return all.size() < 2 ? 0 : all.size() - 1;
+	}
+
+} // End namespace mcsuper
@@ -0,0 +1,138 @@
+#pragma once
+#ifndef H_613579_SRC_PROC_SAMPLER
+#define H_613579_SRC_PROC_SAMPLER 1
+
+#include <array>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <filesystem>
+#include <unordered_map>
+#include <condition_variable>
+
+#include <sys/types.h>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief One reading of a process's counters, cumulative values as the kernel reports them
+	 */
+	struct proc_sample
+	{
+		enum field : size_t
+		{
+			// Milliseconds since the sampler started
+			time_ms,
+			utime,
+			stime,
+			minflt,
+			majflt,
+			threads,
+			rss_pages,
+			voluntary_ctxt,
+			nonvoluntary_ctxt,
+			read_bytes,
+			write_bytes,
+			// The thread that used the most CPU since the previous sample, and how many ticks
+			top_tid,
+			top_ticks,
+			field_count
+		};
+
+		std::array<utils::tulong, field_count> v{};
+	};
+
+
+	/**
+	 * @brief Samples /proc for a process at a fixed rate on its own thread and keeps the last hour
+	 *
+	 * The stat, status and io files of the process and the stat file of each of its threads are opened once
+	 * and re-read with pread, a sample costs a few syscalls and no path lookups. Thread files are rescanned
+	 * every few seconds as the JVM starts and stops threads.
+	 *
+	 * Samples are stored as zigzag varint deltas from the one before in blocks of 64, each block starting from
+	 * zero so it decodes on its own and the oldest can be dropped whole. Most counters move by a few units a
+	 * second, so an hour at 1s resolution is tens of kilobytes
+	 */
+	class proc_sampler
+	{
+		public:
+			static constexpr size_t block_samples = 64;
+
+			/**
+			 * @param history How far back samples are kept
+			 */
+			proc_sampler(pid_t pid, std::chrono::milliseconds interval, std::chrono::seconds history = std::chrono::hours(1));
+
+			/**
+			 * @brief Stops and joins the sampling thread
+			 */
+			~proc_sampler();
+
+			proc_sampler(const proc_sampler &) = delete;
+			proc_sampler &operator=(const proc_sampler &) = delete;
+
+			/**
+			 * @brief Every sample still held, oldest first
+			 */
+			std::vector<proc_sample> samples() const;
+
+			/**
+			 * @brief Write the history as CSV with per-second rates, temp file and rename
+			 *
+			 * @return size_t Samples written
+			 */
+			size_t dump(const std::filesystem::path &path) const;
+
+			/**
+			 * @brief Bytes the encoded history takes
+			 */
+			size_t encoded_bytes() const;
+
+		private:
+			struct thread_file
+			{
+				utils::unique_fd fd;
+				utils::unique_fd comm;
+				utils::tulong ticks = 0;
+			};
+
+			void run();
+			bool take(proc_sample &out);
+			void scan_threads();
+			void store(const proc_sample &sample);
+
+			pid_t m_pid;
+			std::chrono::milliseconds m_interval;
+			size_t m_max_blocks;
+			std::chrono::steady_clock::time_point m_started;
+			std::chrono::system_clock::time_point m_started_wall;
+
+			// Only touched by the sampling thread
+			utils::unique_fd m_stat;
+			utils::unique_fd m_status;
+			utils::unique_fd m_io;
+			std::unordered_map<pid_t, thread_file> m_threads;
+			size_t m_since_scan = 0;
+
+			mutable std::mutex m_lock;
+			std::deque<std::vector<utils::tuchar>> m_blocks;
+			size_t m_in_block = 0;
+			proc_sample m_prev;
+			// Names of every thread seen, so the dump can say which one was busy
+			std::unordered_map<pid_t, std::string> m_names;
+
+			bool m_stop = false;
+			std::condition_variable m_wake;
+			std::thread m_thread;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_613579_SRC_PROC_SAMPLER
@@ -0,0 +1,292 @@
+#include "process.hpp"
+
+#include <csignal>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+#include <linux/mempolicy.h>
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		/**
+		 * @brief Make a close-on-exec pipe, index 0 is the read end
+		 */
+		std::pair<utils::unique_fd, utils::unique_fd> make_pipe()
+		{
+			int fds[2];
+			if (pipe2(fds, O_CLOEXEC) < 0) utils::throw_errno("pipe2");
+			return { utils::unique_fd(fds[0]), utils::unique_fd(fds[1]) };
+		}
+
+
+		// Called through syscall(), older glibc headers don't declare these for C++
+		int sys_pidfd_open(pid_t pid)
+		{
+			return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+		}
+
+
+		int sys_pidfd_send_signal(int pidfd, int sig)
+		{
+			return static_cast<int>(syscall(SYS_pidfd_send_signal, pidfd, sig, nullptr, 0));
+		}
+
+
+		/**
+		 * @brief Move a running process into the cgroup whose directory is open as dirfd
+		 *
+		 * @return bool False with errno set if the kernel refused
+		 */
+		bool join_cgroup(int dirfd, pid_t pid)
+		{
+			utils::unique_fd procs(openat(dirfd, "cgroup.procs", O_WRONLY | O_CLOEXEC));
+			std::string text = std::to_string(pid);
+			return procs && ::write(procs.get(), text.data(), text.size()) >= 0;
+		}
+
+
+		void set_nonblocking(int fd)
+		{
+			int flags = fcntl(fd, F_GETFL);
+			if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) utils::throw_errno("fcntl(O_NONBLOCK)");
+		}
+
+
+		// Bitmask for set_mempolicy, one bit per node
+		typedef std::array<unsigned long, 16> node_mask;
+		constexpr unsigned long max_nodes = sizeof(node_mask) * 8;
+
+
+		/**
+		 * @brief Runs in the child between clone3 and exec, only async-signal-safe calls from here on
+		 *
+		 * Affinity and memory policy both survive exec, so the JVM's first allocation and thread already
+		 * follow them
+		 */
+		[[noreturn]] void exec_child(char *const *argv, const char *workdir, int in, int out, int err, const cpu_set_t *cpus, const node_mask *nodes)
+		{
+			// The supervisor blocks signals for its signalfd and ignores SIGPIPE, neither should leak into the server
+			sigset_t none;
+			sigemptyset(&none);
+			sigprocmask(SIG_SETMASK, &none, nullptr);
+			::signal(SIGPIPE, SIG_DFL);
+
+			// Own process group, so a ^C on the terminal reaches the supervisor only and it decides how to stop the server
+			setpgid(0, 0);
+
+			if (workdir != nullptr && chdir(workdir) < 0) _exit(127);
+			if (cpus != nullptr && sched_setaffinity(0, sizeof(cpu_set_t), cpus) < 0) _exit(127);
+
+			// Preferred rather than bound, a full node spills over instead of invoking the OOM killer
+			if (nodes != nullptr) syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodes->data(), max_nodes);
+
+			if (dup2(in, STDIN_FILENO) < 0 || dup2(out, STDOUT_FILENO) < 0 || dup2(err, STDERR_FILENO) < 0) _exit(127);
+			close_range(3, ~0U, 0);
+
+			execvp(argv[0], argv);
+			_exit(127);
+		}
+	}
+
+
+	child_process child_process::spawn(const spawn_options &opts)
+	{
+		if (opts.argv.empty()) throw std::invalid_argument("spawn: empty command");
+
+		// Build everything the child needs before forking, it can't allocate afterwards
+		std::vector<char *> argv;
+		for (const std::string &arg : opts.argv) argv.push_back(const_cast<char *>(arg.c_str()));
+		argv.push_back(nullptr);
+
+		std::string workdir = opts.workdir.string();
+		const char *cwd = workdir.empty() ? nullptr : workdir.c_str();
+
+		const cpu_set_t *cpus = opts.cpus ? &*opts.cpus : nullptr;
+		node_mask nodes{};
+		if (opts.numa_node >= 0 && static_cast<unsigned long>(opts.numa_node) < max_nodes)
+		{
+			nodes[opts.numa_node / (sizeof(unsigned long) * 8)] |= 1ul << (opts.numa_node % (sizeof(unsigned long) * 8));
+		}
+		const node_mask *numa = opts.numa_node >= 0 ? &nodes : nullptr;
+
+		auto [in_r, in_w]   = make_pipe();
+		auto [out_r, out_w] = make_pipe();
+		auto [err_r, err_w] = make_pipe();
+
+		child_process child;
+
+		int pidfd = -1;
+		clone_args args{};
+		args.flags       = CLONE_PIDFD;
+		args.pidfd       = reinterpret_cast<utils::tulong>(&pidfd);
+		args.exit_signal = SIGCHLD;
+		if (opts.cgroup >= 0)
+		{
+			args.flags |= CLONE_INTO_CGROUP;
+			args.cgroup = static_cast<utils::tulong>(opts.cgroup);
+		}
+
+		long pid = syscall(SYS_clone3, &args, sizeof(args));
+		if (pid == 0) exec_child(argv.data(), cwd, in_r.get(), out_w.get(), err_w.get(), cpus, numa);
+
+		if (pid > 0)
+		{
+			child.m_pid = static_cast<pid_t>(pid);
+			child.m_pidfd.reset(pidfd);
+		}
+		else if (errno == ENOSYS || errno == EPERM || (opts.cgroup >= 0 && (errno == EINVAL || errno == E2BIG)))
+		{
+			// Old kernel or a seccomp filter refusing clone3, or a kernel before 5.7 without CLONE_INTO_CGROUP
+			posix_spawn_file_actions_t actions;
+			posix_spawnattr_t attr;
+			posix_spawn_file_actions_init(&actions);
+			posix_spawnattr_init(&attr);
+
+			if (cwd != nullptr) posix_spawn_file_actions_addchdir_np(&actions, cwd);
+			posix_spawn_file_actions_adddup2(&actions, in_r.get(), STDIN_FILENO);
+			posix_spawn_file_actions_adddup2(&actions, out_w.get(), STDOUT_FILENO);
+			posix_spawn_file_actions_adddup2(&actions, err_w.get(), STDERR_FILENO);
+
+			sigset_t none, defaults;
+			sigemptyset(&none);
+			sigemptyset(&defaults);
+			sigaddset(&defaults, SIGPIPE);
+			posix_spawnattr_setsigmask(&attr, &none);
+			posix_spawnattr_setsigdefault(&attr, &defaults);
+			posix_spawnattr_setpgroup(&attr, 0);
+			posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+			pid_t spawned;
+			int rc = posix_spawnp(&spawned, argv[0], &actions, &attr, argv.data(), environ);
+			posix_spawn_file_actions_destroy(&actions);
+			posix_spawnattr_destroy(&attr);
+			if (rc != 0) throw std::system_error(rc, std::generic_category(), "posix_spawnp");
+
+			child.m_pid = spawned;
+			child.m_pidfd.reset(sys_pidfd_open(spawned));
+			if (!child.m_pidfd) utils::throw_errno("pidfd_open");
+
+			// Late, the child may already be running, but whatever the server starts from here is in it.
+			// A server quietly running outside its limits is worse than one that doesn't start
+			if (opts.cgroup >= 0 && !join_cgroup(opts.cgroup, spawned))
+			{
+				int error = errno;
+				child.signal(SIGKILL);
+				child.wait();
+				throw std::system_error(error, std::generic_category(), "cgroup.procs");
+			}
+
+			// Threads the child has already started keep the supervisor's CPUs, and its memory policy can't be set from here
+			if (cpus != nullptr) sched_setaffinity(spawned, sizeof(cpu_set_t), cpus);
+		}
+		else
+		{
+			utils::throw_errno("clone3");
+		}
+
+		set_nonblocking(out_r.get());
+		set_nonblocking(err_r.get());
+
+		child.m_stdin  = std::move(in_w);
+		child.m_stdout = std::move(out_r);
+		child.m_stderr = std::move(err_r);
+		return child;
+	}
+
+
+	bool child_process::signal(int sig) const noexcept
+	{
+		return m_pidfd && sys_pidfd_send_signal(m_pidfd.get(), sig) == 0;
+	}
+
+
+	exit_status child_process::wait()
+	{
+		siginfo_t info{};
+		while (waitid(static_cast<idtype_t>(P_PIDFD), m_pidfd.get(), &info, WEXITED) < 0)
+		{
+			if (errno != EINTR) utils::throw_errno("waitid");
+		}
+
+		m_pidfd.reset();
+
+		exit_status status;
+		status.exited = info.si_code == CLD_EXITED;
+		status.code   = info.si_status;
+		return status;
+	}
+
+
+	utils::tulong resident_bytes(pid_t pid)
+	{
+		std::string base = "/proc/" + std::to_string(pid);
+		utils::tulong total = 0;
+
+		std::ifstream status(base + "/status");
+		for (std::string line; std::getline(status, line);)
+		{
+			// "VmRSS:	  123456 kB"
+			if (!line.starts_with("VmRSS:")) continue;
+			total = std::stoull(line.substr(6)) * 1024;
+			break;
+		}
+
+		std::error_code ec;
+		for (const auto &task : std::filesystem::directory_iterator(base + "/task", ec))
+		{
+			std::ifstream children(task.path() / "children");
+			for (pid_t child; children >> child;) total += resident_bytes(child);
+		}
+		return total;
+	}
+
+
+	std::optional<process_usage> read_usage(pid_t pid)
+	{
+		std::string base = "/proc/" + std::to_string(pid);
+		std::ifstream stat_file(base + "/stat");
+		std::string stat;
+		if (!std::getline(stat_file, stat)) return std::nullopt;
+
+		// The command name may hold spaces and parentheses, fields are counted from the last ')'
+		size_t close = stat.rfind(')');
+		if (close == std::string::npos) return std::nullopt;
+		std::istringstream fields(stat.substr(close + 2));
+
+		// Field 3 is the state, utime and stime are 14 and 15, num_threads is 20
+		std::string field;
+		utils::tulong utime = 0, stime = 0;
+		process_usage usage;
+		for (int i = 3; i <= 20 && fields >> field; i++)
+		{
+			if (i == 14) utime = std::stoull(field);
+			else if (i == 15) stime = std::stoull(field);
+			else if (i == 20) usage.threads = std::stoull(field);
+		}
+		usage.cpu_seconds = static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+
+		std::ifstream rollup(base + "/smaps_rollup");
+		for (std::string line; std::getline(rollup, line);)
+		{
+			// "Rss:              123456 kB"
+			utils::tulong *into = line.starts_with("Rss:") ? &usage.rss_bytes : line.starts_with("Pss:") ? &usage.pss_bytes
+			                    : line.starts_with("Swap:") ? &usage.swap_bytes : nullptr;
+			if (into) *into = std::stoull(line.substr(line.find(':') + 1)) * 1024;
+		}
+		return usage;
+	}
+
+} // End namespace mcsuper
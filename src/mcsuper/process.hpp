@@ -0,0 +1,126 @@
+#pragma once
+#ifndef H_208817_SRC_PROCESS
+#define H_208817_SRC_PROCESS 1
+
+#include <string>
+#include <optional>
+#include <vector>
+#include <filesystem>
+
+#include <sched.h>
+#include <sys/types.h>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief What to launch and where
+	 */
+	struct spawn_options
+	{
+		// argv[0] is looked up in PATH
+		std::vector<std::string> argv;
+		// Empty means inherit the supervisor's working directory
+		std::filesystem::path workdir;
+		// Directory descriptor of the cgroup v2 to start the child in, -1 for the supervisor's own
+		int cgroup = -1;
+		// CPUs the child and every thread it starts may run on, nothing inherits the supervisor's
+		std::optional<cpu_set_t> cpus;
+		// NUMA node the child's memory is preferably taken from, -1 for the kernel's default policy
+		int numa_node = -1;
+	};
+
+
+	/**
+	 * @brief How a child finished, decoded from waitid
+	 */
+	struct exit_status
+	{
+		// True if the child called exit, false if a signal killed it
+		bool exited = false;
+		// Exit code or terminating signal number
+		int code = 0;
+	};
+
+
+	/**
+	 * @brief A spawned child tracked by a pidfd, with pipes for its standard streams
+	 *
+	 * The pidfd becomes readable once the child exits, so it can sit in the event loop next to the pipes
+	 * instead of relying on SIGCHLD. All descriptors are close-on-exec and the output pipes are non-blocking
+	 */
+	class child_process
+	{
+		public:
+			/**
+			 * @brief Launch a child in its own process group with a clean signal mask
+			 *
+			 * Uses clone3(CLONE_PIDFD) so the pidfd can never refer to a recycled pid, and CLONE_INTO_CGROUP so
+			 * the child is in its cgroup before it runs a single instruction, falling back to posix_spawn +
+			 * pidfd_open and moving the child afterwards on kernels without either
+			 */
+			static child_process spawn(const spawn_options &opts);
+
+			pid_t pid() const noexcept { return m_pid; }
+			int pidfd() const noexcept { return m_pidfd.get(); }
+
+			// Write end of the child's stdin
+			utils::unique_fd &in() noexcept { return m_stdin; }
+			// Read end of the child's stdout
+			utils::unique_fd &out() noexcept { return m_stdout; }
+			// Read end of the child's stderr
+			utils::unique_fd &err() noexcept { return m_stderr; }
+
+			/**
+			 * @brief Send a signal through the pidfd
+			 *
+			 * @return bool False if the child has already been reaped
+			 */
+			bool signal(int sig) const noexcept;
+
+			/**
+			 * @brief Reap the child, only call once the pidfd is readable (or to block until it exits)
+			 */
+			exit_status wait();
+
+		private:
+			pid_t m_pid = -1;
+			utils::unique_fd m_pidfd;
+			utils::unique_fd m_stdin;
+			utils::unique_fd m_stdout;
+			utils::unique_fd m_stderr;
+	};
+
+
+	/**
+	 * @brief Resident memory of a process and all of its descendants, in bytes
+	 *
+	 * Counts a launcher script's JVM along with the script. Zero once the process is gone
+	 */
+	utils::tulong resident_bytes(pid_t pid);
+
+
+	/**
+	 * @brief What a single process costs right now
+	 */
+	struct process_usage
+	{
+		// User plus system time
+		double cpu_seconds = 0;
+		utils::tulong threads = 0;
+		// From smaps_rollup, proportional set size splits shared pages between their users
+		utils::tulong rss_bytes = 0;
+		utils::tulong pss_bytes = 0;
+		utils::tulong swap_bytes = 0;
+	};
+
+	/**
+	 * @brief Read /proc/<pid>/stat and smaps_rollup, nothing if the process is gone
+	 */
+	std::optional<process_usage> read_usage(pid_t pid);
+
+} // End namespace mcsuper
+
+#endif // H_208817_SRC_PROCESS
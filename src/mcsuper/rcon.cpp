@@ -0,0 +1,318 @@
+#include "rcon.hpp"
+
+#include <cstring>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+using std::cerr, std::endl;
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		constexpr utils::tsint type_response = 0;
+		constexpr utils::tsint type_command  = 2;
+		constexpr utils::tsint type_auth     = 3;
+
+		// Header after the length field (id + type) plus the two trailing NULs
+		constexpr size_t packet_overhead = 10;
+		// Replies are fragmented at 4096 bytes, anything far bigger means we've lost framing
+		constexpr size_t max_packet = 1 << 16;
+
+
+		void put_le32(std::string &out, utils::tsint v)
+		{
+			utils::tuint u = static_cast<utils::tuint>(v);
+			char b[4] = { static_cast<char>(u), static_cast<char>(u >> 8), static_cast<char>(u >> 16), static_cast<char>(u >> 24) };
+			out.append(b, 4);
+		}
+
+
+		utils::tsint get_le32(const char *p)
+		{
+			const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+			return static_cast<utils::tsint>(u[0] | u[1] << 8 | u[2] << 16 | static_cast<utils::tuint>(u[3]) << 24);
+		}
+	}
+
+
+	rcon_client::rcon_client(event_loop &loop, std::string host, utils::tushort port, std::string password)
+		: m_loop(loop), m_host(std::move(host)), m_port(port), m_password(std::move(password))
+	{
+	}
+
+
+	rcon_client::~rcon_client()
+	{
+		// Every handler still runs once, closed first so the shutdown isn't reported as a connection problem
+		m_state = state::closed;
+		fail("RCON client shut down");
+	}
+
+
+	void rcon_client::connect(ready_handler on_ready)
+	{
+		if (m_state != state::closed) return;
+		m_on_ready = std::move(on_ready);
+
+		addrinfo hints{};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		addrinfo *res = nullptr;
+		std::string port = std::to_string(m_port);
+		if (getaddrinfo(m_host.c_str(), port.c_str(), &hints, &res) != 0 || res == nullptr)
+		{
+			fail("can't resolve host");
+			return;
+		}
+
+		m_sock.reset(socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+		int rc = m_sock ? ::connect(m_sock.get(), res->ai_addr, res->ai_addrlen) : -1;
+		freeaddrinfo(res);
+
+		if (rc < 0 && errno != EINPROGRESS)
+		{
+			fail(strerror(errno));
+			return;
+		}
+
+		m_state = state::connecting;
+		m_want_write = true;
+		m_loop.add(m_sock.get(), EPOLLIN | EPOLLOUT, [this](utils::tuint events) { on_socket(events); });
+	}
+
+
+	void rcon_client::command(std::string_view cmd, reply_handler on_reply)
+	{
+		if (cmd.size() > max_command)
+		{
+			on_reply(false, "command too long for RCON");
+			return;
+		}
+
+		if (m_state == state::ready) send_command(cmd, std::move(on_reply));
+		else if (m_state == state::closed) on_reply(false, "RCON not connected");
+		else m_queued.emplace_back(std::string(cmd), std::move(on_reply));
+	}
+
+
+	void rcon_client::close()
+	{
+		if (m_state == state::closed) return;
+		fail("connection closed");
+	}
+
+
+	void rcon_client::on_socket(utils::tuint events)
+	{
+		if (m_state == state::connecting)
+		{
+			int err = 0;
+			socklen_t len = sizeof(err);
+			getsockopt(m_sock.get(), SOL_SOCKET, SO_ERROR, &err, &len);
+
+			if (err != 0)
+			{
+				fail(strerror(err));
+				return;
+			}
+			if (!(events & EPOLLOUT)) return;
+
+			on_connected();
+			return;
+		}
+
+		if (events & EPOLLIN)
+		{
+			char buf[16384];
+			for (;;)
+			{
+				ssize_t n = ::read(m_sock.get(), buf, sizeof(buf));
+				if (n > 0)
+				{
+					m_in.append(buf, n);
+					continue;
+				}
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0 && errno == EAGAIN) break;
+
+				fail(n == 0 ? "server closed the connection" : strerror(errno));
+				return;
+			}
+
+			size_t pos = 0;
+			while (m_in.size() - pos >= 4)
+			{
+				utils::tsint len = get_le32(m_in.data() + pos);
+				if (len < static_cast<utils::tsint>(packet_overhead) || static_cast<size_t>(len) > max_packet)
+				{
+					fail("malformed packet");
+					return;
+				}
+				if (m_in.size() - pos < 4 + static_cast<size_t>(len)) break;
+
+				const char *p = m_in.data() + pos + 4;
+				std::string_view body(p + 8, len - packet_overhead);
+				pos += 4 + len;
+
+				on_packet(get_le32(p), get_le32(p + 4), body);
+
+				// A reply handler closed (or closed and reopened) the connection, m_in is no longer ours to parse
+				if (m_state != state::ready && m_state != state::authenticating) return;
+			}
+			m_in.erase(0, pos);
+		}
+
+		if (events & (EPOLLHUP | EPOLLERR))
+		{
+			fail("connection lost");
+			return;
+		}
+
+		if ((events & EPOLLOUT) && m_want_write) flush();
+	}
+
+
+	void rcon_client::on_connected()
+	{
+		int one = 1;
+		setsockopt(m_sock.get(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		m_state = state::authenticating;
+		send_packet(auth_id, type_auth, m_password);
+	}
+
+
+	void rcon_client::on_packet(utils::tsint id, utils::tsint type, std::string_view body)
+	{
+		if (m_state == state::authenticating)
+		{
+			// Source servers send an empty response before the auth result, Minecraft doesn't, ignore it either way
+			if (type == type_response) return;
+
+			if (id == -1)
+			{
+				fail("wrong RCON password");
+				return;
+			}
+			if (id != auth_id) return;
+
+			m_state = state::ready;
+			auto queued = std::move(m_queued);
+			m_queued.clear();
+			for (auto &[cmd, on_reply] : queued) send_command(cmd, std::move(on_reply));
+
+			if (m_on_ready) std::exchange(m_on_ready, {})(true);
+			return;
+		}
+
+		if (m_pending.empty()) return;
+		pending &front = m_pending.front();
+
+		if (id == front.id)
+		{
+			front.reply.append(body);
+		}
+		else if (id == front.id + 1)
+		{
+			// The sentinel's reply, everything for the command has arrived
+			pending done = std::move(front);
+			m_pending.pop_front();
+			done.on_reply(true, std::move(done.reply));
+		}
+	}
+
+
+	void rcon_client::send_command(std::string_view cmd, reply_handler on_reply)
+	{
+		utils::tsint id = m_next_id;
+		m_next_id += 2;
+		if (m_next_id >= auth_id - 1) m_next_id = 1;
+
+		m_pending.push_back({ id, {}, std::move(on_reply) });
+		send_packet(id, type_command, cmd);
+		send_packet(id + 1, type_response, {});
+	}
+
+
+	void rcon_client::send_packet(utils::tsint id, utils::tsint type, std::string_view body)
+	{
+		put_le32(m_out, static_cast<utils::tsint>(body.size() + packet_overhead));
+		put_le32(m_out, id);
+		put_le32(m_out, type);
+		m_out.append(body);
+		m_out.append(2, '\0');
+
+		// Only write straight away if the socket isn't already backed up, otherwise EPOLLOUT will flush
+		if (!m_want_write) flush();
+	}
+
+
+	void rcon_client::flush()
+	{
+		while (m_out_pos < m_out.size())
+		{
+			ssize_t n = ::send(m_sock.get(), m_out.data() + m_out_pos, m_out.size() - m_out_pos, MSG_NOSIGNAL);
+			if (n > 0)
+			{
+				m_out_pos += n;
+				continue;
+			}
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0 && errno == EAGAIN) break;
+
+			fail(strerror(errno));
+			return;
+		}
+
+		if (m_out_pos == m_out.size())
+		{
+			m_out.clear();
+			m_out_pos = 0;
+		}
+
+		bool want = m_out_pos < m_out.size();
+		if (want != m_want_write)
+		{
+			m_want_write = want;
+			update_interest();
+		}
+	}
+
+
+	void rcon_client::update_interest()
+	{
+		m_loop.modify(m_sock.get(), EPOLLIN | (m_want_write ? static_cast<utils::tuint>(EPOLLOUT) : 0));
+	}
+
+
+	void rcon_client::fail(const char *why)
+	{
+		if (m_state != state::ready && m_state != state::closed) cerr << "[mcsuper] RCON " << m_host << ":" << m_port << ": " << why << endl;
+
+		if (m_sock) m_loop.remove(m_sock.get());
+		m_sock.reset();
+		m_state = state::closed;
+		m_in.clear();
+		m_out.clear();
+		m_out_pos = 0;
+		m_want_write = false;
+
+		// Handlers may queue new commands or reconnect, so detach everything first
+		auto pending = std::move(m_pending);
+		auto queued = std::move(m_queued);
+		auto on_ready = std::exchange(m_on_ready, {});
+		m_pending.clear();
+		m_queued.clear();
+
+		for (auto &p : pending) p.on_reply(false, why);
+		for (auto &[cmd, on_reply] : queued) on_reply(false, why);
+		if (on_ready) on_ready(false);
+	}
+
+} // End namespace mcsuper
@@ -0,0 +1,120 @@
+#pragma once
+#ifndef H_493317_SRC_RCON
+#define H_493317_SRC_RCON 1
+
+#include <deque>
+#include <string>
+#include <functional>
+#include <string_view>
+
+#include "utils.hpp"
+#include "event_loop.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Non-blocking Source RCON client living on the supervisor's event loop
+	 *
+	 * Any number of commands may be outstanding at once, they are written back to back without waiting for
+	 * replies. The server answers in order and may split a long reply over several packets with the same id,
+	 * so each command is followed by an empty type-0 packet: the server's reply to that sentinel can only
+	 * arrive after the last fragment of the command's reply, which marks it complete
+	 */
+	class rcon_client
+	{
+		public:
+			/**
+			 * @brief Called with the full reply, ok is false if the connection dropped or auth failed
+			 */
+			typedef std::function<void(bool ok, std::string reply)> reply_handler;
+
+			/**
+			 * @brief Called once the connection is authenticated (true) or has failed (false)
+			 */
+			typedef std::function<void(bool ok)> ready_handler;
+
+			// Longest command body the vanilla server accepts in one packet
+			static constexpr size_t max_command = 1446;
+
+			rcon_client(event_loop &loop, std::string host, utils::tushort port, std::string password);
+
+			/**
+			 * @brief Fails everything outstanding, as close() does
+			 */
+			~rcon_client();
+
+			rcon_client(const rcon_client &) = delete;
+			rcon_client &operator=(const rcon_client &) = delete;
+
+			/**
+			 * @brief Start connecting and authenticating, commands queued before this completes are sent afterwards
+			 */
+			void connect(ready_handler on_ready = {});
+
+			/**
+			 * @brief Queue a command, on_reply runs exactly once
+			 */
+			void command(std::string_view cmd, reply_handler on_reply);
+
+			/**
+			 * @brief Drop the connection, failing everything outstanding
+			 */
+			void close();
+
+			bool connected() const noexcept { return m_state == state::ready; }
+			bool connecting() const noexcept { return m_state == state::connecting || m_state == state::authenticating; }
+			size_t outstanding() const noexcept { return m_pending.size() + m_queued.size(); }
+
+		private:
+			enum class state
+			{
+				closed,
+				connecting,
+				authenticating,
+				ready
+			};
+
+			struct pending
+			{
+				utils::tsint id;
+				std::string reply;
+				reply_handler on_reply;
+			};
+
+			void on_socket(utils::tuint events);
+			void on_connected();
+			void on_packet(utils::tsint id, utils::tsint type, std::string_view body);
+			void send_packet(utils::tsint id, utils::tsint type, std::string_view body);
+			void send_command(std::string_view cmd, reply_handler on_reply);
+			void flush();
+			void update_interest();
+			void fail(const char *why);
+
+			event_loop &m_loop;
+			std::string m_host;
+			utils::tushort m_port;
+			std::string m_password;
+
+			utils::unique_fd m_sock;
+			state m_state = state::closed;
+			ready_handler m_on_ready;
+
+			// Ids count up from 1, each command takes one for itself and one for its sentinel
+			utils::tsint m_next_id = 1;
+			static constexpr utils::tsint auth_id = 0x7fffffff;
+
+			// Commands written to the socket in order of sending, each waiting for its sentinel
+			std::deque<pending> m_pending;
+			// Commands queued while still connecting
+			std::deque<std::pair<std::string, reply_handler>> m_queued;
+
+			std::string m_out;
+			size_t m_out_pos = 0;
+			std::string m_in;
+			bool m_want_write = false;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_493317_SRC_RCON
@@ -0,0 +1,416 @@
+#include "region.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <charconv>
+#include <stdexcept>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "compress.hpp"
+
+using std::cerr, std::endl;
+
+namespace fs = std::filesystem;
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		constexpr size_t header_size = 2 * region_file::sector_size;
+
+		// region_writer flushes once this much is buffered
+		constexpr size_t buffer_size = 1 << 20;
+
+		// Buffers region_writer keeps in flight on its io_uring
+		constexpr size_t queue_depth = 4;
+
+
+		utils::tuint be32(const utils::tuchar *p)
+		{
+			return static_cast<utils::tuint>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+		}
+
+
+		/**
+		 * @brief Decompress a payload of a known codec into out
+		 */
+		void unpack(chunk_compression kind, const utils::tuchar *data, size_t len, std::vector<utils::tuchar> &out)
+		{
+			switch (kind)
+			{
+				case chunk_compression::gzip:
+				case chunk_compression::zlib:
+					inflate_stream(data, len, out);
+					return;
+
+				case chunk_compression::none:
+					out.assign(data, data + len);
+					return;
+
+				case chunk_compression::lz4:
+					lz4_decode_stream(data, len, out);
+					return;
+
+				default:
+					throw std::runtime_error("unsupported chunk compression " + std::to_string(static_cast<int>(kind)));
+			}
+		}
+	}
+
+
+	region_file::region_file(const fs::path &path) : m_path(path)
+	{
+		parse_name(path, m_x, m_z);
+
+		utils::unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOATIME));
+		if (!fd && errno == EPERM) fd.reset(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+		if (!fd) utils::throw_errno("open " + path.string());
+
+		struct stat st;
+		if (fstat(fd.get(), &st) < 0) utils::throw_errno("fstat " + path.string());
+		m_size = st.st_size;
+
+		// The game creates empty region files and only writes the header with the first chunk
+		if (m_size == 0) return;
+		if (m_size < header_size) throw std::runtime_error("truncated region header in " + path.string());
+
+		void *map = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+		if (map == MAP_FAILED) utils::throw_errno("mmap " + path.string());
+		m_map = static_cast<const utils::tuchar *>(map);
+
+		for (size_t i = 0; i < chunks; i++)
+		{
+			m_slots[i].location = be32(m_map + 4 * i);
+			m_slots[i].timestamp = be32(m_map + sector_size + 4 * i);
+		}
+	}
+
+
+	region_file::~region_file()
+	{
+		if (m_map != nullptr) munmap(const_cast<utils::tuchar *>(m_map), m_size);
+	}
+
+
+	bool region_file::parse_name(const fs::path &path, int &x, int &z)
+	{
+		std::string name = path.filename().string();
+		if (!name.starts_with("r.") || !name.ends_with(".mca")) return false;
+
+		const char *p = name.data() + 2;
+		const char *end = name.data() + name.size() - 4;
+
+		auto [after_x, ec_x] = std::from_chars(p, end, x);
+		if (ec_x != std::errc() || after_x == end || *after_x != '.') return false;
+		auto [after_z, ec_z] = std::from_chars(after_x + 1, end, z);
+		return ec_z == std::errc() && after_z == end;
+	}
+
+
+	void region_file::prefetch() const noexcept
+	{
+		if (m_map != nullptr) madvise(const_cast<utils::tuchar *>(m_map), m_size, MADV_WILLNEED);
+	}
+
+
+	size_t region_file::chunk_count() const noexcept
+	{
+		size_t n = 0;
+		for (const slot &s : m_slots) n += s.location != 0;
+		return n;
+	}
+
+
+	std::span<const utils::tuchar> region_file::raw_chunk(size_t index) const
+	{
+		if (!has_chunk(index)) return {};
+
+		utils::tulong start = utils::tulong(sector(index)) * sector_size;
+		utils::tulong span = utils::tulong(sector_count(index)) * sector_size;
+		if (start < header_size || start + 5 > m_size) throw std::runtime_error("chunk outside the file");
+
+		// Length counts the compression byte, and has to fit the sectors the header gave it
+		utils::tuint length = be32(m_map + start);
+		if (length == 0 || length + 4 > span || start + 4 + length > m_size) throw std::runtime_error("bad chunk length");
+
+		return { m_map + start, size_t(length) + 4 };
+	}
+
+
+	fs::path region_file::external_path(size_t index) const
+	{
+		return m_path.parent_path() / ("c." + std::to_string(chunk_x(index)) + "." + std::to_string(chunk_z(index)) + ".mcc");
+	}
+
+
+	bool region_file::read_chunk(size_t index, std::vector<utils::tuchar> &out) const
+	{
+		std::span<const utils::tuchar> raw = raw_chunk(index);
+		if (raw.empty()) return false;
+
+		utils::tuchar type = raw[4];
+		auto kind = static_cast<chunk_compression>(type & ~chunk_external);
+		if ((type & chunk_external) == 0)
+		{
+			unpack(kind, raw.data() + 5, raw.size() - 5, out);
+			return true;
+		}
+
+		// Oversized chunks (over 1 MiB compressed) live in their own file
+		fs::path external = external_path(index);
+		std::ifstream in(external, std::ios::binary);
+		if (!in) throw std::runtime_error("missing " + external.string());
+		std::vector<utils::tuchar> payload((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+		unpack(kind, payload.data(), payload.size(), out);
+		return true;
+	}
+
+
+	region_writer::region_writer(const fs::path &path) : m_path(path)
+	{
+		m_tmp = path;
+		m_tmp += ".tmp";
+		m_fd.reset(open(m_tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+		if (!m_fd) utils::throw_errno("open " + m_tmp.string());
+		m_buffer.reserve(buffer_size + 256 * region_file::sector_size);
+
+		try
+		{
+			m_ring.emplace(queue_depth);
+			m_writes.resize(queue_depth);
+		}
+		catch (const std::system_error &)
+		{
+			// No io_uring here, every flush is a plain pwrite
+		}
+	}
+
+
+	region_writer::~region_writer()
+	{
+		// The kernel may still be reading buffers we're about to free
+		while (m_ring && m_ring->pending() > 0)
+		{
+			try
+			{
+				m_ring->wait();
+			}
+			catch (const std::exception &)
+			{
+				break;
+			}
+		}
+
+		if (m_committed) return;
+		m_fd.reset();
+		std::error_code ec;
+		fs::remove(m_tmp, ec);
+	}
+
+
+	void region_writer::add(size_t index, utils::tuint timestamp, std::span<const utils::tuchar> payload)
+	{
+		size_t sectors = (payload.size() + region_file::sector_size - 1) / region_file::sector_size;
+		if (sectors == 0 || sectors > 255) throw std::runtime_error("chunk payload doesn't fit a region slot");
+
+		utils::tuint location = m_next_sector << 8 | static_cast<utils::tuint>(sectors);
+		for (int i = 0; i < 4; i++)
+		{
+			m_header[4 * index + i] = static_cast<utils::tuchar>(location >> (24 - 8 * i));
+			m_header[region_file::sector_size + 4 * index + i] = static_cast<utils::tuchar>(timestamp >> (24 - 8 * i));
+		}
+		m_next_sector += static_cast<utils::tuint>(sectors);
+
+		m_buffer.insert(m_buffer.end(), payload.begin(), payload.end());
+		m_buffer.resize(m_buffer.size() + sectors * region_file::sector_size - payload.size(), 0);
+		if (m_buffer.size() >= buffer_size) flush();
+	}
+
+
+	void region_writer::flush()
+	{
+		if (m_buffer.empty()) return;
+
+		if (m_ring)
+		{
+			// Hand the full buffer to the ring and carry on filling one whose write already landed
+			auto free_slot = [&]() { return std::find_if(m_writes.begin(), m_writes.end(), [](const pending_write &w) { return !w.busy; }); };
+			while (free_slot() == m_writes.end()) reap();
+
+			auto slot = free_slot();
+			slot->data.swap(m_buffer);
+			slot->offset = m_buffer_at;
+			slot->done = 0;
+			slot->busy = true;
+			m_buffer_at += slot->data.size();
+			m_buffer.clear();
+
+			queue(slot - m_writes.begin());
+			return;
+		}
+
+		const utils::tuchar *p = m_buffer.data();
+		size_t left = m_buffer.size();
+		while (left > 0)
+		{
+			ssize_t n = pwrite(m_fd.get(), p, left, m_buffer_at);
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0) utils::throw_errno("write " + m_tmp.string());
+			p += n;
+			left -= n;
+			m_buffer_at += n;
+		}
+		m_buffer.clear();
+	}
+
+
+	void region_writer::queue(size_t slot)
+	{
+		pending_write &w = m_writes[slot];
+		if (!m_ring->queue_write(m_fd.get(), w.data.data() + w.done, w.data.size() - w.done, w.offset + w.done, slot))
+		{
+			throw std::logic_error("io_uring submission queue full");
+		}
+		m_ring->submit();
+	}
+
+
+	void region_writer::reap()
+	{
+		io_ring::completion done = m_ring->wait();
+		pending_write &w = m_writes[done.user_data];
+
+		if (done.result < 0)
+		{
+			w.busy = false;
+			errno = -done.result;
+			utils::throw_errno("write " + m_tmp.string());
+		}
+		if (done.result == 0)
+		{
+			w.busy = false;
+			throw std::runtime_error("short write to " + m_tmp.string());
+		}
+
+		// Short writes are rare on regular files but legal, the rest goes back on the ring
+		w.done += done.result;
+		if (w.done < w.data.size()) queue(done.user_data);
+		else w.busy = false;
+	}
+
+
+	utils::tulong region_writer::commit()
+	{
+		flush();
+		while (m_ring && m_ring->pending() > 0) reap();
+
+		for (size_t done = 0; done < m_header.size();)
+		{
+			ssize_t n = pwrite(m_fd.get(), m_header.data() + done, m_header.size() - done, done);
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0) utils::throw_errno("write " + m_tmp.string());
+			done += n;
+		}
+
+		if (fsync(m_fd.get()) < 0) utils::throw_errno("fsync " + m_tmp.string());
+		m_fd.reset();
+		fs::rename(m_tmp, m_path);
+		m_committed = true;
+		return utils::tulong(m_next_sector) * region_file::sector_size;
+	}
+
+
+	std::vector<fs::path> find_regions(const fs::path &world)
+	{
+		std::vector<fs::path> regions;
+
+		// Both level layouts keep chunks in folders named "region", entities/ and poi/ are left alone
+		for (auto it = fs::recursive_directory_iterator(world); it != fs::recursive_directory_iterator(); ++it)
+		{
+			int x, z;
+			if (!it->is_regular_file() || it->path().parent_path().filename() != "region") continue;
+			if (region_file::parse_name(it->path(), x, z)) regions.push_back(it->path());
+		}
+		return regions;
+	}
+
+
+	region_scan_stats scan_regions(const std::vector<fs::path> &regions, const chunk_visitor &visit, thread_pool *pool)
+	{
+		auto started = std::chrono::steady_clock::now();
+		thread_pool &workers = pool ? *pool : thread_pool::shared();
+
+		std::atomic<utils::tulong> chunks{ 0 }, stored{ 0 }, raw{ 0 }, corrupt{ 0 };
+		std::mutex report_lock;
+
+		auto report = [&](const fs::path &path, std::string_view what)
+		{
+			corrupt++;
+			std::lock_guard lock(report_lock);
+			cerr << "[mcsuper] " << path.string() << ": " << what << endl;
+		};
+
+		for (const fs::path &path : regions)
+		{
+			workers.submit([&, path]()
+			{
+				thread_local std::vector<utils::tuchar> nbt;
+
+				try
+				{
+					region_file region(path);
+					region.prefetch();
+					utils::tulong local_chunks = 0, local_stored = 0, local_raw = 0;
+
+					for (size_t i = 0; i < region_file::chunks; i++)
+					{
+						try
+						{
+							if (!region.read_chunk(i, nbt)) continue;
+						}
+						catch (const std::exception &e)
+						{
+							report(path, "chunk " + std::to_string(region.chunk_x(i)) + "," + std::to_string(region.chunk_z(i)) + ": " + e.what());
+							continue;
+						}
+
+						local_chunks++;
+						local_stored += utils::tulong(region.sector_count(i)) * region_file::sector_size;
+						local_raw += nbt.size();
+						visit(region, i, nbt);
+					}
+
+					chunks += local_chunks;
+					stored += local_stored;
+					raw += local_raw;
+				}
+				catch (const std::exception &e)
+				{
+					report(path, e.what());
+				}
+			});
+		}
+		workers.wait();
+
+		region_scan_stats stats;
+		stats.regions = regions.size();
+		stats.chunks = chunks;
+		stats.bytes_stored = stored;
+		stats.bytes_raw = raw;
+		stats.corrupt = corrupt;
+		stats.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+		return stats;
+	}
+
+} // End namespace mcsuper
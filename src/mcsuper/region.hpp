@@ -0,0 +1,229 @@
+#pragma once
+#ifndef H_268094_SRC_REGION
+#define H_268094_SRC_REGION 1
+
+#include <span>
+#include <array>
+#include <chrono>
+#include <vector>
+#include <optional>
+#include <filesystem>
+#include <functional>
+
+#include "utils.hpp"
+#include "io_ring.hpp"
+#include "thread_pool.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Compression byte in front of a chunk payload
+	 */
+	enum class chunk_compression : utils::tuchar
+	{
+		gzip = 1,
+		zlib = 2,
+		none = 3,
+		// lz4-java LZ4Block framing, region-file-compression=lz4 since 24w04a
+		lz4 = 4,
+		// Followed by a namespaced codec name, only mods write it
+		custom = 127
+	};
+
+	// Set on the compression byte when the payload lives in a c.<x>.<z>.mcc file next to the region
+	inline constexpr utils::tuchar chunk_external = 0x80;
+
+
+	/**
+	 * @brief An Anvil region file (.mca), mapped read-only
+	 *
+	 * The 8 KiB header is decoded once into a 1024-entry table, after that a chunk is one bounds check and
+	 * one decompression away. Chunks are numbered x + z * 32 within the region
+	 */
+	class region_file
+	{
+		public:
+			static constexpr size_t chunks = 1024;
+			static constexpr size_t sector_size = 4096;
+
+			explicit region_file(const std::filesystem::path &path);
+			~region_file();
+
+			region_file(const region_file &) = delete;
+			region_file &operator=(const region_file &) = delete;
+
+			/**
+			 * @brief Region coordinates from a r.<x>.<z>.mca file name
+			 *
+			 * @return bool False if the name doesn't follow that pattern
+			 */
+			static bool parse_name(const std::filesystem::path &path, int &x, int &z);
+
+			const std::filesystem::path &path() const noexcept { return m_path; }
+			int x() const noexcept { return m_x; }
+			int z() const noexcept { return m_z; }
+
+			bool has_chunk(size_t index) const noexcept { return m_slots[index].location != 0; }
+			// Number of present chunks
+			size_t chunk_count() const noexcept;
+			utils::tuint timestamp(size_t index) const noexcept { return m_slots[index].timestamp; }
+			utils::tuint sector(size_t index) const noexcept { return m_slots[index].location >> 8; }
+			utils::tuint sector_count(size_t index) const noexcept { return m_slots[index].location & 0xFF; }
+			// World chunk coordinates of a slot
+			int chunk_x(size_t index) const noexcept { return m_x * 32 + static_cast<int>(index % 32); }
+			int chunk_z(size_t index) const noexcept { return m_z * 32 + static_cast<int>(index / 32); }
+
+			/**
+			 * @brief Decompress a chunk's NBT into out, reusing its capacity
+			 *
+			 * @return bool False if the slot is empty, corrupt payloads and unsupported codecs throw
+			 */
+			bool read_chunk(size_t index, std::vector<utils::tuchar> &out) const;
+
+			/**
+			 * @brief A chunk's payload exactly as stored: length, compression byte and data, without sector padding
+			 *
+			 * @return std::span<const utils::tuchar> Empty if the slot is empty, a payload that doesn't fit its sectors throws
+			 */
+			std::span<const utils::tuchar> raw_chunk(size_t index) const;
+
+			/**
+			 * @brief Where an external chunk's payload lives
+			 */
+			std::filesystem::path external_path(size_t index) const;
+
+			/**
+			 * @brief Start reading the whole file in the background, for callers about to visit every chunk
+			 */
+			void prefetch() const noexcept;
+
+			/**
+			 * @brief Whole file size, 0 for an empty region
+			 */
+			size_t size() const noexcept { return m_size; }
+
+		private:
+			struct slot
+			{
+				// As stored, sector offset << 8 | sector count
+				utils::tuint location;
+				utils::tuint timestamp;
+			};
+
+			std::filesystem::path m_path;
+			int m_x = 0;
+			int m_z = 0;
+			const utils::tuchar *m_map = nullptr;
+			size_t m_size = 0;
+			std::array<slot, chunks> m_slots{};
+	};
+
+
+	/**
+	 * @brief Writes a new region file front to back, for tools that rewrite regions
+	 *
+	 * Chunks go out in the order they're added, packed into consecutive sectors, through a small coalescing
+	 * buffer so memory stays flat however big the region is. Where io_uring is available a few full buffers
+	 * are in flight at once while the next fills, with pwrite as the fallback. The header goes in last and
+	 * the file is swapped in by rename, so a crash leaves the old region untouched
+	 */
+	class region_writer
+	{
+		public:
+			explicit region_writer(const std::filesystem::path &path);
+
+			/**
+			 * @brief Removes the temp file unless commit() went through
+			 */
+			~region_writer();
+
+			region_writer(const region_writer &) = delete;
+			region_writer &operator=(const region_writer &) = delete;
+
+			/**
+			 * @brief Append one chunk
+			 *
+			 * @param payload As returned by region_file::raw_chunk
+			 */
+			void add(size_t index, utils::tuint timestamp, std::span<const utils::tuchar> payload);
+
+			/**
+			 * @brief Write the header, fsync and replace the original
+			 *
+			 * @return utils::tulong Size of the new file
+			 */
+			utils::tulong commit();
+
+			/**
+			 * @brief Whether writes go through io_uring rather than pwrite
+			 */
+			bool batched() const noexcept { return m_ring.has_value(); }
+
+		private:
+			struct pending_write
+			{
+				std::vector<utils::tuchar> data;
+				utils::tulong offset = 0;
+				size_t done = 0;
+				bool busy = false;
+			};
+
+			void flush();
+			void queue(size_t slot);
+			void reap();
+
+			std::filesystem::path m_path;
+			std::filesystem::path m_tmp;
+			utils::unique_fd m_fd;
+			std::array<utils::tuchar, 2 * region_file::sector_size> m_header{};
+			utils::tuint m_next_sector = 2;
+			std::vector<utils::tuchar> m_buffer;
+			// File offset the buffer will land at
+			utils::tulong m_buffer_at = 2 * region_file::sector_size;
+			bool m_committed = false;
+
+			std::optional<io_ring> m_ring;
+			// Buffers handed to the ring, recycled into m_buffer once written
+			std::vector<pending_write> m_writes;
+	};
+
+
+	/**
+	 * @brief What a scan went through
+	 */
+	struct region_scan_stats
+	{
+		utils::tulong regions = 0;
+		utils::tulong chunks = 0;
+		// Stored (compressed) and decompressed payload bytes
+		utils::tulong bytes_stored = 0;
+		utils::tulong bytes_raw = 0;
+		// Chunks or whole regions that failed to decode, each reported on stderr
+		utils::tulong corrupt = 0;
+		std::chrono::milliseconds elapsed{ 0 };
+	};
+
+
+	/**
+	 * @brief Called for every chunk of a scan, from many threads at once, with the chunk's decompressed NBT
+	 */
+	typedef std::function<void(const region_file &region, size_t index, const std::vector<utils::tuchar> &nbt)> chunk_visitor;
+
+
+	/**
+	 * @brief Every .mca under the region folders of a world, including the nether and end and Bukkit's split dimensions
+	 */
+	std::vector<std::filesystem::path> find_regions(const std::filesystem::path &world);
+
+	/**
+	 * @brief Decompress every chunk of many region files in parallel
+	 *
+	 * Each region file is a task on the pool, so workers stay busy with no coordination beyond stealing
+	 * whole files from one another, and each keeps one decompression buffer for all the chunks it handles
+	 */
+	region_scan_stats scan_regions(const std::vector<std::filesystem::path> &regions, const chunk_visitor &visit, thread_pool *pool = nullptr);
+
+} // End namespace mcsuper
+
+#endif // H_268094_SRC_REGION
@@ -0,0 +1,334 @@
+#include "region_tools.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <bitset>
+#include <array>
+#include <vector>
+#include <optional>
+#include <iostream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "nbt.hpp"
+
+using std::cerr, std::endl;
+
+namespace fs = std::filesystem;
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		typedef std::bitset<region_file::chunks> chunk_set;
+
+
+		/**
+		 * @brief Chunk indices in Z-order, interleaving the bits of x and z so each 2x2, 4x4, ... block is contiguous
+		 */
+		constexpr std::array<utils::tushort, region_file::chunks> z_order = []()
+		{
+			std::array<utils::tushort, region_file::chunks> order{};
+			for (size_t i = 0; i < region_file::chunks; i++)
+			{
+				size_t x = i % 32, z = i / 32, morton = 0;
+				for (size_t bit = 0; bit < 5; bit++) morton |= ((x >> bit) & 1) << (2 * bit) | ((z >> bit) & 1) << (2 * bit + 1);
+				order[morton] = static_cast<utils::tushort>(i);
+			}
+			return order;
+		}();
+
+
+		/**
+		 * @brief Every file in the region format: terrain, entities and points of interest
+		 */
+		std::vector<fs::path> find_region_files(const fs::path &world)
+		{
+			std::vector<fs::path> files;
+			for (auto it = fs::recursive_directory_iterator(world); it != fs::recursive_directory_iterator(); ++it)
+			{
+				int x, z;
+				fs::path folder = it->path().parent_path().filename();
+				if (!it->is_regular_file() || (folder != "region" && folder != "entities" && folder != "poi")) continue;
+				if (region_file::parse_name(it->path(), x, z)) files.push_back(it->path());
+			}
+			return files;
+		}
+
+
+		void add_layout(region_layout &sum, const region_layout &layout)
+		{
+			sum.sectors += layout.sectors;
+			sum.sectors_used += layout.sectors_used;
+			sum.holes += layout.holes;
+			sum.seeks += layout.seeks;
+		}
+
+
+		/**
+		 * @brief Whether a chunk is worth keeping, both the 1.18+ layout and the older Level compound are understood
+		 */
+		bool keep_chunk(const nbt::value &root, utils::tulong min_inhabited)
+		{
+			nbt::value level = root["Level"] ? root["Level"] : root;
+
+			std::string_view status = level["Status"].as_string();
+			if (level["Status"] && status != "minecraft:full" && status != "full") return false;
+
+			return level["InhabitedTime"].as_long() >= static_cast<utils::tslong>(min_inhabited);
+		}
+
+
+		/**
+		 * @brief Present slots in the order their payloads sit in the file, so a rewrite keeps the existing layout
+		 */
+		std::vector<size_t> by_sector(const region_file &region)
+		{
+			std::vector<size_t> order;
+			for (size_t i = 0; i < region_file::chunks; i++)
+			{
+				if (region.has_chunk(i)) order.push_back(i);
+			}
+			std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return region.sector(a) < region.sector(b); });
+			return order;
+		}
+
+
+		/**
+		 * @brief Drop chunks from one region file, deleting it if nothing is left
+		 *
+		 * @return utils::tulong The file's size afterwards
+		 */
+		utils::tulong drop_chunks(const region_file &region, const chunk_set &drop, bool dry_run)
+		{
+			std::vector<size_t> keep;
+			utils::tulong size = 2 * region_file::sector_size;
+			for (size_t i : by_sector(region))
+			{
+				if (drop[i]) continue;
+				keep.push_back(i);
+				size += utils::tulong(region.sector_count(i)) * region_file::sector_size;
+			}
+			if (dry_run) return keep.empty() ? 0 : size;
+
+			if (keep.empty())
+			{
+				fs::remove(region.path());
+			}
+			else
+			{
+				region_writer writer(region.path());
+				for (size_t i : keep) writer.add(i, region.timestamp(i), region.raw_chunk(i));
+				size = writer.commit();
+			}
+
+			// The region no longer points at dropped oversized chunks, their .mcc files are garbage now
+			for (size_t i = 0; i < region_file::chunks; i++)
+			{
+				if (!drop[i] || !region.has_chunk(i)) continue;
+				std::span<const utils::tuchar> raw = region.raw_chunk(i);
+				if (raw[4] & chunk_external) fs::remove(region.external_path(i));
+			}
+			return size;
+		}
+	}
+
+
+	bool world_in_use(const fs::path &world)
+	{
+		// The game takes a POSIX lock on session.lock, which F_GETLK reports without disturbing it
+		utils::unique_fd fd(open((world / "session.lock").c_str(), O_RDWR | O_CLOEXEC));
+		if (!fd) return false;
+
+		struct flock lock{};
+		lock.l_type = F_WRLCK;
+		lock.l_whence = SEEK_SET;
+		if (fcntl(fd.get(), F_GETLK, &lock) < 0) return false;
+		return lock.l_type != F_UNLCK;
+	}
+
+
+	prune_stats prune_world(const fs::path &world, const prune_options &options)
+	{
+		auto started = std::chrono::steady_clock::now();
+		if (world_in_use(world)) throw std::runtime_error(world.string() + " is in use by a running server");
+
+		thread_pool &workers = options.pool ? *options.pool : thread_pool::shared();
+		std::vector<fs::path> regions = find_regions(world);
+
+		std::atomic<utils::tulong> chunks{ 0 }, dropped{ 0 }, unreadable{ 0 }, removed{ 0 }, before{ 0 }, after{ 0 };
+		std::mutex report_lock;
+
+		for (const fs::path &path : regions)
+		{
+			workers.submit([&, path]()
+			{
+				thread_local std::vector<utils::tuchar> buffer;
+				thread_local nbt::document doc;
+
+				try
+				{
+					region_file region(path);
+					region.prefetch();
+
+					chunk_set drop;
+					for (size_t i = 0; i < region_file::chunks; i++)
+					{
+						try
+						{
+							if (!region.read_chunk(i, buffer)) continue;
+							chunks++;
+							doc.parse(buffer.data(), buffer.size());
+							if (!keep_chunk(doc.root(), options.min_inhabited)) drop.set(i);
+						}
+						catch (const std::exception &)
+						{
+							unreadable++;
+						}
+					}
+					if (drop.none()) return;
+					dropped += drop.count();
+
+					// Entities and POIs of a dimension sit in sibling folders, in region files of the same name
+					fs::path dimension = path.parent_path().parent_path();
+					for (const fs::path &file : { path, dimension / "entities" / path.filename(), dimension / "poi" / path.filename() })
+					{
+						if (file != path && !fs::exists(file)) continue;
+
+						std::optional<region_file> sibling;
+						if (file != path) sibling.emplace(file);
+						const region_file &target = file == path ? region : *sibling;
+
+						before += target.size();
+						utils::tulong size = drop_chunks(target, drop, options.dry_run);
+						after += size;
+						if (size == 0) removed++;
+					}
+				}
+				catch (const std::exception &e)
+				{
+					std::lock_guard lock(report_lock);
+					cerr << "[mcsuper] " << path.string() << ": " << e.what() << endl;
+				}
+			});
+		}
+		workers.wait();
+
+		prune_stats stats;
+		stats.regions = regions.size();
+		stats.regions_removed = removed;
+		stats.chunks = chunks;
+		stats.chunks_dropped = dropped;
+		stats.unreadable = unreadable;
+		stats.bytes_before = before;
+		stats.bytes_after = after;
+		stats.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+		return stats;
+	}
+
+
+	region_layout measure_layout(const region_file &region)
+	{
+		region_layout layout;
+		if (region.size() <= 2 * region_file::sector_size) return layout;
+		layout.sectors = (region.size() + region_file::sector_size - 1) / region_file::sector_size - 2;
+
+		std::vector<std::pair<utils::tuint, utils::tuint>> extents;
+		for (size_t i = 0; i < region_file::chunks; i++)
+		{
+			if (region.has_chunk(i)) extents.emplace_back(region.sector(i), region.sector_count(i));
+		}
+		std::sort(extents.begin(), extents.end());
+
+		utils::tulong at = 2;
+		for (auto [sector, count] : extents)
+		{
+			if (sector > at) layout.holes++;
+			at = std::max<utils::tulong>(at, sector + count);
+			layout.sectors_used += count;
+		}
+		if (at < layout.sectors + 2) layout.holes++;
+
+		at = 2;
+		for (size_t i : z_order)
+		{
+			if (!region.has_chunk(i)) continue;
+			if (region.sector(i) != at) layout.seeks++;
+			at = region.sector(i) + region.sector_count(i);
+		}
+		return layout;
+	}
+
+
+	compact_stats compact_world(const fs::path &world, const compact_options &options)
+	{
+		auto started = std::chrono::steady_clock::now();
+		if (world_in_use(world)) throw std::runtime_error(world.string() + " is in use by a running server");
+
+		thread_pool &workers = options.pool ? *options.pool : thread_pool::shared();
+		std::vector<fs::path> files = find_region_files(world);
+
+		compact_stats stats;
+		stats.files = files.size();
+		std::mutex stats_lock;
+
+		for (const fs::path &path : files)
+		{
+			workers.submit([&, path]()
+			{
+				try
+				{
+					region_file region(path);
+					region_layout before = measure_layout(region), after = before;
+					utils::tulong size = region.size(), chunks = region.chunk_count();
+					bool rewrite = before.holes > 0 || before.seeks > 0, batched = false;
+
+					if (rewrite && options.dry_run)
+					{
+						after = { before.sectors_used, before.sectors_used, 0, 0 };
+						size = 2 * region_file::sector_size + before.sectors_used * region_file::sector_size;
+					}
+					else if (rewrite)
+					{
+						// The old payloads are read once, front to back in Z-order
+						region.prefetch();
+						region_writer writer(path);
+						for (size_t i : z_order)
+						{
+							if (region.has_chunk(i)) writer.add(i, region.timestamp(i), region.raw_chunk(i));
+						}
+						writer.commit();
+						batched = writer.batched();
+
+						region_file compacted(path);
+						after = measure_layout(compacted);
+						size = compacted.size();
+					}
+
+					std::lock_guard lock(stats_lock);
+					stats.files_rewritten += rewrite;
+					stats.chunks += chunks;
+					stats.bytes_before += region.size();
+					stats.bytes_after += size;
+					add_layout(stats.before, before);
+					add_layout(stats.after, after);
+					stats.batched |= batched;
+				}
+				catch (const std::exception &e)
+				{
+					// A region that can't be read completely is left as it is
+					std::lock_guard lock(stats_lock);
+					cerr << "[mcsuper] " << path.string() << ": " << e.what() << endl;
+				}
+			});
+		}
+		workers.wait();
+
+		stats.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+		return stats;
+	}
+
+} // End namespace mcsuper
@@ -0,0 +1,123 @@
+#pragma once
+#ifndef H_915273_SRC_REGION_TOOLS
+#define H_915273_SRC_REGION_TOOLS 1
+
+#include <chrono>
+#include <filesystem>
+
+#include "utils.hpp"
+#include "region.hpp"
+#include "thread_pool.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Whether a server holds the world's session.lock right now, every offline tool refuses to touch it then
+	 */
+	bool world_in_use(const std::filesystem::path &world);
+
+
+	/**
+	 * @brief Which chunks prune_world drops
+	 */
+	struct prune_options
+	{
+		// Chunks players spent less than this many ticks near are dropped (1200 = one minute)
+		utils::tulong min_inhabited = 1200;
+		// Only count what would go
+		bool dry_run = false;
+		thread_pool *pool = nullptr;
+	};
+
+
+	/**
+	 * @brief What pruning did, or with dry_run would do
+	 */
+	struct prune_stats
+	{
+		utils::tulong regions = 0;
+		// Region files deleted because nothing in them was kept
+		utils::tulong regions_removed = 0;
+		utils::tulong chunks = 0;
+		utils::tulong chunks_dropped = 0;
+		// Chunks kept because they couldn't be read, pruning never deletes what it can't judge
+		utils::tulong unreadable = 0;
+		// Size of the affected region, entities and poi files before and after
+		utils::tulong bytes_before = 0;
+		utils::tulong bytes_after = 0;
+		std::chrono::milliseconds elapsed{ 0 };
+	};
+
+
+	/**
+	 * @brief Drop the chunks of a stopped world that nobody spent time in, so the game regenerates them when needed
+	 *
+	 * A chunk goes if its InhabitedTime is under the threshold or it never finished generating (status other
+	 * than full). Regions are scanned in parallel, and any that lose chunks are rewritten with the survivors
+	 * packed together, as are the matching entities/ and poi/ files so no orphaned mobs or villager jobs
+	 * outlive their terrain. Each rewrite streams through region_writer, so memory use doesn't grow with the
+	 * world
+	 */
+	prune_stats prune_world(const std::filesystem::path &world, const prune_options &options);
+
+
+	/**
+	 * @brief How scattered a region file's chunks are
+	 */
+	struct region_layout
+	{
+		// Sectors after the header, and how many of them chunks actually use
+		utils::tulong sectors = 0;
+		utils::tulong sectors_used = 0;
+		// Runs of unused sectors between, before or after chunks
+		utils::tulong holes = 0;
+		// Jumps a reader visiting the chunks in Z-order makes, 0 when they lie back to back in that order
+		utils::tulong seeks = 0;
+	};
+
+
+	/**
+	 * @brief Measure a region's fragmentation from its header alone
+	 */
+	region_layout measure_layout(const region_file &region);
+
+
+	struct compact_options
+	{
+		// Only measure
+		bool dry_run = false;
+		thread_pool *pool = nullptr;
+	};
+
+
+	struct compact_stats
+	{
+		utils::tulong files = 0;
+		utils::tulong files_rewritten = 0;
+		utils::tulong chunks = 0;
+		utils::tulong bytes_before = 0;
+		utils::tulong bytes_after = 0;
+		// Summed over all files
+		region_layout before;
+		region_layout after;
+		// Whether the rewrites went through io_uring rather than pwrite
+		bool batched = false;
+		std::chrono::milliseconds elapsed{ 0 };
+	};
+
+
+	/**
+	 * @brief Defragment every region, entities and poi file of a stopped world
+	 *
+	 * Over time the game relocates growing chunks to the end of their region and leaves the old sectors
+	 * unused, and chunk order on disk ends up following generation order. Files with holes or out of order
+	 * chunks are rewritten with the chunks back to back in Z-order (Morton order of x and z), which keeps
+	 * neighbouring chunks close on disk for the game and makes backups one sequential read. Payloads are
+	 * copied as stored, nothing is recompressed
+	 */
+	compact_stats compact_world(const std::filesystem::path &world, const compact_options &options);
+
+} // End namespace mcsuper
+
+#endif // H_915273_SRC_REGION_TOOLS
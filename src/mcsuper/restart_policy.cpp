@@ -0,0 +1,128 @@
+#include "restart_policy.hpp"
+#include "cgroup.hpp"
+
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <system_error>
+
+#include <fcntl.h>
+#include <csignal>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		/**
+		 * @brief Queue readahead for a whole file
+		 */
+		utils::tulong prewarm(const fs::path &path)
+		{
+			utils::unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+			struct stat st;
+			if (!fd || fstat(fd.get(), &st) < 0) return 0;
+			if (posix_fadvise(fd.get(), 0, 0, POSIX_FADV_WILLNEED) != 0) return 0;
+			return st.st_size;
+		}
+	}
+
+
+	std::optional<restart_mode> parse_restart_mode(std::string_view text) noexcept
+	{
+		if (text == "never") return restart_mode::never;
+		if (text == "on-failure") return restart_mode::on_failure;
+		if (text == "always") return restart_mode::always;
+		return std::nullopt;
+	}
+
+
+	const char *exit_kind_name(exit_kind kind) noexcept
+	{
+		switch (kind)
+		{
+			case exit_kind::requested: return "requested stop";
+			case exit_kind::clean: return "clean exit";
+			case exit_kind::oom: return "OOM kill";
+			case exit_kind::crash: return "crash";
+		}
+		return "unknown";
+	}
+
+
+	exit_kind restart_policy::classify(const exit_status &status, bool requested, bool oom_killed) noexcept
+	{
+		if (requested) return exit_kind::requested;
+		if (!status.exited && status.code == SIGKILL && oom_killed) return exit_kind::oom;
+		if (status.exited && status.code == 0) return exit_kind::clean;
+		return exit_kind::crash;
+	}
+
+
+	std::optional<std::chrono::seconds> restart_policy::on_exit(exit_kind kind, std::chrono::steady_clock::duration uptime) noexcept
+	{
+		if (kind == exit_kind::requested || m_config.mode == restart_mode::never) return std::nullopt;
+		if (kind == exit_kind::clean && m_config.mode != restart_mode::always) return std::nullopt;
+
+		// Clean exits count too, a server that quits right after starting (say, an unaccepted EULA) loops just the same
+		if (uptime >= m_config.stable_after) m_failures = 0;
+		m_failures++;
+		if (m_config.max_failures > 0 && m_failures > m_config.max_failures) return std::nullopt;
+
+		m_restarts++;
+		if (m_failures == 1) return std::chrono::seconds::zero();
+
+		auto delay = m_config.min_delay;
+		for (unsigned i = 2; i < m_failures && delay < m_config.max_delay; i++) delay *= 2;
+		return std::min(delay, m_config.max_delay);
+	}
+
+
+	oom_watch::oom_watch(pid_t pid)
+	{
+		// cgroup v2 has a single "0::/path" line
+		std::ifstream in("/proc/" + std::to_string(pid) + "/cgroup");
+		std::string line;
+		while (std::getline(in, line))
+		{
+			if (!line.starts_with("0::")) continue;
+
+			fs::path events = fs::path("/sys/fs/cgroup") / fs::path(line.substr(3)).relative_path() / "memory.events";
+			std::error_code ec;
+			if (fs::exists(events, ec)) m_events = events;
+		}
+
+		m_kills = read_counter(m_events.empty() ? fs::path("/proc/vmstat") : m_events, "oom_kill");
+	}
+
+
+	bool oom_watch::fired() const
+	{
+		return read_counter(m_events.empty() ? fs::path("/proc/vmstat") : m_events, "oom_kill") > m_kills;
+	}
+
+
+	utils::tulong prewarm_jars(const spawn_options &server)
+	{
+		utils::tulong bytes = 0;
+
+		for (size_t i = 0; i + 1 < server.argv.size(); i++)
+		{
+			if (server.argv[i] == "-jar") bytes += prewarm(server.workdir / server.argv[i + 1]);
+		}
+
+		for (const char *folder : { "libraries", "versions" })
+		{
+			std::error_code ec;
+			for (auto it = fs::recursive_directory_iterator(server.workdir / folder, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+			{
+				if (it->path().extension() == ".jar") bytes += prewarm(it->path());
+			}
+		}
+		return bytes;
+	}
+
+} // End namespace mcsuper
@@ -0,0 +1,149 @@
+#pragma once
+#ifndef H_358261_SRC_RESTART_POLICY
+#define H_358261_SRC_RESTART_POLICY 1
+
+#include <chrono>
+#include <optional>
+#include <filesystem>
+#include <string_view>
+
+#include <sys/types.h>
+
+#include "utils.hpp"
+#include "process.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief When the server is started again after it exits on its own
+	 */
+	enum class restart_mode
+	{
+		never,
+		// Crashes and OOM kills, not a clean exit
+		on_failure,
+		// Any exit the supervisor didn't ask for, e.g. for servers restarted by an in-game /stop
+		always
+	};
+
+	/**
+	 * @brief Parse "never", "on-failure" or "always"
+	 */
+	std::optional<restart_mode> parse_restart_mode(std::string_view text) noexcept;
+
+
+	/**
+	 * @brief Why the server went away
+	 */
+	enum class exit_kind
+	{
+		// The supervisor stopped it
+		requested,
+		// Exit code 0 nobody here asked for
+		clean,
+		// SIGKILLed by the kernel's OOM killer, for its cgroup or the whole machine
+		oom,
+		// Anything else: a non-zero exit code or a fatal signal
+		crash
+	};
+
+	const char *exit_kind_name(exit_kind kind) noexcept;
+
+
+	struct restart_config
+	{
+		restart_mode mode = restart_mode::on_failure;
+		// Wait before the second restart in a row, doubled for each further one
+		std::chrono::seconds min_delay{ 5 };
+		std::chrono::seconds max_delay{ 300 };
+		// A run this long ends a crash loop, the next failure restarts immediately again
+		std::chrono::seconds stable_after{ 600 };
+		// Give up after this many failures in a row, 0 to keep trying forever
+		unsigned max_failures = 10;
+	};
+
+
+	/**
+	 * @brief Decides whether and when to restart, with exponential backoff for crash loops
+	 *
+	 * The first failure after a stable run restarts straight away, a server that crashes once in a while
+	 * should be back as fast as the JVM starts. Failures in quick succession wait min_delay, then twice that
+	 * and so on up to max_delay, so a server that dies during startup doesn't spin loading its world over
+	 * and over
+	 */
+	class restart_policy
+	{
+		public:
+			explicit restart_policy(restart_config config) : m_config(config) {}
+
+			/**
+			 * @brief Classify an exit from its status and what the supervisor knows about it
+			 *
+			 * @param requested Whether the supervisor was stopping the server
+			 * @param oom_killed Whether the kernel reported an OOM kill during the run
+			 */
+			static exit_kind classify(const exit_status &status, bool requested, bool oom_killed) noexcept;
+
+			/**
+			 * @brief Record an exit and decide on the restart
+			 *
+			 * @param uptime How long the run lasted
+			 * @return std::optional<std::chrono::seconds> Delay before restarting, nothing to stay down
+			 */
+			std::optional<std::chrono::seconds> on_exit(exit_kind kind, std::chrono::steady_clock::duration uptime) noexcept;
+
+			// Failures since the last stable run
+			unsigned failures() const noexcept { return m_failures; }
+			utils::tulong restarts() const noexcept { return m_restarts; }
+
+		private:
+			restart_config m_config;
+			unsigned m_failures = 0;
+			utils::tulong m_restarts = 0;
+	};
+
+
+	/**
+	 * @brief Notices kernel OOM kills of one process through the memory.events of its cgroup, or /proc/vmstat
+	 * when it has none
+	 *
+	 * Both are cumulative counters, so a baseline taken at spawn and a second look after the exit tell
+	 * whether anything in the server's cgroup (or the machine, without one) was killed meanwhile. With a
+	 * cgroup the machine-wide count is left alone, it would blame the server for every other process's OOM
+	 */
+	class oom_watch
+	{
+		public:
+			explicit oom_watch(pid_t pid);
+
+			/**
+			 * @brief Whether an OOM kill happened since construction
+			 */
+			bool fired() const;
+
+			/**
+			 * @brief memory.events of the process's cgroup v2, empty without the memory controller
+			 */
+			const std::filesystem::path &events() const noexcept { return m_events; }
+
+		private:
+			std::filesystem::path m_events;
+			// oom_kill in m_events, or in /proc/vmstat if that's empty, at construction
+			utils::tulong m_kills = 0;
+	};
+
+
+	/**
+	 * @brief Start reading the server's jars into the page cache, so a restart doesn't wait on the disk
+	 *
+	 * Covers the -jar argument and everything under libraries/ and versions/ in the workdir, where current
+	 * servers unpack their dependencies. posix_fadvise only queues readahead, this returns straight away
+	 *
+	 * @return utils::tulong Bytes asked for
+	 */
+	utils::tulong prewarm_jars(const spawn_options &server);
+
+} // End namespace mcsuper
+
+#endif // H_358261_SRC_RESTART_POLICY
@@ -0,0 +1,41 @@
+#include "ring_buffer.hpp"
+
+#include <sys/mman.h>
+
+
+namespace mcsuper
+{
+	ring_buffer::ring_buffer(size_t capacity)
+	{
+		size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		m_capacity = (capacity + page - 1) / page * page;
+
+		utils::unique_fd mem(memfd_create("mcsuper-ring", MFD_CLOEXEC));
+		if (!mem) utils::throw_errno("memfd_create");
+		if (ftruncate(mem.get(), m_capacity) < 0) utils::throw_errno("ftruncate");
+
+		// Reserve twice the address space, then map the same pages into both halves
+		void *area = mmap(nullptr, m_capacity * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (area == MAP_FAILED) utils::throw_errno("mmap");
+		m_base = static_cast<char *>(area);
+
+		for (int half = 0; half < 2; half++)
+		{
+			void *at = mmap(m_base + half * m_capacity, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, mem.get(), 0);
+			if (at == MAP_FAILED)
+			{
+				int saved = errno;
+				munmap(m_base, m_capacity * 2);
+				errno = saved;
+				utils::throw_errno("mmap(MAP_FIXED)");
+			}
+		}
+	}
+
+
+	ring_buffer::~ring_buffer()
+	{
+		munmap(m_base, m_capacity * 2);
+	}
+
+} // End namespace mcsuper
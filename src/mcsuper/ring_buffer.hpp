@@ -0,0 +1,132 @@
+#pragma once
+#ifndef H_384452_SRC_RING_BUFFER
+#define H_384452_SRC_RING_BUFFER 1
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+#include "utils.hpp"
+#include "metrics.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Fixed-size byte ring backed by a memfd mapped twice back to back
+	 *
+	 * Because the second mapping mirrors the first, the readable and writable regions are always contiguous
+	 * in memory, so a line that wraps past the end can still be handed out as one string_view and a read()
+	 * can fill all free space in one call
+	 */
+	class ring_buffer
+	{
+		public:
+			/**
+			 * @brief Map a new ring
+			 *
+			 * @param capacity Size in bytes, rounded up to a whole number of pages
+			 */
+			explicit ring_buffer(size_t capacity);
+			~ring_buffer();
+
+			ring_buffer(const ring_buffer &) = delete;
+			ring_buffer &operator=(const ring_buffer &) = delete;
+
+			size_t capacity() const noexcept { return m_capacity; }
+			size_t readable() const noexcept { return m_head - m_tail; }
+			size_t writable() const noexcept { return m_capacity - readable(); }
+
+			// Start of the free region, writable() bytes long
+			char *write_ptr() noexcept { return m_base + (m_head % m_capacity); }
+			// Start of the unread region, readable() bytes long
+			const char *read_ptr() const noexcept { return m_base + (m_tail % m_capacity); }
+
+			std::string_view data() const noexcept { return { read_ptr(), readable() }; }
+
+			/**
+			 * @brief Mark n bytes after write_ptr() as filled
+			 */
+			void commit(size_t n) noexcept { m_head += n; }
+
+			/**
+			 * @brief Drop n bytes from the front of the unread region
+			 */
+			void consume(size_t n) noexcept { m_tail += n; }
+
+			/**
+			 * @brief Byte at a free-running position, for owners that keep their own positions
+			 */
+			char *at(utils::tulong position) const noexcept { return m_base + (position % m_capacity); }
+
+		private:
+			char *m_base = nullptr;
+			size_t m_capacity = 0;
+
+			// Free-running positions, only reduced modulo capacity when turned into pointers
+			utils::tulong m_head = 0;
+			utils::tulong m_tail = 0;
+	};
+
+
+	/**
+	 * @brief Lock-free byte ring between exactly one producer thread and one consumer thread
+	 *
+	 * The same mirrored mapping as ring_buffer, with the positions atomic and each on its own cache line.
+	 * The producer only moves the head and the consumer only the tail, so neither ever waits on the other,
+	 * a full ring is the producer's to deal with
+	 */
+	class spsc_ring
+	{
+		public:
+			explicit spsc_ring(size_t capacity) : m_mem(capacity) {}
+
+			size_t capacity() const noexcept { return m_mem.capacity(); }
+
+			/**
+			 * @brief Producer side: room left right now, only ever grows until the next push
+			 */
+			size_t writable() const noexcept
+			{
+				return capacity() - (m_head.value.load(std::memory_order_relaxed) - m_tail.value.load(std::memory_order_acquire));
+			}
+
+			/**
+			 * @brief Producer side: append all of data or, if it doesn't fit, nothing
+			 */
+			bool push(const char *data, size_t len) noexcept
+			{
+				if (len > writable()) return false;
+				utils::tulong head = m_head.value.load(std::memory_order_relaxed);
+				std::memcpy(m_mem.at(head), data, len);
+				m_head.value.store(head + len, std::memory_order_release);
+				return true;
+			}
+
+			/**
+			 * @brief Consumer side: everything pushed so far, contiguous thanks to the mirror
+			 */
+			std::string_view peek() const noexcept
+			{
+				utils::tulong tail = m_tail.value.load(std::memory_order_relaxed);
+				return { m_mem.at(tail), m_head.value.load(std::memory_order_acquire) - tail };
+			}
+
+			/**
+			 * @brief Consumer side: give n bytes from the front of peek() back to the producer
+			 */
+			void consume(size_t n) noexcept
+			{
+				m_tail.value.store(m_tail.value.load(std::memory_order_relaxed) + n, std::memory_order_release);
+			}
+
+		private:
+			ring_buffer m_mem;
+			padded_counter m_head;
+			padded_counter m_tail;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_384452_SRC_RING_BUFFER
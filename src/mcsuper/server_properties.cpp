@@ -0,0 +1,123 @@
+#include "server_properties.hpp"
+
+#include <fstream>
+#include <charconv>
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		std::string_view trim(std::string_view s)
+		{
+			while (!s.empty() && (s.front() == ' ' || s.front() == '\t' || s.front() == '\r')) s.remove_prefix(1);
+			while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+			return s;
+		}
+
+
+		std::string unescape(std::string_view s)
+		{
+			std::string out;
+			out.reserve(s.size());
+
+			for (size_t i = 0; i < s.size(); i++)
+			{
+				if (s[i] != '\\' || i + 1 == s.size())
+				{
+					out += s[i];
+					continue;
+				}
+
+				switch (s[++i])
+				{
+					case 'n': out += '\n'; break;
+					case 't': out += '\t'; break;
+					case 'r': out += '\r'; break;
+					case 'u':
+					{
+						// Minecraft escapes non-ASCII MOTDs as \uXXXX, re-encode as UTF-8
+						utils::tuint cp = 0;
+						if (i + 4 >= s.size() || std::from_chars(s.data() + i + 1, s.data() + i + 5, cp, 16).ec != std::errc()) break;
+						i += 4;
+						if (cp < 0x80) out += static_cast<char>(cp);
+						else if (cp < 0x800)
+						{
+							out += static_cast<char>(0xC0 | (cp >> 6));
+							out += static_cast<char>(0x80 | (cp & 0x3F));
+						}
+						else
+						{
+							out += static_cast<char>(0xE0 | (cp >> 12));
+							out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+							out += static_cast<char>(0x80 | (cp & 0x3F));
+						}
+						break;
+					}
+					default: out += s[i]; break;
+				}
+			}
+
+			return out;
+		}
+	}
+
+
+	server_properties server_properties::load(const std::filesystem::path &path)
+	{
+		server_properties props;
+		std::ifstream in(path);
+		std::string raw;
+
+		while (std::getline(in, raw))
+		{
+			std::string_view line = trim(raw);
+			if (line.empty() || line.front() == '#' || line.front() == '!') continue;
+
+			size_t eq = line.find_first_of("=:");
+			if (eq == std::string_view::npos) continue;
+
+			props.m_values[std::string(trim(line.substr(0, eq)))] = unescape(trim(line.substr(eq + 1)));
+		}
+
+		return props;
+	}
+
+
+	std::optional<std::string> server_properties::get(std::string_view key) const
+	{
+		auto it = m_values.find(key);
+		if (it == m_values.end()) return std::nullopt;
+		return it->second;
+	}
+
+
+	std::string server_properties::get_or(std::string_view key, std::string_view fallback) const
+	{
+		auto it = m_values.find(key);
+		return it == m_values.end() ? std::string(fallback) : it->second;
+	}
+
+
+	bool server_properties::get_bool(std::string_view key, bool fallback) const
+	{
+		auto it = m_values.find(key);
+		if (it == m_values.end()) return fallback;
+		if (it->second == "true") return true;
+		if (it->second == "false") return false;
+		return fallback;
+	}
+
+
+	utils::tslong server_properties::get_int(std::string_view key, utils::tslong fallback) const
+	{
+		auto it = m_values.find(key);
+		if (it == m_values.end()) return fallback;
+
+		utils::tslong value;
+		const std::string &s = it->second;
+		auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+		return ec == std::errc() && end == s.data() + s.size() ? value : fallback;
+	}
+
+} // End namespace mcsuper
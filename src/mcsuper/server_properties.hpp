@@ -0,0 +1,43 @@
+#pragma once
+#ifndef H_160534_SRC_SERVER_PROPERTIES
+#define H_160534_SRC_SERVER_PROPERTIES 1
+
+#include <map>
+#include <string>
+#include <optional>
+#include <filesystem>
+#include <string_view>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Read-only view of a server.properties file
+	 *
+	 * Only the subset of the Java properties format Minecraft writes is understood: one key=value per line,
+	 * '#' or '!' comments, and backslash escapes in values
+	 */
+	class server_properties
+	{
+		public:
+			server_properties() = default;
+
+			/**
+			 * @brief Load a file, a missing file gives an empty set of properties
+			 */
+			static server_properties load(const std::filesystem::path &path);
+
+			std::optional<std::string> get(std::string_view key) const;
+			std::string get_or(std::string_view key, std::string_view fallback) const;
+			bool get_bool(std::string_view key, bool fallback) const;
+			utils::tslong get_int(std::string_view key, utils::tslong fallback) const;
+
+		private:
+			std::map<std::string, std::string, std::less<>> m_values;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_160534_SRC_SERVER_PROPERTIES
@@ -0,0 +1,1172 @@
+#include "supervisor.hpp"
+
+#include <cctype>
+#include <ctime>
+#include <csignal>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/signalfd.h>
+
+#include "mc_protocol.hpp"
+
+using std::cout, std::cerr, std::endl;
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		/**
+		 * @brief Write all of buf to a blocking descriptor
+		 */
+		void write_all(int fd, const char *buf, size_t len)
+		{
+			while (len > 0)
+			{
+				ssize_t n = ::write(fd, buf, len);
+				if (n < 0)
+				{
+					if (errno == EINTR) continue;
+					return;
+				}
+				buf += n;
+				len -= n;
+			}
+		}
+
+
+		// Where the status JSON is kept across supervisor restarts, relative to the workdir
+		const char *status_cache = ".mcsuper-status.json";
+
+		// Console input queued for a server that isn't reading it, anything more is dropped
+		constexpr size_t max_stdin_queue = 1 << 20;
+
+		// Shown to the player whose join wakes the server
+		const char *wake_message = "The server is starting, join again in a minute";
+
+		// A resource counts as under pressure for this long after its trigger last fired
+		constexpr std::chrono::seconds pressure_hold{ 30 };
+		// Triggers can fire every two seconds, the console hears about each resource at most this often
+		constexpr std::chrono::minutes pressure_report{ 1 };
+		constexpr std::chrono::minutes players_warning_every{ 10 };
+		const char *pressure_warning = "The server is short on resources, expect some lag";
+
+		// Repeated messages listed by !spam and given their own metrics
+		constexpr size_t spam_patterns = 20;
+
+
+		/**
+		 * @brief A pattern as a label value, cut short at a character boundary
+		 */
+		std::string pattern_label(std::string_view pattern)
+		{
+			if (pattern.size() > 120)
+			{
+				size_t len = 120;
+				while (len > 0 && (static_cast<utils::tuchar>(pattern[len]) & 0xC0) == 0x80) len--;
+				pattern = pattern.substr(0, len);
+			}
+			return metrics_text::label_value(pattern);
+		}
+	}
+
+
+	supervisor::supervisor(event_loop &loop, supervisor_config config) : m_loop(loop), m_config(std::move(config)), m_restart(m_config.restart)
+	{
+		// Signals are taken synchronously through a signalfd, so they must stay blocked for the whole process
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGINT);
+		sigaddset(&mask, SIGTERM);
+		sigaddset(&mask, SIGHUP);
+		if (sigprocmask(SIG_BLOCK, &mask, nullptr) < 0) utils::throw_errno("sigprocmask");
+
+		m_signals.reset(signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC));
+		if (!m_signals) utils::throw_errno("signalfd");
+
+		// A closed console pipe should be an EPIPE from write, not a dead supervisor
+		::signal(SIGPIPE, SIG_IGN);
+	}
+
+
+	int supervisor::run()
+	{
+		// Before anything starts a thread of its own, they all inherit the supervisor's CPUs
+		if (m_config.placement.enabled()) setup_placement();
+
+		m_loop.add(m_signals.get(), EPOLLIN, [this](utils::tuint) { on_signal(); });
+
+		// Operator input is forwarded to the server console, stdin may be a file or /dev/null which epoll refuses
+		try
+		{
+			m_loop.add(STDIN_FILENO, EPOLLIN, [this](utils::tuint) { on_input(); });
+		}
+		catch (const std::system_error &) {}
+
+		std::filesystem::path log = m_config.server.workdir / m_config.console_log;
+		m_capture.emplace(m_loop, log, m_config.console_ring, m_config.console, [this](std::string_view lines) { on_console(lines); });
+
+		if (!m_config.backup_repo.empty())
+		{
+			backup_pipeline_config backup{ .repo = m_config.backup_repo, .workdir = m_config.server.workdir };
+			m_backup.emplace(m_loop, std::move(backup), [this](std::string_view command) { send_command(command); });
+
+			auto interval = m_config.backup_interval;
+			if (interval.count() > 0) m_backup_timer = m_loop.add_timer(interval, interval, [this]() { scheduled_backup(); });
+		}
+
+		if (m_config.cgroup) setup_cgroup();
+
+		if (m_config.metrics_port != 0)
+		{
+			m_metrics.emplace(m_loop, m_config.metrics_host, m_config.metrics_port, [this]() { return render_metrics(); });
+			cout << "[mcsuper] Serving metrics on port " << m_config.metrics_port << endl;
+		}
+
+		if (m_config.wake_on_join || m_config.listen_port != 0)
+		{
+			std::ifstream in(m_config.server.workdir / status_cache);
+			m_status.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		}
+		if (m_config.listen_port != 0) start_proxy();
+
+		if (m_config.wake_on_join) sleep();
+		else start_server();
+		m_minute_timer = m_loop.add_timer(std::chrono::minutes(1), std::chrono::minutes(1), [this]() { on_minute(); });
+		m_loop.run();
+
+		m_loop.cancel_timer(*m_minute_timer);
+		if (m_restart_timer) m_loop.cancel_timer(*m_restart_timer);
+		if (m_backup_timer) m_loop.cancel_timer(*m_backup_timer);
+		if (m_backup && m_backup->busy()) cout << "[mcsuper] Waiting for the backup to finish" << endl;
+		m_backup.reset();
+		m_front.reset();
+		m_probe.reset();
+		m_proxy.reset();
+		m_metrics.reset();
+		m_pressure.reset();
+		m_cgroup.reset();
+
+		m_loop.remove(STDIN_FILENO);
+		m_loop.remove(m_signals.get());
+		return m_exit_code;
+	}
+
+
+	void supervisor::start_server()
+	{
+		m_child = child_process::spawn(m_config.server);
+		m_started_at = std::chrono::steady_clock::now();
+		m_oom.emplace(m_child->pid());
+		cout << "[mcsuper] Started server, pid " << m_child->pid() << endl;
+
+		if (m_config.sample_interval.count() > 0)
+		{
+			try
+			{
+				m_sampler.emplace(m_child->pid(), m_config.sample_interval);
+			}
+			catch (const std::exception &e)
+			{
+				cerr << "[mcsuper] Can't sample the server: " << e.what() << endl;
+			}
+		}
+
+		if (m_config.placement.main || m_config.placement.workers) m_placement.emplace(m_loop, m_child->pid(), m_config.placement);
+
+		// Commands are queued behind EPOLLOUT rather than waited on, a server that stops reading can't stall the loop
+		if (m_child->in() && fcntl(m_child->in().get(), F_SETFL, fcntl(m_child->in().get(), F_GETFL) | O_NONBLOCK) < 0)
+		{
+			utils::throw_errno("fcntl");
+		}
+
+		int err = m_child->err().get();
+		m_capture->attach(m_child->out().get());
+		m_loop.add(err, EPOLLIN, [this, err](utils::tuint) { on_output(err, STDERR_FILENO); });
+		m_loop.add(m_child->pidfd(), EPOLLIN, [this](utils::tuint) { on_exit(); });
+	}
+
+
+	void supervisor::send_command(std::string_view command)
+	{
+		if (!m_child || !m_child->in()) return;
+
+		if (m_stdin_queue.size() + command.size() >= max_stdin_queue)
+		{
+			if (m_stdin_dropped++ == 0) cerr << "[mcsuper] The server isn't reading its console, dropping commands until it catches up" << endl;
+			return;
+		}
+
+		bool idle = m_stdin_queue.empty();
+		m_stdin_queue.append(command).append(1, '\n');
+		if (idle) flush_stdin();
+	}
+
+
+	void supervisor::flush_stdin()
+	{
+		int fd = m_child->in().get();
+		while (!m_stdin_queue.empty())
+		{
+			ssize_t n = ::write(fd, m_stdin_queue.data(), m_stdin_queue.size());
+			if (n > 0)
+			{
+				m_stdin_queue.erase(0, n);
+				continue;
+			}
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0 && errno == EAGAIN) break;
+
+			cerr << "[mcsuper] Can't write to the server's console (" << std::strerror(errno) << "), dropped " << m_stdin_queue.size() << " bytes of commands" << endl;
+			m_stdin_queue.clear();
+		}
+
+		if (m_stdin_queue.empty() && m_stdin_dropped > 0)
+		{
+			cerr << "[mcsuper] The server is reading its console again, " << m_stdin_dropped << " commands were dropped" << endl;
+			m_stdin_dropped = 0;
+		}
+
+		bool want = !m_stdin_queue.empty();
+		if (want == m_stdin_watched) return;
+		m_stdin_watched = want;
+		if (want) m_loop.add(fd, EPOLLOUT, [this](utils::tuint) { flush_stdin(); });
+		else m_loop.remove(fd);
+	}
+
+
+	void supervisor::request_stop()
+	{
+		if (!m_child)
+		{
+			// Asleep or waiting out a restart delay, staying down is all it takes
+			if (m_restart_timer)
+			{
+				m_loop.cancel_timer(*m_restart_timer);
+				m_restart_timer.reset();
+				cout << "[mcsuper] Restart cancelled" << endl;
+			}
+			m_front.reset();
+			m_loop.stop();
+			return;
+		}
+
+		if (m_stopping)
+		{
+			cout << "[mcsuper] Killing server" << endl;
+			m_child->signal(SIGKILL);
+			return;
+		}
+
+		m_stopping = true;
+		cout << "[mcsuper] Stopping server" << endl;
+		send_command("stop");
+
+		m_kill_timer = m_loop.add_timer(m_config.stop_timeout, std::chrono::nanoseconds::zero(), [this]()
+		{
+			m_kill_timer.reset();
+			cerr << "[mcsuper] Server ignored stop for " << m_config.stop_timeout.count() << "s, killing it" << endl;
+			if (m_child) m_child->signal(SIGKILL);
+		});
+	}
+
+
+	void supervisor::on_output(int fd, int sink)
+	{
+		char buf[65536];
+
+		for (;;)
+		{
+			ssize_t n = ::read(fd, buf, sizeof(buf));
+			if (n > 0)
+			{
+				write_all(sink, buf, n);
+				continue;
+			}
+
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0 && errno == EAGAIN) break;
+
+			// EOF or a hard error, the server closed its end
+			m_loop.remove(fd);
+			break;
+		}
+	}
+
+
+	void supervisor::on_console(std::string_view lines)
+	{
+		// Echo for whoever is watching the terminal, the log file already has its copy
+		write_all(STDOUT_FILENO, lines.data(), lines.size());
+
+		scan_console(lines, [this](const log_line &line) { on_line(line); });
+	}
+
+
+	void supervisor::on_line(const log_line &line)
+	{
+		m_level_counts[static_cast<size_t>(line.level)].add();
+
+		// Only the server's own log lines can carry events, anything without a prefix is stray output
+		if (line.level != log_level::unknown) on_event(events::match(line.message));
+	}
+
+
+	void supervisor::on_event(const events::console_event &event)
+	{
+		if (m_backup) m_backup->on_event(event);
+
+		std::visit(utils::overloaded{
+			[this](const events::server_started &ev)
+			{
+				m_ready = true;
+				cout << "[mcsuper] Server ready after " << ev.seconds << "s" << endl;
+				if (m_exited_at)
+				{
+					auto down = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - *m_exited_at);
+					cout << "[mcsuper] Back up " << down.count() / 1000.0 << "s after the server went down" << endl;
+					m_exited_at.reset();
+				}
+				m_players.start(std::chrono::steady_clock::now());
+				connect_rcon();
+				if (m_config.wake_on_join || m_proxy) cache_status();
+				if (m_proxy) m_front->forward([this](utils::unique_fd client) { m_proxy->add(std::move(client)); });
+			},
+			[this](const events::server_overloaded &ev)
+			{
+				m_ticks.record(ev.ms, ev.ticks);
+			},
+			[this](const events::player_joined &ev)
+			{
+				m_players.joined(ev.name, std::chrono::steady_clock::now());
+			},
+			[this](const events::player_left &ev)
+			{
+				m_players.left(ev.name, std::chrono::steady_clock::now());
+			},
+			[this](const events::server_stopping &)
+			{
+				m_players.stop(std::chrono::steady_clock::now());
+				// New players get the front's answers again, those already in stay until the server drops them
+				if (m_front) m_front->forward({});
+				m_ready = false;
+				m_rcon.reset();
+			},
+			[](const auto &) {}
+		}, event);
+	}
+
+
+	void supervisor::on_input()
+	{
+		char buf[4096];
+		ssize_t n = ::read(STDIN_FILENO, buf, sizeof(buf));
+
+		if (n <= 0 && !(n < 0 && (errno == EINTR || errno == EAGAIN)))
+		{
+			m_loop.remove(STDIN_FILENO);
+			return;
+		}
+		if (n <= 0) return;
+
+		m_input.append(buf, n);
+
+		size_t start = 0;
+		for (size_t nl; (nl = m_input.find('\n', start)) != std::string::npos; start = nl + 1)
+		{
+			std::string_view line(m_input.data() + start, nl - start);
+
+			// Lines starting with '!' are for the supervisor, everything else goes to the server console
+			if (line.starts_with('!')) on_operator_command(line.substr(1));
+			else send_command(line);
+		}
+		m_input.erase(0, start);
+	}
+
+
+	void supervisor::on_operator_command(std::string_view command)
+	{
+		if (command == "lag")
+		{
+			const lag_histogram &life = m_ticks.lifetime();
+			cout << "[mcsuper] Lag warnings: " << life.count() << ", p50 " << life.quantile(0.5) << "ms, p99 " << life.quantile(0.99)
+			     << "ms, max " << life.max() << "ms, " << m_ticks.total_ticks_behind() << " ticks skipped" << endl;
+
+			for (const lag_rollup &r : m_ticks.history())
+			{
+				if (r.warnings == 0) continue;
+
+				std::time_t t = std::chrono::system_clock::to_time_t(r.minute);
+				cout << "[mcsuper]   " << std::put_time(std::localtime(&t), "%H:%M") << "  " << r.warnings << " warnings, p50 " << r.p50_ms
+				     << "ms, p99 " << r.p99_ms << "ms, max " << r.max_ms << "ms, ~" << std::fixed << std::setprecision(1) << r.tps
+				     << " TPS" << std::defaultfloat << endl;
+			}
+		}
+		else if (command.starts_with("rcon "))
+		{
+			if (!m_rcon)
+			{
+				cout << "[mcsuper] RCON isn't connected" << endl;
+				return;
+			}
+
+			m_rcon->command(command.substr(5), [](bool ok, std::string reply)
+			{
+				if (!ok) cout << "[mcsuper] RCON failed: " << reply << endl;
+				else cout << "[mcsuper] " << reply << endl;
+			});
+		}
+		else if (command == "backup")
+		{
+			start_backup();
+		}
+		else if (command == "proxy")
+		{
+			print_proxy();
+		}
+		else if (command == "players")
+		{
+			print_players();
+		}
+		else if (command == "samples")
+		{
+			dump_samples();
+		}
+		else if (command == "pressure")
+		{
+			print_pressure();
+		}
+		else if (command == "threads")
+		{
+			print_threads();
+		}
+		else if (command == "spam")
+		{
+			print_spam();
+		}
+		else
+		{
+			cout << "[mcsuper] Commands: !lag, !rcon <command>, !backup, !proxy, !players, !samples, !pressure, !threads, !spam" << endl;
+		}
+	}
+
+
+	void supervisor::connect_rcon()
+	{
+		server_properties props = server_properties::load(m_config.server.workdir / "server.properties");
+		std::string password = props.get_or("rcon.password", "");
+		if (!props.get_bool("enable-rcon", false) || password.empty()) return;
+
+		auto port = static_cast<utils::tushort>(props.get_int("rcon.port", 25575));
+		m_rcon.emplace(m_loop, "127.0.0.1", port, std::move(password));
+		m_rcon->connect([port](bool ok)
+		{
+			if (ok) cout << "[mcsuper] RCON connected on port " << port << endl;
+		});
+	}
+
+
+	void supervisor::start_backup()
+	{
+		if (!m_backup) cout << "[mcsuper] No backup repository configured, see --backup-repo" << endl;
+		else if (!m_ready) cout << "[mcsuper] Server isn't ready, not backing up" << endl;
+		else if (!m_backup->start()) cout << "[mcsuper] A backup is already running" << endl;
+	}
+
+
+	void supervisor::scheduled_backup()
+	{
+		// Freezing and chunking the world is just the disk and page cache traffic a struggling server can't spare
+		for (pressure_kind kind : { pressure_kind::memory, pressure_kind::io })
+		{
+			if (!under_pressure(kind)) continue;
+			if (!m_backup_deferred) cout << "[mcsuper] Putting the scheduled backup off while the server is under " << pressure_name(kind) << " pressure" << endl;
+			m_backup_deferred = true;
+			return;
+		}
+
+		m_backup_deferred = false;
+		start_backup();
+	}
+
+
+	void supervisor::on_minute()
+	{
+		check_idle();
+		if (m_backup_deferred) scheduled_backup();
+
+		lag_rollup r = m_ticks.rollup();
+		if (r.warnings == 0) return;
+
+		cout << "[mcsuper] Server fell " << r.ticks_behind << " ticks behind in the last minute (max " << r.max_ms << "ms), ~"
+		     << std::fixed << std::setprecision(1) << r.tps << " TPS" << std::defaultfloat << endl;
+	}
+
+
+	void supervisor::on_signal()
+	{
+		signalfd_siginfo info;
+		while (::read(m_signals.get(), &info, sizeof(info)) == sizeof(info))
+		{
+			cout << "[mcsuper] Caught " << strsignal(info.ssi_signo) << endl;
+			request_stop();
+		}
+	}
+
+
+	void supervisor::on_exit()
+	{
+		// Drain whatever the server wrote right before exiting so the last lines aren't lost
+		m_capture->detach();
+		m_capture->flush();
+		on_output(m_child->err().get(), STDERR_FILENO);
+		m_loop.remove(m_child->err().get());
+		m_loop.remove(m_child->pidfd());
+		if (m_stdin_watched) m_loop.remove(m_child->in().get());
+		m_stdin_watched = false;
+		m_stdin_queue.clear();
+		m_stdin_dropped = 0;
+
+		exit_status status = m_child->wait();
+		m_exit_code = status.exited ? status.code : 128 + status.code;
+		auto uptime = std::chrono::steady_clock::now() - m_started_at;
+		exit_kind kind = restart_policy::classify(status, m_stopping, m_oom && m_oom->fired());
+		bool idle = std::exchange(m_idle_stopping, false);
+		m_stopping = false;
+
+		if (status.exited) cout << "[mcsuper] Server exited with code " << status.code << " (" << exit_kind_name(kind) << ")" << endl;
+		else cout << "[mcsuper] Server killed by " << strsignal(status.code) << " (" << exit_kind_name(kind) << ")" << endl;
+
+		if (m_kill_timer) m_loop.cancel_timer(*m_kill_timer);
+		m_kill_timer.reset();
+		m_rcon.reset();
+		m_ready = false;
+		if (m_front) m_front->forward({});
+		m_child.reset();
+		m_oom.reset();
+		m_players.stop(std::chrono::steady_clock::now());
+
+		// What led up to a crash is the whole point of the history, keep it before the sampler goes
+		if (m_sampler && (kind == exit_kind::crash || kind == exit_kind::oom)) dump_samples();
+		m_sampler.reset();
+		m_placement.reset();
+		m_thread_baseline.clear();
+
+		if (idle && kind == exit_kind::requested)
+		{
+			m_idle_stops.add();
+			m_reclaimed.add(m_idle_resident);
+			cout << "[mcsuper] Idle stop freed " << m_idle_resident / (1024 * 1024) << " MiB" << endl;
+			if (m_config.wake_on_join)
+			{
+				sleep();
+				return;
+			}
+		}
+
+		std::optional<std::chrono::seconds> delay = m_restart.on_exit(kind, uptime);
+		if (!delay)
+		{
+			if (kind != exit_kind::requested && m_restart.failures() > m_config.restart.max_failures && m_config.restart.max_failures > 0)
+			{
+				cerr << "[mcsuper] Server failed " << m_restart.failures() << " times in a row, giving up" << endl;
+			}
+			if (m_config.wake_on_join && kind == exit_kind::clean)
+			{
+				sleep();
+				return;
+			}
+			m_loop.stop();
+			return;
+		}
+
+		m_exited_at = std::chrono::steady_clock::now();
+		schedule_restart(*delay);
+	}
+
+
+	void supervisor::schedule_restart(std::chrono::seconds delay)
+	{
+		// Readahead on the jars runs while we wait, or alongside the JVM's own startup on the fast path
+		utils::tulong warmed = prewarm_jars(m_config.server);
+
+		cout << "[mcsuper] Restarting";
+		if (delay.count() > 0) cout << " in " << delay.count() << "s (" << m_restart.failures() << " failures in a row)";
+		if (warmed > 0) cout << ", " << warmed / (1024 * 1024) << " MiB of jars queued for the page cache";
+		cout << endl;
+
+		auto restart = [this]()
+		{
+			m_restart_timer.reset();
+			try
+			{
+				start_server();
+			}
+			catch (const std::exception &e)
+			{
+				cerr << "[mcsuper] Restart failed: " << e.what() << endl;
+				m_loop.stop();
+			}
+		};
+
+		if (delay.count() == 0) restart();
+		else m_restart_timer = m_loop.add_timer(delay, std::chrono::nanoseconds::zero(), restart);
+	}
+
+
+	void supervisor::sleep()
+	{
+		// The proxy's front is already listening and answers for the sleeping server just the same
+		if (m_proxy)
+		{
+			cout << "[mcsuper] Server asleep, it starts when someone joins on port " << m_config.listen_port << endl;
+			return;
+		}
+
+		server_properties props = server_properties::load(m_config.server.workdir / "server.properties");
+		std::string host = props.get_or("server-ip", "");
+		auto port = static_cast<utils::tushort>(props.get_int("server-port", 25565));
+
+		try
+		{
+			m_front.emplace(m_loop, host, port, [this](utils::tsint protocol) { return sleeping_status(protocol); },
+			                [this](std::string_view player) { wake(player); }, wake_message);
+			cout << "[mcsuper] Server asleep, it starts when someone joins on port " << port << endl;
+		}
+		catch (const std::exception &e)
+		{
+			cerr << "[mcsuper] Can't listen on port " << port << " (" << e.what() << "), starting the server now" << endl;
+			wake("");
+		}
+	}
+
+
+	void supervisor::wake(std::string_view player)
+	{
+		if (!player.empty()) cout << "[mcsuper] " << player << " is joining, starting the server" << endl;
+
+		// Free the port for the server before it tries to bind it, unless it's the proxy's own
+		if (!m_proxy) m_front.reset();
+		try
+		{
+			start_server();
+		}
+		catch (const std::exception &e)
+		{
+			cerr << "[mcsuper] Can't start the server: " << e.what() << endl;
+			m_loop.stop();
+		}
+	}
+
+
+	std::string supervisor::sleeping_status(utils::tsint protocol) const
+	{
+		if (!m_status.empty()) return m_status;
+
+		// Never seen the server up, make do with server.properties
+		server_properties props = server_properties::load(m_config.server.workdir / "server.properties");
+		return protocol::status_json("Sleeping", protocol, props.get_int("max-players", 20), 0, props.get_or("motd", "A Minecraft Server"));
+	}
+
+
+	void supervisor::cache_status()
+	{
+		server_properties props = server_properties::load(m_config.server.workdir / "server.properties");
+		std::string host = props.get_or("server-ip", "");
+		auto port = static_cast<utils::tushort>(props.get_int("server-port", 25565));
+
+		try
+		{
+			m_probe.emplace(m_loop, host, port, [this](std::optional<std::string> json)
+			{
+				m_probe.reset();
+				if (!json) return;
+
+				m_status = std::move(*json);
+				std::filesystem::path path = m_config.server.workdir / status_cache;
+				std::filesystem::path tmp = path;
+				tmp += ".tmp";
+				std::ofstream(tmp, std::ios::trunc) << m_status;
+
+				std::error_code ec;
+				std::filesystem::rename(tmp, path, ec);
+			});
+		}
+		catch (const std::exception &e)
+		{
+			cerr << "[mcsuper] Can't fetch the server's status: " << e.what() << endl;
+		}
+	}
+
+
+	void supervisor::start_proxy()
+	{
+		server_properties props = server_properties::load(m_config.server.workdir / "server.properties");
+		std::string host = props.get_or("server-ip", "");
+		auto port = static_cast<utils::tushort>(props.get_int("server-port", 25565));
+		if (port == m_config.listen_port) throw std::runtime_error("--listen needs a port other than server-port " + std::to_string(port) + " in server.properties");
+
+		auto [backend, len] = tcp_proxy::resolve(host, port);
+		m_proxy.emplace(backend, len);
+
+		// Answers while the server isn't ready, forwards once it is
+		m_front.emplace(m_loop, m_config.listen_host, m_config.listen_port, [this](utils::tsint protocol) { return sleeping_status(protocol); },
+		                [this](std::string_view player)
+		                {
+			                if (m_config.wake_on_join && !m_child && !m_restart_timer) wake(player);
+		                },
+		                wake_message);
+		cout << "[mcsuper] Proxying port " << m_config.listen_port << " to the server on port " << port << endl;
+	}
+
+
+	void supervisor::print_proxy() const
+	{
+		if (!m_proxy)
+		{
+			cout << "[mcsuper] No proxy running, see --listen" << endl;
+			return;
+		}
+
+		auto conns = m_proxy->connections();
+		const proxy_totals &totals = m_proxy->totals();
+		utils::tulong up = totals.bytes_up.load(std::memory_order_relaxed);
+		utils::tulong down = totals.bytes_down.load(std::memory_order_relaxed);
+		for (const auto &c : conns)
+		{
+			up += c->bytes_up.load(std::memory_order_relaxed);
+			down += c->bytes_down.load(std::memory_order_relaxed);
+		}
+
+		cout << "[mcsuper] Proxy: " << totals.active.load(std::memory_order_relaxed) << " open, " << totals.connections.load(std::memory_order_relaxed)
+		     << " total, " << totals.refused.load(std::memory_order_relaxed) << " refused by the server, " << up / 1024 << " KiB in, "
+		     << down / 1024 << " KiB out" << endl;
+
+		auto now = std::chrono::system_clock::now();
+		for (const auto &c : conns)
+		{
+			auto age = std::chrono::duration_cast<std::chrono::seconds>(now - c->since);
+			cout << "[mcsuper]   " << c->peer << "  " << age.count() << "s, " << c->bytes_up.load(std::memory_order_relaxed) / 1024 << " KiB / "
+			     << c->packets_in.load(std::memory_order_relaxed) << " segments in, " << c->bytes_down.load(std::memory_order_relaxed) / 1024
+			     << " KiB / " << c->packets_out.load(std::memory_order_relaxed) << " segments out" << endl;
+		}
+	}
+
+
+	void supervisor::check_idle()
+	{
+		if (m_config.idle_stop.count() == 0 || !m_ready || m_stopping || m_players.count() > 0) return;
+		if (m_players.idle_for(std::chrono::steady_clock::now()) < m_config.idle_stop) return;
+
+		if (!m_rcon || !m_rcon->connected()) return idle_stop();
+
+		// A join the console scan missed would stop the server under a player, ask the server itself
+		m_rcon->command("list", [this](bool ok, std::string reply)
+		{
+			// Retried next minute, by then RCON is either back or gone and the table is trusted
+			if (!ok) return;
+
+			std::optional<std::vector<std::string>> online = parse_player_list(reply);
+			if (online && !online->empty())
+			{
+				cout << "[mcsuper] " << online->size() << " players online that the console didn't show, not idle" << endl;
+				m_players.reconcile(*online, std::chrono::steady_clock::now());
+				return;
+			}
+			if (m_ready && !m_stopping) idle_stop();
+		});
+	}
+
+
+	void supervisor::idle_stop()
+	{
+		m_idle_resident = resident_bytes(m_child->pid());
+		cout << "[mcsuper] Nobody online for " << m_config.idle_stop.count() << " minutes, saving and stopping the server ("
+		     << m_idle_resident / (1024 * 1024) << " MiB resident)" << endl;
+
+		// "stop" saves too, flushing first gets the chunks on disk even if the stop then hangs and is killed
+		m_idle_stopping = true;
+		send_command("save-all flush");
+		request_stop();
+	}
+
+
+	void supervisor::print_players() const
+	{
+		auto now = std::chrono::steady_clock::now();
+		auto minutes = [](std::chrono::steady_clock::duration d) { return std::chrono::duration_cast<std::chrono::minutes>(d).count(); };
+
+		if (!m_players.running()) cout << "[mcsuper] Server isn't running";
+		else cout << "[mcsuper] " << m_players.count() << " online, idle for " << minutes(m_players.idle_for(now)) << " min";
+		cout << ", " << minutes(m_players.idle_total(now)) << " min idle in total, " << m_idle_stops.get() << " idle stops freed "
+		     << m_reclaimed.get() / (1024 * 1024) << " MiB" << endl;
+
+		for (const player_sessions::session &p : m_players.online())
+		{
+			cout << "[mcsuper]   " << p.name << "  " << minutes(now - p.since) << " min" << endl;
+		}
+	}
+
+
+	std::string supervisor::render_metrics() const
+	{
+		auto now = std::chrono::steady_clock::now();
+		auto seconds = [](std::chrono::steady_clock::duration d) { return std::chrono::duration<double>(d).count(); };
+		metrics_text out;
+
+		out.family("mcsuper_server_up", "gauge", "Whether the server process is running");
+		out.sample("mcsuper_server_up", utils::tulong(m_child ? 1 : 0));
+		out.family("mcsuper_server_ready", "gauge", "Whether the server has finished starting and accepts players");
+		out.sample("mcsuper_server_ready", utils::tulong(m_ready ? 1 : 0));
+
+		if (std::optional<process_usage> usage = m_child ? read_usage(m_child->pid()) : std::nullopt)
+		{
+			out.family("mcsuper_server_cpu_seconds", "counter", "CPU time of the server process, user plus system", "seconds");
+			out.sample("mcsuper_server_cpu_seconds_total", usage->cpu_seconds);
+			out.family("mcsuper_server_memory_bytes", "gauge", "Memory of the server process from smaps_rollup", "bytes");
+			out.sample("mcsuper_server_memory_bytes", usage->rss_bytes, "kind=\"rss\"");
+			out.sample("mcsuper_server_memory_bytes", usage->pss_bytes, "kind=\"pss\"");
+			out.sample("mcsuper_server_memory_bytes", usage->swap_bytes, "kind=\"swap\"");
+			out.family("mcsuper_server_threads", "gauge", "Threads in the server process");
+			out.sample("mcsuper_server_threads", usage->threads);
+		}
+
+		out.histogram("mcsuper_tick_lag_seconds", "Lag reported by \\\"Can't keep up\\\" warnings", m_ticks.lifetime());
+		out.family("mcsuper_ticks_skipped", "counter", "Ticks the server reported skipping");
+		out.sample("mcsuper_ticks_skipped_total", m_ticks.total_ticks_behind());
+
+		const console_counters &console = m_capture->counters();
+		out.family("mcsuper_console_bytes", "counter", "Console output by where it went: captured from the pipe, written to the log, spilled while the log lagged, or dropped", "bytes");
+		out.sample("mcsuper_console_bytes_total", console.captured.get(), "state=\"captured\"");
+		out.sample("mcsuper_console_bytes_total", console.written.get(), "state=\"written\"");
+		out.sample("mcsuper_console_bytes_total", console.spilled.get(), "state=\"spilled\"");
+		out.sample("mcsuper_console_bytes_total", console.dropped.get(), "state=\"dropped\"");
+		if (const console_dedup *dedup = m_capture->dedup())
+		{
+			out.sample("mcsuper_console_bytes_total", dedup->collapsed_bytes(), "state=\"collapsed\"");
+			out.family("mcsuper_console_collapsed_lines", "counter", "Console lines replaced by a repeat summary in the log");
+			out.sample("mcsuper_console_collapsed_lines_total", dedup->collapsed_lines());
+
+			// Bounded, every pattern would be a label per distinct spam message
+			std::vector<console_pattern> patterns = dedup->top(spam_patterns);
+			out.family("mcsuper_console_pattern_lines", "counter", "Console lines of each of the most repeated messages, numbers masked");
+			for (const console_pattern &p : patterns) out.sample("mcsuper_console_pattern_lines_total", p.lines, "pattern=" + pattern_label(p.pattern));
+			out.family("mcsuper_console_pattern_collapsed_lines", "counter", "Lines of each of the most repeated messages left out of the log");
+			for (const console_pattern &p : patterns) out.sample("mcsuper_console_pattern_collapsed_lines_total", p.collapsed, "pattern=" + pattern_label(p.pattern));
+		}
+		if (const segment_compressor *segments = m_capture->segments())
+		{
+			out.family("mcsuper_console_segments", "counter", "Hours of console log compressed in the background");
+			out.sample("mcsuper_console_segments_total", segments->segments());
+			out.family("mcsuper_console_segment_bytes", "counter", "Size of the compressed hours of console log before and after", "bytes");
+			out.sample("mcsuper_console_segment_bytes_total", segments->bytes_in(), "state=\"raw\"");
+			out.sample("mcsuper_console_segment_bytes_total", segments->bytes_out(), "state=\"compressed\"");
+		}
+		out.family("mcsuper_console_dropped_lines", "counter", "Console lines lost to the drop policy");
+		out.sample("mcsuper_console_dropped_lines_total", console.dropped_lines.get());
+		out.family("mcsuper_console_pipe_bytes", "gauge", "Size of the server's stdout pipe", "bytes");
+		out.sample("mcsuper_console_pipe_bytes", utils::tulong(m_capture->pipe_size()));
+
+		out.family("mcsuper_console_lines", "counter", "Console lines by log level");
+		for (size_t i = 0; i < static_cast<size_t>(log_level::count); i++)
+		{
+			std::string level(level_name(static_cast<log_level>(i)));
+			for (char &c : level) c = static_cast<char>(std::tolower(static_cast<utils::tuchar>(c)));
+			out.sample("mcsuper_console_lines_total", m_level_counts[i].get(), "level=\"" + level + "\"");
+		}
+
+		out.family("mcsuper_players_online", "gauge", "Players online, from the console's join and leave messages");
+		out.sample("mcsuper_players_online", utils::tulong(m_players.count()));
+		out.family("mcsuper_idle_seconds", "gauge", "How long the server has been running with nobody online", "seconds");
+		out.sample("mcsuper_idle_seconds", seconds(m_players.idle_for(now)));
+		out.family("mcsuper_idle_time_seconds", "counter", "Time spent running with nobody online", "seconds");
+		out.sample("mcsuper_idle_time_seconds_total", seconds(m_players.idle_total(now)));
+		out.family("mcsuper_idle_stops", "counter", "Times the server was stopped for having nobody online");
+		out.sample("mcsuper_idle_stops_total", m_idle_stops.get());
+		out.family("mcsuper_idle_reclaimed_bytes", "counter", "Resident memory of the servers stopped for being idle", "bytes");
+		out.sample("mcsuper_idle_reclaimed_bytes_total", m_reclaimed.get());
+
+		out.family("mcsuper_restarts", "counter", "Automatic restarts after the server went down");
+		out.sample("mcsuper_restarts_total", m_restart.restarts());
+		out.family("mcsuper_restart_failures", "gauge", "Failures in a row counting towards --max-restarts");
+		out.sample("mcsuper_restart_failures", utils::tulong(m_restart.failures()));
+
+		if (m_backup)
+		{
+			const backup_metrics &b = m_backup->metrics();
+			out.family("mcsuper_backups", "counter", "Live backups by outcome");
+			out.sample("mcsuper_backups_total", b.completed.get(), "result=\"ok\"");
+			out.sample("mcsuper_backups_total", b.failed.get(), "result=\"failed\"");
+			out.family("mcsuper_backup_duration_seconds", "counter", "Time from save-off until the repository was written", "seconds");
+			out.sample("mcsuper_backup_duration_seconds_total", b.duration_ms.get() / 1000.0);
+			out.family("mcsuper_backup_last_duration_seconds", "gauge", "Duration of the latest completed backup", "seconds");
+			out.sample("mcsuper_backup_last_duration_seconds", b.last_duration_ms.get() / 1000.0);
+			out.family("mcsuper_backup_paused_seconds", "counter", "Time saving was paused for backups", "seconds");
+			out.sample("mcsuper_backup_paused_seconds_total", b.paused_ms.get() / 1000.0);
+		}
+
+		if (m_cgroup)
+		{
+			out.family("mcsuper_pressure_stalled_seconds", "counter", "Time some or all of the server's tasks were stalled on a resource, from PSI", "seconds");
+			for (size_t i = 0; i < static_cast<size_t>(pressure_kind::count); i++)
+			{
+				std::string resource = std::string("resource=\"") + pressure_name(static_cast<pressure_kind>(i)) + "\"";
+				std::optional<pressure_stats> stats = m_cgroup->pressure(static_cast<pressure_kind>(i));
+				if (!stats) continue;
+				out.sample("mcsuper_pressure_stalled_seconds_total", stats->some_us / 1e6, resource + ",kind=\"some\"");
+				out.sample("mcsuper_pressure_stalled_seconds_total", stats->full_us / 1e6, resource + ",kind=\"full\"");
+			}
+			out.family("mcsuper_pressure_triggers", "counter", "Pressure triggers fired, at most one per resource every two seconds");
+			for (size_t i = 0; i < static_cast<size_t>(pressure_kind::count); i++)
+			{
+				auto kind = static_cast<pressure_kind>(i);
+				out.sample("mcsuper_pressure_triggers_total", m_pressure->events(kind), std::string("resource=\"") + pressure_name(kind) + "\"");
+			}
+			out.family("mcsuper_cgroup_memory_bytes", "gauge", "Memory charged to the server's cgroup", "bytes");
+			out.sample("mcsuper_cgroup_memory_bytes", m_cgroup->memory_current());
+			out.family("mcsuper_cgroup_memory_limit_hits", "counter", "Times the server's cgroup reached memory.high or memory.max");
+			out.sample("mcsuper_cgroup_memory_limit_hits_total", m_cgroup->memory_events("high"), "limit=\"high\"");
+			out.sample("mcsuper_cgroup_memory_limit_hits_total", m_cgroup->memory_events("max"), "limit=\"max\"");
+		}
+
+		if (m_proxy)
+		{
+			const proxy_totals &t = m_proxy->totals();
+			utils::tulong up = t.bytes_up.load(std::memory_order_relaxed);
+			utils::tulong down = t.bytes_down.load(std::memory_order_relaxed);
+			for (const auto &c : m_proxy->connections())
+			{
+				up += c->bytes_up.load(std::memory_order_relaxed);
+				down += c->bytes_down.load(std::memory_order_relaxed);
+			}
+
+			out.family("mcsuper_proxy_connections", "counter", "Connections proxied to the server");
+			out.sample("mcsuper_proxy_connections_total", t.connections.load(std::memory_order_relaxed));
+			out.family("mcsuper_proxy_open_connections", "gauge", "Proxied connections open right now");
+			out.sample("mcsuper_proxy_open_connections", t.active.load(std::memory_order_relaxed));
+			out.family("mcsuper_proxy_bytes", "counter", "Bytes proxied, up is from players to the server", "bytes");
+			out.sample("mcsuper_proxy_bytes_total", up, "direction=\"up\"");
+			out.sample("mcsuper_proxy_bytes_total", down, "direction=\"down\"");
+		}
+
+		return out.finish();
+	}
+
+
+	void supervisor::dump_samples()
+	{
+		if (!m_sampler)
+		{
+			cout << "[mcsuper] Nothing sampled, see --sample-interval" << endl;
+			return;
+		}
+
+		std::time_t t = std::time(nullptr);
+		char name[64];
+		std::strftime(name, sizeof(name), "mcsuper-samples-%Y%m%d-%H%M%S.csv", std::localtime(&t));
+		std::filesystem::path path = (m_config.server.workdir / m_config.console_log).parent_path() / name;
+
+		try
+		{
+			size_t rows = m_sampler->dump(path);
+			cout << "[mcsuper] Wrote " << rows << " samples to " << path.string() << " (" << m_sampler->encoded_bytes() / 1024 << " KiB encoded)" << endl;
+		}
+		catch (const std::exception &e)
+		{
+			cerr << "[mcsuper] Can't write samples: " << e.what() << endl;
+		}
+	}
+
+
+	void supervisor::setup_cgroup()
+	{
+		// Named after the server's directory, so several supervisors can share a parent and a restarted one finds its own
+		std::error_code ec;
+		std::filesystem::path dir = std::filesystem::absolute(m_config.server.workdir.empty() ? "." : m_config.server.workdir, ec).lexically_normal();
+		std::string name = "mcsuper-" + (dir.has_filename() ? dir.filename() : dir.parent_path().filename()).string();
+		for (char &c : name)
+		{
+			if (!std::isalnum(static_cast<utils::tuchar>(c)) && c != '-' && c != '_' && c != '.') c = '_';
+		}
+
+		try
+		{
+			m_cgroup.emplace(name, m_config.server.workdir, *m_config.cgroup);
+		}
+		catch (const std::exception &e)
+		{
+			cerr << "[mcsuper] Can't give the server a cgroup, running it without limits: " << e.what() << endl;
+			return;
+		}
+
+		m_config.server.cgroup = m_cgroup->fd();
+		m_pressure.emplace(m_loop, m_cgroup->path(), m_config.cgroup->pressure_stall, [this](pressure_kind kind) { on_pressure(kind); });
+		cout << "[mcsuper] Server cgroup " << m_cgroup->path().string() << endl;
+		if (m_pressure->armed() == 0) cerr << "[mcsuper] No pressure stall information in this kernel, pressure goes unnoticed" << endl;
+	}
+
+
+	void supervisor::on_pressure(pressure_kind kind)
+	{
+		auto now = std::chrono::steady_clock::now();
+		auto i = static_cast<size_t>(kind);
+		m_pressure_at[i] = now;
+
+		if (!m_pressure_logged[i] || now - *m_pressure_logged[i] >= pressure_report)
+		{
+			m_pressure_logged[i] = now;
+			pressure_stats stats = m_cgroup->pressure(kind).value_or(pressure_stats{});
+			cout << "[mcsuper] " << pressure_name(kind) << " pressure: the server was stalled " << stats.some_avg10 << "% of the last 10s, fully "
+			     << stats.full_avg10 << "%";
+			if (kind == pressure_kind::memory) cout << ", " << m_cgroup->memory_current() / (1024 * 1024) << " MiB charged";
+			if (kind != pressure_kind::cpu && m_backup && m_backup->busy()) cout << ", a backup is running";
+			cout << endl;
+		}
+
+		// Players feel it as lag, better they hear it's the server than blame their connection
+		if (m_ready && m_players.count() > 0 && (!m_players_warned || now - *m_players_warned >= players_warning_every))
+		{
+			m_players_warned = now;
+			send_command(std::string("say ") + pressure_warning);
+		}
+	}
+
+
+	bool supervisor::under_pressure(pressure_kind kind) const
+	{
+		const auto &at = m_pressure_at[static_cast<size_t>(kind)];
+		return at && std::chrono::steady_clock::now() - *at < pressure_hold;
+	}
+
+
+	void supervisor::print_pressure() const
+	{
+		if (!m_cgroup)
+		{
+			cout << "[mcsuper] The server has no cgroup, see --cgroup" << endl;
+			return;
+		}
+
+		for (size_t i = 0; i < static_cast<size_t>(pressure_kind::count); i++)
+		{
+			auto kind = static_cast<pressure_kind>(i);
+			std::optional<pressure_stats> stats = m_cgroup->pressure(kind);
+			if (!stats) continue;
+
+			cout << "[mcsuper] " << std::setw(6) << std::left << pressure_name(kind) << std::right << " some " << stats->some_avg10 << "%, full "
+			     << stats->full_avg10 << "% of the last 10s, " << stats->some_us / 1000000 << "s stalled in total, " << m_pressure->events(kind)
+			     << " triggers" << (under_pressure(kind) ? ", under pressure" : "") << endl;
+		}
+		cout << "[mcsuper] " << m_cgroup->memory_current() / (1024 * 1024) << " MiB charged, memory.high reached " << m_cgroup->memory_events("high")
+		     << " times, memory.max " << m_cgroup->memory_events("max") << " times" << endl;
+	}
+
+
+	void supervisor::print_spam() const
+	{
+		const console_dedup *dedup = m_capture->dedup();
+		if (!dedup)
+		{
+			cout << "[mcsuper] Repeated console lines aren't collapsed, see --collapse" << endl;
+			return;
+		}
+
+		std::vector<console_pattern> patterns = dedup->top(spam_patterns);
+		cout << "[mcsuper] " << dedup->collapsed_lines() << " console lines (" << dedup->collapsed_bytes() / 1024 << " KiB) collapsed, "
+		     << patterns.size() << " messages repeated past the limit" << endl;
+		for (const console_pattern &p : patterns)
+		{
+			cout << "[mcsuper]   " << std::setw(8) << p.lines << " lines, " << std::setw(8) << p.collapsed << " collapsed, " << std::setw(6) << p.this_window
+			     << " this minute, " << std::setw(6) << p.last_window << " the one before  " << p.pattern << endl;
+		}
+	}
+
+
+	void supervisor::setup_placement()
+	{
+		placement_config &p = m_config.placement;
+		if (p.numa_node >= 0)
+		{
+			cpu_mask node = cpu_mask::node(p.numa_node);
+			if (node.empty()) throw std::runtime_error("no NUMA node " + std::to_string(p.numa_node) + " with CPUs");
+			if (!p.server) p.server = node;
+		}
+
+		// Dedicated CPUs are the server's even if --server-cpus left them out
+		if (p.server && p.main) p.server = *p.server | *p.main;
+		if (p.server && p.workers) p.server = *p.server | *p.workers;
+		if (p.server) m_config.server.cpus = p.server->set();
+		m_config.server.numa_node = p.numa_node;
+
+		cpu_mask own = supervisor_cpus(p);
+		if (p.main || p.workers) pin_self(own);
+
+		cout << "[mcsuper] Server on CPUs " << (p.server ? p.server->str() : cpu_mask::online().str());
+		if (p.main) cout << ", main thread on " << p.main->str();
+		if (p.workers) cout << ", chunk workers on " << p.workers->str();
+		if (p.numa_node >= 0) cout << ", memory from node " << p.numa_node;
+		cout << ", supervisor on " << own.str() << endl;
+	}
+
+
+	void supervisor::print_threads()
+	{
+		auto now = std::chrono::steady_clock::now();
+		std::vector<thread_stats> server = m_child ? read_threads(m_child->pid()) : std::vector<thread_stats>{};
+		std::vector<thread_stats> own = read_threads(getpid());
+
+		bool delta = !m_thread_baseline.empty();
+		if (delta)
+		{
+			auto secs = std::chrono::duration_cast<std::chrono::seconds>(now - m_thread_baseline_at).count();
+			cout << "[mcsuper] Context switches and migrations in the " << secs << "s since the last !threads" << endl;
+		}
+		else
+		{
+			cout << "[mcsuper] Context switches and migrations since each thread started" << endl;
+		}
+
+		std::unordered_map<pid_t, thread_stats> baseline;
+		auto print = [&](std::vector<thread_stats> &threads, std::string_view owner, size_t limit)
+		{
+			for (thread_stats &t : threads)
+			{
+				baseline[t.tid] = t;
+				auto it = m_thread_baseline.find(t.tid);
+				if (it == m_thread_baseline.end()) continue;
+				t.voluntary -= std::min(t.voluntary, it->second.voluntary);
+				t.involuntary -= std::min(t.involuntary, it->second.involuntary);
+				t.migrations -= std::min(t.migrations, it->second.migrations);
+			}
+
+			// Preemptions and migrations are what cost a tick thread its cache, busiest first
+			std::sort(threads.begin(), threads.end(), [](const thread_stats &a, const thread_stats &b)
+			{
+				return a.involuntary + a.migrations > b.involuntary + b.migrations;
+			});
+			if (threads.size() > limit) threads.resize(limit);
+
+			for (const thread_stats &t : threads)
+			{
+				std::optional<thread_placement::role> role = owner == "server" && m_placement ? m_placement->role_of(t.tid) : std::nullopt;
+				cout << "[mcsuper]   " << owner << " " << std::setw(20) << std::left << t.name << std::right << " " << std::setw(6)
+				     << (role ? thread_placement::role_name(*role) : "") << " CPUs " << std::setw(8) << std::left << t.allowed.str() << std::right
+				     << " on " << std::setw(3) << t.cpu << "  " << t.voluntary << " voluntary, " << t.involuntary << " preempted, " << t.migrations
+				     << " migrations" << endl;
+			}
+		};
+
+		print(server, "server", 12);
+		print(own, "mcsuper", own.size());
+
+		m_thread_baseline = std::move(baseline);
+		m_thread_baseline_at = now;
+	}
+
+} // End namespace mcsuper
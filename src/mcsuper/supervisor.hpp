@@ -0,0 +1,219 @@
+#pragma once
+#ifndef H_559013_SRC_SUPERVISOR
+#define H_559013_SRC_SUPERVISOR 1
+
+#include <array>
+#include <chrono>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+#include "utils.hpp"
+#include "event_loop.hpp"
+#include "process.hpp"
+#include "console_capture.hpp"
+#include "console_scan.hpp"
+#include "console_events.hpp"
+#include "tick_stats.hpp"
+#include "rcon.hpp"
+#include "server_properties.hpp"
+#include "backup_pipeline.hpp"
+#include "restart_policy.hpp"
+#include "front_listener.hpp"
+#include "tcp_proxy.hpp"
+#include "player_sessions.hpp"
+#include "metrics.hpp"
+#include "proc_sampler.hpp"
+#include "cgroup.hpp"
+#include "placement.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Everything the supervisor needs to know about the server it babysits
+	 */
+	struct supervisor_config
+	{
+		spawn_options server;
+		// How long the server gets to act on "stop" before it is killed
+		std::chrono::seconds stop_timeout{ 60 };
+		// Console log, relative paths are inside the server's workdir
+		std::filesystem::path console_log = "logs/console.log";
+		// Bytes of console held in memory for parsing
+		size_t console_ring = 1 << 20;
+		// Slack between the server's stdout and the log file, and what happens past it
+		console_buffering console;
+		// Backup repository for live backups, empty disables them
+		std::filesystem::path backup_repo;
+		// Time between scheduled backups, zero means only on request
+		std::chrono::minutes backup_interval{ 0 };
+		// What happens when the server exits without being asked to
+		restart_config restart;
+		// Start the server only once a player tries to join, and go back to waiting after a clean exit
+		bool wake_on_join = false;
+		// Save and stop the server after this long with nobody online, zero never does
+		std::chrono::minutes idle_stop{ 0 };
+		// Public game port to proxy to the server's own, 0 leaves clients talking to the server directly
+		utils::tushort listen_port = 0;
+		// Address for listen_port, empty for every interface
+		std::string listen_host;
+		// How often the server's /proc counters are sampled into the last hour's history, zero disables it
+		std::chrono::milliseconds sample_interval{ 0 };
+		// OpenMetrics endpoint, 0 disables it
+		utils::tushort metrics_port = 0;
+		std::string metrics_host;
+		// Run the server in a cgroup of its own with these limits and react to its resource pressure
+		std::optional<cgroup_limits> cgroup;
+		// CPUs and NUMA node for the server, its main thread and chunk workers, and so for the supervisor
+		placement_config placement;
+	};
+
+
+	/**
+	 * @brief Runs the server and multiplexes its pipes, pidfd, our signals and timers on one event loop
+	 *
+	 * Nothing here polls, while the server is quiet the supervisor sits in epoll_wait
+	 */
+	class supervisor
+	{
+		public:
+			supervisor(event_loop &loop, supervisor_config config);
+
+			/**
+			 * @brief Start the server and dispatch events until it has exited for good, restarting it as the
+			 * restart policy says in between
+			 *
+			 * @return int The server's last exit code, or 128 + signal if it was killed
+			 */
+			int run();
+
+			/**
+			 * @brief Send one line to the server console, queued if the server isn't reading it right now
+			 */
+			void send_command(std::string_view command);
+
+			/**
+			 * @brief Ask the server to stop, killing it if it doesn't within stop_timeout
+			 */
+			void request_stop();
+
+			/**
+			 * @brief Lag derived from the server's "Can't keep up" warnings
+			 */
+			const tick_stats &ticks() const noexcept { return m_ticks; }
+
+		private:
+			void start_server();
+			void on_output(int fd, int sink);
+			void on_console(std::string_view lines);
+			void on_line(const log_line &line);
+			void on_event(const events::console_event &event);
+			void on_input();
+			void flush_stdin();
+			void on_operator_command(std::string_view command);
+			void on_minute();
+			void check_idle();
+			void idle_stop();
+			void print_players() const;
+			std::string render_metrics() const;
+			void dump_samples();
+			void connect_rcon();
+			void start_backup();
+			void scheduled_backup();
+			void setup_cgroup();
+			void on_pressure(pressure_kind kind);
+			bool under_pressure(pressure_kind kind) const;
+			void print_pressure() const;
+			void setup_placement();
+			void print_threads();
+			void print_spam() const;
+			void on_signal();
+			void on_exit();
+			void schedule_restart(std::chrono::seconds delay);
+			void sleep();
+			void wake(std::string_view player);
+			std::string sleeping_status(utils::tsint protocol) const;
+			void cache_status();
+			void start_proxy();
+			void print_proxy() const;
+
+			event_loop &m_loop;
+			supervisor_config m_config;
+
+			std::optional<child_process> m_child;
+			std::chrono::steady_clock::time_point m_started_at;
+			// Baseline of the OOM kill counters, taken at each spawn
+			std::optional<oom_watch> m_oom;
+			// Per-second history of the running server, with sample_interval
+			std::optional<proc_sampler> m_sampler;
+			// Pins the running server's threads by name, with dedicated main or worker CPUs
+			std::optional<thread_placement> m_placement;
+			// Thread counters at the last !threads, which reports the change since
+			std::unordered_map<pid_t, thread_stats> m_thread_baseline;
+			std::chrono::steady_clock::time_point m_thread_baseline_at;
+
+			restart_policy m_restart;
+			std::optional<event_loop::timer_id> m_restart_timer;
+			// When the server last went down on its own, cleared once it's ready again
+			std::optional<std::chrono::steady_clock::time_point> m_exited_at;
+			std::optional<console_capture> m_capture;
+			// Console lines seen per log level, bumped for every line and read by scrapes
+			padded_counter m_level_counts[static_cast<size_t>(log_level::count)];
+			utils::unique_fd m_signals;
+
+			// Set once the server has printed "Done"
+			bool m_ready = false;
+			bool m_stopping = false;
+			std::optional<event_loop::timer_id> m_kill_timer;
+			std::optional<event_loop::timer_id> m_minute_timer;
+			std::optional<event_loop::timer_id> m_backup_timer;
+
+			// Operator input not yet terminated by a line break
+			std::string m_input;
+			// Commands the server's stdin hasn't taken yet, written as EPOLLOUT says it has room
+			std::string m_stdin_queue;
+			bool m_stdin_watched = false;
+			// Commands turned away since the queue filled up
+			utils::tulong m_stdin_dropped = 0;
+
+			tick_stats m_ticks;
+
+			player_sessions m_players;
+			// Set while a stop for lack of players is in progress, with the server's resident memory at that point
+			bool m_idle_stopping = false;
+			utils::tulong m_idle_resident = 0;
+			padded_counter m_idle_stops;
+			// Resident memory of the servers stopped for being idle, added up
+			padded_counter m_reclaimed;
+
+			// Connected once the server is ready, if server.properties enables RCON
+			std::optional<rcon_client> m_rcon;
+
+			// Answers on the game port while the server sleeps, with wake_on_join, or for good in front of the proxy
+			std::optional<front_listener> m_front;
+			// Carries players to the server while it's ready, with listen_port
+			std::optional<tcp_proxy> m_proxy;
+			std::optional<status_probe> m_probe;
+			// The server's own status JSON from its last start, handed out while it sleeps
+			std::string m_status;
+
+			// Set up when a backup repository is configured
+			std::optional<backup_pipeline> m_backup;
+			// A scheduled backup put off for pressure, taken once it has cleared
+			bool m_backup_deferred = false;
+
+			// With config.cgroup, the server's cgroup and the PSI triggers on it
+			std::optional<server_cgroup> m_cgroup;
+			std::optional<pressure_watch> m_pressure;
+			// When each resource's trigger last fired and when that was last reported
+			std::array<std::optional<std::chrono::steady_clock::time_point>, static_cast<size_t>(pressure_kind::count)> m_pressure_at;
+			std::array<std::optional<std::chrono::steady_clock::time_point>, static_cast<size_t>(pressure_kind::count)> m_pressure_logged;
+			std::optional<std::chrono::steady_clock::time_point> m_players_warned;
+			std::optional<metrics_endpoint> m_metrics;
+			int m_exit_code = 0;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_559013_SRC_SUPERVISOR
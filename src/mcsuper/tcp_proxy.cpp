@@ -0,0 +1,306 @@
+#include "tcp_proxy.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		// Bytes moved into a pipe per splice, its default capacity
+		constexpr size_t pipe_chunk = 1 << 16;
+
+		// Splices per direction per wakeup, so one busy connection can't starve the rest
+		constexpr int max_rounds = 16;
+
+
+		std::pair<utils::unique_fd, utils::unique_fd> make_pipe()
+		{
+			int fds[2];
+			if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) utils::throw_errno("pipe2");
+			return { utils::unique_fd(fds[0]), utils::unique_fd(fds[1]) };
+		}
+
+
+		std::string peer_name(int fd)
+		{
+			sockaddr_storage addr{};
+			socklen_t len = sizeof(addr);
+			if (getpeername(fd, reinterpret_cast<sockaddr *>(&addr), &len) < 0) return "?";
+
+			char host[INET6_ADDRSTRLEN] = "?";
+			utils::tushort port = 0;
+			if (addr.ss_family == AF_INET)
+			{
+				auto *in = reinterpret_cast<sockaddr_in *>(&addr);
+				inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+				port = ntohs(in->sin_port);
+			}
+			else if (addr.ss_family == AF_INET6)
+			{
+				auto *in6 = reinterpret_cast<sockaddr_in6 *>(&addr);
+				inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+				port = ntohs(in6->sin6_port);
+
+				// Dual-stack listeners see IPv4 clients as ::ffff:a.b.c.d
+				if (std::strncmp(host, "::ffff:", 7) == 0) std::memmove(host, host + 7, std::strlen(host + 7) + 1);
+				else return std::string(1, '[').append(host).append("]:").append(std::to_string(port));
+			}
+			return std::string(host) + ":" + std::to_string(port);
+		}
+
+
+		void set_nodelay(int fd)
+		{
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		}
+	}
+
+
+	tcp_proxy::tcp_proxy(const sockaddr_storage &backend, socklen_t backend_len) : m_backend(backend), m_backend_len(backend_len)
+	{
+		m_info_timer = m_loop.add_timer(std::chrono::seconds(1), std::chrono::seconds(1), [this]() { refresh_tcp_info(); });
+		m_thread = std::thread([this]() { m_loop.run(); });
+	}
+
+
+	tcp_proxy::~tcp_proxy()
+	{
+		m_loop.post([this]()
+		{
+			while (!m_sessions.empty()) close(m_sessions.begin());
+			m_loop.cancel_timer(*m_info_timer);
+			m_loop.stop();
+		});
+		m_thread.join();
+	}
+
+
+	std::pair<sockaddr_storage, socklen_t> tcp_proxy::resolve(const std::string &host, utils::tushort port)
+	{
+		addrinfo hints{};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_NUMERICSERV;
+
+		addrinfo *res = nullptr;
+		std::string target = host.empty() ? "127.0.0.1" : host;
+		if (getaddrinfo(target.c_str(), std::to_string(port).c_str(), &hints, &res) != 0 || res == nullptr) throw std::runtime_error("can't resolve " + target);
+
+		sockaddr_storage addr{};
+		std::memcpy(&addr, res->ai_addr, res->ai_addrlen);
+		socklen_t len = res->ai_addrlen;
+		freeaddrinfo(res);
+		return { addr, len };
+	}
+
+
+	void tcp_proxy::add(utils::unique_fd client)
+	{
+		m_loop.post([this, fd = client.release()]() { start(utils::unique_fd(fd)); });
+	}
+
+
+	std::vector<std::shared_ptr<const proxy_counters>> tcp_proxy::connections() const
+	{
+		std::lock_guard lock(m_counters_lock);
+		return m_counters;
+	}
+
+
+	void tcp_proxy::start(utils::unique_fd client)
+	{
+		m_totals.connections.fetch_add(1, std::memory_order_relaxed);
+
+		utils::unique_fd server(socket(m_backend.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+		if (!server || (connect(server.get(), reinterpret_cast<const sockaddr *>(&m_backend), m_backend_len) < 0 && errno != EINPROGRESS))
+		{
+			m_totals.refused.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		session &s = m_sessions.emplace_back();
+		auto ref = std::prev(m_sessions.end());
+		s.client = std::move(client);
+		s.server = std::move(server);
+		std::tie(s.up.pipe_r, s.up.pipe_w) = make_pipe();
+		std::tie(s.down.pipe_r, s.down.pipe_w) = make_pipe();
+
+		s.counters = std::make_shared<proxy_counters>();
+		s.counters->peer = peer_name(s.client.get());
+		s.counters->since = std::chrono::system_clock::now();
+		{
+			std::lock_guard lock(m_counters_lock);
+			m_counters.push_back(s.counters);
+		}
+		m_totals.active.fetch_add(1, std::memory_order_relaxed);
+
+		// The client isn't read until the backend connection is up, its first bytes wait in the socket
+		set_nodelay(s.client.get());
+		s.server_events = EPOLLOUT;
+		m_loop.add(s.server.get(), s.server_events, [this, ref](utils::tuint events) { on_server(ref, events); });
+		m_loop.add(s.client.get(), s.client_events, [this, ref](utils::tuint events) { on_client(ref, events); });
+	}
+
+
+	void tcp_proxy::on_server(session_ref s, utils::tuint events)
+	{
+		if (!s->connected)
+		{
+			int err = 0;
+			socklen_t len = sizeof(err);
+			getsockopt(s->server.get(), SOL_SOCKET, SO_ERROR, &err, &len);
+			if (err != 0 || (events & (EPOLLERR | EPOLLHUP)))
+			{
+				m_totals.refused.fetch_add(1, std::memory_order_relaxed);
+				return close(s);
+			}
+			if (!(events & EPOLLOUT)) return;
+
+			s->connected = true;
+			set_nodelay(s->server.get());
+			if (!pump(s->up, s->client.get(), s->server.get(), s->counters->bytes_up)) return close(s);
+			update_interest(s);
+			return;
+		}
+
+		if (events & EPOLLERR) return close(s);
+
+		bool ok = true;
+		if (events & (EPOLLIN | EPOLLHUP)) ok = pump(s->down, s->server.get(), s->client.get(), s->counters->bytes_down);
+		if (ok && (events & EPOLLOUT)) ok = pump(s->up, s->client.get(), s->server.get(), s->counters->bytes_up);
+		if (!ok) return close(s);
+
+		if (events & EPOLLHUP) hang_up(s->server_hup, s->server.get(), s->up);
+		update_interest(s);
+	}
+
+
+	void tcp_proxy::on_client(session_ref s, utils::tuint events)
+	{
+		if (!s->connected)
+		{
+			if (events & (EPOLLHUP | EPOLLERR)) close(s);
+			return;
+		}
+
+		if (events & EPOLLERR) return close(s);
+
+		bool ok = true;
+		if (events & (EPOLLIN | EPOLLHUP)) ok = pump(s->up, s->client.get(), s->server.get(), s->counters->bytes_up);
+		if (ok && (events & EPOLLOUT)) ok = pump(s->down, s->server.get(), s->client.get(), s->counters->bytes_down);
+		if (!ok) return close(s);
+
+		if (events & EPOLLHUP) hang_up(s->client_hup, s->client.get(), s->down);
+		update_interest(s);
+	}
+
+
+	bool tcp_proxy::pump(direction &dir, int src, int dst, std::atomic<utils::tulong> &bytes)
+	{
+		for (int round = 0; round < max_rounds;)
+		{
+			// Drain the pipe before reading more, so a slow receiver stops the sender
+			if (dir.buffered > 0)
+			{
+				ssize_t n = splice(dir.pipe_r.get(), nullptr, dst, nullptr, dir.buffered, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				if (n > 0)
+				{
+					dir.buffered -= n;
+					bytes.fetch_add(n, std::memory_order_relaxed);
+					continue;
+				}
+				if (n < 0 && errno == EINTR) continue;
+				return n < 0 && errno == EAGAIN;
+			}
+
+			if (dir.eof) return true;
+
+			ssize_t n = splice(src, nullptr, dir.pipe_w.get(), nullptr, pipe_chunk, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n > 0)
+			{
+				dir.buffered = n;
+				round++;
+				continue;
+			}
+			if (n == 0)
+			{
+				// Pass the half-close on, the other direction may still be talking
+				dir.eof = true;
+				shutdown(dst, SHUT_WR);
+				return true;
+			}
+			if (n < 0 && errno == EINTR) continue;
+			return n < 0 && errno == EAGAIN;
+		}
+		return true;
+	}
+
+
+	void tcp_proxy::hang_up(bool &hup, int fd, direction &into)
+	{
+		if (hup) return;
+
+		// A hung up socket is reported ready forever, so it leaves epoll. Whatever it sent is already in its
+		// receive buffer and gets pulled as the other side drains, but nothing can be written to it anymore
+		hup = true;
+		m_loop.remove(fd);
+		into.eof = true;
+		into.buffered = 0;
+	}
+
+
+	void tcp_proxy::update_interest(session_ref s)
+	{
+		// Both sides are done
+		if (s->up.eof && s->down.eof && s->up.buffered == 0 && s->down.buffered == 0) return close(s);
+
+		utils::tuint client = 0, server = 0;
+		if (!s->up.eof && s->up.buffered == 0) client |= EPOLLIN;
+		if (s->down.buffered > 0 || (s->server_hup && !s->down.eof)) client |= EPOLLOUT;
+		if (!s->down.eof && s->down.buffered == 0) server |= EPOLLIN;
+		if (s->up.buffered > 0 || (s->client_hup && !s->up.eof)) server |= EPOLLOUT;
+
+		if (!s->client_hup && client != s->client_events) m_loop.modify(s->client.get(), s->client_events = client);
+		if (!s->server_hup && server != s->server_events) m_loop.modify(s->server.get(), s->server_events = server);
+	}
+
+
+	void tcp_proxy::close(session_ref s)
+	{
+		m_loop.remove(s->client.get());
+		m_loop.remove(s->server.get());
+
+		m_totals.bytes_up.fetch_add(s->counters->bytes_up.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		m_totals.bytes_down.fetch_add(s->counters->bytes_down.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		m_totals.active.fetch_sub(1, std::memory_order_relaxed);
+		{
+			std::lock_guard lock(m_counters_lock);
+			std::erase(m_counters, s->counters);
+		}
+		m_sessions.erase(s);
+	}
+
+
+	void tcp_proxy::refresh_tcp_info()
+	{
+		for (session &s : m_sessions)
+		{
+			tcp_info info{};
+			socklen_t len = sizeof(info);
+			if (getsockopt(s.client.get(), IPPROTO_TCP, TCP_INFO, &info, &len) < 0) continue;
+			s.counters->packets_in.store(info.tcpi_data_segs_in, std::memory_order_relaxed);
+			s.counters->packets_out.store(info.tcpi_data_segs_out, std::memory_order_relaxed);
+		}
+	}
+
+} // End namespace mcsuper
@@ -0,0 +1,149 @@
+#pragma once
+#ifndef H_517648_SRC_TCP_PROXY
+#define H_517648_SRC_TCP_PROXY 1
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <optional>
+
+#include <sys/socket.h>
+
+#include "utils.hpp"
+#include "event_loop.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Live counters of one proxied connection, written by the proxy thread and read by anyone
+	 */
+	struct proxy_counters
+	{
+		std::string peer;
+		std::chrono::system_clock::time_point since;
+		// Client to server and server to client
+		std::atomic<utils::tulong> bytes_up{ 0 };
+		std::atomic<utils::tulong> bytes_down{ 0 };
+		// TCP segments on the client's socket, from TCP_INFO, refreshed every second
+		std::atomic<utils::tulong> packets_in{ 0 };
+		std::atomic<utils::tulong> packets_out{ 0 };
+	};
+
+
+	/**
+	 * @brief Totals over every connection the proxy has carried
+	 */
+	struct proxy_totals
+	{
+		std::atomic<utils::tulong> connections{ 0 };
+		std::atomic<utils::tulong> active{ 0 };
+		// Backend connects that failed, the client was dropped
+		std::atomic<utils::tulong> refused{ 0 };
+		// Bytes of connections that have closed, add the live ones for a current figure
+		std::atomic<utils::tulong> bytes_up{ 0 };
+		std::atomic<utils::tulong> bytes_down{ 0 };
+	};
+
+
+	/**
+	 * @brief Layer 4 proxy from accepted client sockets to the server, on its own thread and event loop
+	 *
+	 * Each direction of a connection is a pipe: splice() moves bytes from the source socket into the pipe
+	 * and from the pipe into the destination socket, so payloads stay in kernel pages and are never copied
+	 * through userspace. A direction stops reading while its pipe can't be drained, which passes backpressure
+	 * through to the sender. Running on a dedicated thread keeps forwarding latency independent of whatever
+	 * the supervisor's loop is busy with
+	 */
+	class tcp_proxy
+	{
+		public:
+			/**
+			 * @param backend Where the server listens, connected to once per client
+			 */
+			tcp_proxy(const sockaddr_storage &backend, socklen_t backend_len);
+
+			/**
+			 * @brief Closes every connection and joins the proxy thread
+			 */
+			~tcp_proxy();
+
+			tcp_proxy(const tcp_proxy &) = delete;
+			tcp_proxy &operator=(const tcp_proxy &) = delete;
+
+			/**
+			 * @brief Resolve host (empty for loopback) and port into a backend address
+			 */
+			static std::pair<sockaddr_storage, socklen_t> resolve(const std::string &host, utils::tushort port);
+
+			/**
+			 * @brief Take over an accepted client socket, safe to call from any thread
+			 */
+			void add(utils::unique_fd client);
+
+			/**
+			 * @brief Counters of the connections open right now
+			 */
+			std::vector<std::shared_ptr<const proxy_counters>> connections() const;
+
+			const proxy_totals &totals() const noexcept { return m_totals; }
+
+		private:
+			struct direction
+			{
+				utils::unique_fd pipe_r;
+				utils::unique_fd pipe_w;
+				// Bytes sitting in the pipe
+				size_t buffered = 0;
+				bool eof = false;
+			};
+
+			struct session
+			{
+				utils::unique_fd client;
+				utils::unique_fd server;
+				bool connected = false;
+				// Out of epoll after EPOLLHUP, read from only as the other side drains
+				bool client_hup = false;
+				bool server_hup = false;
+				direction up;
+				direction down;
+				utils::tuint client_events = 0;
+				utils::tuint server_events = 0;
+				std::shared_ptr<proxy_counters> counters;
+			};
+
+			typedef std::list<session>::iterator session_ref;
+
+			void start(utils::unique_fd client);
+			void on_server(session_ref s, utils::tuint events);
+			void on_client(session_ref s, utils::tuint events);
+			// False once the direction failed
+			bool pump(direction &dir, int src, int dst, std::atomic<utils::tulong> &bytes);
+			void hang_up(bool &hup, int fd, direction &into);
+			void update_interest(session_ref s);
+			void close(session_ref s);
+			void refresh_tcp_info();
+
+			sockaddr_storage m_backend;
+			socklen_t m_backend_len;
+
+			event_loop m_loop;
+			std::list<session> m_sessions;
+			std::optional<event_loop::timer_id> m_info_timer;
+
+			mutable std::mutex m_counters_lock;
+			std::vector<std::shared_ptr<const proxy_counters>> m_counters;
+			proxy_totals m_totals;
+
+			std::thread m_thread;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_517648_SRC_TCP_PROXY
@@ -0,0 +1,142 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		// Which pool the current thread works for and its index there, so submit() can find the local deque
+		thread_local const thread_pool *current_pool = nullptr;
+		thread_local size_t current_index = 0;
+	}
+
+
+	thread_pool::thread_pool(size_t threads)
+	{
+		if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+		for (size_t i = 0; i < threads; i++) m_queues.push_back(std::make_unique<worker_queue>());
+		for (size_t i = 0; i < threads; i++) m_threads.emplace_back([this, i]() { work(i); });
+	}
+
+
+	thread_pool::~thread_pool()
+	{
+		{
+			std::lock_guard lock(m_lock);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+
+		for (std::thread &t : m_threads) t.join();
+	}
+
+
+	thread_pool &thread_pool::shared()
+	{
+		static thread_pool pool;
+		return pool;
+	}
+
+
+	void thread_pool::submit(task fn)
+	{
+		size_t target = current_pool == this ? current_index : m_next++ % m_queues.size();
+
+		m_pending++;
+		{
+			std::lock_guard lock(m_queues[target]->lock);
+			m_queues[target]->tasks.push_back(std::move(fn));
+		}
+
+		// Counted under the sleep lock so a worker can't check, miss it and then sleep through the notify
+		{
+			std::lock_guard lock(m_lock);
+			m_queued++;
+		}
+		m_wake.notify_one();
+	}
+
+
+	void thread_pool::wait()
+	{
+		std::unique_lock lock(m_lock);
+		m_idle.wait(lock, [this]() { return m_pending == 0; });
+
+		if (m_error)
+		{
+			std::exception_ptr error = std::exchange(m_error, nullptr);
+			std::rethrow_exception(error);
+		}
+	}
+
+
+	bool thread_pool::take(size_t self, task &out)
+	{
+		// Own work newest-first
+		{
+			worker_queue &own = *m_queues[self];
+			std::lock_guard lock(own.lock);
+			if (!own.tasks.empty())
+			{
+				out = std::move(own.tasks.back());
+				own.tasks.pop_back();
+				return true;
+			}
+		}
+
+		// Steal the oldest from the others, starting after ourselves so thieves spread out
+		for (size_t i = 1; i < m_queues.size(); i++)
+		{
+			worker_queue &victim = *m_queues[(self + i) % m_queues.size()];
+			std::lock_guard lock(victim.lock);
+			if (!victim.tasks.empty())
+			{
+				out = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+
+	void thread_pool::work(size_t self)
+	{
+		current_pool = this;
+		current_index = self;
+
+		for (;;)
+		{
+			task fn;
+			if (take(self, fn))
+			{
+				m_queued--;
+
+				try
+				{
+					fn();
+				}
+				catch (...)
+				{
+					std::lock_guard lock(m_lock);
+					if (!m_error) m_error = std::current_exception();
+				}
+
+				if (--m_pending == 0)
+				{
+					std::lock_guard lock(m_lock);
+					m_idle.notify_all();
+				}
+				continue;
+			}
+
+			std::unique_lock lock(m_lock);
+			m_wake.wait(lock, [this]() { return m_queued > 0 || m_stop; });
+			if (m_stop && m_queued == 0) return;
+		}
+	}
+
+} // End namespace mcsuper
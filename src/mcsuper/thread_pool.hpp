@@ -0,0 +1,91 @@
+#pragma once
+#ifndef H_650381_SRC_THREAD_POOL
+#define H_650381_SRC_THREAD_POOL 1
+
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief Work-stealing thread pool for the offline world tools
+	 *
+	 * Every worker owns a deque. Work submitted from a worker goes on its own deque and is taken back
+	 * newest-first while it's still hot in cache, idle workers steal the oldest task from someone else.
+	 * Work from outside the pool is dealt round-robin. Tasks should be coarse (a file block, a region file),
+	 * the pool is built for throughput on big batches, not for latency
+	 */
+	class thread_pool
+	{
+		public:
+			typedef std::function<void()> task;
+
+			/**
+			 * @param threads Worker count, 0 for one per CPU
+			 */
+			explicit thread_pool(size_t threads = 0);
+
+			/**
+			 * @brief Runs whatever is still queued, then joins the workers
+			 */
+			~thread_pool();
+
+			thread_pool(const thread_pool &) = delete;
+			thread_pool &operator=(const thread_pool &) = delete;
+
+			/**
+			 * @brief Queue a task, an exception it throws is rethrown by the next wait()
+			 */
+			void submit(task fn);
+
+			/**
+			 * @brief Block until every submitted task has finished, never call it from inside a task
+			 */
+			void wait();
+
+			size_t size() const noexcept { return m_threads.size(); }
+
+			/**
+			 * @brief The process-wide pool, created with one worker per CPU on first use
+			 */
+			static thread_pool &shared();
+
+		private:
+			struct worker_queue
+			{
+				std::mutex lock;
+				std::deque<task> tasks;
+			};
+
+			void work(size_t self);
+			bool take(size_t self, task &out);
+
+			std::vector<std::unique_ptr<worker_queue>> m_queues;
+			std::vector<std::thread> m_threads;
+
+			// Sleeping and waking go through this lock, the queues themselves don't
+			std::mutex m_lock;
+			std::condition_variable m_wake;
+			std::condition_variable m_idle;
+			std::atomic<size_t> m_queued{ 0 };
+			// Queued plus running
+			std::atomic<size_t> m_pending{ 0 };
+			std::atomic<size_t> m_next{ 0 };
+			bool m_stop = false;
+
+			std::exception_ptr m_error;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_650381_SRC_THREAD_POOL
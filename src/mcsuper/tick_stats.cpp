@@ -0,0 +1,144 @@
+#include "tick_stats.hpp"
+
+#include <algorithm>
+
+
+namespace mcsuper
+{
+	size_t lag_histogram::bucket_of(utils::tulong value) noexcept
+	{
+		constexpr utils::tulong linear = 1 << sub_bits;
+		constexpr utils::tulong half = linear >> 1;
+
+		if (value < linear) return value;
+		if (value > UINT32_MAX) return bucket_count - 1;
+
+		// Shift the value down until it has sub_bits significant bits, the shift picks the magnitude band
+		utils::tuint msb = 63 - __builtin_clzll(value);
+		utils::tuint shift = msb - (sub_bits - 1);
+		return linear + (shift - 1) * half + ((value >> shift) - half);
+	}
+
+
+	utils::tulong lag_histogram::bucket_upper(size_t bucket) noexcept
+	{
+		constexpr size_t linear = 1 << sub_bits;
+		constexpr size_t half = linear >> 1;
+
+		if (bucket < linear) return bucket;
+
+		utils::tuint shift = (bucket - linear) / half + 1;
+		utils::tulong sub = (bucket - linear) % half + half;
+		return ((sub + 1) << shift) - 1;
+	}
+
+
+	void lag_histogram::record(utils::tulong value) noexcept
+	{
+		m_buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+		m_count.fetch_add(1, std::memory_order_relaxed);
+		m_sum.fetch_add(value, std::memory_order_relaxed);
+
+		utils::tulong seen = m_max.load(std::memory_order_relaxed);
+		while (value > seen && !m_max.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+	}
+
+
+	void lag_histogram::merge(const lag_histogram &other) noexcept
+	{
+		for (size_t i = 0; i < bucket_count; i++)
+		{
+			utils::tulong n = other.bucket(i);
+			if (n != 0) m_buckets[i].fetch_add(n, std::memory_order_relaxed);
+		}
+
+		m_count.fetch_add(other.count(), std::memory_order_relaxed);
+		m_sum.fetch_add(other.sum(), std::memory_order_relaxed);
+
+		utils::tulong value = other.max();
+		utils::tulong seen = m_max.load(std::memory_order_relaxed);
+		while (value > seen && !m_max.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+	}
+
+
+	void lag_histogram::clear() noexcept
+	{
+		for (auto &b : m_buckets) b.store(0, std::memory_order_relaxed);
+		m_count.store(0, std::memory_order_relaxed);
+		m_sum.store(0, std::memory_order_relaxed);
+		m_max.store(0, std::memory_order_relaxed);
+	}
+
+
+	utils::tulong lag_histogram::quantile(double q) const noexcept
+	{
+		utils::tulong total = count();
+		if (total == 0) return 0;
+
+		// Rank of the wanted recording, 1-based
+		utils::tulong rank = std::max<utils::tulong>(1, static_cast<utils::tulong>(q * total + 0.5));
+		utils::tulong seen = 0;
+
+		for (size_t i = 0; i < bucket_count; i++)
+		{
+			seen += bucket(i);
+			if (seen >= rank) return std::min(bucket_upper(i), max());
+		}
+		return max();
+	}
+
+
+	tick_stats::tick_stats() : m_minute_start(std::chrono::steady_clock::now()) {}
+
+
+	void tick_stats::record(utils::tulong ms, utils::tulong ticks) noexcept
+	{
+		m_lifetime.record(ms);
+		m_minute.record(ms);
+		m_ticks_minute.fetch_add(ticks, std::memory_order_relaxed);
+		m_ticks_total.fetch_add(ticks, std::memory_order_relaxed);
+	}
+
+
+	double tick_stats::effective_tps(utils::tulong ticks_behind, std::chrono::seconds window) noexcept
+	{
+		if (window.count() <= 0) return nominal_tps;
+		double tps = nominal_tps - static_cast<double>(ticks_behind) / window.count();
+		return std::clamp(tps, 0.0, nominal_tps);
+	}
+
+
+	lag_rollup tick_stats::rollup()
+	{
+		auto now = std::chrono::steady_clock::now();
+		auto window = std::chrono::round<std::chrono::seconds>(now - m_minute_start);
+		m_minute_start = now;
+
+		lag_rollup r;
+		r.minute       = std::chrono::system_clock::now();
+		r.warnings     = m_minute.count();
+		r.ticks_behind = m_ticks_minute.exchange(0, std::memory_order_relaxed);
+		r.p50_ms       = m_minute.quantile(0.50);
+		r.p99_ms       = m_minute.quantile(0.99);
+		r.max_ms       = m_minute.max();
+		r.tps          = effective_tps(r.ticks_behind, window);
+		m_minute.clear();
+
+		m_history[m_history_next] = r;
+		m_history_next = (m_history_next + 1) % history_minutes;
+		m_history_len = std::min(m_history_len + 1, history_minutes);
+		return r;
+	}
+
+
+	std::vector<lag_rollup> tick_stats::history() const
+	{
+		std::vector<lag_rollup> out;
+		out.reserve(m_history_len);
+
+		size_t first = (m_history_next + history_minutes - m_history_len) % history_minutes;
+		for (size_t i = 0; i < m_history_len; i++) out.push_back(m_history[(first + i) % history_minutes]);
+		return out;
+	}
+
+} // End namespace mcsuper
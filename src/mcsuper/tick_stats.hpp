@@ -0,0 +1,143 @@
+#pragma once
+#ifndef H_841926_SRC_TICK_STATS
+#define H_841926_SRC_TICK_STATS 1
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief HDR-style log-linear histogram of millisecond values with atomic counters
+	 *
+	 * Values below 16 get exact buckets, above that each power of two is split into 8 buckets, so every
+	 * bucket is within 1/8 (12.5%) of its true value across the whole 32-bit range. Recording is a couple of
+	 * relaxed atomic adds, readers may run concurrently and see a slightly torn but never corrupt view
+	 */
+	class lag_histogram
+	{
+		public:
+			static constexpr utils::tuint sub_bits = 4;
+			static constexpr size_t bucket_count = (1 << sub_bits) + (32 - sub_bits) * (1 << (sub_bits - 1));
+
+			void record(utils::tulong value) noexcept;
+
+			/**
+			 * @brief Add every count from another histogram into this one
+			 */
+			void merge(const lag_histogram &other) noexcept;
+
+			void clear() noexcept;
+
+			utils::tulong count() const noexcept { return m_count.load(std::memory_order_relaxed); }
+			utils::tulong sum() const noexcept { return m_sum.load(std::memory_order_relaxed); }
+			utils::tulong max() const noexcept { return m_max.load(std::memory_order_relaxed); }
+
+			/**
+			 * @brief Value at or below which a fraction q of recordings fall, reported as the bucket's upper bound
+			 *
+			 * @param q Quantile in [0, 1]
+			 * @return utils::tulong Zero if nothing was recorded
+			 */
+			utils::tulong quantile(double q) const noexcept;
+
+			/**
+			 * @brief Bucket a value lands in
+			 */
+			static size_t bucket_of(utils::tulong value) noexcept;
+
+			/**
+			 * @brief Largest value that lands in a bucket
+			 */
+			static utils::tulong bucket_upper(size_t bucket) noexcept;
+
+			utils::tulong bucket(size_t i) const noexcept { return m_buckets[i].load(std::memory_order_relaxed); }
+
+		private:
+			std::array<std::atomic<utils::tulong>, bucket_count> m_buckets{};
+			std::atomic<utils::tulong> m_count{ 0 };
+			std::atomic<utils::tulong> m_sum{ 0 };
+			std::atomic<utils::tulong> m_max{ 0 };
+	};
+
+
+	/**
+	 * @brief Summary of one minute of "Can't keep up" warnings
+	 */
+	struct lag_rollup
+	{
+		std::chrono::system_clock::time_point minute;
+		utils::tulong warnings = 0;
+		utils::tulong ticks_behind = 0;
+		utils::tulong p50_ms = 0;
+		utils::tulong p99_ms = 0;
+		utils::tulong max_ms = 0;
+		// 20 minus the ticks skipped per second over the window
+		double tps = 20.0;
+	};
+
+
+	/**
+	 * @brief Turns the server's "Running Nms or N ticks behind" warnings into lag percentiles and an effective TPS
+	 *
+	 * This is the only TPS signal a vanilla server gives without a profiler. The server rate-limits the warning
+	 * and reports the lag accumulated since the last one, so summing ticks behind over a window gives how many
+	 * of the window's nominal 20/s ticks never ran
+	 */
+	class tick_stats
+	{
+		public:
+			static constexpr double nominal_tps = 20.0;
+			static constexpr size_t history_minutes = 60;
+
+			tick_stats();
+
+			/**
+			 * @brief Record one warning, safe to call from any thread
+			 */
+			void record(utils::tulong ms, utils::tulong ticks) noexcept;
+
+			/**
+			 * @brief Close the current minute, call once a minute from a single thread
+			 *
+			 * @return lag_rollup The minute just closed
+			 */
+			lag_rollup rollup();
+
+			/**
+			 * @brief Completed minutes, oldest first, at most history_minutes of them
+			 */
+			std::vector<lag_rollup> history() const;
+
+			/**
+			 * @brief Lag over the whole run
+			 */
+			const lag_histogram &lifetime() const noexcept { return m_lifetime; }
+
+			utils::tulong total_ticks_behind() const noexcept { return m_ticks_total.load(std::memory_order_relaxed); }
+
+			/**
+			 * @brief Effective TPS for a number of ticks skipped during a window
+			 */
+			static double effective_tps(utils::tulong ticks_behind, std::chrono::seconds window) noexcept;
+
+		private:
+			lag_histogram m_lifetime;
+			lag_histogram m_minute;
+			std::atomic<utils::tulong> m_ticks_minute{ 0 };
+			std::atomic<utils::tulong> m_ticks_total{ 0 };
+
+			std::chrono::steady_clock::time_point m_minute_start;
+			std::array<lag_rollup, history_minutes> m_history{};
+			size_t m_history_len = 0;
+			size_t m_history_next = 0;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_841926_SRC_TICK_STATS
@@ -6,6 +6,11 @@
 #include <chrono>
 #include <cstdint>
 #include <iostream>
+#include <cerrno>
+#include <system_error>
+#include <utility>
+
+#include <unistd.h>
 
 
 namespace utils
@@ -23,6 +28,69 @@ namespace utils
     typedef int_least16_t     tsshort;
     typedef int_least8_t      tschar;
     
+
+    /**
+     * @brief Throw a std::system_error built from the current errno
+     * 
+     * @param what Name of the call that failed, used as the error message
+     */
+    [[noreturn]] inline void throw_errno(const std::string &what)
+    {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+
+    /**
+     * @brief Build a visitor for std::visit out of several lambdas
+     */
+    template <typename... Fns>
+    struct overloaded : Fns...
+    {
+        using Fns::operator()...;
+    };
+
+
+    /**
+     * @brief Owning wrapper around a file descriptor, closes it when destroyed
+     */
+    class unique_fd
+    {
+        public:
+            unique_fd() noexcept = default;
+            explicit unique_fd(int fd) noexcept : m_fd(fd) {}
+            ~unique_fd() { reset(); }
+
+            unique_fd(const unique_fd &) = delete;
+            unique_fd &operator=(const unique_fd &) = delete;
+
+            unique_fd(unique_fd &&other) noexcept : m_fd(other.release()) {}
+            unique_fd &operator=(unique_fd &&other) noexcept
+            {
+                if (this != &other) reset(other.release());
+                return *this;
+            }
+
+            int get() const noexcept { return m_fd; }
+            explicit operator bool() const noexcept { return m_fd >= 0; }
+
+            /**
+             * @brief Give up ownership of the descriptor without closing it
+             */
+            int release() noexcept { return std::exchange(m_fd, -1); }
+
+            /**
+             * @brief Close the owned descriptor (if any) and take ownership of a new one
+             */
+            void reset(int fd = -1) noexcept
+            {
+                if (m_fd >= 0) ::close(m_fd);
+                m_fd = fd;
+            }
+
+        private:
+            int m_fd = -1;
+    };
+    
 } // End namespace utils
 
 #endif // H_446981_SRC_UTILS___SRC_UTILS
\ No newline at end of file
@@ -0,0 +1,261 @@
+/**
+ * A child floods its stdout as fast as it can while mcsuper's console capture persists it to a FIFO whose reader
+ * is throttled well below the flood's rate, the way a slow disk or log shipper would be. The child times every
+ * write, which must never stall on the log; the FIFO's reader checks what arrived
+ *
+ * usage: console_flood spill|drop [lines] [max write ms]
+ */
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <optional>
+#include <filesystem>
+#include <string_view>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "utils.hpp"
+#include "event_loop.hpp"
+#include "console_capture.hpp"
+
+using std::cout, std::cerr, std::endl;
+using namespace mcsuper;
+
+
+namespace
+{
+	// The FIFO's reader takes this much, then naps, about 6 MiB/s
+	constexpr size_t reader_chunk = 64 << 10;
+	constexpr std::chrono::milliseconds reader_nap{ 10 };
+	// Lines per write(), log4j flushes a buffer at a time too
+	constexpr size_t lines_per_write = 64;
+
+
+	int format_line(char *buf, size_t size, utils::tulong n)
+	{
+		return std::snprintf(buf, size, "[12:00:01] [Server thread/INFO]: line %08llu %.80s\n", static_cast<unsigned long long>(n),
+			"xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
+	}
+
+
+	/**
+	 * @brief The flooding server: waits for go, writes lines to out, reports its slowest write() in ns to result
+	 */
+	[[noreturn]] void flood(int go, int out, int result, utils::tulong lines)
+	{
+		char c;
+		if (::read(go, &c, 1) != 1) _exit(1);
+
+		static char buf[lines_per_write * 160];
+		utils::tulong worst = 0;
+		for (utils::tulong i = 0; i < lines; )
+		{
+			size_t len = 0;
+			for (size_t j = 0; j < lines_per_write && i < lines; j++, i++) len += format_line(buf + len, sizeof(buf) - len, i);
+
+			auto start = std::chrono::steady_clock::now();
+			for (size_t done = 0; done < len; )
+			{
+				ssize_t n = ::write(out, buf + done, len - done);
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0) _exit(1);
+				done += n;
+			}
+			worst = std::max<utils::tulong>(worst, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		}
+
+		if (::write(result, &worst, sizeof(worst)) != sizeof(worst)) _exit(1);
+		_exit(0);
+	}
+
+
+	/**
+	 * @brief The capture's counters once it has stopped reading, none of these move while the writer finishes
+	 */
+	struct flood_totals
+	{
+		utils::tulong captured = 0;
+		utils::tulong spilled = 0;
+		utils::tulong dropped = 0;
+		utils::tulong unparsed = 0;
+	};
+
+
+	bool fail(const std::string &why)
+	{
+		cerr << "FAIL: " << why << endl;
+		return false;
+	}
+
+
+	/**
+	 * @brief Every line once, in order, and nothing else
+	 */
+	bool check_spill(const std::string &log, utils::tulong lines, const flood_totals &totals)
+	{
+		if (totals.spilled == 0) return fail("the log never fell behind, the reader isn't throttled enough to test anything");
+		if (totals.dropped != 0) return fail(std::to_string(totals.dropped) + " bytes dropped while spilling");
+
+		char buf[160];
+		size_t pos = 0;
+		for (utils::tulong i = 0; i < lines; i++)
+		{
+			int len = format_line(buf, sizeof(buf), i);
+			if (log.compare(pos, len, buf, len) != 0) return fail("line " + std::to_string(i) + " is missing or out of order at offset " + std::to_string(pos));
+			pos += len;
+		}
+		if (pos != log.size()) return fail(std::to_string(log.size() - pos) + " unexpected bytes after the last line");
+		return true;
+	}
+
+
+	/**
+	 * @brief Lines may be missing, or cut where a drop begins or ends, but the rest keep their order and the gaps are noted
+	 */
+	bool check_drop(const std::string &log, utils::tulong lines, const flood_totals &totals)
+	{
+		if (totals.dropped == 0) return fail("nothing dropped, the reader isn't throttled enough to test anything");
+
+		// The log is what was captured, less what was dropped, plus a note for each gap
+		constexpr std::string_view note_end = " bytes of console output dropped around here, the log couldn't keep up\n";
+		size_t notes = 0;
+		for (size_t pos = log.find(note_end); pos != std::string::npos; pos = log.find(note_end, pos + 1))
+		{
+			size_t begin = log.rfind("[mcsuper] ", pos);
+			if (begin == std::string::npos) return fail("a drop note without its prefix");
+			notes += pos + note_end.size() - begin;
+		}
+		if (notes == 0) return fail("no note where output was dropped");
+		if (log.size() - notes + totals.dropped != totals.captured)
+		{
+			return fail("captured " + std::to_string(totals.captured) + " bytes but the log has " + std::to_string(log.size() - notes)
+				+ " and " + std::to_string(totals.dropped) + " were dropped");
+		}
+
+		constexpr std::string_view marker = "]: line ";
+		std::optional<utils::tulong> last;
+		utils::tulong seen = 0;
+		for (size_t pos = log.find(marker); pos != std::string::npos; pos = log.find(marker, pos + 1))
+		{
+			if (pos + marker.size() + 8 > log.size()) break;
+			utils::tulong n = std::strtoull(log.substr(pos + marker.size(), 8).c_str(), nullptr, 10);
+			if (n >= lines || (last && n <= *last)) return fail("line " + std::to_string(n) + " out of order at offset " + std::to_string(pos));
+			last = n;
+			seen++;
+		}
+		if (seen >= lines) return fail("every line arrived although bytes were dropped");
+		cout << seen << " of " << lines << " lines kept" << endl;
+		return true;
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) return 2;
+	std::optional<console_overflow> overflow = parse_console_overflow(argv[1]);
+	if (!overflow) return 2;
+	utils::tulong lines = argc > 2 ? std::stoull(argv[2]) : 100000;
+	double max_write_ms = argc > 3 ? std::stod(argv[3]) : 100;
+
+	int go[2], out[2], result[2];
+	if (pipe2(go, O_CLOEXEC) < 0 || pipe2(out, O_CLOEXEC) < 0 || pipe2(result, O_CLOEXEC) < 0) utils::throw_errno("pipe2");
+
+	// Forked before any thread starts
+	pid_t child = fork();
+	if (child < 0) utils::throw_errno("fork");
+	if (child == 0)
+	{
+		close(go[1]);
+		close(out[0]);
+		close(result[0]);
+		flood(go[0], out[1], result[1], lines);
+	}
+	close(go[0]);
+	close(out[1]);
+	close(result[1]);
+	utils::unique_fd go_w(go[1]), out_r(out[0]), result_r(result[0]);
+	if (fcntl(out_r.get(), F_SETFL, O_NONBLOCK) < 0) utils::throw_errno("fcntl");
+
+	char dir_name[] = "/tmp/mcsuper-flood-XXXXXX";
+	if (!mkdtemp(dir_name)) utils::throw_errno("mkdtemp");
+	std::filesystem::path dir(dir_name);
+	std::filesystem::path fifo = dir / "console.log";
+	if (mkfifo(fifo.c_str(), 0600) < 0) utils::throw_errno("mkfifo");
+
+	std::string log;
+	std::thread reader([&]()
+	{
+		utils::unique_fd in(open(fifo.c_str(), O_RDONLY | O_CLOEXEC));
+		if (!in) return;
+		std::string buf(reader_chunk, '\0');
+		for (;;)
+		{
+			ssize_t n = ::read(in.get(), buf.data(), buf.size());
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) break;
+			log.append(buf.data(), n);
+			std::this_thread::sleep_for(reader_nap);
+		}
+	});
+
+	event_loop loop;
+	console_buffering buffering;
+	// The flood is three times this, so most of it has to be spilled
+	buffering.buffer = 4 << 20;
+	buffering.overflow = *overflow;
+	buffering.spill_dir = dir;
+
+	utils::tulong parsed = 0;
+	std::optional<console_capture> capture;
+	capture.emplace(loop, fifo, 1 << 20, buffering, [&](std::string_view text) { parsed += std::count(text.begin(), text.end(), '\n'); });
+	capture->attach(out_r.get());
+
+	auto start = std::chrono::steady_clock::now();
+	if (::write(go_w.get(), "g", 1) != 1) utils::throw_errno("write");
+
+	int status = 0;
+	loop.add_timer(std::chrono::milliseconds{ 10 }, std::chrono::milliseconds{ 10 }, [&]()
+	{
+		if (waitpid(child, &status, WNOHANG) != child) return;
+		capture->detach();
+		capture->flush();
+		loop.stop();
+	});
+	loop.run();
+	auto flooded = std::chrono::steady_clock::now();
+
+	utils::tulong worst = 0;
+	bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && ::read(result_r.get(), &worst, sizeof(worst)) == sizeof(worst);
+	if (!ok) fail("the flooding child failed");
+
+	flood_totals totals;
+	totals.captured = capture->counters().captured.get();
+	totals.spilled = capture->counters().spilled.get();
+	totals.dropped = capture->counters().dropped.get();
+	totals.unparsed = capture->counters().unparsed.get();
+
+	// Everything the writer still holds goes down the FIFO before the capture is gone
+	capture.reset();
+	reader.join();
+	auto drained = std::chrono::steady_clock::now();
+	std::filesystem::remove_all(dir);
+
+	auto ms = [](auto d) { return std::chrono::duration<double, std::milli>(d).count(); };
+	cout << lines << " lines, " << totals.captured / 1024 << " KiB flooded in " << ms(flooded - start) << " ms, the log drained after "
+	     << ms(drained - start) << " ms" << endl;
+	cout << totals.spilled / 1024 << " KiB spilled, " << totals.dropped / 1024 << " KiB dropped, slowest write " << worst / 1e6 << " ms" << endl;
+
+	if (ok && worst / 1e6 > max_write_ms) ok = fail("a write took " + std::to_string(worst / 1e6) + " ms, the server was kept waiting");
+	// The parser only misses lines if the event loop fell a whole ring behind, which it has no reason to here
+	if (ok && totals.unparsed == 0 && parsed != lines) ok = fail("parsed " + std::to_string(parsed) + " lines of " + std::to_string(lines));
+	if (ok) ok = *overflow == console_overflow::spill ? check_spill(log, lines, totals) : check_drop(log, lines, totals);
+	return ok ? 0 : 1;
+}
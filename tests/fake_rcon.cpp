@@ -0,0 +1,216 @@
+#include "fake_rcon.hpp"
+
+#include <charconv>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+
+namespace mcsuper
+{
+	namespace
+	{
+		constexpr utils::tsint type_response = 0;
+		constexpr utils::tsint type_command  = 2;
+		constexpr utils::tsint type_auth     = 3;
+		constexpr size_t packet_overhead = 10;
+
+
+		void put_le32(std::string &out, utils::tsint v)
+		{
+			utils::tuint u = static_cast<utils::tuint>(v);
+			char b[4] = { static_cast<char>(u), static_cast<char>(u >> 8), static_cast<char>(u >> 16), static_cast<char>(u >> 24) };
+			out.append(b, 4);
+		}
+
+
+		utils::tsint get_le32(const char *p)
+		{
+			const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+			return static_cast<utils::tsint>(u[0] | u[1] << 8 | u[2] << 16 | static_cast<utils::tuint>(u[3]) << 24);
+		}
+
+
+		void put_packet(std::string &out, utils::tsint id, utils::tsint type, std::string_view body)
+		{
+			put_le32(out, static_cast<utils::tsint>(body.size() + packet_overhead));
+			put_le32(out, id);
+			put_le32(out, type);
+			out.append(body);
+			out.append(2, '\0');
+		}
+	}
+
+
+	fake_rcon::fake_rcon(const options &opts) : m_opts(opts)
+	{
+		m_listen.reset(socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+		if (!m_listen) utils::throw_errno("socket");
+
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t len = sizeof(addr);
+		if (bind(m_listen.get(), reinterpret_cast<sockaddr *>(&addr), len) < 0) utils::throw_errno("bind");
+		if (listen(m_listen.get(), 4) < 0) utils::throw_errno("listen");
+		if (getsockname(m_listen.get(), reinterpret_cast<sockaddr *>(&addr), &len) < 0) utils::throw_errno("getsockname");
+		m_port = ntohs(addr.sin_port);
+
+		m_stop.reset(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK));
+		if (!m_stop) utils::throw_errno("eventfd");
+
+		m_thread = std::thread([this]() { run(); });
+	}
+
+
+	fake_rcon::~fake_rcon()
+	{
+		utils::tulong one = 1;
+		if (::write(m_stop.get(), &one, sizeof(one)) < 0) {}
+		m_thread.join();
+	}
+
+
+	std::string fake_rcon::big_reply(size_t n)
+	{
+		std::string reply(n, '\0');
+		for (size_t i = 0; i < n; i++) reply[i] = static_cast<char>('a' + (i / 7 + i / fragment) % 26);
+		return reply;
+	}
+
+
+	void fake_rcon::run()
+	{
+		pollfd fds[2] = { { m_listen.get(), POLLIN, 0 }, { m_stop.get(), POLLIN, 0 } };
+		for (;;)
+		{
+			if (poll(fds, 2, -1) < 0 && errno != EINTR) return;
+			if (fds[1].revents & POLLIN) return;
+			if (!(fds[0].revents & POLLIN)) continue;
+
+			utils::unique_fd conn(accept4(m_listen.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+			if (!conn) continue;
+			int one = 1;
+			setsockopt(conn.get(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			serve(conn.get());
+		}
+	}
+
+
+	void fake_rcon::serve(int conn)
+	{
+		std::string in, out;
+		bool authed = false;
+		char buf[16384];
+
+		// False once the client is gone or we're stopping
+		auto send_all = [&](std::string_view data)
+		{
+			while (!data.empty())
+			{
+				ssize_t n = ::send(conn, data.data(), data.size(), MSG_NOSIGNAL);
+				if (n > 0)
+				{
+					data.remove_prefix(n);
+					continue;
+				}
+				if (n < 0 && errno == EINTR) continue;
+				if (n < 0 && errno != EAGAIN) return false;
+
+				pollfd fds[2] = { { conn, POLLOUT, 0 }, { m_stop.get(), POLLIN, 0 } };
+				if (poll(fds, 2, -1) < 0 && errno != EINTR) return false;
+				if (fds[1].revents & POLLIN) return false;
+			}
+			return true;
+		};
+
+		for (;;)
+		{
+			pollfd fds[2] = { { conn, POLLIN, 0 }, { m_stop.get(), POLLIN, 0 } };
+			if (poll(fds, 2, -1) < 0 && errno != EINTR) return;
+			if (fds[1].revents & POLLIN) return;
+
+			ssize_t n = ::read(conn, buf, sizeof(buf));
+			if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+			if (n <= 0) return;
+			in.append(buf, n);
+
+			size_t pos = 0;
+			while (in.size() - pos >= 4)
+			{
+				utils::tsint len = get_le32(in.data() + pos);
+				if (len < static_cast<utils::tsint>(packet_overhead)) return;
+				if (in.size() - pos < 4 + static_cast<size_t>(len)) break;
+
+				const char *p = in.data() + pos + 4;
+				answer(get_le32(p), get_le32(p + 4), std::string_view(p + 8, len - packet_overhead), authed, out);
+				pos += 4 + len;
+
+				if (m_opts.chunk == 0)
+				{
+					if (!send_all(out)) return;
+					out.clear();
+				}
+			}
+			in.erase(0, pos);
+
+			for (size_t at = 0; at < out.size(); at += m_opts.chunk)
+			{
+				if (!send_all(std::string_view(out).substr(at, m_opts.chunk))) return;
+			}
+			out.clear();
+		}
+	}
+
+
+	void fake_rcon::answer(utils::tsint id, utils::tsint type, std::string_view body, bool &authed, std::string &out)
+	{
+		if (type == type_auth)
+		{
+			authed = body == m_opts.password;
+			put_packet(out, authed ? id : -1, type_command, {});
+			return;
+		}
+		if (!authed) return;
+
+		if (type != type_command)
+		{
+			put_packet(out, id, type_response, "Unknown request " + std::to_string(type));
+			return;
+		}
+
+		std::string reply;
+		if (body.starts_with("echo "))
+		{
+			reply = body.substr(5);
+		}
+		else if (body.starts_with("big "))
+		{
+			size_t n = 0;
+			std::from_chars(body.data() + 4, body.data() + body.size(), n);
+			reply = big_reply(n);
+		}
+		else
+		{
+			reply = "Unknown command: " + std::string(body);
+		}
+		m_commands.fetch_add(1, std::memory_order_relaxed);
+
+		// Like vanilla, an empty reply still gets its one packet
+		size_t at = 0;
+		do
+		{
+			size_t len = std::min(reply.size() - at, fragment);
+			put_packet(out, id, type_response, std::string_view(reply).substr(at, len));
+			m_fragments.fetch_add(1, std::memory_order_relaxed);
+			at += len;
+		}
+		while (at < reply.size());
+	}
+
+} // End namespace mcsuper
@@ -0,0 +1,80 @@
+#pragma once
+#ifndef H_385106_TESTS_FAKE_RCON
+#define H_385106_TESTS_FAKE_RCON 1
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <string_view>
+
+#include "utils.hpp"
+
+
+namespace mcsuper
+{
+	/**
+	 * @brief An RCON server on loopback that answers the way the vanilla server does, for tests and benchmarks
+	 *
+	 * Serves one connection at a time on its own thread. Replies longer than 4096 bytes are split into packets
+	 * with the command's id, and any packet of an unknown type, such as rcon_client's empty sentinel, is
+	 * answered with "Unknown request <type>". Commands it knows:
+	 *   echo <text>    replies text
+	 *   big <n>        replies big_reply(n)
+	 * anything else gets "Unknown command: " and the command back
+	 */
+	class fake_rcon
+	{
+		public:
+			/**
+			 * @brief How the server writes its replies
+			 */
+			struct options
+			{
+				std::string password = "secret";
+				// 0 sends each packet on its own, otherwise the replies to everything one read brought in are
+				// sent together, chunk bytes per send(), so packets are cut or coalesced at arbitrary points
+				size_t chunk = 0;
+			};
+
+			// Longest reply body vanilla puts in one packet
+			static constexpr size_t fragment = 4096;
+
+			explicit fake_rcon(const options &opts);
+
+			/**
+			 * @brief Drops the connection and joins the server thread
+			 */
+			~fake_rcon();
+
+			fake_rcon(const fake_rcon &) = delete;
+			fake_rcon &operator=(const fake_rcon &) = delete;
+
+			utils::tushort port() const noexcept { return m_port; }
+
+			// Commands answered, and reply packets sent for them
+			utils::tulong commands() const noexcept { return m_commands.load(std::memory_order_relaxed); }
+			utils::tulong fragments() const noexcept { return m_fragments.load(std::memory_order_relaxed); }
+
+			/**
+			 * @brief The reply to "big <n>", n bytes that differ between fragments
+			 */
+			static std::string big_reply(size_t n);
+
+		private:
+			void run();
+			void serve(int conn);
+			// Answer one packet, appending the reply packets to out
+			void answer(utils::tsint id, utils::tsint type, std::string_view body, bool &authed, std::string &out);
+
+			options m_opts;
+			utils::unique_fd m_listen;
+			utils::unique_fd m_stop;
+			utils::tushort m_port = 0;
+			std::atomic<utils::tulong> m_commands{ 0 };
+			std::atomic<utils::tulong> m_fragments{ 0 };
+			std::thread m_thread;
+	};
+
+} // End namespace mcsuper
+
+#endif // H_385106_TESTS_FAKE_RCON
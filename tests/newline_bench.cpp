@@ -0,0 +1,165 @@
+/**
+ * Splitting console output into lines: find_newlines, whichever SIMD width it dispatched to, against a std::getline
+ * baseline, both bare and with every line's prefix parsed as scan_console does. Each runs over the same console a
+ * few times and the best run counts: a captured server log, mapped rather than read in, or else a generated one
+ *
+ * usage: newline_bench [MiB of generated console | console log]
+ */
+#include <chrono>
+#include <random>
+#include <string>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <spanstream>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils.hpp"
+#include "console_scan.hpp"
+
+using std::cout, std::cerr, std::endl;
+using namespace mcsuper;
+
+
+namespace
+{
+	constexpr int rounds = 5;
+
+
+	/**
+	 * @brief A console of mixed line lengths: short chat, typical server lines and the odd long stack frame
+	 */
+	std::string make_console(size_t size)
+	{
+		static const char *const prefixes[] = { "[12:34:56] [Server thread/INFO]: ", "[12:34:56] [Server thread/WARN]: ", "[12:34:56 INFO]: ",
+			"[12:34:56] [Worker-Main-3/ERROR] [minecraft/Util]: ", "\tat net.minecraft.server.MinecraftServer.runServer(MinecraftServer.java:" };
+		std::mt19937 rng(42);
+		std::string console;
+		console.reserve(size + 512);
+		while (console.size() < size)
+		{
+			console += prefixes[rng() % std::size(prefixes)];
+			size_t len = rng() % 8 == 0 ? 100 + rng() % 300 : 10 + rng() % 70;
+			for (size_t i = 0; i < len; i++) console += static_cast<char>('a' + rng() % 26);
+			console += '\n';
+		}
+		return console;
+	}
+
+
+	/**
+	 * @brief Map a captured log for the life of the process, up to its last line break so every line is complete
+	 */
+	std::string_view map_console(const char *path)
+	{
+		utils::unique_fd fd(::open(path, O_RDONLY | O_CLOEXEC));
+		if (!fd) utils::throw_errno(std::string("open ") + path);
+		struct stat st;
+		if (fstat(fd.get(), &st) < 0) utils::throw_errno(std::string("fstat ") + path);
+		if (st.st_size == 0) return {};
+
+		void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+		if (map == MAP_FAILED) utils::throw_errno(std::string("mmap ") + path);
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+		std::string_view console(static_cast<const char *>(map), st.st_size);
+		return console.substr(0, console.rfind('\n') + 1);
+	}
+
+
+	/**
+	 * @brief Best of rounds runs of fn, which returns the lines it found
+	 */
+	bool bench(const char *name, std::string_view console, utils::tulong want, const std::function<utils::tulong()> &fn)
+	{
+		double best = 0;
+		for (int i = 0; i < rounds; i++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			utils::tulong lines = fn();
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (lines != want)
+			{
+				cerr << "FAIL: " << name << " found " << lines << " lines of " << want << endl;
+				return false;
+			}
+			if (i == 0 || seconds < best) best = seconds;
+		}
+		cout << std::setw(24) << std::left << name << std::right << std::setw(9) << console.size() / best / (1 << 20) << " MiB/s "
+		     << std::setw(7) << want / best / 1e6 << " M lines/s" << endl;
+		return true;
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	// A number is the size to generate, anything else is a log to read
+	std::string generated;
+	std::string_view console;
+	if (argc > 1 && !std::all_of(argv[1], argv[1] + std::strlen(argv[1]), [](char c) { return c >= '0' && c <= '9'; }))
+	{
+		console = map_console(argv[1]);
+	}
+	else
+	{
+		generated = make_console((argc > 1 ? std::stoul(argv[1]) : 256) << 20);
+		console = generated;
+	}
+	utils::tulong lines = std::count(console.begin(), console.end(), '\n');
+	cout << std::fixed << std::setprecision(1) << console.size() / double(1 << 20) << " MiB, " << lines << " lines, find_newlines uses "
+	     << newline_scanner_name() << endl;
+
+	// Kept live so the parse isn't optimised away
+	volatile utils::tulong sink = 0;
+
+	bool ok = bench("std::getline", console, lines, [&]()
+	{
+		std::ispanstream in(std::span<const char>(console.data(), console.size()));
+		std::string line;
+		utils::tulong n = 0;
+		while (std::getline(in, line)) n++;
+		return n;
+	});
+	ok = bench("find_newlines", console, lines, [&]()
+	{
+		size_t offsets[256];
+		utils::tulong n = 0;
+		for (size_t start = 0; start < console.size(); )
+		{
+			size_t found = find_newlines(console.data() + start, console.size() - start, offsets, std::size(offsets));
+			n += found;
+			if (found < std::size(offsets)) break;
+			start += offsets[found - 1] + 1;
+		}
+		return n;
+	}) && ok;
+	ok = bench("std::getline+parse_line", console, lines, [&]()
+	{
+		std::ispanstream in(std::span<const char>(console.data(), console.size()));
+		std::string line;
+		utils::tulong n = 0;
+		while (std::getline(in, line))
+		{
+			sink = sink + static_cast<utils::tulong>(parse_line(line).level);
+			n++;
+		}
+		return n;
+	}) && ok;
+	ok = bench("scan_console", console, lines, [&]()
+	{
+		utils::tulong n = 0;
+		scan_console(console, [&](const log_line &line)
+		{
+			sink = sink + static_cast<utils::tulong>(line.level);
+			n++;
+		});
+		return n;
+	}) && ok;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,286 @@
+/**
+ * What tcp_proxy costs: round-trip latency and bulk throughput to an echo server, straight and through the proxy.
+ * The echo server and the load run in a child, so the parent's CPU time is the proxy's, which makes bytes forwarded
+ * per CPU second the proxy's per-core throughput
+ *
+ * usage: proxy_bench [MiB per stream] [round trips]
+ */
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iomanip>
+#include <optional>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "utils.hpp"
+#include "tcp_proxy.hpp"
+
+using std::cout, std::cerr, std::endl;
+using namespace mcsuper;
+
+
+namespace
+{
+	typedef std::chrono::steady_clock clock;
+
+	// A keep-alive or movement packet's worth
+	constexpr size_t ping_size = 64;
+	constexpr size_t stream_chunk = 1 << 16;
+
+
+	utils::unique_fd listen_loopback(utils::tushort &port)
+	{
+		utils::unique_fd fd(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+		if (!fd) utils::throw_errno("socket");
+
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t len = sizeof(addr);
+		if (bind(fd.get(), reinterpret_cast<sockaddr *>(&addr), len) < 0) utils::throw_errno("bind");
+		if (listen(fd.get(), 64) < 0) utils::throw_errno("listen");
+		if (getsockname(fd.get(), reinterpret_cast<sockaddr *>(&addr), &len) < 0) utils::throw_errno("getsockname");
+		port = ntohs(addr.sin_port);
+		return fd;
+	}
+
+
+	utils::unique_fd connect_loopback(utils::tushort port)
+	{
+		utils::unique_fd fd(socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0));
+		if (!fd) utils::throw_errno("socket");
+
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(port);
+		if (connect(fd.get(), reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) utils::throw_errno("connect");
+		int one = 1;
+		setsockopt(fd.get(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		return fd;
+	}
+
+
+	bool write_all(int fd, const char *data, size_t len)
+	{
+		while (len > 0)
+		{
+			ssize_t n = ::write(fd, data, len);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			data += n;
+			len -= n;
+		}
+		return true;
+	}
+
+
+	/**
+	 * @brief The stand-in server: writes back whatever each connection sends until it closes its side
+	 */
+	void echo_server(int listen_fd)
+	{
+		for (;;)
+		{
+			int conn = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+			if (conn < 0) return;
+
+			std::thread([conn]()
+			{
+				int one = 1;
+				setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				std::vector<char> buf(stream_chunk);
+				for (;;)
+				{
+					ssize_t n = ::read(conn, buf.data(), buf.size());
+					if (n < 0 && errno == EINTR) continue;
+					if (n <= 0 || !write_all(conn, buf.data(), n)) break;
+				}
+				close(conn);
+			}).detach();
+		}
+	}
+
+
+	/**
+	 * @brief Round-trip times of ping_size messages on one connection, in microseconds and sorted
+	 */
+	std::vector<double> round_trips(utils::tushort port, size_t count)
+	{
+		utils::unique_fd fd = connect_loopback(port);
+		char buf[ping_size] = {};
+		std::vector<double> rtts;
+		rtts.reserve(count);
+
+		// The first few warm up both ends and aren't counted
+		for (size_t i = 0; i < count + 100; i++)
+		{
+			auto start = clock::now();
+			if (!write_all(fd.get(), buf, sizeof(buf))) utils::throw_errno("write");
+			for (size_t got = 0; got < sizeof(buf); )
+			{
+				ssize_t n = ::read(fd.get(), buf + got, sizeof(buf) - got);
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0) utils::throw_errno("read");
+				got += n;
+			}
+			if (i >= 100) rtts.push_back(std::chrono::duration<double, std::micro>(clock::now() - start).count());
+		}
+		std::sort(rtts.begin(), rtts.end());
+		return rtts;
+	}
+
+
+	/**
+	 * @brief Send bytes down each of streams connections while reading the echo back, MiB/s one way
+	 */
+	double stream(utils::tushort port, size_t streams, size_t bytes)
+	{
+		std::vector<utils::unique_fd> fds;
+		for (size_t i = 0; i < streams; i++) fds.push_back(connect_loopback(port));
+
+		auto start = clock::now();
+		std::vector<std::thread> threads;
+		std::atomic<bool> short_read{ false };
+		for (auto &fd : fds)
+		{
+			threads.emplace_back([&fd, bytes]()
+			{
+				std::vector<char> buf(stream_chunk, 'x');
+				for (size_t sent = 0; sent < bytes; sent += buf.size()) write_all(fd.get(), buf.data(), std::min(buf.size(), bytes - sent));
+				shutdown(fd.get(), SHUT_WR);
+			});
+			threads.emplace_back([&fd, bytes, &short_read]()
+			{
+				std::vector<char> buf(stream_chunk);
+				size_t got = 0;
+				for (;;)
+				{
+					ssize_t n = ::read(fd.get(), buf.data(), buf.size());
+					if (n < 0 && errno == EINTR) continue;
+					if (n <= 0) break;
+					got += n;
+				}
+				if (got != bytes) short_read = true;
+			});
+		}
+		for (auto &t : threads) t.join();
+		double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+		if (short_read) throw std::runtime_error("a stream came back short");
+		return streams * bytes / seconds / (1 << 20);
+	}
+
+
+	double percentile(const std::vector<double> &sorted, double p)
+	{
+		return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+	}
+
+
+	/**
+	 * @brief The load, run in the child
+	 */
+	bool drive(utils::tushort echo_port, utils::tushort proxy_port, size_t mib, size_t count)
+	{
+		cout << std::fixed << std::setprecision(1);
+
+		std::vector<double> direct = round_trips(echo_port, count), proxied = round_trips(proxy_port, count);
+		for (double p : { 0.5, 0.9, 0.99 })
+		{
+			cout << "round trip p" << std::setw(2) << std::left << static_cast<int>(p * 100) << std::right << ": direct " << std::setw(7) << percentile(direct, p)
+			     << " us, proxied " << std::setw(7) << percentile(proxied, p) << " us, added " << std::setw(7) << percentile(proxied, p) - percentile(direct, p) << " us" << endl;
+		}
+
+		for (size_t streams : { 1, 4 })
+		{
+			double straight = stream(echo_port, streams, mib << 20), through = stream(proxy_port, streams, mib << 20);
+			cout << streams << " stream" << (streams == 1 ? ": " : "s:") << " direct " << std::setw(8) << straight << " MiB/s, proxied " << std::setw(8) << through << " MiB/s" << endl;
+		}
+		return true;
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	size_t mib = argc > 1 ? std::stoul(argv[1]) : 1024;
+	size_t count = argc > 2 ? std::stoul(argv[2]) : 20000;
+
+	utils::tushort echo_port = 0, proxy_port = 0;
+	utils::unique_fd echo_listen = listen_loopback(echo_port);
+	utils::unique_fd proxy_listen = listen_loopback(proxy_port);
+	int done[2];
+	if (pipe2(done, O_CLOEXEC) < 0) utils::throw_errno("pipe2");
+
+	// Forked before the proxy's thread starts, the child keeps the write end of done until it exits
+	pid_t child = fork();
+	if (child < 0) utils::throw_errno("fork");
+	if (child == 0)
+	{
+		close(done[0]);
+		proxy_listen.reset();
+		std::thread(echo_server, echo_listen.get()).detach();
+
+		bool ok = false;
+		try
+		{
+			ok = drive(echo_port, proxy_port, mib, count);
+		}
+		catch (const std::exception &e)
+		{
+			cerr << "FAIL: " << e.what() << endl;
+		}
+		cout.flush();
+		_exit(ok ? 0 : 1);
+	}
+	close(done[1]);
+	utils::unique_fd done_r(done[0]);
+	echo_listen.reset();
+
+	rusage before, after;
+	getrusage(RUSAGE_SELF, &before);
+	std::optional<tcp_proxy> proxy;
+	auto [backend, backend_len] = tcp_proxy::resolve("", echo_port);
+	proxy.emplace(backend, backend_len);
+
+	pollfd fds[2] = { { proxy_listen.get(), POLLIN, 0 }, { done_r.get(), POLLIN, 0 } };
+	for (;;)
+	{
+		if (poll(fds, 2, -1) < 0 && errno != EINTR) utils::throw_errno("poll");
+		if (fds[1].revents) break;
+		if (!(fds[0].revents & POLLIN)) continue;
+		utils::unique_fd client(accept4(proxy_listen.get(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC));
+		if (client) proxy->add(std::move(client));
+	}
+
+	int status = 0;
+	waitpid(child, &status, 0);
+
+	// Counted once the proxy has seen both sides close
+	for (int i = 0; i < 100 && proxy->totals().active.load() > 0; i++) std::this_thread::sleep_for(std::chrono::milliseconds{ 10 });
+	utils::tulong forwarded = proxy->totals().bytes_up.load() + proxy->totals().bytes_down.load();
+	proxy.reset();
+	getrusage(RUSAGE_SELF, &after);
+
+	auto cpu = [](const rusage &r) { return r.ru_utime.tv_sec + r.ru_stime.tv_sec + (r.ru_utime.tv_usec + r.ru_stime.tv_usec) / 1e6; };
+	double seconds = cpu(after) - cpu(before);
+	cout << std::fixed << std::setprecision(1) << "proxy forwarded " << forwarded / double(1 << 20) << " MiB on " << seconds << " s of CPU, "
+	     << forwarded / seconds / (1 << 20) << " MiB/s per core" << endl;
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return 1;
+	return forwarded > 0 ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+/**
+ * Throughput and latency of rcon_client against fake_rcon on loopback, keeping 1 (request/reply, the old way) up to
+ * hundreds of commands in flight, with one-packet and multi-packet replies. Latency is from queueing a command to its
+ * reply handler running
+ *
+ * usage: rcon_bench [commands per run]
+ */
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#include "utils.hpp"
+#include "event_loop.hpp"
+#include "rcon.hpp"
+#include "fake_rcon.hpp"
+
+using std::cout, std::cerr, std::endl;
+using namespace mcsuper;
+
+
+namespace
+{
+	typedef std::chrono::steady_clock clock;
+
+
+	/**
+	 * @brief Run commands commands with up to window outstanding, false if any failed
+	 */
+	bool bench(size_t window, size_t reply, size_t commands)
+	{
+		fake_rcon server({});
+		event_loop loop;
+		rcon_client client(loop, "127.0.0.1", server.port(), "secret");
+
+		std::string command = reply < 64 ? "echo " + std::string(reply, 'x') : "big " + std::to_string(reply);
+		std::vector<double> latencies;
+		latencies.reserve(commands);
+		size_t sent = 0, failed = 0;
+		clock::time_point start;
+
+		std::function<void()> fill = [&]()
+		{
+			while (sent < commands && sent - latencies.size() - failed < window)
+			{
+				sent++;
+				clock::time_point queued = clock::now();
+				client.command(command, [&, queued](bool ok, std::string)
+				{
+					if (ok) latencies.push_back(std::chrono::duration<double, std::micro>(clock::now() - queued).count());
+					else failed++;
+					if (latencies.size() + failed == commands) loop.stop();
+					else fill();
+				});
+			}
+		};
+
+		client.connect([&](bool ok)
+		{
+			if (!ok)
+			{
+				loop.stop();
+				return;
+			}
+			start = clock::now();
+			fill();
+		});
+		loop.run();
+		double seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+		if (failed > 0 || latencies.size() != commands)
+		{
+			cerr << "FAIL: " << commands - latencies.size() << " of " << commands << " commands failed" << endl;
+			return false;
+		}
+
+		std::sort(latencies.begin(), latencies.end());
+		auto percentile = [&](double p) { return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))]; };
+		cout << "window " << std::setw(4) << window << ", " << std::setw(6) << reply << " B replies (" << (reply + fake_rcon::fragment - 1) / fake_rcon::fragment + (reply == 0)
+		     << " packets): " << std::setw(9) << static_cast<utils::tulong>(commands / seconds) << " commands/s, latency us p50 " << std::setw(7) << percentile(0.5)
+		     << " p90 " << std::setw(7) << percentile(0.9) << " p99 " << std::setw(7) << percentile(0.99) << " max " << std::setw(8) << latencies.back() << endl;
+		return true;
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+	size_t commands = argc > 1 ? std::stoul(argv[1]) : 100000;
+	cout << std::fixed << std::setprecision(1);
+
+	bool ok = true;
+	for (size_t reply : { size_t{ 16 }, size_t{ 20000 } })
+	{
+		for (size_t window : { 1, 8, 64, 512 }) ok = bench(window, reply, reply > 4096 ? commands / 10 : commands) && ok;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,216 @@
+/**
+ * rcon_client against fake_rcon: hundreds of commands in flight at once, replies spanning several packets, packets
+ * cut into pieces or run together on the wire, a wrong password, and a connection closed or a client destroyed with
+ * commands outstanding
+ */
+#include <chrono>
+#include <string>
+#include <vector>
+#include <optional>
+#include <iostream>
+
+#include "utils.hpp"
+#include "event_loop.hpp"
+#include "rcon.hpp"
+#include "fake_rcon.hpp"
+
+using std::cout, std::cerr, std::endl;
+using namespace mcsuper;
+
+
+namespace
+{
+	constexpr std::chrono::seconds timeout{ 20 };
+	// Around the fragment size, and a reply spread over five packets
+	constexpr size_t big_sizes[] = { 0, 1, fake_rcon::fragment - 1, fake_rcon::fragment, fake_rcon::fragment + 1, 5 * fake_rcon::fragment - 3 };
+
+
+	bool fail(const std::string &why)
+	{
+		cerr << "FAIL: " << why << endl;
+		return false;
+	}
+
+
+	/**
+	 * @brief Run the loop until a handler stops it, false if that takes longer than the timeout
+	 */
+	bool run(event_loop &loop)
+	{
+		bool expired = false;
+		event_loop::timer_id timer = loop.add_timer(timeout, {}, [&]()
+		{
+			expired = true;
+			loop.stop();
+		});
+		loop.run();
+		loop.cancel_timer(timer);
+		return !expired || fail("timed out");
+	}
+
+
+	struct expected
+	{
+		std::string command;
+		std::string reply;
+	};
+
+
+	expected make_command(size_t i)
+	{
+		if (i % 3 == 0)
+		{
+			size_t size = big_sizes[i / 3 % std::size(big_sizes)];
+			return { "big " + std::to_string(size), fake_rcon::big_reply(size) };
+		}
+		std::string text = "command " + std::to_string(i);
+		return { "echo " + text, text };
+	}
+
+
+	/**
+	 * @brief Queue count commands at once, each reply has to arrive complete and in the order they were sent
+	 */
+	bool pipeline(event_loop &loop, rcon_client &client, size_t first, size_t count)
+	{
+		size_t next = first, done = 0;
+		bool ok = true;
+		for (size_t i = first; i < first + count; i++)
+		{
+			client.command(make_command(i).command, [&, i](bool good, std::string reply)
+			{
+				expected want = make_command(i);
+				if (!good) ok = fail(want.command + " failed: " + reply);
+				else if (i != next) ok = fail("reply to command " + std::to_string(i) + " came in place of " + std::to_string(next));
+				else if (reply != want.reply) ok = fail(want.command + " got " + std::to_string(reply.size()) + " bytes of the wrong reply");
+				next = i + 1;
+				if (++done == count) loop.stop();
+			});
+		}
+		if (!run(loop)) return false;
+		return ok && client.outstanding() == 0;
+	}
+
+
+	bool test_pipelining(size_t chunk)
+	{
+		cout << "pipelining, replies sent " << (chunk == 0 ? std::string("a packet at a time") : std::to_string(chunk) + " bytes at a time") << endl;
+		fake_rcon server({ .chunk = chunk });
+		event_loop loop;
+		rcon_client client(loop, "127.0.0.1", server.port(), "secret");
+
+		// The first batch is queued while connecting, the second goes straight out on a ready connection
+		bool ready = false;
+		client.connect([&](bool ok) { ready = ok; });
+		if (!pipeline(loop, client, 0, 600)) return false;
+		if (!ready) return fail("never authenticated");
+		if (!pipeline(loop, client, 600, 600)) return false;
+
+		if (server.commands() != 1200) return fail("the server answered " + std::to_string(server.commands()) + " commands");
+		if (server.fragments() <= server.commands()) return fail("no reply needed more than one packet");
+		return true;
+	}
+
+
+	bool test_wrong_password()
+	{
+		cout << "wrong password" << endl;
+		fake_rcon server({});
+		event_loop loop;
+		rcon_client client(loop, "127.0.0.1", server.port(), "wrong");
+
+		int ready = -1, failed = 0;
+		client.connect([&](bool ok)
+		{
+			ready = ok;
+			loop.stop();
+		});
+		client.command("echo a", [&](bool ok, std::string) { failed += !ok; });
+		client.command("echo b", [&](bool ok, std::string) { failed += !ok; });
+		if (!run(loop)) return false;
+
+		if (ready != 0) return fail("authenticated with the wrong password");
+		if (failed != 2) return fail(std::to_string(failed) + " of 2 queued commands failed");
+		return !client.connected() || fail("still connected");
+	}
+
+
+	bool test_close_outstanding()
+	{
+		cout << "closing with commands outstanding" << endl;
+		fake_rcon server({});
+		event_loop loop;
+		rcon_client client(loop, "127.0.0.1", server.port(), "secret");
+		client.connect();
+
+		// The first reply closes the connection, everything behind it fails exactly once
+		constexpr size_t count = 100;
+		std::vector<int> calls(count);
+		size_t good = 0, bad = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			client.command("big 20000", [&, i](bool ok, std::string)
+			{
+				calls[i]++;
+				(ok ? good : bad)++;
+				if (i == 0) client.close();
+				if (good + bad == count) loop.stop();
+			});
+		}
+		if (!run(loop)) return false;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			if (calls[i] != 1) return fail("command " + std::to_string(i) + " answered " + std::to_string(calls[i]) + " times");
+		}
+		if (good != 1) return fail(std::to_string(good) + " commands succeeded, only the first should have");
+		return client.outstanding() == 0 || fail("commands still outstanding");
+	}
+
+
+	bool test_destroy_outstanding()
+	{
+		cout << "destroying with commands outstanding" << endl;
+		fake_rcon server({});
+		event_loop loop;
+
+		std::vector<int> calls(4);
+		size_t bad = 0;
+		auto handler = [&](size_t i) { return [&, i](bool ok, std::string) { calls[i]++; bad += !ok; }; };
+
+		// Written and waiting for their replies
+		std::optional<rcon_client> ready;
+		ready.emplace(loop, "127.0.0.1", server.port(), "secret");
+		ready->connect([&](bool) { loop.stop(); });
+		if (!run(loop)) return false;
+		ready->command("big 20000", handler(0));
+		ready->command("big 20000", handler(1));
+		ready.reset();
+
+		// Still queued behind the connect
+		std::optional<rcon_client> connecting;
+		connecting.emplace(loop, "127.0.0.1", server.port(), "secret");
+		connecting->connect();
+		connecting->command("echo a", handler(2));
+		connecting->command("echo b", handler(3));
+		connecting.reset();
+
+		for (size_t i = 0; i < calls.size(); i++)
+		{
+			if (calls[i] != 1) return fail("command " + std::to_string(i) + " answered " + std::to_string(calls[i]) + " times");
+		}
+		return bad == calls.size() || fail(std::to_string(calls.size() - bad) + " commands succeeded on a destroyed client");
+	}
+}
+
+
+int main()
+{
+	bool ok = test_pipelining(0);
+	ok = test_pipelining(7) && ok;
+	ok = test_pipelining(1 << 16) && ok;
+	ok = test_wrong_password() && ok;
+	ok = test_close_outstanding() && ok;
+	ok = test_destroy_outstanding() && ok;
+	return ok ? 0 : 1;
+}